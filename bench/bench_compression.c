@@ -0,0 +1,135 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Measures what gzip compression of request bodies costs and saves: CPU time
+ * per batch against the bytes saved, for JSON and MessagePack batches of
+ * typical metric documents and the compression levels 1, 6 and 9. The last
+ * column relates both, in bytes saved per microsecond of CPU time.
+ *
+ * Usage: bench_compression [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mf_encode.h"
+#include "contrib/mf_gzip.h"
+
+#define N_METRICS 1000
+
+static const char* host = "node01.cluster.hlrs.de";
+static const char* task = "myapp";
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+run(const char* label, int format, mf_metric* metrics, size_t batch,
+    int level, int iterations)
+{
+    mf_buffer body;
+    mf_buffer compressed;
+    mf_gzip gz;
+    size_t raw = 0;
+    size_t packed = 0;
+    size_t batches = 0;
+    double elapsed = 0;
+    size_t i;
+    int it;
+
+    mf_buffer_init(&body);
+    mf_buffer_init(&compressed);
+    mf_gzip_init(&gz);
+
+    for (it = 0; it < iterations; ++it) {
+        for (i = 0; i < N_METRICS; i += batch) {
+            mf_buffer_reset(&body);
+            if (batch == 1) {
+                mf_encode_metric(&body, format, host, task, &metrics[i]);
+            } else {
+                mf_encode_batch(&body, format, host, task, &metrics[i], batch);
+            }
+
+            double start = now();
+            if (!mf_gzip_compress(&gz, level, &compressed, body.data, body.size)) {
+                exit(1);
+            }
+            elapsed += now() - start;
+
+            raw += body.size;
+            packed += compressed.size;
+            batches++;
+        }
+    }
+
+    printf("%-8s batch %4zu level %d: %9.0f -> %8.0f bytes (%5.1f%%) "
+        "%9.2f us/batch %8.1f bytes/us\n",
+        label, batch, level, (double) raw / batches, (double) packed / batches,
+        100.0 * packed / raw, elapsed * 1e6 / batches,
+        (raw > packed) ? (raw - packed) / (elapsed * 1e6) : 0.0);
+
+    mf_gzip_free(&gz);
+    mf_buffer_free(&compressed);
+    mf_buffer_free(&body);
+}
+
+int
+main(int argc, char** argv)
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 100;
+    mf_metric* metrics = malloc(sizeof(mf_metric) * N_METRICS);
+    char* values = malloc(32 * N_METRICS);
+    char* timestamps = malloc(32 * N_METRICS);
+    const char* names[] = { "PAPI_TOT_INS", "PAPI_TOT_CYC", "PAPI_L3_TCM" };
+    size_t batches[] = { 1, 10, 100, 1000 };
+    int levels[] = { 1, 6, 9 };
+    size_t i, l;
+
+    /* samples of three counters every 100 ms, as a sampler reports them */
+    srand(42);
+    for (i = 0; i < N_METRICS; ++i) {
+        long ms = 789 + (long) (i / 3) * 100;
+        snprintf(timestamps + 32 * i, 32, "2016-04-20T12:%02ld:%02ld.%03ld",
+            34 + ms / 60000, (ms / 1000) % 60, ms % 1000);
+        snprintf(values + 32 * i, 32, "%d", 1000000 + rand() % 100000);
+        metrics[i].timestamp = timestamps + 32 * i;
+        metrics[i].type = "PAPI-C";
+        metrics[i].name = names[i % 3];
+        metrics[i].value = values + 32 * i;
+    }
+
+    for (i = 0; i < sizeof(batches) / sizeof(batches[0]); ++i) {
+        for (l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+            run("json", MF_FORMAT_JSON, metrics, batches[i], levels[l],
+                iterations);
+            run("msgpack", MF_FORMAT_MSGPACK, metrics, batches[i], levels[l],
+                iterations);
+        }
+    }
+
+    free(timestamps);
+    free(values);
+    free(metrics);
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the cost of recording a value in a histogram, for a single thread
+ * and for several threads recording into the same histogram.
+ *
+ * Usage: bench_histogram [threads] [values per thread]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mf_histogram.h"
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct worker_t {
+    mf_histogram* histogram;
+    long count;
+} worker;
+
+static void*
+run(void* arg)
+{
+    worker* w = (worker*) arg;
+    uint64_t value = 88172645463325252ULL;
+    long i;
+
+    for (i = 0; i < w->count; ++i) {
+        /* xorshift, so that values spread over many buckets */
+        value ^= value << 13;
+        value ^= value >> 7;
+        value ^= value << 17;
+        mf_histogram_record(w->histogram, value >> 40);
+    }
+    return NULL;
+}
+
+int
+main(int argc, char** argv)
+{
+    int n_threads = (argc > 1) ? atoi(argv[1]) : 4;
+    long count = (argc > 2) ? atol(argv[2]) : 100000000L;
+    pthread_t* threads = malloc(sizeof(pthread_t) * n_threads);
+    worker w;
+    int n, i;
+
+    w.histogram = mf_histogram_new("latency", "bench", MF_HIST_PERCENTILES);
+    w.count = count;
+
+    for (n = 1; n <= n_threads; n *= 2) {
+        double start = now();
+        for (i = 0; i < n; ++i) {
+            pthread_create(&threads[i], NULL, run, &w);
+        }
+        for (i = 0; i < n; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+        double elapsed = now() - start;
+
+        double collect_start = now();
+        uint64_t collected = mf_histogram_collect(w.histogram);
+        double collect_elapsed = now() - collect_start;
+
+        printf("%2d threads: %7.1f M values/s per thread, collect %6.1f us (%llu values)\n",
+            n, count / elapsed / 1e6, collect_elapsed * 1e6,
+            (unsigned long long) collected);
+    }
+
+    mf_histogram_free(w.histogram);
+    free(threads);
+
+    return 0;
+}
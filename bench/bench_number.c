@@ -0,0 +1,134 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the time to format a number with snprintf() against mf_number,
+ * for integers of all lengths, counters below a million, and doubles given
+ * by random bits, by random values of a sensor with a few decimals, and
+ * with the precision that round-trips (%.17g). The output sizes are printed
+ * along, as shorter doubles also make the documents smaller.
+ *
+ * Usage: bench_number [numbers]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "contrib/mf_number.h"
+
+#define NUMBERS 1000000
+
+enum { INTEGERS, COUNTERS, DOUBLES, SENSOR };
+
+static const char* kinds[] = {
+    "integers", "counters", "random doubles", "sensor doubles"
+};
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t state = 88172645463325252ULL;
+
+static uint64_t
+next_random()
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static void
+fill(int kind, void* values, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        uint64_t bits = next_random();
+        switch (kind) {
+        case INTEGERS:
+            ((long long*) values)[i] = (long long) (bits >> (bits % 64));
+            break;
+        case COUNTERS:
+            ((long long*) values)[i] = (long long) (bits % 1000000);
+            break;
+        case DOUBLES:
+            /* finite doubles only */
+            bits &= ~(0x400ULL << 52);
+            memcpy(&((double*) values)[i], &bits, sizeof(double));
+            break;
+        case SENSOR:
+            ((double*) values)[i] = (double) (bits % 10000000) / 1000;
+            break;
+        }
+    }
+}
+
+static void
+run(int kind, size_t n)
+{
+    void* values = malloc(n * sizeof(double));
+    char text[MF_NUMBER_SIZE];
+    size_t printf_bytes = 0;
+    size_t mf_bytes = 0;
+    size_t i;
+
+    fill(kind, values, n);
+
+    double start = now();
+    for (i = 0; i < n; ++i) {
+        printf_bytes += (kind == INTEGERS || kind == COUNTERS) ?
+            snprintf(text, sizeof(text), "%lld", ((long long*) values)[i]) :
+            snprintf(text, sizeof(text), "%.17g", ((double*) values)[i]);
+    }
+    double printf_ns = (now() - start) / n * 1e9;
+
+    start = now();
+    for (i = 0; i < n; ++i) {
+        mf_bytes += (kind == INTEGERS || kind == COUNTERS) ?
+            mf_number_int(text, ((long long*) values)[i]) :
+            mf_number_double(text, ((double*) values)[i]);
+    }
+    double mf_ns = (now() - start) / n * 1e9;
+
+    printf("%-16s %10.1f %10.1f %8.1fx %10.1f %10.1f\n", kinds[kind],
+        printf_ns, mf_ns, printf_ns / mf_ns,
+        (double) printf_bytes / n, (double) mf_bytes / n);
+
+    free(values);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t n = (argc > 1) ? strtoul(argv[1], NULL, 10) : NUMBERS;
+    int kind;
+
+    printf("%-16s %10s %10s %9s %10s %10s\n", "numbers",
+        "printf ns", "mf ns", "speedup", "printf B", "mf B");
+    for (kind = INTEGERS; kind <= SENSOR; ++kind) {
+        run(kind, n);
+    }
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures how the rate of mf_api_update() calls scales with the number of
+ * reporting threads: per-thread staging rings merged by the flusher, against
+ * a single queue shared by all threads and protected by a mutex. No request
+ * is sent; the batches are only counted.
+ *
+ * Usage: bench_staging [max threads] [metrics per thread]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mf_staging.h"
+#include "contrib/mf_buffer.h"
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct worker_t {
+    mf_staging* staging;
+    int count;
+} worker;
+
+/* baseline: one queue for all threads */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static mf_buffer queue;
+static size_t queued = 0;
+
+static int
+count_batch(const mf_metric* metrics, size_t count, void* user_data)
+{
+    *(size_t*) user_data += count;
+    return 1;
+}
+
+static void
+fill_metric(mf_metric* metric, char* value, int i)
+{
+    snprintf(value, 32, "%d", i);
+    metric->timestamp = "2016-04-20T12:34:56.789";
+    metric->type = "PAPI-C";
+    metric->name = "PAPI_TOT_INS";
+    metric->value = value;
+}
+
+static void*
+run_staged(void* arg)
+{
+    worker* w = (worker*) arg;
+    mf_metric metric;
+    char value[32];
+    int i;
+
+    for (i = 0; i < w->count; ++i) {
+        fill_metric(&metric, value, i);
+        mf_staging_append(w->staging, &metric);
+    }
+    return NULL;
+}
+
+static void*
+run_shared(void* arg)
+{
+    worker* w = (worker*) arg;
+    mf_metric metric;
+    char value[32];
+    int i;
+
+    for (i = 0; i < w->count; ++i) {
+        fill_metric(&metric, value, i);
+        pthread_mutex_lock(&queue_lock);
+        mf_buffer_append_str(&queue, metric.timestamp);
+        mf_buffer_append_str(&queue, metric.type);
+        mf_buffer_append_str(&queue, metric.name);
+        mf_buffer_append_str(&queue, metric.value);
+        if (++queued % 512 == 0) {
+            mf_buffer_reset(&queue);
+        }
+        pthread_mutex_unlock(&queue_lock);
+    }
+    return NULL;
+}
+
+static double
+run(int n_threads, int count, int staged)
+{
+    pthread_t* threads = malloc(sizeof(pthread_t) * n_threads);
+    worker w;
+    size_t received = 0;
+    int i;
+
+    w.staging = NULL;
+    w.count = count;
+    if (staged) {
+        w.staging = mf_staging_new(MF_STAGING_RING_SIZE, MF_STAGING_BATCH_SIZE,
+            MF_STAGING_MAX_AGE_MS, count_batch, &received);
+    }
+
+    double start = now();
+    for (i = 0; i < n_threads; ++i) {
+        pthread_create(&threads[i], NULL, staged ? run_staged : run_shared, &w);
+    }
+    for (i = 0; i < n_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    if (staged) {
+        mf_staging_flush(w.staging);
+    }
+    double elapsed = now() - start;
+
+    if (staged) {
+        mf_staging_free(w.staging);
+        if (received != (size_t) n_threads * count) {
+            fprintf(stderr, "lost metrics: %zu of %d\n", received, n_threads * count);
+        }
+    }
+    free(threads);
+
+    return n_threads * (double) count / elapsed;
+}
+
+int
+main(int argc, char** argv)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = (argc > 1) ? atoi(argv[1]) : (int) cores;
+    int count = (argc > 2) ? atoi(argv[2]) : 1000000;
+    int n;
+
+    mf_buffer_init(&queue);
+
+    printf("%ld cores, %d metrics per thread\n", cores, count);
+    printf("%8s %14s %14s %8s\n", "threads", "shared (M/s)", "staged (M/s)", "speedup");
+
+    double base = 0;
+    for (n = 1; n <= max_threads; n *= 2) {
+        double shared = run(n, count, 0);
+        double staged = run(n, count, 1);
+        if (n == 1) {
+            base = staged;
+        }
+        printf("%8d %14.2f %14.2f %7.1fx\n",
+            n, shared / 1e6, staged / 1e6, staged / base);
+    }
+
+    mf_buffer_free(&queue);
+
+    return 0;
+}
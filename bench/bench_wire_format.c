@@ -0,0 +1,142 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compares encode time and bytes per metric of the JSON and MessagePack wire
+ * formats, for single documents, for batches and for compressed series, and
+ * of _bulk bodies written straight to Elasticsearch.
+ *
+ * Usage: bench_wire_format [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mf_encode.h"
+#include "mf_series.h"
+
+#define N_METRICS 1000
+
+/* not a wire format; selects mf_encode_bulk() */
+#define BULK -1
+
+static const char* host = "node01.cluster.hlrs.de";
+static const char* task = "myapp";
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+run(const char* label, int format, mf_metric* metrics, size_t batch, int iterations)
+{
+    mf_buffer buffer;
+    size_t bytes = 0;
+    size_t i;
+    int it;
+
+    mf_buffer_init(&buffer);
+
+    double start = now();
+    for (it = 0; it < iterations; ++it) {
+        for (i = 0; i < N_METRICS; i += batch) {
+            mf_buffer_reset(&buffer);
+            if (format == BULK) {
+                mf_encode_bulk(&buffer, "user", "AVRhZ1K2Ml8pRq3Ztm8o",
+                    host, task, &metrics[i], batch);
+            } else if (batch == 1) {
+                mf_encode_metric(&buffer, format, host, task, &metrics[i]);
+            } else {
+                mf_encode_batch(&buffer, format, host, task, &metrics[i], batch);
+            }
+            bytes += buffer.size;
+        }
+    }
+    double elapsed = now() - start;
+    double n = (double) N_METRICS * iterations;
+
+    printf("%-10s batch %4zu: %8.1f ns/metric %8.1f bytes/metric\n",
+        label, batch, elapsed * 1e9 / n, bytes / n);
+
+    mf_buffer_free(&buffer);
+}
+
+static void
+run_series(const char* label, int format, const double* values, int iterations)
+{
+    long long timestamps[N_METRICS];
+    mf_buffer buffer;
+    size_t bytes = 0;
+    int i, it;
+
+    for (i = 0; i < N_METRICS; ++i) {
+        timestamps[i] = 1461150000000LL + i * 100;
+    }
+    mf_buffer_init(&buffer);
+
+    double start = now();
+    for (it = 0; it < iterations; ++it) {
+        mf_buffer_reset(&buffer);
+        mf_series_encode(&buffer, format, host, task, "PAPI-C", "PAPI_TOT_INS",
+            timestamps, values, N_METRICS);
+        bytes += buffer.size;
+    }
+    double elapsed = now() - start;
+    double n = (double) N_METRICS * iterations;
+
+    printf("%-10s batch %4d: %8.1f ns/metric %8.1f bytes/metric\n",
+        label, N_METRICS, elapsed * 1e9 / n, bytes / n);
+
+    mf_buffer_free(&buffer);
+}
+
+int
+main(int argc, char** argv)
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 1000;
+    mf_metric* metrics = malloc(sizeof(mf_metric) * N_METRICS);
+    char* values = malloc(32 * N_METRICS);
+    double* samples = malloc(sizeof(double) * N_METRICS);
+    size_t batches[] = { 1, 10, 100, 1000 };
+    size_t i;
+
+    for (i = 0; i < N_METRICS; ++i) {
+        samples[i] = 1e9 + (i / 10) * 1024;
+        snprintf(values + 32 * i, 32, "%.1f", samples[i]);
+        metrics[i].timestamp = "2016-04-20T12:34:56.789";
+        metrics[i].type = "PAPI-C";
+        metrics[i].name = "PAPI_TOT_INS";
+        metrics[i].value = values + 32 * i;
+    }
+
+    for (i = 0; i < sizeof(batches) / sizeof(batches[0]); ++i) {
+        run("json", MF_FORMAT_JSON, metrics, batches[i], iterations);
+        run("msgpack", MF_FORMAT_MSGPACK, metrics, batches[i], iterations);
+        run("bulk", BULK, metrics, batches[i], iterations);
+    }
+    run_series("series", MF_FORMAT_JSON, samples, iterations);
+    run_series("series-mp", MF_FORMAT_MSGPACK, samples, iterations);
+
+    free(samples);
+    free(values);
+    free(metrics);
+
+    return 0;
+}
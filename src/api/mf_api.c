@@ -14,7 +14,17 @@
  * limitations under the License.
  */
 #include "mf_api.h"
+#include "mf_encode.h"
+#include "mf_energy.h"
+#include "mf_histogram.h"
+#include "mf_series.h"
+#include "mf_staging.h"
+#include "mf_suppress.h"
+#include "mf_watch.h"
+#include "contrib/mf_buffer.h"
 #include "contrib/mf_debug.h"
+#include "contrib/mf_msgpack.h"
+#include "contrib/mf_number.h"
 #include "contrib/mf_publisher.h"
 
 #include <ctype.h>    /* tolower */
@@ -22,8 +32,9 @@
 #include <stdlib.h>   /* malloc */
 #include <string.h>   /* memcpy, strlen */
 #include <netdb.h>    /* freeaddrinfo */
+#include <pthread.h>  /* pthread_mutex_lock */
 #include <sys/time.h> /* gettimeofday */
-#include <time.h>     /* strftime, localtime */
+#include <time.h>     /* strftime, localtime_r */
 #include <unistd.h>   /* gethostname */
 #include <math.h>     /* floor */
 
@@ -31,209 +42,1987 @@
  * Variable Declarations
  ******************************************************************************/
 
+/*
+ * A context holds everything a sequence of requests needs: the identity of
+ * the experiment, the publisher (and thereby the connection) and the buffers
+ * reused for encoding. Contexts share no mutable state, so each thread may
+ * use its own context without locking.
+ */
+struct mf_ctx_t {
+    char* experiment_id;
+    char* user;
+    char* application;
+    char* hostname;
+    char* server;
+    char* job_id;
+    const char* path;
+
+    mf_publisher* publisher; /* NULL for the default publisher */
+    int wire_format;
+    mf_buffer body;
+
+    /* Elasticsearch _bulk endpoint metrics are sent to; NULL if disabled;
+     * replaced holding both send_lock and lane_lock */
+    char* bulk_url;
+    char* bulk_index;  /* NULL for the user */
+
+    /* fields of snapshot documents, grown to the widest snapshot */
+    Data* snapshot;
+    size_t snapshot_capacity;
+
+    /* metrics of mf_ctx_update_batch(), grown to the largest batch */
+    mf_metric* batch;
+    size_t batch_capacity;
+
+    /* per-thread staging of mf_ctx_update(), NULL if disabled */
+    mf_staging* staging;
+
+    /* backpressure policy of the staging, under send_lock, and the metrics
+     * it dropped */
+    int backpressure;
+    long backpressure_limit;
+    unsigned long staging_dropped;    /* by earlier staging areas */
+    unsigned long reported_dropped;   /* last count sent to the server */
+    char dropped_value[MF_NUMBER_SIZE];
+
+    /* types of mf_ctx_set_priority(); appended under lane_lock, read without */
+    pthread_mutex_t lane_lock;
+    char* priority_types[MF_PRIORITY_TYPES];
+    int priorities[MF_PRIORITY_TYPES];
+    size_t n_priority_types;
+
+    /* queue, connection and body of high-priority metrics; NULL until used */
+    mf_staging* lane;
+    mf_publisher* lane_publisher;
+    mf_buffer lane_body;
+
+    /* drops redundant samples before they are staged or encoded */
+    mf_suppressor* suppressor;
+
+    /* sampler of watched variables, installed atomically by the first
+     * mf_ctx_watch() or mf_ctx_hist_new() */
+    mf_watcher* watcher;
+    long watch_interval_ms;
+
+    /* sampler of the energy counters, NULL unless mf_ctx_sample_energy() */
+    mf_energy* energy;
+
+    /* histograms uploaded at every sample */
+    pthread_mutex_t hist_lock;
+    mf_histogram** histograms;
+    size_t n_histograms;
+
+    /* serializes requests of the application and of the staging flusher */
+    pthread_mutex_t send_lock;
+
+    /* time mf_ctx_free() may spend sending pending data */
+    long shutdown_timeout_ms;
+};
+
+/* used by the mf_api_* functions; created on first use */
+static mf_ctx* default_ctx = NULL;
+static pthread_mutex_t default_ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+static int exit_handler_registered = 0;
+
+#define SHUTDOWN_TIMEOUT_MS 2000
+
+/* the priority lane is small: it carries few metrics, sent right away */
+#define LANE_RING_SIZE  (8 * 1024)
+#define LANE_BATCH_SIZE 64
+#define LANE_MAX_AGE_MS 100
+
+/*******************************************************************************
+ * Forward Declarations
+ ******************************************************************************/
+
+static void to_lowercase(char* word, int length);
+static void get_hostname(char* hostname);
+static mf_ctx* get_default_ctx();
+static void shutdown_at_exit();
+static mf_ctx* ctx_alloc(mf_publisher* publisher);
+static void ctx_clear_identity(mf_ctx* ctx);
+static const char* ctx_register(
+    mf_ctx* ctx,
+    const char* server,
+    const char* user,
+    const char* application,
+    const char* experiment_id,
+    const char* job_id);
+static char* send_metrics(mf_ctx* ctx, const mf_metric* metrics, size_t count, int is_batch);
+static char* send_locked(mf_ctx* ctx, const mf_metric* metrics, size_t count, int is_batch);
+static char* send_encoded(
+    mf_ctx* ctx,
+    mf_publisher* publisher,
+    mf_buffer* body,
+    const mf_metric* metrics,
+    size_t count,
+    int is_batch);
+static int send_staged(const mf_metric* metrics, size_t count, void* user_data);
+static int send_lane(const mf_metric* metrics, size_t count, void* user_data);
+static int is_urgent(mf_ctx* ctx, const char* type);
+static int grow_batch(mf_ctx* ctx, size_t count);
+static unsigned long staging_dropped(mf_ctx* ctx);
+static int send_sample(mf_metric* metrics, size_t count, void* user_data);
+static int start_watcher(mf_ctx* ctx);
+static int send_energy(mf_metric* metrics, size_t count, void* user_data);
+static char* send_bulk(
+    mf_ctx* ctx,
+    mf_publisher* publisher,
+    mf_buffer* body,
+    const mf_metric* metrics,
+    size_t count);
+static char* post_body(
+    mf_ctx* ctx,
+    mf_publisher* publisher,
+    mf_buffer* body,
+    int format,
+    int* rejected);
+static void build_metrics_url(mf_ctx* ctx, char* URL, size_t size);
+static void get_time_as_string(char* timestamp, const char* format, int in_milliseconds);
+char* mf_api_get_time();
+void convert_time_to_char(double ts, char* time_stamp);
+
+/*******************************************************************************
+ * mf_ctx_new
+ ******************************************************************************/
+
+mf_ctx*
+mf_ctx_new(
+    const char* server,
+    const char* user,
+    const char* application,
+    const char* experiment_id,
+    const char* job_id)
+{
+    mf_publisher* publisher = mf_publisher_new();
+    if (publisher == NULL) {
+        return NULL;
+    }
+
+    mf_ctx* ctx = ctx_alloc(publisher);
+    if (ctx == NULL) {
+        mf_publisher_free(publisher);
+        return NULL;
+    }
+
+    if (ctx_register(ctx, server, user, application, experiment_id, job_id) == NULL) {
+        mf_ctx_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+/*******************************************************************************
+ * mf_ctx_free
+ ******************************************************************************/
+
+void
+mf_ctx_free(mf_ctx* ctx)
+{
+    size_t i;
+
+    if (ctx == NULL) {
+        return;
+    }
+
+    /* bounds the time spent sending the pending data below */
+    mf_publisher_abort_after(ctx->publisher, ctx->shutdown_timeout_ms);
+    if (ctx->lane_publisher != NULL) {
+        mf_publisher_abort_after(ctx->lane_publisher, ctx->shutdown_timeout_ms);
+    }
+
+    mf_watcher_free(ctx->watcher);
+    mf_energy_free(ctx->energy);
+    mf_ctx_hist_flush(ctx);
+    mf_staging_free(ctx->lane);
+    mf_staging_free(ctx->staging);
+    mf_suppressor_free(ctx->suppressor);
+    ctx_clear_identity(ctx);
+    mf_publisher_free(ctx->publisher);
+    mf_buffer_free(&ctx->body);
+    mf_publisher_free(ctx->lane_publisher);
+    mf_buffer_free(&ctx->lane_body);
+    for (i = 0; i < ctx->n_priority_types; ++i) {
+        free(ctx->priority_types[i]);
+    }
+    free(ctx->bulk_url);
+    free(ctx->bulk_index);
+    free(ctx->snapshot);
+    free(ctx->batch);
+    for (i = 0; i < ctx->n_histograms; ++i) {
+        mf_histogram_free(ctx->histograms[i]);
+    }
+    free(ctx->histograms);
+    pthread_mutex_destroy(&ctx->hist_lock);
+    pthread_mutex_destroy(&ctx->send_lock);
+    pthread_mutex_destroy(&ctx->lane_lock);
+    free(ctx);
+
+    /* the messages of the shutdown, before the process may exit */
+    mf_log_flush();
+}
+
+/*******************************************************************************
+ * ctx_alloc
+ ******************************************************************************/
+
+static mf_ctx*
+ctx_alloc(mf_publisher* publisher)
+{
+    mf_ctx* ctx = (mf_ctx*) calloc(1, sizeof(mf_ctx));
+    if (ctx == NULL) {
+        log_error("cannot allocate context (%zu bytes)", sizeof(mf_ctx));
+        return NULL;
+    }
+
+    ctx->suppressor = mf_suppressor_new();
+    if (ctx->suppressor == NULL) {
+        free(ctx);
+        return NULL;
+    }
+
+    ctx->path = "v1/mf/metrics";
+    ctx->publisher = publisher;
+    ctx->wire_format = MF_FORMAT_JSON;
+    mf_buffer_init(&ctx->body);
+    mf_buffer_init(&ctx->lane_body);
+    pthread_mutex_init(&ctx->send_lock, NULL);
+    pthread_mutex_init(&ctx->lane_lock, NULL);
+    pthread_mutex_init(&ctx->hist_lock, NULL);
+    ctx->watch_interval_ms = MF_WATCH_INTERVAL_MS;
+    ctx->shutdown_timeout_ms = SHUTDOWN_TIMEOUT_MS;
+    ctx->backpressure = MF_BACKPRESSURE_BLOCK;
+    ctx->backpressure_limit = -1;
+
+    return ctx;
+}
+
+/*******************************************************************************
+ * get_default_ctx
+ ******************************************************************************/
+
+static mf_ctx*
+get_default_ctx()
+{
+    mf_ctx* ctx = __atomic_load_n(&default_ctx, __ATOMIC_ACQUIRE);
+    if (ctx != NULL) {
+        return ctx;
+    }
+
+    pthread_mutex_lock(&default_ctx_lock);
+    if (default_ctx == NULL) {
+        __atomic_store_n(&default_ctx, ctx_alloc(NULL), __ATOMIC_RELEASE);
+    }
+    if (!exit_handler_registered) {
+        exit_handler_registered = atexit(shutdown_at_exit) == 0;
+    }
+    ctx = default_ctx;
+    pthread_mutex_unlock(&default_ctx_lock);
+
+    return ctx;
+}
+
+/*******************************************************************************
+ * shutdown_at_exit
+ ******************************************************************************/
+
+/*
+ * Sends the data still pending when the process exits without calling
+ * mf_api_clear().
+ */
+static void
+shutdown_at_exit()
+{
+    mf_api_clear();
+}
+
+/*******************************************************************************
+ * ctx_clear_identity
+ ******************************************************************************/
+
+static void
+ctx_clear_identity(mf_ctx* ctx)
+{
+    free(ctx->experiment_id);
+    free(ctx->user);
+    free(ctx->application);
+    free(ctx->hostname);
+    free(ctx->server);
+    free(ctx->job_id);
+
+    ctx->experiment_id = NULL;
+    ctx->user = NULL;
+    ctx->application = NULL;
+    ctx->hostname = NULL;
+    ctx->server = NULL;
+    ctx->job_id = NULL;
+}
+
+/*******************************************************************************
+ * ctx_register
+ ******************************************************************************/
+
+static const char*
+ctx_register(
+    mf_ctx* ctx,
+    const char* server,
+    const char* user,
+    const char* application,
+    const char* experiment_id,
+    const char* job_id)
+{
+    if (server == NULL || server[0] == '\0') {
+        log_error("parameter 'server' is not set (%s)", server);
+        return NULL;
+    }
+    if (user == NULL || user[0] == '\0') {
+        log_error("parameter 'user' is not set (%s)", user);
+        return NULL;
+    }
+
+    ctx_clear_identity(ctx);
+    ctx->server = strdup(server);
+
+    ctx->user = strdup(user);
+    to_lowercase(ctx->user, strlen(ctx->user));
+
+    /* handle input parameter 'application' */
+    if (application == NULL || application[0] == '\0') {
+        ctx->application = strdup("_all");
+    } else {
+        ctx->application = strdup(application);
+        to_lowercase(ctx->application, strlen(ctx->application));
+    }
+
+    /* handle input parameter 'experiment_id' */
+    if (experiment_id == NULL || experiment_id[0] == '\0') {
+        ctx->experiment_id = NULL;
+    } else {
+        ctx->experiment_id = strdup(experiment_id);
+    }
+
+    /* handle input parameter 'job_id') */
+    if (job_id == NULL || job_id[0] == '\0') {
+        ctx->job_id = strdup("mf_api");
+    } else {
+        ctx->job_id = strdup(job_id);
+    }
+
+    char hostname[254];
+    get_hostname(hostname);
+    ctx->hostname = strdup(hostname);
+
+    char timestamp[64];
+    get_time_as_string(timestamp, "%Y-%m-%dT%H:%M:%S.%%6u", 1);
+
+    /*
+     * either create a new experiment_id if uninitialized,
+     * otherwise mf_create_user just returns the given id
+     */
+    char message[1000] = "";
+    snprintf(message, sizeof(message),
+        "{ \
+          \"host\":\"%s\", \
+          \"@timestamp\":\"%s\", \
+          \"user\":\"%s\", \
+          \"application\":\"%s\", \
+          \"job_id\":\"%s\" \
+        }",
+        ctx->hostname,
+        timestamp,
+        ctx->user,
+        ctx->application,
+        ctx->job_id
+    );
+
+    const char* response = mf_publisher_create_user(ctx->publisher,
+        ctx->server, ctx->user, ctx->experiment_id, message
+    );
+    if (response == NULL) {
+        return NULL;
+    }
+
+    /* we just expect that the reponse is correct */
+    free(ctx->experiment_id);
+    ctx->experiment_id = strdup(response);
+
+    return ctx->experiment_id;
+}
+
+/*******************************************************************************
+ * mf_api_new
+ ******************************************************************************/
+
+const char*
+mf_api_new(
+    const char* server,
+    const char* user,
+    const char* application,
+    const char* experiment_id,
+    const char* job_id)
+{
+    mf_ctx* ctx = get_default_ctx();
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    return ctx_register(ctx, server, user, application, experiment_id, job_id);
+}
+
+/*******************************************************************************
+ * mf_ctx_get_server
+ ******************************************************************************/
+
+const char*
+mf_ctx_get_server(mf_ctx* ctx)
+{
+    return (ctx != NULL) ? ctx->server : NULL;
+}
+
+/*******************************************************************************
+ * mf_ctx_get_id
+ ******************************************************************************/
+
+const char*
+mf_ctx_get_id(mf_ctx* ctx)
+{
+    return (ctx != NULL) ? ctx->experiment_id : NULL;
+}
+
+/*******************************************************************************
+ * mf_ctx_get_user
+ ******************************************************************************/
+
+const char*
+mf_ctx_get_user(mf_ctx* ctx)
+{
+    return (ctx != NULL) ? ctx->user : NULL;
+}
+
+/*******************************************************************************
+ * mf_ctx_get_application
+ ******************************************************************************/
+
+const char*
+mf_ctx_get_application(mf_ctx* ctx)
+{
+    return (ctx != NULL) ? ctx->application : NULL;
+}
+
+/*******************************************************************************
+ * mf_ctx_get_job_id
+ ******************************************************************************/
+
+const char*
+mf_ctx_get_job_id(mf_ctx* ctx)
+{
+    return (ctx != NULL) ? ctx->job_id : NULL;
+}
+
+/*******************************************************************************
+ * mf_api_get_server
+ ******************************************************************************/
+
+const char*
+mf_api_get_server()
+{
+    return mf_ctx_get_server(default_ctx);
+}
+
+/*******************************************************************************
+ * mf_api_get_id
+ ******************************************************************************/
+
+const char*
+mf_api_get_id()
+{
+    return mf_ctx_get_id(default_ctx);
+}
+
+/*******************************************************************************
+ * mf_api_get_user
+ ******************************************************************************/
+
+const char*
+mf_api_get_user()
+{
+    return mf_ctx_get_user(default_ctx);
+}
+
+/*******************************************************************************
+ * mf_api_get_application
+ ******************************************************************************/
+
+const char*
+mf_api_get_application()
+{
+    return mf_ctx_get_application(default_ctx);
+}
+
+/*******************************************************************************
+ * mf_api_get_job_id
+ ******************************************************************************/
+
+const char*
+mf_api_get_job_id()
+{
+    return mf_ctx_get_job_id(default_ctx);
+}
+
+/*******************************************************************************
+ * mf_ctx_update
+ ******************************************************************************/
+
+char*
+mf_ctx_update(mf_ctx* ctx, mf_metric* metric)
+{
+    if (!mf_suppressor_pass(ctx->suppressor, metric)) {
+        return (char*) "";
+    }
+
+    /* stamped on the stack; the metric of the caller is left untouched */
+    mf_metric stamped = *metric;
+    char timestamp[64];
+    if (stamped.timestamp == NULL) {
+        get_time_as_string(timestamp, "%Y-%m-%dT%H:%M:%S.%%6u", 1);
+        stamped.timestamp = timestamp;
+    }
+
+    if (is_urgent(ctx, stamped.type)) {
+        return mf_staging_append(ctx->lane, &stamped) ? (char*) "" : NULL;
+    }
+    mf_staging* staging = __atomic_load_n(&ctx->staging, __ATOMIC_ACQUIRE);
+    if (staging != NULL) {
+        return mf_staging_append(staging, &stamped) ? (char*) "" : NULL;
+    }
+
+    return send_metrics(ctx, &stamped, 1, 0);
+}
+
+/*******************************************************************************
+ * mf_api_update
+ ******************************************************************************/
+
+char*
+mf_api_update(mf_metric* metric)
+{
+    return mf_ctx_update(get_default_ctx(), metric);
+}
+
+/*******************************************************************************
+ * grow_batch
+ ******************************************************************************/
+
+/*
+ * Ensures the batch of the context holds count metrics. Must be called with
+ * the send lock held.
+ */
+static int
+grow_batch(mf_ctx* ctx, size_t count)
+{
+    if (count <= ctx->batch_capacity) {
+        return 1;
+    }
+
+    mf_metric* batch = realloc(ctx->batch, sizeof(mf_metric) * count);
+    if (batch == NULL) {
+        log_error("cannot allocate batch of %zu metrics", count);
+        return 0;
+    }
+    ctx->batch = batch;
+    ctx->batch_capacity = count;
+
+    return 1;
+}
+
+/*******************************************************************************
+ * mf_ctx_update_batch
+ ******************************************************************************/
+
+char*
+mf_ctx_update_batch(mf_ctx* ctx, mf_metric* metrics, size_t count)
+{
+    char timestamp[64];
+    char* response;
+    int failed = 0;
+    size_t n = 0;
+    size_t i;
+
+    if (metrics == NULL || count == 0) {
+        log_error("parameter 'metrics' is not set (%zu)", count);
+        return NULL;
+    }
+
+    get_time_as_string(timestamp, "%Y-%m-%dT%H:%M:%S.%%6u", 1);
+
+    pthread_mutex_lock(&ctx->send_lock);
+    if (!grow_batch(ctx, count)) {
+        pthread_mutex_unlock(&ctx->send_lock);
+        return NULL;
+    }
+
+    /* the metrics sent, stamped in the batch of the context */
+    for (i = 0; i < count; ++i) {
+        if (mf_suppressor_pass(ctx->suppressor, &metrics[i])) {
+            ctx->batch[n] = metrics[i];
+            if (ctx->batch[n].timestamp == NULL) {
+                ctx->batch[n].timestamp = timestamp;
+            }
+            if (!is_urgent(ctx, ctx->batch[n].type)) {
+                n++;
+            } else if (!mf_staging_append(ctx->lane, &ctx->batch[n])) {
+                failed = 1;
+            }
+        }
+    }
+
+    response = (n > 0) ? send_locked(ctx, ctx->batch, n, 1) : (char*) "";
+    if (failed) {
+        response = NULL;
+    }
+    pthread_mutex_unlock(&ctx->send_lock);
+
+    return response;
+}
+
+/*******************************************************************************
+ * mf_api_update_batch
+ ******************************************************************************/
+
+char*
+mf_api_update_batch(mf_metric* metrics, size_t count)
+{
+    return mf_ctx_update_batch(get_default_ctx(), metrics, count);
+}
+
+/*******************************************************************************
+ * mf_ctx_update_snapshot
+ ******************************************************************************/
+
+char*
+mf_ctx_update_snapshot(
+    mf_ctx* ctx,
+    const char* type,
+    const char** names,
+    const char** values,
+    size_t count)
+{
+    size_t i;
+
+    if (names == NULL || values == NULL || count == 0) {
+        log_error("parameter 'names' or 'values' is not set (%zu)", count);
+        return NULL;
+    }
+
+    char timestamp[64];
+    get_time_as_string(timestamp, "%Y-%m-%dT%H:%M:%S.%%6u", 1);
+
+    char URL[256];
+    build_metrics_url(ctx, URL, sizeof(URL));
+
+    pthread_mutex_lock(&ctx->send_lock);
+
+    /* task and type, the metrics, and the terminating element */
+    if (count + 3 > ctx->snapshot_capacity) {
+        Data* data = realloc(ctx->snapshot, sizeof(Data) * (count + 3));
+        if (data == NULL) {
+            pthread_mutex_unlock(&ctx->send_lock);
+            log_error("cannot allocate snapshot of %zu metrics", count);
+            return NULL;
+        }
+        ctx->snapshot = data;
+        ctx->snapshot_capacity = count + 3;
+    }
+
+    Data* snapshot = ctx->snapshot;
+    size_t n = 2;
+    snapshot[0].key = (char*) "task";
+    snapshot[0].value = ctx->application;
+    snapshot[1].key = (char*) "type";
+    snapshot[1].value = (char*) type;
+    for (i = 0; i < count; ++i) {
+        mf_metric metric = { NULL, type, names[i], values[i] };
+        if (mf_suppressor_pass(ctx->suppressor, &metric)) {
+            snapshot[n].key = (char*) names[i];
+            snapshot[n].value = (char*) values[i];
+            n++;
+        }
+    }
+    if (n == 2) {
+        pthread_mutex_unlock(&ctx->send_lock);
+        return (char*) "";
+    }
+    snapshot[n].key = NULL;
+    snapshot[n].value = NULL;
+
+    Message message;
+    message.sender = ctx->hostname;
+    message.username = NULL;
+    message.timestamp = timestamp;
+    message.data = snapshot;
+
+    mf_publisher_publish(ctx->publisher, URL, &message);
+    char* response = (char*) mf_publisher_get_response(ctx->publisher).data;
+    pthread_mutex_unlock(&ctx->send_lock);
+
+    return response;
+}
+
+/*******************************************************************************
+ * mf_api_update_snapshot
+ ******************************************************************************/
+
+char*
+mf_api_update_snapshot(
+    const char* type,
+    const char** names,
+    const char** values,
+    size_t count)
+{
+    return mf_ctx_update_snapshot(get_default_ctx(), type, names, values, count);
+}
+
+/*******************************************************************************
+ * mf_ctx_set_format
+ ******************************************************************************/
+
+void
+mf_ctx_set_format(mf_ctx* ctx, int format)
+{
+    if (format != MF_FORMAT_JSON && format != MF_FORMAT_MSGPACK) {
+        log_error("unknown format %d", format);
+        return;
+    }
+    __atomic_store_n(&ctx->wire_format, format, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * mf_api_set_format
+ ******************************************************************************/
+
+void
+mf_api_set_format(int format)
+{
+    mf_ctx_set_format(get_default_ctx(), format);
+}
+
+/*******************************************************************************
+ * mf_ctx_set_bulk_endpoint
+ ******************************************************************************/
+
+int
+mf_ctx_set_bulk_endpoint(mf_ctx* ctx, const char* url, const char* index)
+{
+    char* bulk_url = NULL;
+    char* bulk_index = NULL;
+
+    if ((url != NULL && (bulk_url = strdup(url)) == NULL) ||
+        (index != NULL && (bulk_index = strdup(index)) == NULL)) {
+        log_error("cannot allocate bulk endpoint %s", url);
+        free(bulk_url);
+        return 0;
+    }
+
+    /* both the send lock and the priority lane may be sending to it */
+    pthread_mutex_lock(&ctx->send_lock);
+    pthread_mutex_lock(&ctx->lane_lock);
+    free(ctx->bulk_url);
+    free(ctx->bulk_index);
+    ctx->bulk_url = bulk_url;
+    ctx->bulk_index = bulk_index;
+    pthread_mutex_unlock(&ctx->lane_lock);
+    pthread_mutex_unlock(&ctx->send_lock);
+
+    return 1;
+}
+
+/*******************************************************************************
+ * mf_api_set_bulk_endpoint
+ ******************************************************************************/
+
+int
+mf_api_set_bulk_endpoint(const char* url, const char* index)
+{
+    mf_ctx* ctx = get_default_ctx();
+
+    return ctx != NULL && mf_ctx_set_bulk_endpoint(ctx, url, index);
+}
+
+/*******************************************************************************
+ * mf_ctx_update_series
+ ******************************************************************************/
+
+char*
+mf_ctx_update_series(
+    mf_ctx* ctx,
+    const char* type,
+    const char* name,
+    const long long* timestamps,
+    const double* values,
+    size_t count)
+{
+    char* response;
+    int rejected;
+
+    if (timestamps == NULL || values == NULL || count == 0) {
+        log_error("parameter 'timestamps' or 'values' is not set (%zu)", count);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ctx->send_lock);
+    do {
+        int format = __atomic_load_n(&ctx->wire_format, __ATOMIC_RELAXED);
+        mf_buffer_reset(&ctx->body);
+        if (!mf_series_encode(&ctx->body, format, ctx->hostname,
+                ctx->application, type, name,
+                timestamps, values, count)) {
+            response = NULL;
+            break;
+        }
+        response = post_body(ctx, ctx->publisher, &ctx->body, format, &rejected);
+    } while (rejected);
+    pthread_mutex_unlock(&ctx->send_lock);
+
+    return response;
+}
+
+/*******************************************************************************
+ * mf_api_update_series
+ ******************************************************************************/
+
+char*
+mf_api_update_series(
+    const char* type,
+    const char* name,
+    const long long* timestamps,
+    const double* values,
+    size_t count)
+{
+    return mf_ctx_update_series(get_default_ctx(), type, name,
+        timestamps, values, count);
+}
+
+/*******************************************************************************
+ * build_metrics_url
+ ******************************************************************************/
+
+static void
+build_metrics_url(mf_ctx* ctx, char* URL, size_t size)
+{
+    snprintf(URL, size, "%s/%s/%s/%s?task=%s",
+        ctx->server,
+        ctx->path,
+        ctx->user,
+        ctx->experiment_id,
+        ctx->application
+    );
+}
+
+/*******************************************************************************
+ * post_body
+ ******************************************************************************/
+
+/*
+ * Sends the content of the body, encoded in the given format, to the metrics
+ * resource. If the server does not understand the format, the context
+ * negotiates down to JSON, and the caller has to encode and send the data
+ * again.
+ */
+static char*
+post_body(
+    mf_ctx* ctx,
+    mf_publisher* publisher,
+    mf_buffer* body,
+    int format,
+    int* rejected)
+{
+    char URL[256];
+    build_metrics_url(ctx, URL, sizeof(URL));
+
+    *rejected = 0;
+    char* response = mf_publisher_send(publisher,
+        URL, body->data, body->size, mf_encode_content_type(format)
+    );
+
+    if (format != MF_FORMAT_JSON &&
+        mf_publisher_get_status(publisher) == 415) {
+        log_warn("server rejected %s, falling back to JSON",
+            mf_encode_content_type(format));
+        __atomic_store_n(&ctx->wire_format, MF_FORMAT_JSON, __ATOMIC_RELAXED);
+        *rejected = 1;
+        return NULL;
+    }
+
+    return response;
+}
+
+/*******************************************************************************
+ * send_metrics
+ ******************************************************************************/
+
+static char*
+send_metrics(mf_ctx* ctx, const mf_metric* metrics, size_t count, int is_batch)
+{
+    pthread_mutex_lock(&ctx->send_lock);
+    char* response = send_locked(ctx, metrics, count, is_batch);
+    pthread_mutex_unlock(&ctx->send_lock);
+
+    return response;
+}
+
+/*******************************************************************************
+ * send_locked
+ ******************************************************************************/
+
+/*
+ * Encodes the metrics into the body of the context and sends them. Must be
+ * called with the send lock held.
+ */
+static char*
+send_locked(mf_ctx* ctx, const mf_metric* metrics, size_t count, int is_batch)
+{
+    return send_encoded(ctx, ctx->publisher, &ctx->body, metrics, count, is_batch);
+}
+
+/*******************************************************************************
+ * send_encoded
+ ******************************************************************************/
+
+/*
+ * Encodes the metrics into body and sends them through publisher. The caller
+ * serializes the use of both.
+ */
+static char*
+send_encoded(
+    mf_ctx* ctx,
+    mf_publisher* publisher,
+    mf_buffer* body,
+    const mf_metric* metrics,
+    size_t count,
+    int is_batch)
+{
+    char* response;
+    int rejected;
+
+    if (ctx->server == NULL) {
+        log_error("no experiment registered (%s)", "call mf_api_new() first");
+        return NULL;
+    }
+    if (ctx->bulk_url != NULL) {
+        return send_bulk(ctx, publisher, body, metrics, is_batch ? count : 1);
+    }
+
+    do {
+        int format = __atomic_load_n(&ctx->wire_format, __ATOMIC_RELAXED);
+        int encoded;
+
+        mf_buffer_reset(body);
+        if (is_batch) {
+            encoded = mf_encode_batch(body, format,
+                ctx->hostname, ctx->application, metrics, count);
+        } else {
+            encoded = mf_encode_metric(body, format,
+                ctx->hostname, ctx->application, metrics);
+        }
+        if (!encoded) {
+            response = NULL;
+            break;
+        }
+        response = post_body(ctx, publisher, body, format, &rejected);
+    } while (rejected);
+
+    return response;
+}
+
+/*******************************************************************************
+ * send_bulk
+ ******************************************************************************/
+
+/*
+ * Encodes the metrics into body as a _bulk request and sends it to the bulk
+ * endpoint. Elasticsearch answers 200 even if single documents failed, and
+ * then sets "errors" in the response, which fails the request as well.
+ */
+static char*
+send_bulk(
+    mf_ctx* ctx,
+    mf_publisher* publisher,
+    mf_buffer* body,
+    const mf_metric* metrics,
+    size_t count)
+{
+    const char* index = (ctx->bulk_index != NULL) ? ctx->bulk_index : ctx->user;
+
+    mf_buffer_reset(body);
+    if (!mf_encode_bulk(body, index, ctx->experiment_id,
+            ctx->hostname, ctx->application, metrics, count)) {
+        return NULL;
+    }
+
+    char* response = mf_publisher_send(publisher, ctx->bulk_url,
+        body->data, body->size, MF_BULK_CONTENT_TYPE);
+    if (response != NULL && (mf_publisher_get_status(publisher) >= 400 ||
+            strstr(response, "\"errors\":true") != NULL)) {
+        log_error("bulk request to %s failed (%ld): %.200s", ctx->bulk_url,
+            mf_publisher_get_status(publisher), response);
+        return NULL;
+    }
+
+    return response;
+}
+
+/*******************************************************************************
+ * send_staged
+ ******************************************************************************/
+
+/*
+ * Called by the staging flusher with metrics merged from all threads. If
+ * the backpressure policy dropped metrics since the last batch, the number
+ * of metrics dropped so far is appended to the batch.
+ */
+static int
+send_staged(const mf_metric* metrics, size_t count, void* user_data)
+{
+    mf_ctx* ctx = (mf_ctx*) user_data;
+    char timestamp[64];
+
+    pthread_mutex_lock(&ctx->send_lock);
+    unsigned long dropped = staging_dropped(ctx);
+    if (dropped != ctx->reported_dropped && grow_batch(ctx, count + 1)) {
+        get_time_as_string(timestamp, "%Y-%m-%dT%H:%M:%S.%%6u", 1);
+        mf_number_uint(ctx->dropped_value, dropped);
+
+        memcpy(ctx->batch, metrics, sizeof(mf_metric) * count);
+        ctx->batch[count].timestamp = timestamp;
+        ctx->batch[count].type = "mf_api";
+        ctx->batch[count].name = "staging_dropped";
+        ctx->batch[count].value = ctx->dropped_value;
+        ctx->reported_dropped = dropped;
+
+        metrics = ctx->batch;
+        count++;
+    }
+
+    char* response = send_locked(ctx, metrics, count, 1);
+    pthread_mutex_unlock(&ctx->send_lock);
+
+    return response != NULL;
+}
+
+/*******************************************************************************
+ * send_lane
+ ******************************************************************************/
+
+/*
+ * Called by the flusher of the priority lane. It is the only user of the
+ * lane's publisher and body, so it sends without the send lock and never
+ * waits for a request of the bulk traffic. The lane lock keeps the bulk
+ * endpoint from being replaced meanwhile.
+ */
+static int
+send_lane(const mf_metric* metrics, size_t count, void* user_data)
+{
+    mf_ctx* ctx = (mf_ctx*) user_data;
+
+    pthread_mutex_lock(&ctx->lane_lock);
+    char* response = send_encoded(ctx, ctx->lane_publisher, &ctx->lane_body,
+        metrics, count, 1);
+    pthread_mutex_unlock(&ctx->lane_lock);
+
+    return response != NULL;
+}
+
+/*******************************************************************************
+ * is_urgent
+ ******************************************************************************/
+
+/*
+ * Types are only ever appended, and the count is published after the lane
+ * and the type, so a reader sees both complete. Costs a single load while no
+ * priority is set.
+ */
+static int
+is_urgent(mf_ctx* ctx, const char* type)
+{
+    size_t n = __atomic_load_n(&ctx->n_priority_types, __ATOMIC_ACQUIRE);
+    size_t i;
+
+    if (n == 0 || type == NULL) {
+        return 0;
+    }
+    for (i = 0; i < n; ++i) {
+        if (strcmp(ctx->priority_types[i], type) == 0) {
+            return __atomic_load_n(&ctx->priorities[i], __ATOMIC_RELAXED) ==
+                MF_PRIORITY_HIGH;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * set_staging
+ ******************************************************************************/
+
+/*
+ * The flusher reads ctx->staging in send_staged(), so it is replaced with
+ * the send lock held; a new flusher waits for the lock before its first
+ * batch. The new area is set up completely before it is published: adaptive
+ * or not, and with the backpressure policy read under the same lock. The old
+ * staging area is freed last, outside the lock, since its final flush goes
+ * through send_staged() as well. Updating threads load the pointer without
+ * the lock; see mf_api_set_staging() for why they must not run meanwhile.
+ */
+static int
+set_staging(mf_ctx* ctx, size_t batch_size, long max_age_ms, int adaptive)
+{
+    mf_staging* staging = NULL;
+
+    if (batch_size > 0) {
+        staging = mf_staging_new(MF_STAGING_RING_SIZE, batch_size,
+            max_age_ms, send_staged, ctx);
+        if (staging == NULL) {
+            return 0;
+        }
+        if (adaptive) {
+            mf_staging_set_adaptive(staging, 1);
+        }
+    }
+
+    pthread_mutex_lock(&ctx->send_lock);
+    if (staging != NULL) {
+        mf_staging_set_backpressure(staging,
+            ctx->backpressure, ctx->backpressure_limit);
+    }
+    mf_staging* old = ctx->staging;
+    if (old != NULL) {
+        ctx->staging_dropped += mf_staging_get_dropped(old);
+    }
+    __atomic_store_n(&ctx->staging, staging, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx->send_lock);
+
+    mf_staging_free(old);
+
+    return 1;
+}
+
+/*******************************************************************************
+ * mf_ctx_set_staging
+ ******************************************************************************/
+
+int
+mf_ctx_set_staging(mf_ctx* ctx, size_t batch_size, long max_age_ms)
+{
+    return set_staging(ctx, batch_size, max_age_ms, 0);
+}
+
+/*******************************************************************************
+ * mf_api_set_staging
+ ******************************************************************************/
+
+int
+mf_api_set_staging(size_t batch_size, long max_age_ms)
+{
+    mf_ctx* ctx = get_default_ctx();
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    return mf_ctx_set_staging(ctx, batch_size, max_age_ms);
+}
+
+/*******************************************************************************
+ * mf_ctx_set_adaptive_staging
+ ******************************************************************************/
+
+int
+mf_ctx_set_adaptive_staging(mf_ctx* ctx, size_t batch_size, long max_age_ms)
+{
+    return set_staging(ctx, batch_size, max_age_ms, 1);
+}
+
+/*******************************************************************************
+ * mf_api_set_adaptive_staging
+ ******************************************************************************/
+
+int
+mf_api_set_adaptive_staging(size_t batch_size, long max_age_ms)
+{
+    mf_ctx* ctx = get_default_ctx();
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    return mf_ctx_set_adaptive_staging(ctx, batch_size, max_age_ms);
+}
+
+/*******************************************************************************
+ * mf_ctx_set_backpressure
+ ******************************************************************************/
+
+/*
+ * Holds the send lock, under which the staging area is replaced, so the
+ * policy reaches the area in use and any area installed later.
+ */
+void
+mf_ctx_set_backpressure(mf_ctx* ctx, int policy, long limit)
+{
+    pthread_mutex_lock(&ctx->send_lock);
+    ctx->backpressure = policy;
+    ctx->backpressure_limit = limit;
+    if (ctx->staging != NULL) {
+        mf_staging_set_backpressure(ctx->staging, policy, limit);
+    }
+    pthread_mutex_unlock(&ctx->send_lock);
+}
+
+/*******************************************************************************
+ * mf_api_set_backpressure
+ ******************************************************************************/
+
+void
+mf_api_set_backpressure(int policy, long limit)
+{
+    mf_ctx* ctx = get_default_ctx();
+    if (ctx != NULL) {
+        mf_ctx_set_backpressure(ctx, policy, limit);
+    }
+}
+
+/*******************************************************************************
+ * mf_ctx_set_priority
+ ******************************************************************************/
+
+int
+mf_ctx_set_priority(mf_ctx* ctx, const char* type, int priority)
+{
+    int result = 1;
+    size_t n;
+    size_t i;
+
+    if (type == NULL ||
+        (priority != MF_PRIORITY_NORMAL && priority != MF_PRIORITY_HIGH)) {
+        log_error("invalid priority %d of type %s", priority, type);
+        return 0;
+    }
+
+    pthread_mutex_lock(&ctx->lane_lock);
+    n = ctx->n_priority_types;
+    for (i = 0; i < n; ++i) {
+        if (strcmp(ctx->priority_types[i], type) == 0) {
+            __atomic_store_n(&ctx->priorities[i], priority, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&ctx->lane_lock);
+            return 1;
+        }
+    }
+
+    if (ctx->lane == NULL) {
+        ctx->lane_publisher = mf_publisher_new();
+        if (ctx->lane_publisher != NULL) {
+            ctx->lane = mf_staging_new(LANE_RING_SIZE, LANE_BATCH_SIZE,
+                LANE_MAX_AGE_MS, send_lane, ctx);
+        }
+        if (ctx->lane == NULL) {
+            mf_publisher_free(ctx->lane_publisher);
+            ctx->lane_publisher = NULL;
+            pthread_mutex_unlock(&ctx->lane_lock);
+            return 0;
+        }
+        /* an idle lane sends a metric as soon as it is queued */
+        mf_staging_set_adaptive(ctx->lane, 1);
+    }
+
+    if (n == MF_PRIORITY_TYPES) {
+        log_error("cannot set priority of type %s (%d types at most)",
+            type, MF_PRIORITY_TYPES);
+        result = 0;
+    } else if ((ctx->priority_types[n] = strdup(type)) == NULL) {
+        log_error("cannot allocate type %s", type);
+        result = 0;
+    } else {
+        ctx->priorities[n] = priority;
+        __atomic_store_n(&ctx->n_priority_types, n + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&ctx->lane_lock);
+
+    return result;
+}
+
+/*******************************************************************************
+ * mf_api_set_priority
+ ******************************************************************************/
+
+int
+mf_api_set_priority(const char* type, int priority)
+{
+    mf_ctx* ctx = get_default_ctx();
+
+    return ctx != NULL && mf_ctx_set_priority(ctx, type, priority);
+}
+
+/*******************************************************************************
+ * mf_ctx_flush
+ ******************************************************************************/
+
+void
+mf_ctx_flush(mf_ctx* ctx)
+{
+    if (ctx != NULL && ctx->lane != NULL) {
+        mf_staging_flush(ctx->lane);
+    }
+    if (ctx != NULL && ctx->staging != NULL) {
+        mf_staging_flush(ctx->staging);
+    }
+}
+
+/*******************************************************************************
+ * mf_api_flush
+ ******************************************************************************/
+
+void
+mf_api_flush()
+{
+    mf_ctx_flush(default_ctx);
+}
+
+/*******************************************************************************
+ * send_sample
+ ******************************************************************************/
+
+/*
+ * Called by the sampler thread with the values of all watched variables;
+ * sends those that are not suppressed, and uploads the histograms.
+ */
+static int
+send_sample(mf_metric* metrics, size_t count, void* user_data)
+{
+    mf_ctx* ctx = (mf_ctx*) user_data;
+    char timestamp[64];
+    int result = 1;
+    size_t i;
+    size_t n = 0;
+
+    for (i = 0; i < count; ++i) {
+        if (mf_suppressor_pass(ctx->suppressor, &metrics[i])) {
+            metrics[n++] = metrics[i];
+        }
+    }
+    count = n;
+
+    if (count > 0) {
+        get_time_as_string(timestamp, "%Y-%m-%dT%H:%M:%S.%%6u", 1);
+        for (i = 0; i < count; ++i) {
+            metrics[i].timestamp = timestamp;
+        }
+        result = send_metrics(ctx, metrics, count, 1) != NULL;
+    }
+
+    return mf_ctx_hist_flush(ctx) && result;
+}
+
+/*******************************************************************************
+ * start_watcher
+ ******************************************************************************/
+
+/*
+ * Threads may call mf_ctx_watch() or mf_ctx_hist_new() concurrently, so the
+ * watcher is installed with a compare-and-swap; a thread that loses the race
+ * frees the watcher it created, which has nothing to sample yet.
+ */
+static int
+start_watcher(mf_ctx* ctx)
+{
+    mf_watcher* watcher = __atomic_load_n(&ctx->watcher, __ATOMIC_ACQUIRE);
+    if (watcher != NULL) {
+        return 1;
+    }
+
+    watcher = mf_watcher_new(ctx->watch_interval_ms, send_sample, ctx);
+    if (watcher == NULL) {
+        return 0;
+    }
+    mf_watcher* expected = NULL;
+    if (!__atomic_compare_exchange_n(&ctx->watcher, &expected, watcher, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        mf_watcher_free(watcher);
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * mf_ctx_watch
+ ******************************************************************************/
+
+int
+mf_ctx_watch(
+    mf_ctx* ctx,
+    const char* name,
+    const char* type,
+    const volatile void* addr,
+    int kind)
+{
+    if (!start_watcher(ctx)) {
+        return 0;
+    }
+
+    return mf_watcher_add(__atomic_load_n(&ctx->watcher, __ATOMIC_ACQUIRE),
+        name, type, addr, kind);
+}
+
+/*******************************************************************************
+ * mf_api_watch
+ ******************************************************************************/
+
+int
+mf_api_watch(
+    const char* name,
+    const char* type,
+    const volatile void* addr,
+    int kind)
+{
+    mf_ctx* ctx = get_default_ctx();
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    return mf_ctx_watch(ctx, name, type, addr, kind);
+}
+
+/*******************************************************************************
+ * mf_ctx_unwatch
+ ******************************************************************************/
+
+int
+mf_ctx_unwatch(mf_ctx* ctx, const volatile void* addr)
+{
+    mf_watcher* watcher = (ctx != NULL) ?
+        __atomic_load_n(&ctx->watcher, __ATOMIC_ACQUIRE) : NULL;
+    if (watcher == NULL) {
+        return 0;
+    }
+
+    return mf_watcher_remove(watcher, addr);
+}
+
+/*******************************************************************************
+ * mf_api_unwatch
+ ******************************************************************************/
+
+int
+mf_api_unwatch(const volatile void* addr)
+{
+    return mf_ctx_unwatch(default_ctx, addr);
+}
+
+/*******************************************************************************
+ * mf_ctx_set_watch_interval
+ ******************************************************************************/
+
+void
+mf_ctx_set_watch_interval(mf_ctx* ctx, long interval_ms)
+{
+    ctx->watch_interval_ms = (interval_ms > 0) ? interval_ms : MF_WATCH_INTERVAL_MS;
+    mf_watcher* watcher = __atomic_load_n(&ctx->watcher, __ATOMIC_ACQUIRE);
+    if (watcher != NULL) {
+        mf_watcher_set_interval(watcher, ctx->watch_interval_ms);
+    }
+}
+
+/*******************************************************************************
+ * mf_api_set_watch_interval
+ ******************************************************************************/
+
+void
+mf_api_set_watch_interval(long interval_ms)
+{
+    mf_ctx* ctx = get_default_ctx();
+    if (ctx != NULL) {
+        mf_ctx_set_watch_interval(ctx, interval_ms);
+    }
+}
+
+/*******************************************************************************
+ * send_energy
+ ******************************************************************************/
 
+static int
+send_energy(mf_metric* metrics, size_t count, void* user_data)
+{
+    mf_ctx* ctx = (mf_ctx*) user_data;
+    char timestamp[64];
+    size_t i;
 
-typedef struct mf_state_t mf_state;
+    if (count == 0) {
+        return 1;
+    }
 
-struct mf_state_t {
-    const char* experiment_id;
-    const char* user;
-    const char* application;
-    const char* hostname;
-    const char* server;
-    const char* job_id;
-    const char* path;
-    const char* date;
-} mf_state_t;
+    get_time_as_string(timestamp, "%Y-%m-%dT%H:%M:%S.%%6u", 1);
+    for (i = 0; i < count; ++i) {
+        metrics[i].timestamp = timestamp;
+    }
+    return send_metrics(ctx, metrics, count, 1) != NULL;
+}
+
+/*******************************************************************************
+ * mf_ctx_sample_energy
+ ******************************************************************************/
+
+int
+mf_ctx_sample_energy(mf_ctx* ctx, const char* root, long interval_ms)
+{
+    mf_energy_free(ctx->energy);
+    ctx->energy = NULL;
+    if (interval_ms < 0) {
+        return 0;
+    }
 
-mf_state* status;
+    ctx->energy = mf_energy_new(root, interval_ms, send_energy, ctx);
+    return (ctx->energy != NULL) ? (int) mf_energy_zones(ctx->energy) : 0;
+}
 
 /*******************************************************************************
- * Forward Declarations
+ * mf_api_sample_energy
  ******************************************************************************/
 
-static void to_lowercase(char* word, int length);
-static void get_hostname(char* hostname);
-char* mf_api_get_time();
-void convert_time_to_char(double ts, char* time_stamp);
+int
+mf_api_sample_energy(const char* root, long interval_ms)
+{
+    mf_ctx* ctx = get_default_ctx();
+
+    return (ctx != NULL) ? mf_ctx_sample_energy(ctx, root, interval_ms) : 0;
+}
 
 /*******************************************************************************
- * mf_api_new
+ * mf_ctx_hist_new
  ******************************************************************************/
 
-const char*
-mf_api_new(
-    const char* server,
-    const char* user,
-    const char* application,
-    const char* experiment_id,
-    const char* job_id)
+mf_histogram*
+mf_ctx_hist_new(mf_ctx* ctx, const char* type, const char* name, int flags)
 {
-    if (server == NULL || server[0] == '\0') {
-        log_error("parameter 'server' is not set (%s)", server);
+    if (!start_watcher(ctx)) {
         return NULL;
     }
-    if (user == NULL || user[0] == '\0') {
-        log_error("parameter 'user' is not set (%s)", user);
+
+    mf_histogram* histogram = mf_histogram_new(type, name, flags);
+    if (histogram == NULL) {
         return NULL;
     }
 
-    if (status == NULL) {
-        status = (mf_state*) malloc(sizeof(mf_state));
+    pthread_mutex_lock(&ctx->hist_lock);
+    mf_histogram** histograms = realloc(ctx->histograms,
+        sizeof(mf_histogram*) * (ctx->n_histograms + 1));
+    if (histograms != NULL) {
+        ctx->histograms = histograms;
+        ctx->histograms[ctx->n_histograms++] = histogram;
+    }
+    pthread_mutex_unlock(&ctx->hist_lock);
+
+    if (histograms == NULL) {
+        log_error("cannot register histogram %s", name);
+        mf_histogram_free(histogram);
+        return NULL;
     }
-    status->server = strdup(server);
-    status->path = strdup("v1/mf/metrics");
 
-    char tmp[strlen(user)];
-    strcpy(tmp, user);
-    to_lowercase(tmp, strlen(tmp));
-    status->user = strdup(tmp);
+    return histogram;
+}
 
-    /* handle input parameter 'application' */
-    if (application == NULL || application[0] == '\0') {
-        status->application = strdup("_all");
-    } else {
-        strcpy(tmp, application);
-        to_lowercase(tmp, strlen(tmp));
-        status->application = strdup(tmp);
+/*******************************************************************************
+ * mf_api_hist_new
+ ******************************************************************************/
+
+mf_histogram*
+mf_api_hist_new(const char* type, const char* name, int flags)
+{
+    mf_ctx* ctx = get_default_ctx();
+    if (ctx == NULL) {
+        return NULL;
     }
 
-    /* handle input parameter 'experiment_id' */
-    if (experiment_id == NULL || experiment_id[0] == '\0') {
-        status->experiment_id = NULL;
-    } else {
-        status->experiment_id = strdup(experiment_id);
+    return mf_ctx_hist_new(ctx, type, name, flags);
+}
+
+/*******************************************************************************
+ * mf_api_hist_record
+ ******************************************************************************/
+
+void
+mf_api_hist_record(mf_histogram* histogram, unsigned long long value)
+{
+    mf_histogram_record(histogram, value);
+}
+
+/*******************************************************************************
+ * mf_ctx_hist_flush
+ ******************************************************************************/
+
+int
+mf_ctx_hist_flush(mf_ctx* ctx)
+{
+    char* response = NULL;
+    size_t used = 0;
+    size_t i;
+    int rejected;
+
+    if (ctx == NULL) {
+        return 0;
     }
 
-    /* handle input parameter 'job_id') */
-    if (job_id == NULL || job_id[0] == '\0') {
-        status->job_id = strdup("mf_api");
-    } else {
-        status->job_id = strdup(job_id);
+    pthread_mutex_lock(&ctx->hist_lock);
+    for (i = 0; i < ctx->n_histograms; ++i) {
+        used += mf_histogram_collect(ctx->histograms[i]) > 0;
+    }
+    if (used == 0 || ctx->server == NULL) {
+        pthread_mutex_unlock(&ctx->hist_lock);
+        return used == 0;
     }
 
-    char* hostname = (char *)malloc(sizeof(char) * 254);
-    get_hostname(hostname);
-    status->hostname = strdup(hostname);
+    char timestamp[64];
+    get_time_as_string(timestamp, "%Y-%m-%dT%H:%M:%S.%%6u", 1);
+
+    pthread_mutex_lock(&ctx->send_lock);
+    do {
+        int format = __atomic_load_n(&ctx->wire_format, __ATOMIC_RELAXED);
+        size_t written = 0;
+        int encoded;
+
+        mf_buffer_reset(&ctx->body);
+        encoded = (format == MF_FORMAT_MSGPACK) ?
+            mf_msgpack_array(&ctx->body, (uint32_t) used) :
+            mf_buffer_append_char(&ctx->body, '[');
+        for (i = 0; encoded && i < ctx->n_histograms; ++i) {
+            if (mf_histogram_count(ctx->histograms[i]) == 0) {
+                continue;
+            }
+            encoded = (format == MF_FORMAT_MSGPACK || written == 0 ||
+                    mf_buffer_append_char(&ctx->body, ',')) &&
+                mf_histogram_encode(&ctx->body, format, ctx->hostname,
+                    ctx->application, timestamp, ctx->histograms[i]);
+            written++;
+        }
+        if (!encoded || (format != MF_FORMAT_MSGPACK &&
+                !mf_buffer_append_char(&ctx->body, ']'))) {
+            response = NULL;
+            break;
+        }
+        response = post_body(ctx, ctx->publisher, &ctx->body, format, &rejected);
+    } while (rejected);
+    pthread_mutex_unlock(&ctx->send_lock);
+    pthread_mutex_unlock(&ctx->hist_lock);
+
+    return response != NULL;
+}
+
+/*******************************************************************************
+ * mf_api_hist_flush
+ ******************************************************************************/
+
+int
+mf_api_hist_flush()
+{
+    return mf_ctx_hist_flush(default_ctx);
+}
+
+/*******************************************************************************
+ * mf_ctx_suppress
+ ******************************************************************************/
+
+int
+mf_ctx_suppress(
+    mf_ctx* ctx,
+    const char* type,
+    const char* name,
+    int mode,
+    double deadband,
+    long heartbeat_ms)
+{
+    return mf_suppressor_set(ctx->suppressor, type, name, mode,
+        deadband, heartbeat_ms);
+}
+
+/*******************************************************************************
+ * mf_api_suppress
+ ******************************************************************************/
+
+int
+mf_api_suppress(
+    const char* type,
+    const char* name,
+    int mode,
+    double deadband,
+    long heartbeat_ms)
+{
+    mf_ctx* ctx = get_default_ctx();
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    return mf_ctx_suppress(ctx, type, name, mode, deadband, heartbeat_ms);
+}
+
+/*******************************************************************************
+ * mf_ctx_get_suppressed
+ ******************************************************************************/
+
+unsigned long
+mf_ctx_get_suppressed(mf_ctx* ctx)
+{
+    return mf_suppressor_get_suppressed(ctx->suppressor);
+}
+
+/*******************************************************************************
+ * mf_api_get_suppressed
+ ******************************************************************************/
+
+unsigned long
+mf_api_get_suppressed()
+{
+    mf_ctx* ctx = get_default_ctx();
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    return mf_ctx_get_suppressed(ctx);
+}
+
+/*******************************************************************************
+ * mf_ctx_query
+ ******************************************************************************/
+
+int
+mf_ctx_query(
+    mf_ctx* ctx,
+    const char* resource,
+    mf_query_callback callback,
+    void* user_data)
+{
+    if (ctx == NULL || ctx->server == NULL) {
+        log_error("no server registered (%s)", "call mf_api_new() first");
+        return 0;
+    }
+    if (resource == NULL) {
+        log_error("parameter '%s' is not set", "resource");
+        return 0;
+    }
+
+    size_t size = strlen(ctx->server) + strlen(resource) + 2;
+    char* URL = malloc(size);
+    if (URL == NULL) {
+        log_error("cannot allocate URL of %zu bytes", size);
+        return 0;
+    }
+    snprintf(URL, size, "%s/%s", ctx->server, resource);
 
     /*
-     * either create a new experiment_id if uninitialized,
-     * otherwise mf_create_user just returns the given id
+     * A query runs on a connection of its own, so that neither the callback
+     * nor a long response holds up the requests sending metrics.
      */
-    char message[1000] = "";
-    sprintf(message,
-        "{ \
-          \"host\":\"%s\", \
-          \"@timestamp\":\"%s\", \
-          \"user\":\"%s\", \
-          \"application\":\"%s\", \
-          \"job_id\":\"%s\" \
-        }",
-        status->hostname,
-        mf_api_get_time(),
-        status->user,
-        status->application,
-        status->job_id
-    );
+    mf_publisher* publisher = mf_publisher_new();
+    int result = publisher != NULL &&
+        mf_publisher_query(publisher, URL, callback, user_data);
+    mf_publisher_free(publisher);
+    free(URL);
+
+    return result;
+}
+
+/*******************************************************************************
+ * mf_api_query
+ ******************************************************************************/
+
+int
+mf_api_query(
+    const char* resource,
+    mf_query_callback callback,
+    void* user_data)
+{
+    return mf_ctx_query(default_ctx, resource, callback, user_data);
+}
+
+/*******************************************************************************
+ * mf_ctx_query_metrics
+ ******************************************************************************/
 
-    const char* response = mf_create_user(
-        status->server, status->user, status->experiment_id, message
+int
+mf_ctx_query_metrics(mf_ctx* ctx, mf_query_callback callback, void* user_data)
+{
+    if (ctx == NULL || ctx->experiment_id == NULL) {
+        log_error("no experiment registered (%s)", "call mf_api_new() first");
+        return 0;
+    }
+
+    char resource[256];
+    snprintf(resource, sizeof(resource), "v1/mf/profiles/%s/%s/%s",
+        ctx->user,
+        ctx->application,
+        ctx->experiment_id
     );
 
-    /* we just expect that the reponse is correct */
-    status->experiment_id = strdup(response);
+    return mf_ctx_query(ctx, resource, callback, user_data);
+}
 
-    return response;
+/*******************************************************************************
+ * mf_api_query_metrics
+ ******************************************************************************/
+
+int
+mf_api_query_metrics(mf_query_callback callback, void* user_data)
+{
+    return mf_ctx_query_metrics(default_ctx, callback, user_data);
 }
 
 /*******************************************************************************
- * mf_api_get_server
+ * mf_ctx_get_response
  ******************************************************************************/
 
 const char*
-mf_api_get_server()
+mf_ctx_get_response(mf_ctx* ctx, size_t* size)
 {
-    return (status != NULL) ? status->server : NULL;
+    mf_view view = mf_publisher_get_response(ctx != NULL ? ctx->publisher : NULL);
+
+    if (size != NULL) {
+        *size = view.size;
+    }
+    return view.data;
 }
 
 /*******************************************************************************
- * mf_api_get_id
+ * mf_api_get_response
  ******************************************************************************/
 
 const char*
-mf_api_get_id()
+mf_api_get_response(size_t* size)
 {
-    return (status != NULL) ? status->experiment_id : NULL;
+    return mf_ctx_get_response(default_ctx, size);
 }
 
 /*******************************************************************************
- * mf_api_get_user
+ * mf_ctx_set_timeouts
  ******************************************************************************/
 
-const char*
-mf_api_get_user()
+void
+mf_ctx_set_timeouts(mf_ctx* ctx, long connect_timeout_ms, long deadline_ms)
 {
-    return (status != NULL) ? status->user : NULL;
+    mf_publisher_set_timeouts(ctx->publisher, connect_timeout_ms, deadline_ms);
 }
 
 /*******************************************************************************
- * mf_api_get_application
+ * mf_api_set_timeouts
  ******************************************************************************/
 
-const char*
-mf_api_get_application()
+void
+mf_api_set_timeouts(long connect_timeout_ms, long deadline_ms)
 {
-    return (status != NULL) ? status->application : NULL;
+    mf_publisher_set_timeouts(NULL, connect_timeout_ms, deadline_ms);
 }
 
 /*******************************************************************************
- * mf_api_get_job_id
+ * mf_ctx_set_retries
  ******************************************************************************/
 
-const char*
-mf_api_get_job_id()
+void
+mf_ctx_set_retries(
+    mf_ctx* ctx,
+    int max_retries,
+    long backoff_base_ms,
+    long backoff_max_ms)
 {
-    return (status != NULL) ? status->job_id : NULL;
+    mf_publisher_set_retries(ctx->publisher,
+        max_retries, backoff_base_ms, backoff_max_ms);
 }
 
 /*******************************************************************************
- * mf_api_update
+ * mf_api_set_retries
  ******************************************************************************/
 
-char*
-mf_api_update(mf_metric* metric)
+void
+mf_api_set_retries(int max_retries, long backoff_base_ms, long backoff_max_ms)
+{
+    mf_publisher_set_retries(NULL, max_retries, backoff_base_ms, backoff_max_ms);
+}
+
+/*******************************************************************************
+ * mf_ctx_set_compression
+ ******************************************************************************/
+
+void
+mf_ctx_set_compression(mf_ctx* ctx, int level, size_t min_size)
+{
+    mf_publisher_set_compression(ctx->publisher, level, min_size);
+}
+
+/*******************************************************************************
+ * mf_api_set_compression
+ ******************************************************************************/
+
+void
+mf_api_set_compression(int level, size_t min_size)
+{
+    mf_publisher_set_compression(NULL, level, min_size);
+}
+
+/*******************************************************************************
+ * mf_ctx_set_circuit_breaker
+ ******************************************************************************/
+
+void
+mf_ctx_set_circuit_breaker(
+    mf_ctx* ctx,
+    int failure_threshold,
+    long open_ms,
+    const char* spool_path)
+{
+    mf_publisher_set_circuit_breaker(ctx->publisher,
+        failure_threshold, open_ms, spool_path);
+}
+
+/*******************************************************************************
+ * mf_api_set_circuit_breaker
+ ******************************************************************************/
+
+void
+mf_api_set_circuit_breaker(
+    int failure_threshold,
+    long open_ms,
+    const char* spool_path)
+{
+    mf_publisher_set_circuit_breaker(NULL, failure_threshold, open_ms, spool_path);
+}
+
+/*******************************************************************************
+ * staging_dropped
+ ******************************************************************************/
+
+static unsigned long
+staging_dropped(mf_ctx* ctx)
 {
-    char curl_data[4095] = { 0 };
-    if (metric->timestamp == '\0') {
-        metric->timestamp = strdup(mf_api_get_time());
+    if (ctx == NULL) {
+        return 0;
     }
+    return ctx->staging_dropped +
+        ((ctx->staging != NULL) ? mf_staging_get_dropped(ctx->staging) : 0);
+}
 
-    sprintf(curl_data,
-        "{ \
-            \"@timestamp\": \"%s\", \
-            \"host\":\"%s\", \
-            \"task\":\"%s\", \
-            \"type\": \"%s\", \
-            \"%s\": \"%s\" \
-        }",
-        metric->timestamp,
-        status->hostname,
-        status->application,
-        metric->type,
-        metric->name,
-        metric->value
-    );
+/*******************************************************************************
+ * mf_ctx_get_dropped
+ ******************************************************************************/
 
-    char URL[256];
-    sprintf(URL, "%s/%s/%s/%s?task=%s",
-        status->server,
-        status->path,
-        status->user,
-        status->experiment_id,
-        status->application
-    );
+unsigned long
+mf_ctx_get_dropped(mf_ctx* ctx)
+{
+    return mf_publisher_get_dropped(ctx->publisher) + staging_dropped(ctx);
+}
+
+/*******************************************************************************
+ * mf_api_get_dropped
+ ******************************************************************************/
+
+unsigned long
+mf_api_get_dropped()
+{
+    mf_ctx* ctx = __atomic_load_n(&default_ctx, __ATOMIC_ACQUIRE);
 
-    return publish_json(URL, curl_data);
+    return mf_publisher_get_dropped(NULL) + staging_dropped(ctx);
 }
 
 /*******************************************************************************
@@ -243,7 +2032,46 @@ mf_api_update(mf_metric* metric)
 void
 mf_api_clear()
 {
-    memset(&status, 0, sizeof(status));
+    pthread_mutex_lock(&default_ctx_lock);
+    mf_ctx_free(default_ctx);
+    __atomic_store_n(&default_ctx, NULL, __ATOMIC_RELEASE);
+    /* the default publisher outlives the context */
+    mf_publisher_abort_after(NULL, -1);
+    pthread_mutex_unlock(&default_ctx_lock);
+    mf_log_stop();
+}
+
+/*******************************************************************************
+ * mf_api_set_log_level
+ ******************************************************************************/
+
+void
+mf_api_set_log_level(int level)
+{
+    mf_log_set_level(level);
+}
+
+/*******************************************************************************
+ * mf_ctx_set_shutdown_timeout
+ ******************************************************************************/
+
+void
+mf_ctx_set_shutdown_timeout(mf_ctx* ctx, long timeout_ms)
+{
+    ctx->shutdown_timeout_ms = (timeout_ms >= 0) ? timeout_ms : 0;
+}
+
+/*******************************************************************************
+ * mf_api_set_shutdown_timeout
+ ******************************************************************************/
+
+void
+mf_api_set_shutdown_timeout(long timeout_ms)
+{
+    mf_ctx* ctx = get_default_ctx();
+    if (ctx != NULL) {
+        mf_ctx_set_shutdown_timeout(ctx, timeout_ms);
+    }
 }
 
 /*******************************************************************************
@@ -270,7 +2098,7 @@ get_fully_qualified_domain_name(char *fqdn)
 
     int gai_result;
 
-    char *hostname = (char *)malloc(sizeof(char) * 80);
+    char hostname[80];
     gethostname(hostname, sizeof hostname);
 
     memset(&hints, 0, sizeof hints);
@@ -278,7 +2106,7 @@ get_fully_qualified_domain_name(char *fqdn)
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_CANONNAME;
 
-    if ((gai_result = getaddrinfo(hostname, "http", &hints, &info)) != 1) {
+    if ((gai_result = getaddrinfo(hostname, "http", &hints, &info)) != 0) {
         FILE *tmp = NULL;
         if ((tmp = popen("hostname", "r")) == NULL ) {
             perror("popen");
@@ -287,14 +2115,14 @@ get_fully_qualified_domain_name(char *fqdn)
         char line[200];
         while (fgets(line, 200, tmp) != NULL )
             sprintf(fqdn, "%s", line);
+        pclose(tmp);
         return 1;
     }
     for (p = info; p != NULL ; p = p->ai_next) {
         sprintf(fqdn, "%s\n", p->ai_canonname);
     }
 
-    if (info->ai_canonname)
-        freeaddrinfo(info);
+    freeaddrinfo(info);
 
     return 1;
 }
@@ -321,7 +2149,7 @@ get_time_as_string(char* timestamp, const char* format, int in_milliseconds)
     char buf[64];
     struct timeval tv;
     time_t current_time;
-    struct tm *tm;
+    struct tm tm;
     int cut_of = 0;
     if (in_milliseconds) {
         cut_of = 3;
@@ -331,9 +2159,9 @@ get_time_as_string(char* timestamp, const char* format, int in_milliseconds)
     current_time = tv.tv_sec;
 
     /* get timestamp */
-    if((tm = localtime(&current_time)) != NULL) {
+    if(localtime_r(&current_time, &tm) != NULL) {
         // yyyy-MM-dd’T'HH:mm:ss.SSS
-        strftime(fmt, sizeof fmt, "%Y-%m-%dT%H:%M:%S.%%6u", tm);
+        strftime(fmt, sizeof fmt, "%Y-%m-%dT%H:%M:%S.%%6u", &tm);
         snprintf(buf, sizeof buf, fmt, tv.tv_usec);
     }
 
@@ -349,6 +2177,18 @@ get_time_as_string(char* timestamp, const char* format, int in_milliseconds)
     }
 }
 
+/*******************************************************************************
+ * mf_api_get_time_ms
+ ******************************************************************************/
+
+long long
+mf_api_get_time_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 /*******************************************************************************
  * mf_api_get_time
  ******************************************************************************/
@@ -356,7 +2196,8 @@ get_time_as_string(char* timestamp, const char* format, int in_milliseconds)
 char*
 mf_api_get_time()
 {
-    char* timestamp = (char *)malloc(sizeof(char) * 64);
+    static __thread char timestamp[64];
+
     get_time_as_string(timestamp, "%Y-%m-%dT%H:%M:%S.%%6u", 1);
     debug("TIMESTAMP: %s", timestamp);
     return timestamp;
@@ -16,9 +16,46 @@
 #ifndef MF_API_H_
 #define MF_API_H_
 
+#include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MF_FORMAT_JSON    0 /* application/json */
+#define MF_FORMAT_MSGPACK 1 /* application/msgpack */
+
+#define MF_WATCH_INT    0 /* int */
+#define MF_WATCH_LONG   1 /* long */
+#define MF_WATCH_ULONG  2 /* unsigned long */
+#define MF_WATCH_FLOAT  3 /* float */
+#define MF_WATCH_DOUBLE 4 /* double */
+
+#define MF_HIST_PERCENTILES 1 /* send p50, p90, p99 and p99.9 */
+#define MF_HIST_BUCKETS     2 /* send the non-empty buckets */
+
+#define MF_SUPPRESS_NONE     0 /* send every sample */
+#define MF_SUPPRESS_CHANGE   1 /* send only changed values */
+#define MF_SUPPRESS_ABSOLUTE 2 /* send only changes larger than the deadband */
+#define MF_SUPPRESS_RELATIVE 3 /* same, relative to the value sent last */
+
+#define MF_BACKPRESSURE_BLOCK       0 /* wait for room, up to a timeout */
+#define MF_BACKPRESSURE_DROP_NEWEST 1 /* drop the metric being reported */
+#define MF_BACKPRESSURE_DROP_OLDEST 2 /* drop the oldest staged metrics */
+#define MF_BACKPRESSURE_DOWNSAMPLE  3 /* keep every n-th sample per metric */
+
+#define MF_PRIORITY_NORMAL 0 /* staged and batched with the bulk traffic */
+#define MF_PRIORITY_HIGH   1 /* sent right away on a separate connection */
+#define MF_PRIORITY_TYPES  16 /* types with a priority per context */
+
+#define MF_LOG_ERROR 0 /* failures only */
+#define MF_LOG_WARN  1 /* and recoverable problems (default) */
+#define MF_LOG_INFO  2 /* and notable events */
+#define MF_LOG_DEBUG 3 /* and every request, with libcurl's verbose output */
 
 typedef struct mf_metric_t mf_metric;
+typedef struct mf_ctx_t mf_ctx;
+typedef struct mf_histogram_t mf_histogram;
 
 struct mf_metric_t {
     const char* timestamp; /* YYYY-MM-ddTHH:MM:SS.ZZZ */
@@ -27,6 +64,19 @@ struct mf_metric_t {
     const char* value;     /* value of the metric in question */
 };// mf_metric_t;
 
+/** @brief Receives one record read back from the monitoring server.
+ *
+ * The record is passed as count key/value strings, which are only valid during
+ * the call. Keys of nested objects are flattened into dotted paths. Return 0
+ * to continue, or non-zero to stop reading.
+ */
+typedef int (*mf_query_callback)(
+    const char** keys,
+    const char** values,
+    size_t count,
+    void* user_data
+);
+
 /** @brief Registers a new user and experiment.
  *
  * This function registers both the given username at the monitoring server, as
@@ -55,10 +105,350 @@ const char* mf_api_new(
  *
  * @param metric representation of metric data including a timestamp
  *
- * @return the response from the monitoring server in JSON format
+ * @return the response from the monitoring server in JSON format, which is
+ *         owned by the API and valid until the next request; an empty
+ *         string if the metric was staged (see mf_api_set_staging()) or
+ *         suppressed (see mf_api_suppress())
  */
 char* mf_api_update(mf_metric* metric);
 
+/** @brief Sends several metrics to the monitoring server in one request.
+ *
+ * The metrics are sent as a single array of documents, which saves one round
+ * trip per metric compared to calling mf_api_update() repeatedly. Metrics
+ * without timestamp are stamped with the current time.
+ *
+ * @param metrics array of metric data
+ * @param count number of elements in metrics
+ *
+ * @return the response from the monitoring server in JSON format; an empty
+ *         string if all metrics were suppressed (see mf_api_suppress())
+ */
+char* mf_api_update_batch(mf_metric* metrics, size_t count);
+
+/** @brief Sends numeric samples of a single metric in compressed form.
+ *
+ * Instead of one document per sample, host, task, type and name are sent
+ * only once, while timestamps and values are compressed column-wise
+ * (delta-of-delta and XOR encoding as in Gorilla). For samples taken at a
+ * fixed rate this reduces the upload size by more than an order of magnitude.
+ *
+ * @param type type of the metric, e.g. PAPI-C, energy or progress
+ * @param name name of the metric
+ * @param timestamps sample times in milliseconds since the epoch
+ * @param values sample values
+ * @param count number of samples
+ *
+ * @return the response from the monitoring server in JSON format
+ */
+char* mf_api_update_series(
+    const char* type,
+    const char* name,
+    const long long* timestamps,
+    const double* values,
+    size_t count
+);
+
+/** @brief Sends many metrics of the same type as one wide document.
+ *
+ * Instead of one document per metric, a snapshot holds all given metrics as
+ * fields of a single document with a common timestamp, e.g. all counters of a
+ * sampler taken at the same tick.
+ *
+ * @param type type of the metrics, e.g. PAPI-C, energy or progress
+ * @param names names of the metrics
+ * @param values values of the metrics
+ * @param count number of metrics
+ *
+ * @return the response from the monitoring server in JSON format; an empty
+ *         string if all metrics were suppressed (see mf_api_suppress())
+ */
+char* mf_api_update_snapshot(
+    const char* type,
+    const char** names,
+    const char** values,
+    size_t count
+);
+
+/** @brief Stages metrics in per-thread buffers and sends them in batches.
+ *
+ * With staging enabled, mf_api_update() copies the metric into a buffer of
+ * the calling thread, without taking a lock, and returns immediately. A
+ * background thread merges the buffers of all threads into batches of up to
+ * batch_size metrics, which it sends as soon as a buffer is half full, and
+ * at the latest after max_age_ms. This allows many threads, e.g. of an
+ * OpenMP region, to report at the same time without contending.
+ *
+ * Call this function before the reporting threads start, or while none of
+ * them reports: the previous staging area is freed once its metrics are
+ * sent, and a thread still appending to it would touch freed memory. While
+ * staging is enabled, mf_api_update() is safe to call from any thread.
+ *
+ * @param batch_size maximum number of metrics per request; 0 sends the
+ *        staged metrics and disables staging
+ * @param max_age_ms maximum time a metric is staged
+ *
+ * @return 1 if successful; 0 otherwise
+ */
+int mf_api_set_staging(size_t batch_size, long max_age_ms);
+
+/** @brief Stages metrics with batch sizes and delays tuned automatically.
+ *
+ * Same as mf_api_set_staging(), but batch_size and max_age_ms are upper
+ * bounds only. The sender measures how long the server takes per request,
+ * and how many metrics are staged per millisecond; while the server is slow
+ * or the load is high, it sends fewer, larger batches for throughput, and
+ * while the server is fast and the application idle, it sends metrics within
+ * about one round trip for low latency.
+ *
+ * @param batch_size largest number of metrics per request, e.g. 4096
+ * @param max_age_ms longest time a metric is staged
+ *
+ * @return 1 if successful; 0 otherwise
+ */
+int mf_api_set_adaptive_staging(size_t batch_size, long max_age_ms);
+
+/** @brief Decides what happens when metrics are staged faster than sent.
+ *
+ * Each reporting thread stages up to 64 KB of metrics. If the server cannot
+ * keep up and the buffer of a thread is full, mf_api_update():
+ *
+ * - MF_BACKPRESSURE_BLOCK: waits until the metric fits, at most limit
+ *   milliseconds, and drops it then; a negative limit never drops (default)
+ * - MF_BACKPRESSURE_DROP_NEWEST: drops the metric and returns immediately
+ * - MF_BACKPRESSURE_DROP_OLDEST: drops the oldest staged metrics of the
+ *   thread to make room, so that the latest values are sent
+ * - MF_BACKPRESSURE_DOWNSAMPLE: once the buffer is half full, stages only
+ *   every limit-th sample of each metric, and drops the newest if it is full
+ *
+ * The first policy never loses data; the others never slow the application
+ * down. Dropped metrics are counted by mf_api_get_dropped(), and the count
+ * is sent along with the next batch as the metric "staging_dropped" of type
+ * "mf_api". The policy applies to staged metrics only (see
+ * mf_api_set_staging()), and can be set before or after enabling staging.
+ *
+ * @param policy one of MF_BACKPRESSURE_*
+ * @param limit timeout in ms or downsampling factor, depending on the policy
+ */
+void mf_api_set_backpressure(int policy, long limit);
+
+/** @brief Sends metrics of the given type ahead of the bulk traffic.
+ *
+ * Metrics of a type with MF_PRIORITY_HIGH, e.g. alerts or job state, bypass
+ * the staging and batches of mf_api_update() and mf_api_update_batch(): they
+ * go through a small queue of their own, which a separate thread sends
+ * immediately over its own connection, so they neither wait for a batch to
+ * fill nor for a slow request of the bulk traffic to finish. Metrics of all
+ * other types keep being batched.
+ *
+ * The queue and the connection are created when the first type is set. Up
+ * to MF_PRIORITY_TYPES types can be set; setting a type again changes its
+ * priority.
+ *
+ * @param type type of the metrics, e.g. alert
+ * @param priority one of MF_PRIORITY_*
+ *
+ * @return 1 if successful; 0 otherwise
+ */
+int mf_api_set_priority(const char* type, int priority);
+
+/** @brief Sends all staged metrics.
+ *
+ * Metrics staged by other threads are included if these threads finished
+ * staging before, e.g. because they were joined.
+ */
+void mf_api_flush();
+
+/** @brief Samples a variable of the application at a fixed interval.
+ *
+ * Registers the variable at addr, e.g. a progress counter or residual of a
+ * solver. A sampler thread reads all watched variables every interval (see
+ * mf_api_set_watch_interval()) and sends their values as one batch, so the
+ * code updating the variables does not need to call the API at all.
+ *
+ * The variable must stay valid until mf_api_unwatch() or mf_api_clear() is
+ * called. It is read without synchronization, which is safe for naturally
+ * aligned variables of the supported kinds.
+ *
+ * @param name name of the metric
+ * @param type type of the metric, e.g. progress
+ * @param addr address of the variable
+ * @param kind one of MF_WATCH_INT, MF_WATCH_LONG, MF_WATCH_ULONG,
+ *        MF_WATCH_FLOAT or MF_WATCH_DOUBLE
+ *
+ * @return 1 if successful; 0 otherwise
+ */
+int mf_api_watch(
+    const char* name,
+    const char* type,
+    const volatile void* addr,
+    int kind
+);
+
+/** @brief Stops sampling the variable at addr.
+ *
+ * @return 1 if the variable was watched; 0 otherwise
+ */
+int mf_api_unwatch(const volatile void* addr);
+
+/** @brief Sets the interval at which watched variables are sampled.
+ *
+ * @param interval_ms sampling interval; 1000 ms by default
+ */
+void mf_api_set_watch_interval(long interval_ms);
+
+/** @brief Samples the energy counters of the node (RAPL via powercap).
+ *
+ * Discovers the powercap zones below root, e.g. the packages and their
+ * cores and DRAM, and starts a thread that reads their energy counters
+ * every interval. Each sample is sent as one batch with two metrics of
+ * type "energy" per zone: "<zone>_energy", the energy consumed since the
+ * start in J, and "<zone>_power", the average power since the previous
+ * sample in W, e.g. package-0_power. Counter wraparound is accounted for.
+ *
+ * Calling this function again restarts sampling. The counters are
+ * readable by root only on many systems; zones that cannot be read are
+ * skipped.
+ *
+ * @param root directory of the zones; NULL for /sys/class/powercap
+ * @param interval_ms sampling interval; 0 for 1000 ms, negative to stop
+ *
+ * @return the number of zones sampled; 0 if none could be read
+ */
+int mf_api_sample_energy(const char* root, long interval_ms);
+
+/** @brief Creates a histogram metric, e.g. of request latencies.
+ *
+ * Instead of sending every value, values are counted in log-linear buckets
+ * with a relative width of at most 1/32 (see mf_histogram.h). At every
+ * sampling interval (see mf_api_set_watch_interval()) and on
+ * mf_api_hist_flush(), the histograms of all threads are merged, and a
+ * document with the count, sum, min and max of the values recorded since
+ * the last upload, plus the percentiles and/or the buckets, is sent.
+ *
+ * The histogram is freed by mf_api_clear().
+ *
+ * @param type type of the metric, e.g. latency
+ * @param name name of the metric, e.g. request_us
+ * @param flags MF_HIST_PERCENTILES and/or MF_HIST_BUCKETS
+ *
+ * @return the histogram; NULL if out of resources
+ */
+mf_histogram* mf_api_hist_new(const char* type, const char* name, int flags);
+
+/** @brief Records a value in a histogram.
+ *
+ * Safe to call from any thread without locking: each thread counts into a
+ * histogram of its own, which costs a few instructions per value.
+ *
+ * @param histogram histogram created by mf_api_hist_new()
+ * @param value the value, e.g. a latency in microseconds
+ */
+void mf_api_hist_record(mf_histogram* histogram, unsigned long long value);
+
+/** @brief Sends the values recorded in all histograms since the last upload.
+ *
+ * @return 1 if successful or there was nothing to send; 0 otherwise
+ */
+int mf_api_hist_flush();
+
+/** @brief Suppresses samples of a metric that carry no new information.
+ *
+ * Many metrics, e.g. temperatures, memory used or progress, stay constant
+ * for long periods. With MF_SUPPRESS_CHANGE, a sample of the metric is only
+ * sent if its value differs from the value sent last; with
+ * MF_SUPPRESS_ABSOLUTE or MF_SUPPRESS_RELATIVE, only if it moved by more than
+ * deadband, or by more than deadband times the value sent last. A sample is
+ * sent regardless once heartbeat_ms passed since the last one, so the metric
+ * never goes silent. MF_SUPPRESS_NONE sends every sample again.
+ *
+ * Applies to mf_api_update(), mf_api_update_batch(), mf_api_update_snapshot()
+ * and watched variables. Suppressed samples are dropped before they are
+ * staged or encoded. Values that are not numbers are compared as strings.
+ *
+ * @param type type of the metric
+ * @param name name of the metric
+ * @param mode one of MF_SUPPRESS_*
+ * @param deadband minimum change of a sample that is sent
+ * @param heartbeat_ms maximum time between two samples sent; 0 for none
+ *
+ * @return 1 if successful; 0 otherwise
+ */
+int mf_api_suppress(
+    const char* type,
+    const char* name,
+    int mode,
+    double deadband,
+    long heartbeat_ms
+);
+
+/** @brief Returns the number of samples suppressed so far. */
+unsigned long mf_api_get_suppressed();
+
+/** @brief Selects the encoding of metric documents sent to the server.
+ *
+ * MF_FORMAT_MSGPACK sends metric documents and batches as MessagePack, which
+ * is smaller and cheaper to produce than JSON. The format is announced in the
+ * Content-Type header; if the server rejects it with 415 Unsupported Media
+ * Type, the API falls back to MF_FORMAT_JSON for all further requests.
+ *
+ * @param format MF_FORMAT_JSON (default) or MF_FORMAT_MSGPACK
+ */
+void mf_api_set_format(int format);
+
+/** @brief Writes metrics straight to an Elasticsearch _bulk endpoint.
+ *
+ * The monitoring server stores metric documents in Elasticsearch one by
+ * one. With a bulk endpoint set, mf_api_update() and mf_api_update_batch(),
+ * including staged, watched and high-priority metrics, send their metrics
+ * directly to the endpoint instead, as one _bulk request (NDJSON) per batch.
+ * Every document carries the experiment ID in the field "@experiment_id".
+ * Time series and histograms are still sent to the monitoring server, which
+ * is also needed to register the experiment.
+ *
+ * Call this function after mf_api_new() and before the reporting threads
+ * start. A _bulk response reporting an error fails the request.
+ *
+ * @param url URL of the endpoint, e.g. http://localhost:9200/_bulk; NULL
+ *        sends to the monitoring server again
+ * @param index index the documents are written to; NULL for the user
+ *
+ * @return 1 if successful; 0 otherwise
+ */
+int mf_api_set_bulk_endpoint(const char* url, const char* index);
+
+/** @brief Reads a resource of the monitoring server record by record.
+ *
+ * This function sends a GET request to the given resource and passes every
+ * record of the JSON response to the callback while the response is still
+ * arriving. Memory use is bounded by the size of the largest record, so that
+ * responses with millions of metrics can be processed. The request uses a
+ * connection of its own, so the callback may report metrics meanwhile.
+ *
+ * @param resource path relative to the server, e.g. v1/mf/profiles/user/app
+ * @param callback function invoked for every record
+ * @param user_data passed to the callback
+ *
+ * @return 1 if the whole response was processed; 0 otherwise
+ */
+int mf_api_query(
+    const char* resource,
+    mf_query_callback callback,
+    void* user_data
+);
+
+/** @brief Reads back the metrics of the current experiment.
+ *
+ * Convenience wrapper of mf_api_query() for the profile of the user,
+ * application and experiment set by mf_api_new().
+ *
+ * @param callback function invoked for every metric document
+ * @param user_data passed to the callback
+ *
+ * @return 1 if all metrics were processed; 0 otherwise
+ */
+int mf_api_query_metrics(mf_query_callback callback, void* user_data);
+
 /** @brief Adds a new user to the database.
  *
  * This function adds a new user to the monitoring server.
@@ -79,6 +469,18 @@ char* mf_api_add_user(char* username);
  */
 char* mf_api_new_experiment(char* json);
 
+/** @brief Returns the body of the last response from the monitoring server.
+ *
+ * The returned memory is owned by the API and reused by the next request, so
+ * the view is valid until then. It grows with the largest response seen, so
+ * that large responses do not need an allocation per request.
+ *
+ * @param size set to the length of the response in bytes, if not NULL
+ *
+ * @return the response body, '\0'-terminated
+ */
+const char* mf_api_get_response(size_t* size);
+
 /** @brief Returns the current monitoring server.
  *
  * @return current monitoring server URL
@@ -109,22 +511,297 @@ const char* mf_api_get_job_id();
  */
 const char* mf_api_get_id();
 
-/** @brief Clears the internal data structures.
+/** @brief Bounds the time spent sending a single request.
+ *
+ * Calls that talk to the monitoring server never take longer than deadline_ms
+ * milliseconds, including all retries. Defaults are 2000 ms for connecting
+ * and 10000 ms in total; 0 disables a limit.
+ *
+ * @param connect_timeout_ms upper bound for establishing a connection
+ * @param deadline_ms upper bound for the whole call
+ */
+void mf_api_set_timeouts(long connect_timeout_ms, long deadline_ms);
+
+/** @brief Configures retries of failed requests.
+ *
+ * Failed requests are retried with jittered exponential backoff as long as
+ * the deadline set by mf_api_set_timeouts() permits. Defaults are 3 retries,
+ * 100 ms base and 2000 ms maximum backoff.
  *
- * This method clears the internal data structures. It should be used at the
- * end of all operations in a program.
+ * @param max_retries maximum number of retries per request
+ * @param backoff_base_ms backoff before the first retry
+ * @param backoff_max_ms upper bound for a single backoff pause
+ */
+void mf_api_set_retries(int max_retries, long backoff_base_ms, long backoff_max_ms);
+
+/** @brief Compresses request bodies with gzip.
+ *
+ * Batches and series of repetitive metric documents typically shrink to a
+ * fifth or less, at the cost of CPU time in the reporting thread (see
+ * bench/bench_compression.c). Bodies smaller than min_size bytes are sent
+ * uncompressed. Compression is off by default, and is turned off again if
+ * the server rejects compressed bodies.
+ *
+ * @param level 1 (fastest) to 9 (smallest); 0 disables compression
+ * @param min_size smallest body that gets compressed, e.g. 1024
+ */
+void mf_api_set_compression(int level, size_t min_size);
+
+/** @brief Configures the circuit breaker.
+ *
+ * While the monitoring server is known to be down, metric data is not sent but
+ * appended to a spool file (one JSON document per line), or dropped if no
+ * spool file is given. Defaults are 5 failures and 30000 ms. Updates sent
+ * directly meanwhile return NULL.
+ *
+ * @param failure_threshold consecutive failures that open the circuit
+ * @param open_ms time until the server is probed again
+ * @param spool_path file for undeliverable data, or NULL
+ */
+void mf_api_set_circuit_breaker(
+    int failure_threshold,
+    long open_ms,
+    const char* spool_path
+);
+
+/** @brief Returns the number of metric documents dropped so far.
+ *
+ * Counts the documents the circuit breaker could not spool, and the metrics
+ * dropped by the backpressure policy (see mf_api_set_backpressure()).
+ *
+ * @return number of dropped documents
+ */
+unsigned long mf_api_get_dropped();
+
+/** @brief Sends pending data and clears the internal data structures.
+ *
+ * This method sends the metrics still staged, the histograms and any
+ * request in progress, but spends at most the shutdown timeout doing so
+ * (see mf_api_set_shutdown_timeout()); data that cannot be sent in time is
+ * spooled or dropped like after a failed request. Afterwards, it frees the
+ * state set up by mf_api_new() and stops the thread writing the log.
+ *
+ * It should be used at the end of all operations in a program, after the
+ * threads reporting metrics have finished. If it is not called, it runs
+ * automatically when the process exits.
  */
 void mf_api_clear();
 
+/** @brief Bounds the time mf_api_clear() may spend sending pending data.
+ *
+ * This bounds in particular how long the exit of the process may be delayed
+ * by an unreachable monitoring server. The default is 2000 ms.
+ *
+ * @param timeout_ms upper bound for sending pending data
+ */
+void mf_api_set_shutdown_timeout(long timeout_ms);
+
+/** @brief Selects the diagnostic messages the library writes to stderr.
+ *
+ * Messages are recorded in binary into a ring buffer, without formatting,
+ * and written by a background thread, so that enabled messages cost little
+ * and disabled ones nothing but a comparison. The level applies to the
+ * whole process; it can also be set by the environment variable
+ * MF_LOG_LEVEL (error, warn, info or debug).
+ *
+ * @param level one of MF_LOG_*; MF_LOG_WARN by default
+ */
+void mf_api_set_log_level(int level);
+
+/** @brief Registers a new user and experiment in a context of its own.
+ *
+ * The mf_api_* functions share a single default context. A context created
+ * by this function instead has its own experiment, connection, buffers and
+ * send policy, so that several experiments can be reported at once, and
+ * several threads can report concurrently without locking, one context per
+ * thread. A context must not be used by two threads at the same time.
+ *
+ * The parameters are the same as for mf_api_new().
+ *
+ * @return the new context; NULL if the registration failed
+ */
+mf_ctx* mf_ctx_new(
+    const char* server,
+    const char* user,
+    const char* application,
+    const char* experiment_id,
+    const char* job_id
+);
+
+/** @brief Sends pending data, closes the connection and frees the context.
+ *
+ * Like mf_api_clear(), it spends at most the shutdown timeout of the context
+ * sending pending data. Contexts are not freed automatically at exit.
+ *
+ * @param ctx the context; may be NULL
+ */
+void mf_ctx_free(mf_ctx* ctx);
+
+/** @brief Same as mf_api_set_shutdown_timeout(), for the given context. */
+void mf_ctx_set_shutdown_timeout(mf_ctx* ctx, long timeout_ms);
+
+/** @brief Same as mf_api_update(), sent via the given context. */
+char* mf_ctx_update(mf_ctx* ctx, mf_metric* metric);
+
+/** @brief Same as mf_api_update_batch(), sent via the given context. */
+char* mf_ctx_update_batch(mf_ctx* ctx, mf_metric* metrics, size_t count);
+
+/** @brief Same as mf_api_update_series(), sent via the given context. */
+char* mf_ctx_update_series(
+    mf_ctx* ctx,
+    const char* type,
+    const char* name,
+    const long long* timestamps,
+    const double* values,
+    size_t count
+);
+
+/** @brief Same as mf_api_update_snapshot(), sent via the given context. */
+char* mf_ctx_update_snapshot(
+    mf_ctx* ctx,
+    const char* type,
+    const char** names,
+    const char** values,
+    size_t count
+);
+
+/** @brief Same as mf_api_set_staging(), for the given context only. */
+int mf_ctx_set_staging(mf_ctx* ctx, size_t batch_size, long max_age_ms);
+
+/** @brief Same as mf_api_set_adaptive_staging(), for the given context only. */
+int mf_ctx_set_adaptive_staging(mf_ctx* ctx, size_t batch_size, long max_age_ms);
+
+/** @brief Same as mf_api_set_backpressure(), for the given context only. */
+void mf_ctx_set_backpressure(mf_ctx* ctx, int policy, long limit);
+
+/** @brief Same as mf_api_set_priority(), for the given context only. */
+int mf_ctx_set_priority(mf_ctx* ctx, const char* type, int priority);
+
+/** @brief Same as mf_api_flush(), for the given context only. */
+void mf_ctx_flush(mf_ctx* ctx);
+
+/** @brief Same as mf_api_watch(), sampled into the given context. */
+int mf_ctx_watch(
+    mf_ctx* ctx,
+    const char* name,
+    const char* type,
+    const volatile void* addr,
+    int kind
+);
+
+/** @brief Same as mf_api_unwatch(), for the given context. */
+int mf_ctx_unwatch(mf_ctx* ctx, const volatile void* addr);
+
+/** @brief Same as mf_api_set_watch_interval(), for the given context. */
+void mf_ctx_set_watch_interval(mf_ctx* ctx, long interval_ms);
+
+/** @brief Same as mf_api_sample_energy(), sampled into the given context. */
+int mf_ctx_sample_energy(mf_ctx* ctx, const char* root, long interval_ms);
+
+/** @brief Same as mf_api_hist_new(), uploaded via the given context. */
+mf_histogram* mf_ctx_hist_new(
+    mf_ctx* ctx,
+    const char* type,
+    const char* name,
+    int flags
+);
+
+/** @brief Same as mf_api_hist_flush(), for the histograms of the context. */
+int mf_ctx_hist_flush(mf_ctx* ctx);
+
+/** @brief Same as mf_api_suppress(), for the given context only. */
+int mf_ctx_suppress(
+    mf_ctx* ctx,
+    const char* type,
+    const char* name,
+    int mode,
+    double deadband,
+    long heartbeat_ms
+);
+
+/** @brief Returns the number of samples the context suppressed so far. */
+unsigned long mf_ctx_get_suppressed(mf_ctx* ctx);
+
+/** @brief Same as mf_api_set_format(), for the given context only. */
+void mf_ctx_set_format(mf_ctx* ctx, int format);
+
+/** @brief Same as mf_api_set_bulk_endpoint(), for the given context only. */
+int mf_ctx_set_bulk_endpoint(mf_ctx* ctx, const char* url, const char* index);
+
+/** @brief Same as mf_api_query(), read via the given context. */
+int mf_ctx_query(
+    mf_ctx* ctx,
+    const char* resource,
+    mf_query_callback callback,
+    void* user_data
+);
+
+/** @brief Same as mf_api_query_metrics(), for the experiment of the context. */
+int mf_ctx_query_metrics(mf_ctx* ctx, mf_query_callback callback, void* user_data);
+
+/** @brief Same as mf_api_get_response(), for the last request of the context. */
+const char* mf_ctx_get_response(mf_ctx* ctx, size_t* size);
+
+/** @brief Returns the monitoring server of the context. */
+const char* mf_ctx_get_server(mf_ctx* ctx);
+
+/** @brief Returns the user of the context. */
+const char* mf_ctx_get_user(mf_ctx* ctx);
+
+/** @brief Returns the application name of the context. */
+const char* mf_ctx_get_application(mf_ctx* ctx);
+
+/** @brief Returns the job id of the context. */
+const char* mf_ctx_get_job_id(mf_ctx* ctx);
+
+/** @brief Returns the experiment ID of the context. */
+const char* mf_ctx_get_id(mf_ctx* ctx);
+
+/** @brief Same as mf_api_set_timeouts(), for the given context only. */
+void mf_ctx_set_timeouts(mf_ctx* ctx, long connect_timeout_ms, long deadline_ms);
+
+/** @brief Same as mf_api_set_retries(), for the given context only. */
+void mf_ctx_set_retries(
+    mf_ctx* ctx,
+    int max_retries,
+    long backoff_base_ms,
+    long backoff_max_ms
+);
+
+/** @brief Same as mf_api_set_compression(), for the given context only. */
+void mf_ctx_set_compression(mf_ctx* ctx, int level, size_t min_size);
+
+/** @brief Same as mf_api_set_circuit_breaker(), for the given context only. */
+void mf_ctx_set_circuit_breaker(
+    mf_ctx* ctx,
+    int failure_threshold,
+    long open_ms,
+    const char* spool_path
+);
+
+/** @brief Returns the number of documents the context dropped so far. */
+unsigned long mf_ctx_get_dropped(mf_ctx* ctx);
+
 /** @brief Gets the current time formatted correctly for Elasticsearch.
  *
  * This function returns the current timestamp having the following pattern:
  * YYYY-MM-ddTHH:MM:SS.ZZZ
  *
- * @return current timestamp as a string
+ * @return current timestamp as a string, which is owned by the API and valid
+ *         until the next call in the same thread
  */
 char* mf_api_get_time();
 
+/** @brief Gets the current time in milliseconds since the epoch.
+ *
+ * This is the time base expected by mf_api_update_series().
+ *
+ * @return current time in milliseconds
+ */
+long long mf_api_get_time_ms();
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -0,0 +1,291 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Header-only C++17 interface to the monitoring API.
+ *
+ * Metric keys are constexpr objects built from string literals, so type and
+ * name are fixed at compile time and reporting a sample never builds a
+ * std::string. Values are passed as typed arguments and formatted into a
+ * buffer of the value; C strings are passed through as they are, while
+ * std::string and std::string_view values are copied once, since a view is
+ * not necessarily '\0'-terminated.
+ *
+ * \code{.cpp}
+ * constexpr mf::key iteration("progress", "iteration");
+ * constexpr mf::key solve("timing", "solve");
+ *
+ * mf::session session("http://localhost:3030", "user", "app");
+ * mf::update(iteration, 42);
+ * {
+ *     mf::region timing(solve);  // sends the elapsed seconds at scope exit
+ *     ...
+ * }
+ * \endcode
+ *
+ * The session and region objects are move-only, so a registration or a
+ * measurement is ended exactly once.
+ */
+
+#ifndef MF_API_HPP_
+#define MF_API_HPP_
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "mf_api.h"
+
+namespace mf {
+
+/**
+ * @brief Type and name of a metric, fixed at compile time.
+ */
+class key {
+public:
+    template <std::size_t T, std::size_t N>
+    constexpr key(const char (&type)[T], const char (&name)[N]) noexcept
+        : type_(type), name_(name)
+    {
+        static_assert(T > 1 && N > 1, "type and name must not be empty");
+    }
+
+    constexpr const char* type() const noexcept { return type_; }
+    constexpr const char* name() const noexcept { return name_; }
+
+private:
+    const char* type_;
+    const char* name_;
+};
+
+/**
+ * @brief Text of a metric value.
+ *
+ * Numbers are formatted into an inline buffer independently of the locale,
+ * i.e. integers in decimal and floating point numbers in the shortest text
+ * that reads them back exactly. C strings are referenced, not copied. The
+ * text of a std::string or std::string_view is copied, into the inline
+ * buffer if it fits and to the heap otherwise.
+ */
+class value {
+public:
+    value(const char* text) noexcept : text_(text) {}
+
+    template <typename S, typename = std::enable_if_t<
+        std::is_convertible_v<const S&, std::string_view> &&
+        !std::is_convertible_v<const S&, const char*>>>
+    value(const S& text)
+    {
+        std::string_view view(text);
+        char* copy = buffer_;
+
+        if (view.size() >= sizeof(buffer_)) {
+            heap_.reset(new char[view.size() + 1]);
+            copy = heap_.get();
+        }
+        std::memcpy(copy, view.data(), view.size());
+        copy[view.size()] = '\0';
+        text_ = copy;
+    }
+
+    template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>,
+        typename = void>
+    value(T number) noexcept : text_(buffer_)
+    {
+        if constexpr (std::is_same_v<T, bool>) {
+            text_ = number ? "1" : "0";
+        } else {
+            *std::to_chars(buffer_, buffer_ + sizeof(buffer_) - 1, number).ptr =
+                '\0';
+        }
+    }
+
+    value(const value&) = delete;
+    value& operator=(const value&) = delete;
+
+    const char* c_str() const noexcept { return text_; }
+
+private:
+    char buffer_[48];
+    std::unique_ptr<char[]> heap_;
+    const char* text_;
+};
+
+/**
+ * @brief Sends a sample of the metric, stamped with the current time.
+ *
+ * @return true if the sample was sent, staged or suppressed; false otherwise
+ */
+inline bool
+update(const key& metric_key, const value& sample) noexcept
+{
+    mf_metric metric = {
+        nullptr, metric_key.type(), metric_key.name(), sample.c_str()
+    };
+    return mf_api_update(&metric) != nullptr;
+}
+
+namespace detail {
+
+/* set while a session owns the registration of the process */
+inline std::atomic<bool> session_open{false};
+
+} // namespace detail
+
+/**
+ * @brief Registers at the monitoring server for the lifetime of the object.
+ *
+ * The constructor calls mf_api_new(), the destructor mf_api_clear(), which
+ * sends the metrics still staged. A moved-from session does nothing.
+ *
+ * Since the registration is global to the process, at most one session is
+ * open at a time; constructing another one fails while it is.
+ */
+class session {
+public:
+    session(
+        const char* server,
+        const char* user,
+        const char* application,
+        const char* experiment_id = nullptr,
+        const char* job_id = nullptr) noexcept
+        : open_(false)
+    {
+        if (detail::session_open.exchange(true)) {
+            return;
+        }
+        open_ = mf_api_new(server, user, application, experiment_id, job_id)
+            != nullptr;
+        if (!open_) {
+            detail::session_open.store(false);
+        }
+    }
+
+    session(session&& other) noexcept
+        : open_(std::exchange(other.open_, false))
+    {
+    }
+
+    session& operator=(session&& other) noexcept
+    {
+        if (this != &other) {
+            close();
+            open_ = std::exchange(other.open_, false);
+        }
+        return *this;
+    }
+
+    session(const session&) = delete;
+    session& operator=(const session&) = delete;
+
+    ~session() { close(); }
+
+    /** @brief Returns true if the registration succeeded. */
+    explicit operator bool() const noexcept { return open_; }
+
+    /** @brief Returns the experiment ID; nullptr if not registered. */
+    const char* id() const noexcept
+    {
+        return open_ ? mf_api_get_id() : nullptr;
+    }
+
+    /** @brief Ends the session before the end of the scope. */
+    void close() noexcept
+    {
+        if (open_) {
+            open_ = false;
+            mf_api_clear();
+            detail::session_open.store(false);
+        }
+    }
+
+private:
+    bool open_;
+};
+
+/**
+ * @brief Measures the time spent in a scope and sends it in seconds.
+ *
+ * The time is taken from a monotonic clock and sent once, by stop() or the
+ * destructor. A moved-from region sends nothing.
+ */
+class region {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit region(const key& metric_key) noexcept
+        : key_(metric_key), start_(clock::now()), running_(true)
+    {
+    }
+
+    region(region&& other) noexcept
+        : key_(other.key_), start_(other.start_),
+          running_(std::exchange(other.running_, false))
+    {
+    }
+
+    region& operator=(region&& other) noexcept
+    {
+        if (this != &other) {
+            stop();
+            key_ = other.key_;
+            start_ = other.start_;
+            running_ = std::exchange(other.running_, false);
+        }
+        return *this;
+    }
+
+    region(const region&) = delete;
+    region& operator=(const region&) = delete;
+
+    ~region() { stop(); }
+
+    /** @brief Returns the time elapsed since the start in seconds. */
+    double elapsed() const noexcept
+    {
+        return std::chrono::duration<double>(clock::now() - start_).count();
+    }
+
+    /**
+     * @brief Sends the elapsed time now instead of at the end of the scope.
+     *
+     * @return true if sent; false if the time was already sent or sending
+     *         failed
+     */
+    bool stop() noexcept
+    {
+        if (!running_) {
+            return false;
+        }
+        running_ = false;
+        return update(key_, elapsed());
+    }
+
+private:
+    key key_;
+    clock::time_point start_;
+    bool running_;
+};
+
+} // namespace mf
+
+#endif
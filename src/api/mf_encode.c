@@ -0,0 +1,196 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mf_encode.h"
+#include "contrib/mf_json.h"
+#include "contrib/mf_msgpack.h"
+
+#include <string.h>   /* strlen */
+
+/*******************************************************************************
+ * mf_encode_content_type
+ ******************************************************************************/
+
+const char*
+mf_encode_content_type(int format)
+{
+    if (format == MF_FORMAT_MSGPACK) {
+        return MF_MSGPACK_CONTENT_TYPE;
+    }
+    return "application/json";
+}
+
+/*******************************************************************************
+ * encode_json
+ ******************************************************************************/
+
+/*
+ * Appends the document of the metric, with the additional field
+ * "@experiment_id" unless experiment_id is NULL.
+ */
+static int
+encode_json_document(
+    mf_buffer* buffer,
+    const char* experiment_id,
+    const char* host,
+    const char* task,
+    const mf_metric* metric)
+{
+    return mf_buffer_append_str(buffer, "{\"@timestamp\":") &&
+        mf_json_string(buffer, metric->timestamp) &&
+        mf_buffer_append_str(buffer, ",\"host\":") &&
+        mf_json_string(buffer, host) &&
+        mf_buffer_append_str(buffer, ",\"task\":") &&
+        mf_json_string(buffer, task) &&
+        mf_buffer_append_str(buffer, ",\"type\":") &&
+        mf_json_string(buffer, metric->type) &&
+        mf_buffer_append_char(buffer, ',') &&
+        mf_json_string(buffer, metric->name) &&
+        mf_buffer_append_char(buffer, ':') &&
+        mf_json_string(buffer, metric->value) &&
+        (experiment_id == NULL ||
+            (mf_buffer_append_str(buffer, ",\"@experiment_id\":") &&
+             mf_json_string(buffer, experiment_id))) &&
+        mf_buffer_append_char(buffer, '}');
+}
+
+static int
+encode_json(
+    mf_buffer* buffer,
+    const char* host,
+    const char* task,
+    const mf_metric* metric)
+{
+    return encode_json_document(buffer, NULL, host, task, metric);
+}
+
+/*******************************************************************************
+ * encode_msgpack
+ ******************************************************************************/
+
+static int
+msgpack_string(mf_buffer* buffer, const char* str)
+{
+    if (str == NULL) {
+        return mf_msgpack_nil(buffer);
+    }
+    return mf_msgpack_str(buffer, str, strlen(str));
+}
+
+static int
+encode_msgpack(
+    mf_buffer* buffer,
+    const char* host,
+    const char* task,
+    const mf_metric* metric)
+{
+    return mf_msgpack_map(buffer, 5) &&
+        mf_msgpack_str(buffer, "@timestamp", 10) &&
+        msgpack_string(buffer, metric->timestamp) &&
+        mf_msgpack_str(buffer, "host", 4) &&
+        msgpack_string(buffer, host) &&
+        mf_msgpack_str(buffer, "task", 4) &&
+        msgpack_string(buffer, task) &&
+        mf_msgpack_str(buffer, "type", 4) &&
+        msgpack_string(buffer, metric->type) &&
+        msgpack_string(buffer, metric->name) &&
+        msgpack_string(buffer, metric->value);
+}
+
+/*******************************************************************************
+ * mf_encode_metric
+ ******************************************************************************/
+
+int
+mf_encode_metric(
+    mf_buffer* buffer,
+    int format,
+    const char* host,
+    const char* task,
+    const mf_metric* metric)
+{
+    if (format == MF_FORMAT_MSGPACK) {
+        return encode_msgpack(buffer, host, task, metric);
+    }
+    return encode_json(buffer, host, task, metric);
+}
+
+/*******************************************************************************
+ * mf_encode_batch
+ ******************************************************************************/
+
+int
+mf_encode_batch(
+    mf_buffer* buffer,
+    int format,
+    const char* host,
+    const char* task,
+    const mf_metric* metrics,
+    size_t count)
+{
+    size_t i;
+
+    if (format == MF_FORMAT_MSGPACK) {
+        if (!mf_msgpack_array(buffer, (uint32_t) count)) {
+            return 0;
+        }
+        for (i = 0; i < count; ++i) {
+            if (!encode_msgpack(buffer, host, task, &metrics[i])) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    if (!mf_buffer_append_char(buffer, '[')) {
+        return 0;
+    }
+    for (i = 0; i < count; ++i) {
+        if ((i > 0 && !mf_buffer_append_char(buffer, ',')) ||
+            !encode_json(buffer, host, task, &metrics[i])) {
+            return 0;
+        }
+    }
+    return mf_buffer_append_char(buffer, ']');
+}
+
+/*******************************************************************************
+ * mf_encode_bulk
+ ******************************************************************************/
+
+int
+mf_encode_bulk(
+    mf_buffer* buffer,
+    const char* index,
+    const char* experiment_id,
+    const char* host,
+    const char* task,
+    const mf_metric* metrics,
+    size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        if (!mf_buffer_append_str(buffer, "{\"index\":{\"_index\":") ||
+            !mf_json_string(buffer, index) ||
+            !mf_buffer_append_str(buffer, "}}\n") ||
+            !encode_json_document(buffer, experiment_id, host, task,
+                &metrics[i]) ||
+            !mf_buffer_append_char(buffer, '\n')) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Serialization of metric documents in the supported wire formats.
+ *
+ * A metric document carries the fields "@timestamp", "host", "task", "type"
+ * and one field named after the metric holding its value. A batch is an
+ * array of such documents. All functions append to the given buffer and
+ * return 1 if successful or 0 if out of memory.
+ */
+
+#ifndef MF_ENCODE_H_
+#define MF_ENCODE_H_
+
+#include <stddef.h>
+
+#include "mf_api.h"
+#include "contrib/mf_buffer.h"
+
+/* Content-Type of request bodies of the Elasticsearch _bulk API */
+#define MF_BULK_CONTENT_TYPE "application/x-ndjson"
+
+/**
+ * @brief Returns the Content-Type header value for the given format.
+ */
+const char* mf_encode_content_type(int format);
+
+/**
+ * @brief Appends a single metric document.
+ */
+int mf_encode_metric(
+    mf_buffer* buffer,
+    int format,
+    const char* host,
+    const char* task,
+    const mf_metric* metric
+);
+
+/**
+ * @brief Appends an array of count metric documents.
+ */
+int mf_encode_batch(
+    mf_buffer* buffer,
+    int format,
+    const char* host,
+    const char* task,
+    const mf_metric* metrics,
+    size_t count
+);
+
+/**
+ * @brief Appends count metric documents as a body of the Elasticsearch _bulk
+ * API: per metric, an action line indexing into the given index, and a line
+ * with the JSON document, which additionally carries the experiment ID in
+ * the field "@experiment_id".
+ */
+int mf_encode_bulk(
+    mf_buffer* buffer,
+    const char* index,
+    const char* experiment_id,
+    const char* host,
+    const char* task,
+    const mf_metric* metrics,
+    size_t count
+);
+
+#endif
@@ -0,0 +1,420 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mf_energy.h"
+#include "mf_sampler.h"
+#include "contrib/mf_debug.h"
+
+#include <dirent.h>   /* scandir */
+#include <errno.h>    /* errno */
+#include <fcntl.h>    /* open */
+#include <stdint.h>   /* uint64_t */
+#include <stdio.h>    /* snprintf */
+#include <stdlib.h>   /* malloc */
+#include <string.h>   /* strdup */
+#include <time.h>     /* clock_gettime */
+#include <unistd.h>   /* pread */
+
+/*******************************************************************************
+ * Variable Declarations
+ ******************************************************************************/
+
+#define VALUE_SIZE 32
+
+typedef struct zone_t {
+    char* id;          /* directory below the root, e.g. intel-rapl:0 */
+    char* name;        /* e.g. package-0 or package-0_core */
+    char* energy_name; /* <zone>_energy */
+    char* power_name;  /* <zone>_power */
+    int fd;            /* of energy_uj */
+    uint64_t range;    /* value at which the counter wraps; 0 if unknown */
+    uint64_t last;     /* counter at the previous sample */
+    double joules;     /* consumed since the start */
+    char energy[VALUE_SIZE];
+    char power[VALUE_SIZE];
+} zone;
+
+struct mf_energy_t {
+    mf_energy_cb callback;
+    void* user_data;
+
+    /* its lock is held while a sample is taken and sent */
+    mf_sampler sampler;
+
+    zone* zones;
+    size_t count;
+    mf_metric* metrics;
+    double last_sample;  /* time of the previous sample in s */
+};
+
+/*******************************************************************************
+ * Forward Declarations
+ ******************************************************************************/
+
+static void sample(void* arg);
+static void free_zones(mf_energy* energy);
+
+/*******************************************************************************
+ * now_s
+ ******************************************************************************/
+
+static double
+now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*******************************************************************************
+ * read_counter
+ ******************************************************************************/
+
+/*
+ * Reads a decimal counter from the start of the file, so that the same
+ * descriptor serves every sample.
+ */
+static int
+read_counter(int fd, uint64_t* value)
+{
+    char buffer[VALUE_SIZE];
+    char* end;
+
+    ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (n <= 0) {
+        return 0;
+    }
+    buffer[n] = '\0';
+
+    *value = strtoull(buffer, &end, 10);
+    return end != buffer;
+}
+
+/*******************************************************************************
+ * read_attribute
+ ******************************************************************************/
+
+/*
+ * Reads the first line of the attribute file of a zone into value, without
+ * the newline. Returns 1 if successful; 0 otherwise.
+ */
+static int
+read_attribute(
+    const char* root,
+    const char* id,
+    const char* attribute,
+    char* value,
+    size_t size)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s/%s", root, id, attribute);
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    int found = fgets(value, size, file) != NULL;
+    fclose(file);
+
+    if (found) {
+        value[strcspn(value, "\n")] = '\0';
+    }
+    return found;
+}
+
+/*******************************************************************************
+ * zone_name
+ ******************************************************************************/
+
+/*
+ * Names the zone after its parent, whose ID is its own without the last
+ * ":<n>", if the parent was found before (IDs are sorted).
+ */
+static void
+zone_name(mf_energy* energy, const char* id, const char* name,
+          char* full_name, size_t size)
+{
+    const char* colon = strrchr(id, ':');
+    size_t i;
+
+    for (i = 0; colon != NULL && i < energy->count; ++i) {
+        const char* parent = energy->zones[i].id;
+        if (strlen(parent) == (size_t) (colon - id) &&
+            strncmp(parent, id, colon - id) == 0) {
+            snprintf(full_name, size, "%s_%s", energy->zones[i].name, name);
+            return;
+        }
+    }
+    snprintf(full_name, size, "%s", name);
+}
+
+/*******************************************************************************
+ * add_zone
+ ******************************************************************************/
+
+/*
+ * Adds the zone with the given ID if it has a readable energy counter.
+ * Returns 0 only if out of memory.
+ */
+static int
+add_zone(mf_energy* energy, const char* root, const char* id)
+{
+    char path[512];
+    char name[128];
+    char full_name[256];
+    char range[VALUE_SIZE];
+    zone z;
+
+    memset(&z, 0, sizeof(zone));
+    snprintf(path, sizeof(path), "%s/%s/energy_uj", root, id);
+    z.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (z.fd < 0) {
+        if (errno != ENOENT && errno != ENOTDIR) {
+            log_warn("cannot read energy of zone %s (%s)", id, strerror(errno));
+        }
+        return 1;
+    }
+    if (!read_counter(z.fd, &z.last)) {
+        log_warn("cannot read energy of zone %s (%s)", id, "no counter");
+        close(z.fd);
+        return 1;
+    }
+    if (read_attribute(root, id, "max_energy_range_uj", range, sizeof(range))) {
+        z.range = strtoull(range, NULL, 10);
+    }
+    if (!read_attribute(root, id, "name", name, sizeof(name))) {
+        snprintf(name, sizeof(name), "%s", id);
+    }
+
+    zone_name(energy, id, name, full_name, sizeof(full_name));
+    z.id = strdup(id);
+    z.name = strdup(full_name);
+    z.energy_name = malloc(strlen(full_name) + 8);
+    z.power_name = malloc(strlen(full_name) + 7);
+    if (z.id == NULL || z.name == NULL || z.energy_name == NULL ||
+        z.power_name == NULL) {
+        free(z.id);
+        free(z.name);
+        free(z.energy_name);
+        free(z.power_name);
+        close(z.fd);
+        return 0;
+    }
+    sprintf(z.energy_name, "%s_energy", full_name);
+    sprintf(z.power_name, "%s_power", full_name);
+
+    energy->zones[energy->count++] = z;
+    debug("energy: zone %s (%s)", id, full_name);
+
+    return 1;
+}
+
+/*******************************************************************************
+ * discover
+ ******************************************************************************/
+
+/*
+ * Adds every entry of the root with an energy counter. The control types,
+ * e.g. intel-rapl, have none and are skipped.
+ */
+static int
+discover(mf_energy* energy, const char* root)
+{
+    struct dirent** entries;
+    int result = 1;
+    int n;
+    int i;
+
+    n = scandir(root, &entries, NULL, alphasort);
+    if (n < 0) {
+        log_warn("cannot list energy zones in %s (%s)", root, strerror(errno));
+        return 0;
+    }
+
+    energy->zones = (zone*) calloc(n > 0 ? n : 1, sizeof(zone));
+    energy->metrics = (mf_metric*) calloc(n > 0 ? 2 * n : 1, sizeof(mf_metric));
+    result = energy->zones != NULL && energy->metrics != NULL;
+
+    for (i = 0; i < n; ++i) {
+        if (result && entries[i]->d_name[0] != '.') {
+            result = add_zone(energy, root, entries[i]->d_name);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    if (result && energy->count == 0) {
+        log_warn("no readable energy counters in %s", root);
+    }
+    return result && energy->count > 0;
+}
+
+/*******************************************************************************
+ * mf_energy_new
+ ******************************************************************************/
+
+mf_energy*
+mf_energy_new(
+    const char* root,
+    long interval_ms,
+    mf_energy_cb callback,
+    void* user_data)
+{
+    mf_energy* energy = (mf_energy*) calloc(1, sizeof(mf_energy));
+    if (energy == NULL) {
+        log_error("cannot allocate energy sampler (%zu bytes)", sizeof(mf_energy));
+        return NULL;
+    }
+
+    if (root == NULL) {
+        root = MF_ENERGY_ROOT;
+    }
+    if (!discover(energy, root)) {
+        free_zones(energy);
+        free(energy);
+        return NULL;
+    }
+
+    energy->callback = callback;
+    energy->user_data = user_data;
+    energy->last_sample = now_s();
+
+    if (!mf_sampler_start(&energy->sampler, "energy",
+            (interval_ms > 0) ? interval_ms : MF_ENERGY_INTERVAL_MS,
+            sample, energy)) {
+        free_zones(energy);
+        free(energy);
+        return NULL;
+    }
+
+    return energy;
+}
+
+/*******************************************************************************
+ * mf_energy_zones
+ ******************************************************************************/
+
+size_t
+mf_energy_zones(mf_energy* energy)
+{
+    return energy->count;
+}
+
+/*******************************************************************************
+ * sample
+ ******************************************************************************/
+
+/*
+ * Must be called with the lock held. A counter below its previous value has
+ * wrapped at its range; zones without a known range are assumed to have
+ * restarted from zero.
+ */
+static void
+sample(void* arg)
+{
+    mf_energy* energy = (mf_energy*) arg;
+    double now = now_s();
+    double elapsed = now - energy->last_sample;
+    size_t n = 0;
+    size_t i;
+
+    for (i = 0; i < energy->count; ++i) {
+        zone* z = &energy->zones[i];
+        uint64_t counter;
+        uint64_t delta;
+
+        if (!read_counter(z->fd, &counter)) {
+            continue;
+        }
+        if (counter >= z->last) {
+            delta = counter - z->last;
+        } else if (z->range > z->last) {
+            delta = z->range - z->last + counter;
+        } else {
+            delta = counter;
+        }
+        z->last = counter;
+        z->joules += delta * 1e-6;
+
+        snprintf(z->energy, VALUE_SIZE, "%.6f", z->joules);
+        snprintf(z->power, VALUE_SIZE, "%.3f",
+            (elapsed > 0) ? delta * 1e-6 / elapsed : 0.0);
+
+        energy->metrics[n].timestamp = NULL;
+        energy->metrics[n].type = "energy";
+        energy->metrics[n].name = z->energy_name;
+        energy->metrics[n].value = z->energy;
+        n++;
+        energy->metrics[n].timestamp = NULL;
+        energy->metrics[n].type = "energy";
+        energy->metrics[n].name = z->power_name;
+        energy->metrics[n].value = z->power;
+        n++;
+    }
+    energy->last_sample = now;
+
+    if (!energy->callback(energy->metrics, n, energy->user_data)) {
+        debug("energy: failed to send sample of %zu zones", energy->count);
+    }
+}
+
+/*******************************************************************************
+ * mf_energy_sample
+ ******************************************************************************/
+
+void
+mf_energy_sample(mf_energy* energy)
+{
+    pthread_mutex_lock(&energy->sampler.lock);
+    sample(energy);
+    pthread_mutex_unlock(&energy->sampler.lock);
+}
+
+/*******************************************************************************
+ * free_zones
+ ******************************************************************************/
+
+static void
+free_zones(mf_energy* energy)
+{
+    size_t i;
+
+    for (i = 0; i < energy->count; ++i) {
+        close(energy->zones[i].fd);
+        free(energy->zones[i].id);
+        free(energy->zones[i].name);
+        free(energy->zones[i].energy_name);
+        free(energy->zones[i].power_name);
+    }
+    free(energy->zones);
+    free(energy->metrics);
+}
+
+/*******************************************************************************
+ * mf_energy_free
+ ******************************************************************************/
+
+void
+mf_energy_free(mf_energy* energy)
+{
+    if (energy == NULL) {
+        return;
+    }
+
+    mf_sampler_stop(&energy->sampler);
+
+    free_zones(energy);
+    free(energy);
+}
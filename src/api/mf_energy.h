@@ -0,0 +1,88 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Sampling of the energy counters of the powercap framework (RAPL).
+ *
+ * Linux exposes the RAPL domains of a node as zones below
+ * /sys/class/powercap, e.g. intel-rapl:0 for the first package and
+ * intel-rapl:0:0 for its cores. Each zone has a name and a counter of the
+ * energy consumed in microjoules, which wraps at max_energy_range_uj.
+ *
+ * A sampler thread reads the counters of all zones at a fixed interval,
+ * through descriptors opened once, and hands the energy consumed since the
+ * start and the average power since the last sample to the callback.
+ */
+
+#ifndef MF_ENERGY_H_
+#define MF_ENERGY_H_
+
+#include <stddef.h>
+
+#include "mf_api.h"
+
+#define MF_ENERGY_ROOT        "/sys/class/powercap"
+#define MF_ENERGY_INTERVAL_MS 1000
+
+typedef struct mf_energy_t mf_energy;
+
+/**
+ * @brief Receives the metrics of one sample.
+ *
+ * There are two metrics of type "energy" per zone: "<zone>_energy", the
+ * energy consumed since the sampler started in J, and "<zone>_power", the
+ * average power since the previous sample in W. Subzones are named after
+ * their parent, e.g. package-0_core. The timestamp of the metrics is NULL
+ * and may be set by the callback. The strings are only valid during the
+ * call.
+ *
+ * @return 1 if the sample was sent; 0 otherwise
+ */
+typedef int (*mf_energy_cb)(mf_metric* metrics, size_t count, void* user_data);
+
+/**
+ * @brief Discovers the zones below root, reads their counters once and
+ *        starts the sampler thread.
+ *
+ * @param root directory of the zones; NULL for MF_ENERGY_ROOT
+ * @param interval_ms interval of the samples; 0 for MF_ENERGY_INTERVAL_MS
+ *
+ * @return the sampler; NULL if no readable zone was found or out of
+ *         resources
+ */
+mf_energy* mf_energy_new(
+    const char* root,
+    long interval_ms,
+    mf_energy_cb callback,
+    void* user_data
+);
+
+/**
+ * @brief Returns the number of zones sampled.
+ */
+size_t mf_energy_zones(mf_energy* energy);
+
+/**
+ * @brief Samples all zones immediately.
+ */
+void mf_energy_sample(mf_energy* energy);
+
+/**
+ * @brief Stops the sampler thread, closes the counters and frees the sampler.
+ */
+void mf_energy_free(mf_energy* energy);
+
+#endif
@@ -0,0 +1,547 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mf_histogram.h"
+#include "contrib/mf_debug.h"
+#include "contrib/mf_json.h"
+#include "contrib/mf_msgpack.h"
+#include "contrib/mf_number.h"
+
+#include <pthread.h>  /* pthread_key_create */
+#include <stdlib.h>   /* calloc */
+#include <string.h>   /* strdup, strlen */
+
+/*******************************************************************************
+ * Variable Declarations
+ ******************************************************************************/
+
+#define SUB_BUCKETS (1 << MF_HIST_PRECISION)
+
+typedef struct hist_shard_t hist_shard;
+
+/*
+ * Counters of one thread. Only the owning thread writes them, the collector
+ * reads them; relaxed atomic loads and stores keep both sides free of data
+ * races without read-modify-write instructions.
+ */
+struct hist_shard_t {
+    uint64_t sum;
+    int retired;      /* set when the owning thread has exited */
+    hist_shard* next;
+    uint64_t counts[MF_HIST_N_BUCKETS];
+};
+
+struct mf_histogram_t {
+    unsigned long id;
+    char* type;
+    char* name;
+    int flags;
+
+    pthread_key_t key;
+    pthread_mutex_t lock; /* protects the list of shards */
+    hist_shard* shards;
+
+    /* counts of exited threads, and totals at the previous collection */
+    uint64_t retired[MF_HIST_N_BUCKETS];
+    uint64_t retired_sum;
+    uint64_t previous[MF_HIST_N_BUCKETS];
+    uint64_t previous_sum;
+
+    /* values recorded between the last two collections */
+    uint64_t interval[MF_HIST_N_BUCKETS];
+    uint64_t interval_sum;
+    uint64_t interval_count;
+};
+
+static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+static const char* percentile_keys[] = { "p50", "p90", "p99", "p99.9" };
+#define N_PERCENTILES (sizeof(percentiles) / sizeof(percentiles[0]))
+
+/* distinguishes histograms allocated at the same address */
+static unsigned long next_id = 0;
+
+/* shard used by the last mf_histogram_record() of the thread */
+static __thread mf_histogram* cached_histogram = NULL;
+static __thread unsigned long cached_id = 0;
+static __thread hist_shard* cached_shard = NULL;
+
+/*******************************************************************************
+ * Forward Declarations
+ ******************************************************************************/
+
+static void retire_shard(void* shard);
+
+/*******************************************************************************
+ * mf_histogram_bucket
+ ******************************************************************************/
+
+size_t
+mf_histogram_bucket(uint64_t value)
+{
+    if (value < SUB_BUCKETS) {
+        return (size_t) value;
+    }
+
+    int shift = 63 - __builtin_clzll(value) - MF_HIST_PRECISION;
+    return ((size_t) (shift + 1) << MF_HIST_PRECISION) |
+        (size_t) ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+/*******************************************************************************
+ * mf_histogram_bucket_lower
+ ******************************************************************************/
+
+uint64_t
+mf_histogram_bucket_lower(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int shift = (int) (bucket >> MF_HIST_PRECISION) - 1;
+    return ((uint64_t) ((bucket & (SUB_BUCKETS - 1)) | SUB_BUCKETS)) << shift;
+}
+
+/*******************************************************************************
+ * mf_histogram_bucket_upper
+ ******************************************************************************/
+
+uint64_t
+mf_histogram_bucket_upper(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int shift = (int) (bucket >> MF_HIST_PRECISION) - 1;
+    return mf_histogram_bucket_lower(bucket) + (((uint64_t) 1 << shift) - 1);
+}
+
+/*******************************************************************************
+ * mf_histogram_new
+ ******************************************************************************/
+
+mf_histogram*
+mf_histogram_new(const char* type, const char* name, int flags)
+{
+    if (name == NULL) {
+        log_error("parameter 'name' is not set (%s)", "histogram");
+        return NULL;
+    }
+
+    mf_histogram* histogram = (mf_histogram*) calloc(1, sizeof(mf_histogram));
+    if (histogram == NULL) {
+        log_error("cannot allocate histogram (%zu bytes)", sizeof(mf_histogram));
+        return NULL;
+    }
+
+    histogram->id = __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+    histogram->type = (type != NULL) ? strdup(type) : NULL;
+    histogram->name = strdup(name);
+    histogram->flags = flags;
+
+    if (pthread_key_create(&histogram->key, retire_shard) != 0) {
+        log_error("cannot create thread-local key (%s)", name);
+        free(histogram->type);
+        free(histogram->name);
+        free(histogram);
+        return NULL;
+    }
+    pthread_mutex_init(&histogram->lock, NULL);
+
+    return histogram;
+}
+
+/*******************************************************************************
+ * retire_shard
+ ******************************************************************************/
+
+static void
+retire_shard(void* shard)
+{
+    __atomic_store_n(&((hist_shard*) shard)->retired, 1, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+ * get_shard
+ ******************************************************************************/
+
+static hist_shard*
+get_shard(mf_histogram* histogram)
+{
+    hist_shard* shard = (hist_shard*) pthread_getspecific(histogram->key);
+
+    if (shard == NULL) {
+        shard = (hist_shard*) calloc(1, sizeof(hist_shard));
+        if (shard == NULL) {
+            return NULL;
+        }
+        pthread_setspecific(histogram->key, shard);
+
+        pthread_mutex_lock(&histogram->lock);
+        shard->next = histogram->shards;
+        histogram->shards = shard;
+        pthread_mutex_unlock(&histogram->lock);
+    }
+
+    cached_histogram = histogram;
+    cached_id = histogram->id;
+    cached_shard = shard;
+
+    return shard;
+}
+
+/*******************************************************************************
+ * mf_histogram_record
+ ******************************************************************************/
+
+void
+mf_histogram_record(mf_histogram* histogram, uint64_t value)
+{
+    hist_shard* shard = cached_shard;
+
+    if (cached_histogram != histogram || cached_id != histogram->id) {
+        if ((shard = get_shard(histogram)) == NULL) {
+            return;
+        }
+    }
+
+    uint64_t* count = &shard->counts[mf_histogram_bucket(value)];
+    __atomic_store_n(count,
+        __atomic_load_n(count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&shard->sum,
+        __atomic_load_n(&shard->sum, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * mf_histogram_collect
+ ******************************************************************************/
+
+uint64_t
+mf_histogram_collect(mf_histogram* histogram)
+{
+    hist_shard** link;
+    size_t i;
+
+    memcpy(histogram->interval, histogram->retired, sizeof(histogram->interval));
+    histogram->interval_sum = histogram->retired_sum;
+
+    pthread_mutex_lock(&histogram->lock);
+    link = &histogram->shards;
+    while (*link != NULL) {
+        hist_shard* shard = *link;
+        int retired = __atomic_load_n(&shard->retired, __ATOMIC_ACQUIRE);
+
+        for (i = 0; i < MF_HIST_N_BUCKETS; ++i) {
+            uint64_t count = __atomic_load_n(&shard->counts[i], __ATOMIC_RELAXED);
+            histogram->interval[i] += count;
+            if (retired) {
+                histogram->retired[i] += count;
+            }
+        }
+        uint64_t sum = __atomic_load_n(&shard->sum, __ATOMIC_RELAXED);
+        histogram->interval_sum += sum;
+
+        if (retired) {
+            histogram->retired_sum += sum;
+            *link = shard->next;
+            free(shard);
+        } else {
+            link = &shard->next;
+        }
+    }
+    pthread_mutex_unlock(&histogram->lock);
+
+    /* turn the totals into the values recorded since the last collection */
+    histogram->interval_count = 0;
+    for (i = 0; i < MF_HIST_N_BUCKETS; ++i) {
+        uint64_t total = histogram->interval[i];
+        histogram->interval[i] = total - histogram->previous[i];
+        histogram->previous[i] = total;
+        histogram->interval_count += histogram->interval[i];
+    }
+    uint64_t total_sum = histogram->interval_sum;
+    histogram->interval_sum = total_sum - histogram->previous_sum;
+    histogram->previous_sum = total_sum;
+
+    return histogram->interval_count;
+}
+
+/*******************************************************************************
+ * mf_histogram_count
+ ******************************************************************************/
+
+uint64_t
+mf_histogram_count(const mf_histogram* histogram)
+{
+    return histogram->interval_count;
+}
+
+/*******************************************************************************
+ * mf_histogram_percentile
+ ******************************************************************************/
+
+uint64_t
+mf_histogram_percentile(const mf_histogram* histogram, double percentile)
+{
+    uint64_t seen = 0;
+    size_t i;
+
+    if (histogram->interval_count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (percentile / 100.0 * histogram->interval_count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (i = 0; i < MF_HIST_N_BUCKETS; ++i) {
+        seen += histogram->interval[i];
+        if (seen >= rank) {
+            return mf_histogram_bucket_upper(i);
+        }
+    }
+    return mf_histogram_bucket_upper(MF_HIST_N_BUCKETS - 1);
+}
+
+/*******************************************************************************
+ * mf_histogram_encode
+ ******************************************************************************/
+
+static int
+append_json_field(mf_buffer* buffer, const char* key, const char* value)
+{
+    return mf_json_string(buffer, key) &&
+        mf_buffer_append_char(buffer, ':') &&
+        mf_json_string(buffer, value) &&
+        mf_buffer_append_char(buffer, ',');
+}
+
+static int
+append_json_uint(mf_buffer* buffer, const char* key, uint64_t value)
+{
+    return (key == NULL ||
+            (mf_json_string(buffer, key) && mf_buffer_append_char(buffer, ':'))) &&
+        mf_number_append_uint(buffer, value);
+}
+
+static int
+append_msgpack_field(mf_buffer* buffer, const char* key, const char* value)
+{
+    return mf_msgpack_str(buffer, key, strlen(key)) &&
+        (value == NULL ?
+            mf_msgpack_nil(buffer) :
+            mf_msgpack_str(buffer, value, strlen(value)));
+}
+
+static int
+append_msgpack_uint(mf_buffer* buffer, const char* key, uint64_t value)
+{
+    return mf_msgpack_str(buffer, key, strlen(key)) &&
+        mf_msgpack_uint(buffer, value);
+}
+
+static void
+get_range(const mf_histogram* histogram, uint64_t* min, uint64_t* max)
+{
+    size_t i;
+
+    *min = 0;
+    *max = 0;
+    for (i = 0; i < MF_HIST_N_BUCKETS; ++i) {
+        if (histogram->interval[i] > 0) {
+            *min = mf_histogram_bucket_upper(i);
+            break;
+        }
+    }
+    for (i = MF_HIST_N_BUCKETS; i > 0; --i) {
+        if (histogram->interval[i - 1] > 0) {
+            *max = mf_histogram_bucket_upper(i - 1);
+            break;
+        }
+    }
+}
+
+static int
+encode_msgpack(
+    mf_buffer* buffer,
+    const char* host,
+    const char* task,
+    const char* timestamp,
+    const mf_histogram* histogram,
+    uint64_t min,
+    uint64_t max)
+{
+    int with_percentiles = histogram->flags & MF_HIST_PERCENTILES;
+    int with_buckets = histogram->flags & MF_HIST_BUCKETS;
+    uint32_t fields = 10;
+    uint32_t used = 0;
+    size_t i;
+
+    if (with_percentiles) {
+        fields += N_PERCENTILES;
+    }
+    if (with_buckets) {
+        fields += 1;
+        for (i = 0; i < MF_HIST_N_BUCKETS; ++i) {
+            used += histogram->interval[i] > 0;
+        }
+    }
+
+    if (!(mf_msgpack_map(buffer, fields) &&
+          append_msgpack_field(buffer, "@timestamp", timestamp) &&
+          append_msgpack_field(buffer, "host", host) &&
+          append_msgpack_field(buffer, "task", task) &&
+          append_msgpack_field(buffer, "type", histogram->type) &&
+          append_msgpack_field(buffer, "name", histogram->name) &&
+          append_msgpack_field(buffer, "encoding", "hdr") &&
+          append_msgpack_uint(buffer, "count", histogram->interval_count) &&
+          append_msgpack_uint(buffer, "sum", histogram->interval_sum) &&
+          append_msgpack_uint(buffer, "min", min) &&
+          append_msgpack_uint(buffer, "max", max))) {
+        return 0;
+    }
+
+    for (i = 0; with_percentiles && i < N_PERCENTILES; ++i) {
+        if (!append_msgpack_uint(buffer, percentile_keys[i],
+                mf_histogram_percentile(histogram, percentiles[i]))) {
+            return 0;
+        }
+    }
+
+    if (with_buckets) {
+        if (!mf_msgpack_str(buffer, "buckets", 7) ||
+            !mf_msgpack_array(buffer, used * 2)) {
+            return 0;
+        }
+        for (i = 0; i < MF_HIST_N_BUCKETS; ++i) {
+            if (histogram->interval[i] > 0 &&
+                (!mf_msgpack_uint(buffer, mf_histogram_bucket_lower(i)) ||
+                 !mf_msgpack_uint(buffer, histogram->interval[i]))) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static int
+encode_json(
+    mf_buffer* buffer,
+    const char* host,
+    const char* task,
+    const char* timestamp,
+    const mf_histogram* histogram,
+    uint64_t min,
+    uint64_t max)
+{
+    int first = 1;
+    size_t i;
+
+    if (!(mf_buffer_append_char(buffer, '{') &&
+          append_json_field(buffer, "@timestamp", timestamp) &&
+          append_json_field(buffer, "host", host) &&
+          append_json_field(buffer, "task", task) &&
+          append_json_field(buffer, "type", histogram->type) &&
+          append_json_field(buffer, "name", histogram->name) &&
+          append_json_field(buffer, "encoding", "hdr") &&
+          append_json_uint(buffer, "count", histogram->interval_count) &&
+          mf_buffer_append_char(buffer, ',') &&
+          append_json_uint(buffer, "sum", histogram->interval_sum) &&
+          mf_buffer_append_char(buffer, ',') &&
+          append_json_uint(buffer, "min", min) &&
+          mf_buffer_append_char(buffer, ',') &&
+          append_json_uint(buffer, "max", max))) {
+        return 0;
+    }
+
+    for (i = 0; (histogram->flags & MF_HIST_PERCENTILES) && i < N_PERCENTILES; ++i) {
+        if (!mf_buffer_append_char(buffer, ',') ||
+            !append_json_uint(buffer, percentile_keys[i],
+                mf_histogram_percentile(histogram, percentiles[i]))) {
+            return 0;
+        }
+    }
+
+    if (histogram->flags & MF_HIST_BUCKETS) {
+        if (!mf_buffer_append_str(buffer, ",\"buckets\":[")) {
+            return 0;
+        }
+        for (i = 0; i < MF_HIST_N_BUCKETS; ++i) {
+            if (histogram->interval[i] == 0) {
+                continue;
+            }
+            if ((!first && !mf_buffer_append_char(buffer, ',')) ||
+                !append_json_uint(buffer, NULL, mf_histogram_bucket_lower(i)) ||
+                !mf_buffer_append_char(buffer, ',') ||
+                !append_json_uint(buffer, NULL, histogram->interval[i])) {
+                return 0;
+            }
+            first = 0;
+        }
+        if (!mf_buffer_append_char(buffer, ']')) {
+            return 0;
+        }
+    }
+
+    return mf_buffer_append_char(buffer, '}');
+}
+
+int
+mf_histogram_encode(
+    mf_buffer* buffer,
+    int format,
+    const char* host,
+    const char* task,
+    const char* timestamp,
+    const mf_histogram* histogram)
+{
+    uint64_t min, max;
+
+    get_range(histogram, &min, &max);
+    if (format == MF_FORMAT_MSGPACK) {
+        return encode_msgpack(buffer, host, task, timestamp, histogram, min, max);
+    }
+    return encode_json(buffer, host, task, timestamp, histogram, min, max);
+}
+
+/*******************************************************************************
+ * mf_histogram_free
+ ******************************************************************************/
+
+void
+mf_histogram_free(mf_histogram* histogram)
+{
+    hist_shard* shard;
+
+    if (histogram == NULL) {
+        return;
+    }
+
+    pthread_key_delete(histogram->key);
+    while ((shard = histogram->shards) != NULL) {
+        histogram->shards = shard->next;
+        free(shard);
+    }
+    if (cached_histogram == histogram) {
+        cached_histogram = NULL;
+    }
+
+    pthread_mutex_destroy(&histogram->lock);
+    free(histogram->type);
+    free(histogram->name);
+    free(histogram);
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Histograms with log-linear buckets, recorded lock-free per thread.
+ *
+ * As in HdrHistogram, values below 2^MF_HIST_PRECISION have a bucket each;
+ * every higher power of two is split into 2^MF_HIST_PRECISION buckets of
+ * equal width. Any 64-bit value thus falls into one of MF_HIST_N_BUCKETS
+ * buckets, whose width is at most 1/32 of its values.
+ *
+ * Every thread records into a shard of its own, so recording a value is a
+ * bucket lookup and two increments of thread-owned counters, without locks
+ * or atomic read-modify-write instructions. mf_histogram_collect() merges
+ * the shards into the distribution of the values recorded since the last
+ * collection, which mf_histogram_encode() turns into a histogram document.
+ *
+ * The document has the fields "@timestamp", "host", "task", "type", "name",
+ * "encoding" (always "hdr"), "count", "sum", "min" and "max". With
+ * MF_HIST_PERCENTILES, it also has "p50", "p90", "p99" and "p99.9". With
+ * MF_HIST_BUCKETS, "buckets" lists the non-empty buckets as a flat array of
+ * pairs of lower bound and count. Percentiles, min and max are reported as
+ * the upper bound of their bucket.
+ */
+
+#ifndef MF_HISTOGRAM_H_
+#define MF_HISTOGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mf_api.h"
+#include "contrib/mf_buffer.h"
+
+#define MF_HIST_PRECISION 5
+#define MF_HIST_N_BUCKETS ((64 - MF_HIST_PRECISION + 1) << MF_HIST_PRECISION)
+
+/**
+ * @brief Creates an empty histogram of metric name of the given type.
+ *
+ * @param flags MF_HIST_PERCENTILES and/or MF_HIST_BUCKETS
+ *
+ * @return the histogram; NULL if out of resources
+ */
+mf_histogram* mf_histogram_new(const char* type, const char* name, int flags);
+
+/**
+ * @brief Records a value in the shard of the calling thread.
+ */
+void mf_histogram_record(mf_histogram* histogram, uint64_t value);
+
+/**
+ * @brief Merges the shards of all threads.
+ *
+ * The values recorded since the previous call become the distribution
+ * read by mf_histogram_percentile() and mf_histogram_encode(). Must not be
+ * called concurrently for the same histogram.
+ *
+ * @return the number of values recorded since the previous call
+ */
+uint64_t mf_histogram_collect(mf_histogram* histogram);
+
+/**
+ * @brief Returns the number of values recorded between the last two calls
+ *        of mf_histogram_collect().
+ */
+uint64_t mf_histogram_count(const mf_histogram* histogram);
+
+/**
+ * @brief Returns the upper bound of the bucket holding the given percentile
+ *        (0 to 100) of the collected values, or 0 if there are none.
+ */
+uint64_t mf_histogram_percentile(const mf_histogram* histogram, double percentile);
+
+/**
+ * @brief Appends a histogram document of the collected values.
+ *
+ * @return 1 if successful; 0 if out of memory
+ */
+int mf_histogram_encode(
+    mf_buffer* buffer,
+    int format,
+    const char* host,
+    const char* task,
+    const char* timestamp,
+    const mf_histogram* histogram
+);
+
+/**
+ * @brief Frees the histogram and the shards of all threads.
+ *
+ * No thread may record concurrently or afterwards.
+ */
+void mf_histogram_free(mf_histogram* histogram);
+
+/**
+ * @brief Returns the index of the bucket of value.
+ */
+size_t mf_histogram_bucket(uint64_t value);
+
+/**
+ * @brief Returns the smallest value of the given bucket.
+ */
+uint64_t mf_histogram_bucket_lower(size_t bucket);
+
+/**
+ * @brief Returns the largest value of the given bucket.
+ */
+uint64_t mf_histogram_bucket_upper(size_t bucket);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mf_sampler.h"
+#include "contrib/mf_debug.h"
+
+#include <time.h>     /* clock_gettime */
+
+/*******************************************************************************
+ * Forward Declarations
+ ******************************************************************************/
+
+static void* sampler_main(void* arg);
+
+/*******************************************************************************
+ * mf_sampler_start
+ ******************************************************************************/
+
+int
+mf_sampler_start(
+    mf_sampler* sampler,
+    const char* name,
+    long interval_ms,
+    mf_sampler_cb sample,
+    void* user_data)
+{
+    sampler->interval_ms = interval_ms;
+    sampler->sample = sample;
+    sampler->user_data = user_data;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sampler->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&sampler->lock, NULL);
+
+    sampler->running = 1;
+    if (pthread_create(&sampler->thread, NULL, sampler_main, sampler) != 0) {
+        log_error("cannot start sampler thread (%s)", name);
+        pthread_mutex_destroy(&sampler->lock);
+        pthread_cond_destroy(&sampler->wake);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*******************************************************************************
+ * mf_sampler_set_interval
+ ******************************************************************************/
+
+void
+mf_sampler_set_interval(mf_sampler* sampler, long interval_ms)
+{
+    pthread_mutex_lock(&sampler->lock);
+    sampler->interval_ms = interval_ms;
+    pthread_mutex_unlock(&sampler->lock);
+}
+
+/*******************************************************************************
+ * sampler_main
+ ******************************************************************************/
+
+static void*
+sampler_main(void* arg)
+{
+    mf_sampler* sampler = (mf_sampler*) arg;
+    struct timespec next, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    pthread_mutex_lock(&sampler->lock);
+    while (sampler->running) {
+        /* skip the samples missed while sending took longer than the interval */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > next.tv_sec ||
+            (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec)) {
+            next = now;
+        }
+
+        next.tv_sec += sampler->interval_ms / 1000;
+        next.tv_nsec += (sampler->interval_ms % 1000) * 1000000;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+
+        while (sampler->running &&
+               pthread_cond_timedwait(&sampler->wake, &sampler->lock, &next) == 0) {
+            /* woken up early, e.g. by mf_sampler_stop() */
+        }
+        if (sampler->running) {
+            sampler->sample(sampler->user_data);
+        }
+    }
+    pthread_mutex_unlock(&sampler->lock);
+
+    return NULL;
+}
+
+/*******************************************************************************
+ * mf_sampler_stop
+ ******************************************************************************/
+
+void
+mf_sampler_stop(mf_sampler* sampler)
+{
+    pthread_mutex_lock(&sampler->lock);
+    sampler->running = 0;
+    pthread_cond_signal(&sampler->wake);
+    pthread_mutex_unlock(&sampler->lock);
+    pthread_join(sampler->thread, NULL);
+
+    pthread_mutex_destroy(&sampler->lock);
+    pthread_cond_destroy(&sampler->wake);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Thread that takes samples at a fixed rate.
+ *
+ * Shared by the watcher and the energy sampler. Samples are taken at fixed
+ * points in time, so that the interval does not drift by the time spent
+ * sending; samples missed while sending took longer than the interval are
+ * skipped rather than taken in a burst.
+ *
+ * The sampler is embedded in its owner, which may use its lock to protect
+ * the data read by the sample function.
+ */
+
+#ifndef MF_SAMPLER_H_
+#define MF_SAMPLER_H_
+
+#include <pthread.h>
+
+/**
+ * @brief Takes one sample; called by the thread with the lock held.
+ */
+typedef void (*mf_sampler_cb)(void* user_data);
+
+typedef struct mf_sampler_t mf_sampler;
+
+struct mf_sampler_t {
+    /* held while a sample is taken */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    long interval_ms;
+    int running;
+    pthread_t thread;
+
+    mf_sampler_cb sample;
+    void* user_data;
+};
+
+/**
+ * @brief Initializes the sampler and starts its thread.
+ *
+ * @param name of the sampler in error messages
+ *
+ * @return 1 if successful; 0 if the thread could not be started
+ */
+int mf_sampler_start(
+    mf_sampler* sampler,
+    const char* name,
+    long interval_ms,
+    mf_sampler_cb sample,
+    void* user_data
+);
+
+/**
+ * @brief Changes the interval, starting with the sample after the next.
+ */
+void mf_sampler_set_interval(mf_sampler* sampler, long interval_ms);
+
+/**
+ * @brief Stops and joins the thread and releases the lock.
+ */
+void mf_sampler_stop(mf_sampler* sampler);
+
+#endif
@@ -0,0 +1,485 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mf_series.h"
+#include "mf_api.h"
+#include "contrib/mf_json.h"
+#include "contrib/mf_msgpack.h"
+#include "contrib/mf_number.h"
+
+#include <string.h>   /* memcpy, strlen */
+
+/*******************************************************************************
+ * Bit Streams
+ ******************************************************************************/
+
+/*
+ * Writes bits to the end of the buffer, either as raw bytes or, for JSON,
+ * base64-encoded in groups of three bytes.
+ */
+typedef struct bit_writer_t {
+    mf_buffer* buffer;
+    unsigned char current;
+    int used;
+    int base64;
+    uint32_t group;
+    int grouped;
+} bit_writer;
+
+typedef struct bit_reader_t {
+    const unsigned char* data;
+    size_t size;
+    size_t position;
+    int used;
+} bit_reader;
+
+static const char base64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* writes the first digits of the group of three bytes, padded with '=' */
+static int
+put_base64(mf_buffer* buffer, uint32_t group, int digits)
+{
+    char out[4];
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        out[i] = (i < digits) ?
+            base64_digits[(group >> (18 - 6 * i)) & 0x3f] : '=';
+    }
+    return mf_buffer_append(buffer, out, 4);
+}
+
+static int
+put_byte(bit_writer* w, unsigned char byte)
+{
+    if (!w->base64) {
+        return mf_buffer_append(w->buffer, &byte, 1);
+    }
+
+    w->group = (w->group << 8) | byte;
+    if (++w->grouped < 3) {
+        return 1;
+    }
+    w->grouped = 0;
+    return put_base64(w->buffer, w->group, 4);
+}
+
+/* writes the lowest count bits of value, most significant bit first */
+static int
+put_bits(bit_writer* w, uint64_t value, int count)
+{
+    while (count > 0) {
+        int room = 8 - w->used;
+        int take = (count < room) ? count : room;
+        unsigned bits = (unsigned) (value >> (count - take)) & ((1u << take) - 1);
+
+        w->current |= (unsigned char) (bits << (room - take));
+        w->used += take;
+        count -= take;
+
+        if (w->used == 8) {
+            if (!put_byte(w, w->current)) {
+                return 0;
+            }
+            w->current = 0;
+            w->used = 0;
+        }
+    }
+    return 1;
+}
+
+static int
+flush_bits(bit_writer* w)
+{
+    if (w->used > 0 && !put_byte(w, w->current)) {
+        return 0;
+    }
+    if (w->base64 && w->grouped > 0) {
+        /* one byte gives two digits, two bytes three */
+        uint32_t group = w->group << (8 * (3 - w->grouped));
+        return put_base64(w->buffer, group, w->grouped + 1);
+    }
+    return 1;
+}
+
+static int
+get_bits(bit_reader* r, int count, uint64_t* value)
+{
+    uint64_t result = 0;
+
+    while (count > 0) {
+        if (r->position >= r->size) {
+            return 0;
+        }
+        int room = 8 - r->used;
+        int take = (count < room) ? count : room;
+        unsigned bits = (r->data[r->position] >> (room - take)) & ((1u << take) - 1);
+
+        result = (result << take) | bits;
+        r->used += take;
+        count -= take;
+
+        if (r->used == 8) {
+            r->position++;
+            r->used = 0;
+        }
+    }
+
+    *value = result;
+    return 1;
+}
+
+static int
+leading_zeros(uint64_t x)
+{
+    return (x == 0) ? 64 : __builtin_clzll(x);
+}
+
+static int
+trailing_zeros(uint64_t x)
+{
+    return (x == 0) ? 64 : __builtin_ctzll(x);
+}
+
+/*******************************************************************************
+ * mf_series_compress
+ ******************************************************************************/
+
+/*
+ * Delta-of-delta buckets: a prefix of n one-bits followed by a zero selects
+ * a signed value of the given width; the last bucket has no trailing zero.
+ */
+static const int dod_widths[] = { 7, 9, 12 };
+
+static int
+put_timestamp(bit_writer* w, int64_t dod)
+{
+    int i;
+
+    if (dod == 0) {
+        return put_bits(w, 0, 1);
+    }
+    for (i = 0; i < 3; ++i) {
+        int64_t limit = (int64_t) 1 << (dod_widths[i] - 1);
+        if (dod >= -limit + 1 && dod <= limit) {
+            /* prefix 10, 110, 1110 */
+            return put_bits(w, ((1u << (i + 2)) - 2), i + 2) &&
+                put_bits(w, (uint64_t) (dod + limit - 1), dod_widths[i]);
+        }
+    }
+    return put_bits(w, 0x0f, 4) && put_bits(w, (uint64_t) dod, 64);
+}
+
+static int
+get_timestamp(bit_reader* r, int64_t* dod)
+{
+    uint64_t bit;
+    uint64_t raw;
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        if (!get_bits(r, 1, &bit)) {
+            return 0;
+        }
+        if (bit == 0) {
+            break;
+        }
+    }
+
+    if (i == 0) {
+        *dod = 0;
+        return 1;
+    }
+    if (i == 4) {
+        if (!get_bits(r, 64, &raw)) {
+            return 0;
+        }
+        *dod = (int64_t) raw;
+        return 1;
+    }
+
+    int64_t limit = (int64_t) 1 << (dod_widths[i - 1] - 1);
+    if (!get_bits(r, dod_widths[i - 1], &raw)) {
+        return 0;
+    }
+    *dod = (int64_t) raw - limit + 1;
+    return 1;
+}
+
+/*
+ * Returns the size of the longest bit stream of count samples: the first
+ * sample verbatim, the others with the widest timestamp code (4 + 64 bits)
+ * and value code (2 + 5 + 6 + 64 bits).
+ */
+static size_t
+max_compressed_size(size_t count)
+{
+    return (count == 0) ? 0 : (128 + 145 * (count - 1) + 7) / 8;
+}
+
+static int
+compress(
+    bit_writer* w,
+    const long long* timestamps,
+    const double* values,
+    size_t count)
+{
+    uint64_t previous_value = 0;
+    int64_t previous_delta = 0;
+    int previous_leading = -1;
+    int previous_trailing = 0;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        uint64_t value;
+        memcpy(&value, &values[i], sizeof(value));
+
+        /* first sample is stored verbatim */
+        if (i == 0) {
+            if (!put_bits(w, (uint64_t) timestamps[0], 64) ||
+                !put_bits(w, value, 64)) {
+                return 0;
+            }
+            previous_value = value;
+            continue;
+        }
+
+        int64_t delta = timestamps[i] - timestamps[i - 1];
+        if (!put_timestamp(w, delta - previous_delta)) {
+            return 0;
+        }
+        previous_delta = delta;
+
+        uint64_t xor = value ^ previous_value;
+        previous_value = value;
+
+        if (xor == 0) {
+            if (!put_bits(w, 0, 1)) {
+                return 0;
+            }
+            continue;
+        }
+
+        int leading = leading_zeros(xor);
+        int trailing = trailing_zeros(xor);
+        if (leading > 31) {
+            leading = 31;
+        }
+
+        if (previous_leading >= 0 &&
+            leading >= previous_leading && trailing >= previous_trailing) {
+            /* meaningful bits fit into the previous window */
+            int length = 64 - previous_leading - previous_trailing;
+            if (!put_bits(w, 2, 2) ||
+                !put_bits(w, xor >> previous_trailing, length)) {
+                return 0;
+            }
+        } else {
+            int length = 64 - leading - trailing;
+            if (!put_bits(w, 3, 2) ||
+                !put_bits(w, (uint64_t) leading, 5) ||
+                !put_bits(w, (uint64_t) (length & 0x3f), 6) ||
+                !put_bits(w, xor >> trailing, length)) {
+                return 0;
+            }
+            previous_leading = leading;
+            previous_trailing = trailing;
+        }
+    }
+
+    return flush_bits(w);
+}
+
+int
+mf_series_compress(
+    mf_buffer* buffer,
+    const long long* timestamps,
+    const double* values,
+    size_t count)
+{
+    bit_writer w = { buffer, 0, 0, 0, 0, 0 };
+
+    if (!mf_buffer_reserve(buffer, max_compressed_size(count))) {
+        return 0;
+    }
+    return compress(&w, timestamps, values, count);
+}
+
+/*******************************************************************************
+ * mf_series_decompress
+ ******************************************************************************/
+
+int
+mf_series_decompress(
+    const void* data,
+    size_t size,
+    size_t count,
+    long long* timestamps,
+    double* values)
+{
+    bit_reader r = { (const unsigned char*) data, size, 0, 0 };
+    uint64_t previous_value = 0;
+    int64_t previous_delta = 0;
+    int leading = 0;
+    int trailing = 0;
+    uint64_t bits;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        if (i == 0) {
+            if (!get_bits(&r, 64, &bits)) {
+                return 0;
+            }
+            timestamps[0] = (int64_t) bits;
+            if (!get_bits(&r, 64, &previous_value)) {
+                return 0;
+            }
+            memcpy(&values[0], &previous_value, sizeof(double));
+            continue;
+        }
+
+        int64_t dod;
+        if (!get_timestamp(&r, &dod)) {
+            return 0;
+        }
+        previous_delta += dod;
+        timestamps[i] = timestamps[i - 1] + previous_delta;
+
+        if (!get_bits(&r, 1, &bits)) {
+            return 0;
+        }
+        if (bits == 1) {
+            if (!get_bits(&r, 1, &bits)) {
+                return 0;
+            }
+            if (bits == 1) {
+                uint64_t l, n;
+                if (!get_bits(&r, 5, &l) || !get_bits(&r, 6, &n)) {
+                    return 0;
+                }
+                int length = (n == 0) ? 64 : (int) n;
+                leading = (int) l;
+                trailing = 64 - leading - length;
+            }
+
+            uint64_t xor;
+            if (!get_bits(&r, 64 - leading - trailing, &xor)) {
+                return 0;
+            }
+            previous_value ^= xor << trailing;
+        }
+        memcpy(&values[i], &previous_value, sizeof(double));
+    }
+
+    return 1;
+}
+
+/*******************************************************************************
+ * mf_series_encode
+ ******************************************************************************/
+
+/*
+ * Inserts the MessagePack header of the binary value that was appended to
+ * the buffer from offset start on.
+ */
+static int
+insert_bin_header(mf_buffer* buffer, size_t start)
+{
+    size_t length = buffer->size - start;
+    int width = (length <= UINT8_MAX) ? 1 : (length <= UINT16_MAX) ? 2 : 4;
+    int i;
+
+    if (!mf_buffer_reserve(buffer, width + 1)) {
+        return 0;
+    }
+
+    unsigned char* out = (unsigned char*) buffer->data + start;
+    memmove(out + width + 1, out, length);
+    out[0] = (width == 1) ? 0xc4 : (width == 2) ? 0xc5 : 0xc6;
+    for (i = 0; i < width; ++i) {
+        out[width - i] = (unsigned char) (length >> (8 * i));
+    }
+    buffer->size += width + 1;
+    buffer->data[buffer->size] = '\0';
+
+    return 1;
+}
+
+static int
+append_json_field(mf_buffer* buffer, const char* key, const char* value)
+{
+    return mf_json_string(buffer, key) &&
+        mf_buffer_append_char(buffer, ':') &&
+        mf_json_string(buffer, value) &&
+        mf_buffer_append_char(buffer, ',');
+}
+
+static int
+append_msgpack_field(mf_buffer* buffer, const char* key, const char* value)
+{
+    return mf_msgpack_str(buffer, key, strlen(key)) &&
+        mf_msgpack_str(buffer, value, strlen(value));
+}
+
+int
+mf_series_encode(
+    mf_buffer* buffer,
+    int format,
+    const char* host,
+    const char* task,
+    const char* type,
+    const char* name,
+    const long long* timestamps,
+    const double* values,
+    size_t count)
+{
+    size_t size = max_compressed_size(count);
+    bit_writer w = { buffer, 0, 0, format != MF_FORMAT_MSGPACK, 0, 0 };
+
+    /* the bit stream is written straight into the buffer, reserved for the
+     * longest possible stream up front */
+    if (format == MF_FORMAT_MSGPACK) {
+        if (!(mf_msgpack_map(buffer, 7) &&
+              append_msgpack_field(buffer, "host", host) &&
+              append_msgpack_field(buffer, "task", task) &&
+              append_msgpack_field(buffer, "type", type) &&
+              append_msgpack_field(buffer, "name", name) &&
+              append_msgpack_field(buffer, "encoding", "gorilla") &&
+              mf_msgpack_str(buffer, "count", 5) &&
+              mf_msgpack_uint(buffer, count) &&
+              mf_msgpack_str(buffer, "data", 4))) {
+            return 0;
+        }
+
+        size_t start = buffer->size;
+        return mf_buffer_reserve(buffer, size + 5) &&
+            compress(&w, timestamps, values, count) &&
+            insert_bin_header(buffer, start);
+    }
+
+    return mf_buffer_append_char(buffer, '{') &&
+        append_json_field(buffer, "host", host) &&
+        append_json_field(buffer, "task", task) &&
+        append_json_field(buffer, "type", type) &&
+        append_json_field(buffer, "name", name) &&
+        append_json_field(buffer, "encoding", "gorilla") &&
+        mf_buffer_append_str(buffer, "\"count\":") &&
+        mf_number_append_uint(buffer, count) &&
+        mf_buffer_append_str(buffer, ",\"data\":\"") &&
+        mf_buffer_reserve(buffer, (size + 2) / 3 * 4 + 2) &&
+        compress(&w, timestamps, values, count) &&
+        mf_buffer_append_str(buffer, "\"}");
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Columnar, compressed encoding of numeric samples of a single metric.
+ *
+ * A series document carries host, task, type and name only once, followed by
+ * the samples compressed as in Facebook's Gorilla time series database:
+ * timestamps are stored as delta-of-deltas, values as XOR against the
+ * previous value, both with variable-length bit codes. Samples taken at a
+ * fixed rate of a slowly changing counter need little more than a bit per
+ * timestamp and a few bits per value.
+ *
+ * The document has the fields "host", "task", "type", "name", "encoding"
+ * (always "gorilla"), "count" and "data". In MessagePack, "data" is a binary
+ * value; in JSON, it is a base64-encoded string.
+ *
+ * @see Pelkonen et al., Gorilla: A Fast, Scalable, In-Memory Time Series
+ *      Database, VLDB 2015
+ */
+
+#ifndef MF_SERIES_H_
+#define MF_SERIES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "contrib/mf_buffer.h"
+
+/**
+ * @brief Appends the compressed bit stream of count samples.
+ *
+ * @return 1 if successful; 0 if out of memory
+ */
+int mf_series_compress(
+    mf_buffer* buffer,
+    const long long* timestamps,
+    const double* values,
+    size_t count
+);
+
+/**
+ * @brief Decodes count samples from a bit stream written by
+ *        mf_series_compress().
+ *
+ * @return 1 if successful; 0 if the stream is truncated
+ */
+int mf_series_decompress(
+    const void* data,
+    size_t size,
+    size_t count,
+    long long* timestamps,
+    double* values
+);
+
+/**
+ * @brief Appends a series document in the given wire format.
+ *
+ * @return 1 if successful; 0 if out of memory
+ */
+int mf_series_encode(
+    mf_buffer* buffer,
+    int format,
+    const char* host,
+    const char* task,
+    const char* type,
+    const char* name,
+    const long long* timestamps,
+    const double* values,
+    size_t count
+);
+
+#endif
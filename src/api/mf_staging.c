@@ -0,0 +1,879 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mf_staging.h"
+#include "contrib/mf_buffer.h"
+#include "contrib/mf_debug.h"
+
+#include <math.h>     /* ceil */
+#include <pthread.h>  /* pthread_key_create */
+#include <sched.h>    /* sched_yield */
+#include <stdint.h>   /* uint32_t */
+#include <stdlib.h>   /* malloc */
+#include <string.h>   /* memcpy, strlen */
+#include <time.h>     /* clock_gettime, nanosleep */
+
+/*******************************************************************************
+ * Variable Declarations
+ ******************************************************************************/
+
+/*
+ * A record consists of its size (including padding to a multiple of four
+ * bytes), a byte flagging which fields are set, and the '\0'-terminated
+ * fields timestamp, type, name and value. A record never wraps around the
+ * end of the ring; a size of RECORD_WRAP tells the flusher to continue at
+ * the start.
+ */
+#define RECORD_HEADER 5
+#define RECORD_WRAP   UINT32_MAX
+#define N_FIELDS      4
+
+/* sample counters per thread for MF_BACKPRESSURE_DOWNSAMPLE, by metric hash */
+#define DOWNSAMPLE_SLOTS 256
+
+/* bounds of the adaptive batch size and linger time, see adapt() */
+#define ADAPTIVE_MIN_BATCH  64
+#define ADAPTIVE_MIN_LINGER 1
+
+/* a thread waiting for room yields this often before it starts sleeping */
+#define WAIT_SPINS    64
+#define WAIT_SLEEP_NS 100000
+
+typedef struct mf_staging_slot_t mf_staging_slot;
+
+struct mf_staging_slot_t {
+    char* ring;
+    size_t capacity;
+
+    size_t head;      /* written by the owning thread only */
+    size_t tail;      /* advanced by compare-and-swap, see drain() */
+    int retired;      /* set when the owning thread has exited */
+
+    /* samples seen under pressure, for MF_BACKPRESSURE_DOWNSAMPLE */
+    uint32_t samples[DOWNSAMPLE_SLOTS];
+
+    mf_staging* staging;
+    mf_staging_slot* next;
+};
+
+struct mf_staging_t {
+    pthread_key_t key;
+    size_t ring_size;
+    size_t batch_size;
+    long max_age_ms;
+    mf_staging_flush_cb callback;
+    void* user_data;
+
+    /*
+     * Adaptive control, changed at any time: the batch size and the time
+     * between two passes of the flusher follow the measured round trip of
+     * the callback and the rate of staged metrics. While idle is set, the
+     * first metric staged wakes the flusher.
+     */
+    int adaptive;
+    size_t target;
+    long linger_ms;
+    double rtt_ms;
+    double rate;
+    int saturated;
+    int idle;
+
+    /* backpressure policy, changed at any time, and its victims */
+    int policy;
+    long limit;
+    unsigned long dropped;
+
+    /* protects the list of slots and the state of the flusher */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    mf_staging_slot* slots;
+    int running;
+    pthread_t flusher;
+
+    /* held while the rings are drained, so there is a single reader */
+    pthread_mutex_t drain_lock;
+    mf_metric* batch;
+    mf_buffer records; /* copies of the records of the batch */
+};
+
+/*******************************************************************************
+ * Forward Declarations
+ ******************************************************************************/
+
+static void* flusher_main(void* arg);
+static void retire_slot(void* slot);
+
+/*******************************************************************************
+ * mf_staging_new
+ ******************************************************************************/
+
+mf_staging*
+mf_staging_new(
+    size_t ring_size,
+    size_t batch_size,
+    long max_age_ms,
+    mf_staging_flush_cb callback,
+    void* user_data)
+{
+    mf_staging* staging = (mf_staging*) calloc(1, sizeof(mf_staging));
+    if (staging == NULL) {
+        log_error("cannot allocate staging area (%zu bytes)", sizeof(mf_staging));
+        return NULL;
+    }
+
+    staging->ring_size = 256;
+    while (staging->ring_size < ring_size) {
+        staging->ring_size *= 2;
+    }
+    staging->batch_size = (batch_size > 0) ? batch_size : 1;
+    staging->max_age_ms = (max_age_ms > 0) ? max_age_ms : 1;
+    staging->callback = callback;
+    staging->user_data = user_data;
+    staging->target = staging->batch_size;
+    staging->linger_ms = staging->max_age_ms;
+    staging->policy = MF_BACKPRESSURE_BLOCK;
+    staging->limit = -1;
+    mf_buffer_init(&staging->records);
+
+    staging->batch = (mf_metric*) malloc(sizeof(mf_metric) * staging->batch_size);
+    if (staging->batch == NULL) {
+        log_error("cannot allocate batch of %zu metrics", staging->batch_size);
+        free(staging);
+        return NULL;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&staging->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&staging->lock, NULL);
+    pthread_mutex_init(&staging->drain_lock, NULL);
+
+    if (pthread_key_create(&staging->key, retire_slot) != 0) {
+        log_error("cannot create thread-local key (%s)", "staging");
+        goto error_key;
+    }
+
+    staging->running = 1;
+    if (pthread_create(&staging->flusher, NULL, flusher_main, staging) != 0) {
+        log_error("cannot start flusher thread (%s)", "staging");
+        goto error_thread;
+    }
+
+    return staging;
+
+error_thread:
+    pthread_key_delete(staging->key);
+error_key:
+    pthread_mutex_destroy(&staging->drain_lock);
+    pthread_mutex_destroy(&staging->lock);
+    pthread_cond_destroy(&staging->wake);
+    free(staging->batch);
+    free(staging);
+    return NULL;
+}
+
+/*******************************************************************************
+ * new_slot
+ ******************************************************************************/
+
+static mf_staging_slot*
+new_slot(mf_staging* staging)
+{
+    mf_staging_slot* slot = (mf_staging_slot*) calloc(1, sizeof(mf_staging_slot));
+    if (slot == NULL) {
+        return NULL;
+    }
+
+    slot->ring = (char*) malloc(staging->ring_size);
+    if (slot->ring == NULL) {
+        free(slot);
+        return NULL;
+    }
+    slot->capacity = staging->ring_size;
+    slot->staging = staging;
+
+    pthread_setspecific(staging->key, slot);
+
+    pthread_mutex_lock(&staging->lock);
+    slot->next = staging->slots;
+    staging->slots = slot;
+    pthread_mutex_unlock(&staging->lock);
+
+    return slot;
+}
+
+/*******************************************************************************
+ * retire_slot
+ ******************************************************************************/
+
+/*
+ * Called when a thread that appended metrics exits. The flusher frees the
+ * slot after it has sent the remaining records.
+ */
+static void
+retire_slot(void* slot)
+{
+    __atomic_store_n(&((mf_staging_slot*) slot)->retired, 1, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+ * wake_flusher
+ ******************************************************************************/
+
+/*
+ * Signalled without holding the lock: a lost wake-up only delays the
+ * flusher until its next periodic pass.
+ */
+static void
+wake_flusher(mf_staging* staging)
+{
+    pthread_cond_signal(&staging->wake);
+}
+
+/*******************************************************************************
+ * mf_staging_set_backpressure
+ ******************************************************************************/
+
+void
+mf_staging_set_backpressure(mf_staging* staging, int policy, long limit)
+{
+    __atomic_store_n(&staging->limit, limit, __ATOMIC_RELAXED);
+    __atomic_store_n(&staging->policy, policy, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * mf_staging_set_adaptive
+ ******************************************************************************/
+
+void
+mf_staging_set_adaptive(mf_staging* staging, int adaptive)
+{
+    __atomic_store_n(&staging->adaptive, adaptive != 0, __ATOMIC_RELAXED);
+    wake_flusher(staging);
+}
+
+/*******************************************************************************
+ * mf_staging_get_tuning
+ ******************************************************************************/
+
+void
+mf_staging_get_tuning(mf_staging* staging, size_t* batch_size, long* linger_ms)
+{
+    *batch_size = __atomic_load_n(&staging->target, __ATOMIC_RELAXED);
+    *linger_ms = __atomic_load_n(&staging->linger_ms, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * mf_staging_get_dropped
+ ******************************************************************************/
+
+unsigned long
+mf_staging_get_dropped(mf_staging* staging)
+{
+    return __atomic_load_n(&staging->dropped, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * now_ms
+ ******************************************************************************/
+
+static double
+now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+/*******************************************************************************
+ * drop_oldest
+ ******************************************************************************/
+
+/*
+ * Removes the oldest record of the ring of the calling thread, unless the
+ * flusher collected it first. The owning thread wrote the record, so its
+ * size can be read without synchronization.
+ */
+static void
+drop_oldest(mf_staging* staging, mf_staging_slot* slot)
+{
+    size_t tail = __atomic_load_n(&slot->tail, __ATOMIC_ACQUIRE);
+    if (tail == slot->head) {
+        return;
+    }
+
+    size_t offset = tail & (slot->capacity - 1);
+    uint32_t size = *(uint32_t*) (slot->ring + offset);
+    int is_record = (size != RECORD_WRAP);
+    size_t next = tail + (is_record ? size : slot->capacity - offset);
+
+    if (__atomic_compare_exchange_n(&slot->tail, &tail, next, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && is_record) {
+        __atomic_add_fetch(&staging->dropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*******************************************************************************
+ * keep_sample
+ ******************************************************************************/
+
+/*
+ * Counts the samples of the metric (FNV-1a of type and name) and keeps
+ * every n-th. Metrics that collide share a counter.
+ */
+static int
+keep_sample(mf_staging_slot* slot, const mf_metric* metric, long n)
+{
+    const char* fields[2] = { metric->type, metric->name };
+    uint32_t hash = 2166136261u;
+    const char* c;
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        for (c = fields[i]; c != NULL && *c != '\0'; ++c) {
+            hash = (hash ^ (unsigned char) *c) * 16777619u;
+        }
+        hash = (hash ^ 0xff) * 16777619u;
+    }
+
+    return n <= 1 || slot->samples[hash % DOWNSAMPLE_SLOTS]++ % n == 0;
+}
+
+/*******************************************************************************
+ * wait_for_room
+ ******************************************************************************/
+
+/*
+ * Waits until needed bytes are free, or timeout_ms have passed if it is not
+ * negative. Yields first, then sleeps, so that a thread waiting for a slow
+ * server does not keep a core busy.
+ */
+static int
+wait_for_room(mf_staging* staging, mf_staging_slot* slot, size_t needed,
+              long timeout_ms, size_t* used)
+{
+    double deadline = (timeout_ms >= 0) ? now_ms() + timeout_ms : 0;
+    struct timespec pause = { 0, WAIT_SLEEP_NS };
+    int spins;
+
+    for (spins = 0; slot->capacity - *used < needed; ++spins) {
+        if (timeout_ms >= 0 && now_ms() >= deadline) {
+            return 0;
+        }
+        wake_flusher(staging);
+        if (spins < WAIT_SPINS) {
+            sched_yield();
+        } else {
+            nanosleep(&pause, NULL);
+        }
+        *used = slot->head - __atomic_load_n(&slot->tail, __ATOMIC_ACQUIRE);
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * make_room
+ ******************************************************************************/
+
+/*
+ * Applies the backpressure policy to a ring that is at least half full.
+ * Returns 1 if the metric can be written, with *used updated, or 0 if it
+ * is dropped.
+ */
+static int
+make_room(mf_staging* staging, mf_staging_slot* slot, const mf_metric* metric,
+          size_t needed, size_t* used)
+{
+    int policy = __atomic_load_n(&staging->policy, __ATOMIC_RELAXED);
+    long limit = __atomic_load_n(&staging->limit, __ATOMIC_RELAXED);
+
+    if (policy == MF_BACKPRESSURE_DOWNSAMPLE && !keep_sample(slot, metric, limit)) {
+        return 0;
+    }
+    if (slot->capacity - *used >= needed) {
+        return 1;
+    }
+
+    switch (policy) {
+    case MF_BACKPRESSURE_DROP_OLDEST:
+        wake_flusher(staging);
+        while (slot->capacity - *used < needed) {
+            drop_oldest(staging, slot);
+            *used = slot->head - __atomic_load_n(&slot->tail, __ATOMIC_ACQUIRE);
+        }
+        return 1;
+    case MF_BACKPRESSURE_DROP_NEWEST:
+    case MF_BACKPRESSURE_DOWNSAMPLE:
+        wake_flusher(staging);
+        return 0;
+    default:
+        return wait_for_room(staging, slot, needed, limit, used);
+    }
+}
+
+/*******************************************************************************
+ * mf_staging_append
+ ******************************************************************************/
+
+int
+mf_staging_append(mf_staging* staging, const mf_metric* metric)
+{
+    const char* fields[N_FIELDS] = {
+        metric->timestamp, metric->type, metric->name, metric->value
+    };
+    size_t lengths[N_FIELDS];
+    size_t size = RECORD_HEADER;
+    unsigned char mask = 0;
+    int i;
+
+    mf_staging_slot* slot = (mf_staging_slot*) pthread_getspecific(staging->key);
+    if (slot == NULL && (slot = new_slot(staging)) == NULL) {
+        log_error("cannot allocate staging ring (%zu bytes)", staging->ring_size);
+        return 0;
+    }
+
+    for (i = 0; i < N_FIELDS; ++i) {
+        lengths[i] = 0;
+        if (fields[i] != NULL) {
+            lengths[i] = strlen(fields[i]) + 1;
+            mask |= 1 << i;
+        }
+        size += lengths[i];
+    }
+    size = (size + 3) & ~(size_t) 3;
+    if (size > slot->capacity / 2) {
+        log_error("metric of %zu bytes exceeds staging ring", size);
+        return 0;
+    }
+
+    size_t head = slot->head;
+    size_t offset = head & (slot->capacity - 1);
+    size_t contiguous = slot->capacity - offset;
+    size_t needed = (size <= contiguous) ? size : size + contiguous;
+
+    size_t used = head - __atomic_load_n(&slot->tail, __ATOMIC_ACQUIRE);
+    if (slot->capacity - used < needed || used >= slot->capacity / 2) {
+        if (!make_room(staging, slot, metric, needed, &used)) {
+            __atomic_add_fetch(&staging->dropped, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+
+    if (size > contiguous) {
+        *(uint32_t*) (slot->ring + offset) = RECORD_WRAP;
+        offset = 0;
+    }
+
+    char* record = slot->ring + offset;
+    *(uint32_t*) record = (uint32_t) size;
+    record[4] = (char) mask;
+    record += RECORD_HEADER;
+    for (i = 0; i < N_FIELDS; ++i) {
+        /* absent fields have length 0 and may be NULL */
+        if (lengths[i] > 0) {
+            memcpy(record, fields[i], lengths[i]);
+            record += lengths[i];
+        }
+    }
+
+    __atomic_store_n(&slot->head, head + needed, __ATOMIC_RELEASE);
+
+    /* wake the flusher once when the ring becomes half full */
+    if (used < slot->capacity / 2 && used + needed >= slot->capacity / 2) {
+        wake_flusher(staging);
+    } else if (used == 0) {
+        /* pairs with the fence in adapt(), so one of both sees the other */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&staging->idle, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&staging->idle, 0, __ATOMIC_RELAXED)) {
+            wake_flusher(staging);
+        }
+    }
+
+    return 1;
+}
+
+/*******************************************************************************
+ * decode_record
+ ******************************************************************************/
+
+static void
+decode_record(const char* record, mf_metric* metric)
+{
+    const char* fields[N_FIELDS];
+    unsigned char mask = (unsigned char) record[4];
+    const char* field = record + RECORD_HEADER;
+    int i;
+
+    for (i = 0; i < N_FIELDS; ++i) {
+        fields[i] = NULL;
+        if (mask & (1 << i)) {
+            fields[i] = field;
+            field += strlen(field) + 1;
+        }
+    }
+
+    metric->timestamp = fields[0];
+    metric->type = fields[1];
+    metric->name = fields[2];
+    metric->value = fields[3];
+}
+
+/*******************************************************************************
+ * emit
+ ******************************************************************************/
+
+/*
+ * Decodes the copied records into the batch and hands it to the callback.
+ */
+static void
+emit(mf_staging* staging, size_t count)
+{
+    const char* record = staging->records.data;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        decode_record(record, &staging->batch[i]);
+        record += *(const uint32_t*) record;
+    }
+
+    double start = now_ms();
+    if (!staging->callback(staging->batch, count, staging->user_data)) {
+        debug("staging: failed to send batch of %zu metrics", count);
+    }
+    staging->rtt_ms += ((now_ms() - start) - staging->rtt_ms) / 4;
+
+    mf_buffer_reset(&staging->records);
+}
+
+/*******************************************************************************
+ * reap
+ ******************************************************************************/
+
+/*
+ * Frees the slots of exited threads that have no records left.
+ */
+static void
+reap(mf_staging* staging)
+{
+    mf_staging_slot** link;
+
+    pthread_mutex_lock(&staging->lock);
+    link = &staging->slots;
+    while (*link != NULL) {
+        mf_staging_slot* slot = *link;
+        if (__atomic_load_n(&slot->retired, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&slot->tail, __ATOMIC_ACQUIRE) ==
+                __atomic_load_n(&slot->head, __ATOMIC_ACQUIRE)) {
+            *link = slot->next;
+            free(slot->ring);
+            free(slot);
+        } else {
+            link = &slot->next;
+        }
+    }
+    pthread_mutex_unlock(&staging->lock);
+}
+
+/*******************************************************************************
+ * copy_records
+ ******************************************************************************/
+
+/*
+ * Appends up to max records between pos and head to the records of the
+ * batch; returns the position after the last one copied. If the owning
+ * thread dropped records meanwhile, what was copied may be garbage, which
+ * drain() detects since the tail has moved.
+ */
+static size_t
+copy_records(mf_staging* staging, mf_staging_slot* slot, size_t pos,
+             size_t head, size_t max, size_t* count)
+{
+    while (pos < head && *count < max) {
+        size_t offset = pos & (slot->capacity - 1);
+        uint32_t size = __atomic_load_n((uint32_t*) (slot->ring + offset),
+            __ATOMIC_RELAXED);
+
+        if (size == RECORD_WRAP) {
+            pos += slot->capacity - offset;
+            continue;
+        }
+        if (size < RECORD_HEADER || size > slot->capacity - offset ||
+            !mf_buffer_append(&staging->records, slot->ring + offset, size)) {
+            break;
+        }
+        pos += size;
+        (*count)++;
+    }
+    return pos;
+}
+
+/*******************************************************************************
+ * drain
+ ******************************************************************************/
+
+/*
+ * Merges the records of all rings into batches. Must be called with
+ * drain_lock held. New slots are only ever prepended, and slots are only
+ * removed by reap(), so the list can be walked without the lock.
+ *
+ * The records are copied, and the copies claimed by moving the tail of the
+ * ring with compare-and-swap; the owning thread drops records the same way
+ * (see drop_oldest()). If it won, the copies are discarded and the ring is
+ * read again from the new tail.
+ */
+static size_t
+drain(mf_staging* staging)
+{
+    mf_staging_slot* slots;
+    mf_staging_slot* slot;
+    size_t count = 0;
+    size_t drained = 0;
+    int adaptive = __atomic_load_n(&staging->adaptive, __ATOMIC_RELAXED);
+    size_t limit = adaptive ? staging->target : staging->batch_size;
+
+    staging->saturated = 0;
+
+    pthread_mutex_lock(&staging->lock);
+    slots = staging->slots;
+    pthread_mutex_unlock(&staging->lock);
+
+    for (slot = slots; slot != NULL; slot = slot->next) {
+        /* records staged during the pass are left for the next one */
+        size_t head = __atomic_load_n(&slot->head, __ATOMIC_ACQUIRE);
+
+        for (;;) {
+            size_t tail = __atomic_load_n(&slot->tail, __ATOMIC_ACQUIRE);
+            /* positions only grow; drops may move the tail past the head */
+            if (tail >= head) {
+                break;
+            }
+
+            size_t mark = staging->records.size;
+            size_t copied = count;
+            size_t pos = copy_records(staging, slot, tail, head,
+                limit, &copied);
+
+            if (!__atomic_compare_exchange_n(&slot->tail, &tail, pos, 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                staging->records.size = mark;
+                continue;
+            }
+            if (pos == tail) {
+                log_error("cannot copy staged metrics (%zu bytes)", mark);
+                break;
+            }
+
+            drained += copied - count;
+            count = copied;
+            if (count == limit) {
+                emit(staging, count);
+                count = 0;
+
+                /* more is staged than a batch takes: send larger ones */
+                staging->saturated = 1;
+                if (adaptive) {
+                    limit = (2 * limit < staging->batch_size) ?
+                        2 * limit : staging->batch_size;
+                }
+            }
+        }
+    }
+
+    if (count > 0) {
+        emit(staging, count);
+    }
+    if (adaptive) {
+        __atomic_store_n(&staging->target, limit, __ATOMIC_RELAXED);
+    }
+
+    reap(staging);
+
+    return drained;
+}
+
+/*******************************************************************************
+ * is_empty
+ ******************************************************************************/
+
+static int
+is_empty(mf_staging* staging)
+{
+    mf_staging_slot* slot;
+    int empty = 1;
+
+    pthread_mutex_lock(&staging->lock);
+    for (slot = staging->slots; slot != NULL && empty; slot = slot->next) {
+        empty = __atomic_load_n(&slot->tail, __ATOMIC_ACQUIRE) ==
+            __atomic_load_n(&slot->head, __ATOMIC_ACQUIRE);
+    }
+    pthread_mutex_unlock(&staging->lock);
+
+    return empty;
+}
+
+/*******************************************************************************
+ * adapt
+ ******************************************************************************/
+
+/*
+ * Tunes the batch size and returns the time until the next pass, after a
+ * pass that drained metrics in elapsed_ms.
+ *
+ * While a pass fills whole batches, the queue is deeper than a batch, and
+ * drain() doubles the batch size and the flusher returns right away. Once
+ * the flusher keeps up, a batch only needs to carry the metrics staged
+ * during two round trips, so that half of the time is spent waiting for the
+ * server; and the flusher lingers about one round trip, so that it sends no
+ * faster than the server answers. A fast server thus gets small batches
+ * soon, a slow one large batches. When a pass finds nothing, the flusher
+ * sleeps until the next metric is staged, which it then sends right away.
+ */
+static long
+adapt(mf_staging* staging, size_t drained, double elapsed_ms)
+{
+    if (elapsed_ms < ADAPTIVE_MIN_LINGER) {
+        elapsed_ms = ADAPTIVE_MIN_LINGER;
+    }
+    staging->rate += (drained / elapsed_ms - staging->rate) / 4;
+
+    size_t target = staging->target;
+    long linger = ADAPTIVE_MIN_LINGER;
+
+    if (!staging->saturated) {
+        double wanted = ceil(2 * staging->rate * staging->rtt_ms);
+        size_t smallest = (staging->batch_size < ADAPTIVE_MIN_BATCH) ?
+            staging->batch_size : ADAPTIVE_MIN_BATCH;
+        if (wanted < target) {
+            target = (wanted <= smallest) ? smallest : (size_t) wanted;
+        }
+
+        linger = (long) ceil(staging->rtt_ms);
+        if (linger < ADAPTIVE_MIN_LINGER) {
+            linger = ADAPTIVE_MIN_LINGER;
+        } else if (linger > staging->max_age_ms) {
+            linger = staging->max_age_ms;
+        }
+    }
+
+    __atomic_store_n(&staging->target, target, __ATOMIC_RELAXED);
+    __atomic_store_n(&staging->linger_ms, linger, __ATOMIC_RELAXED);
+
+    if (drained > 0) {
+        return linger;
+    }
+
+    /* a metric staged before the flag was set did not wake the flusher */
+    __atomic_store_n(&staging->idle, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!is_empty(staging)) {
+        __atomic_store_n(&staging->idle, 0, __ATOMIC_RELAXED);
+        return linger;
+    }
+    return staging->max_age_ms;
+}
+
+/*******************************************************************************
+ * flusher_main
+ ******************************************************************************/
+
+static void*
+flusher_main(void* arg)
+{
+    mf_staging* staging = (mf_staging*) arg;
+    struct timespec deadline;
+    double last = now_ms();
+
+    pthread_mutex_lock(&staging->lock);
+    while (staging->running) {
+        pthread_mutex_unlock(&staging->lock);
+
+        long wait_ms = staging->max_age_ms;
+        pthread_mutex_lock(&staging->drain_lock);
+        size_t drained = drain(staging);
+        if (__atomic_load_n(&staging->adaptive, __ATOMIC_RELAXED)) {
+            double now = now_ms();
+            wait_ms = adapt(staging, drained, now - last);
+            last = now;
+        }
+        pthread_mutex_unlock(&staging->drain_lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += wait_ms / 1000;
+        deadline.tv_nsec += (wait_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&staging->lock);
+        if (staging->running) {
+            pthread_cond_timedwait(&staging->wake, &staging->lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&staging->lock);
+
+    return NULL;
+}
+
+/*******************************************************************************
+ * mf_staging_flush
+ ******************************************************************************/
+
+void
+mf_staging_flush(mf_staging* staging)
+{
+    pthread_mutex_lock(&staging->drain_lock);
+    drain(staging);
+    pthread_mutex_unlock(&staging->drain_lock);
+}
+
+/*******************************************************************************
+ * mf_staging_free
+ ******************************************************************************/
+
+void
+mf_staging_free(mf_staging* staging)
+{
+    mf_staging_slot* slot;
+
+    if (staging == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&staging->lock);
+    staging->running = 0;
+    pthread_cond_signal(&staging->wake);
+    pthread_mutex_unlock(&staging->lock);
+    pthread_join(staging->flusher, NULL);
+
+    mf_staging_flush(staging);
+
+    pthread_key_delete(staging->key);
+    while ((slot = staging->slots) != NULL) {
+        staging->slots = slot->next;
+        free(slot->ring);
+        free(slot);
+    }
+
+    pthread_mutex_destroy(&staging->drain_lock);
+    pthread_mutex_destroy(&staging->lock);
+    pthread_cond_destroy(&staging->wake);
+    mf_buffer_free(&staging->records);
+    free(staging->batch);
+    free(staging);
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Per-thread staging of metrics that are sent in batches.
+ *
+ * Every thread that appends a metric gets a ring buffer of its own, which
+ * only this thread writes and only the flusher reads. Appending therefore
+ * takes neither a lock nor an atomic read-modify-write instruction; the ring
+ * positions are published with plain acquire/release loads and stores. A
+ * flusher thread collects the records of all rings and merges them into
+ * batches of up to batch_size metrics, whenever a ring is half full or at
+ * the latest every max_age_ms milliseconds. The flusher copies the records
+ * out of a ring before it sends them, so a slow server holds up the rings
+ * only for as long as the flusher cannot collect them.
+ *
+ * When a ring is full, the backpressure policy decides whether the thread
+ * waits for room or a metric is dropped (see MF_BACKPRESSURE_*).
+ *
+ * With adaptive control, batch_size and max_age_ms are upper bounds, and the
+ * flusher sizes its batches and the pauses between its passes after the
+ * measured duration of the callback and the rate of staged metrics.
+ *
+ * A ring is freed by the flusher once its thread has exited and all its
+ * records have been sent.
+ */
+
+#ifndef MF_STAGING_H_
+#define MF_STAGING_H_
+
+#include <stddef.h>
+
+#include "mf_api.h"
+
+#define MF_STAGING_RING_SIZE  (64 * 1024)
+#define MF_STAGING_BATCH_SIZE 512
+#define MF_STAGING_MAX_AGE_MS 1000
+
+typedef struct mf_staging_t mf_staging;
+
+/**
+ * @brief Receives a batch of staged metrics.
+ *
+ * The metrics point into the staging rings and are only valid during the
+ * call. Batches are never delivered concurrently.
+ *
+ * @return 1 if the batch was sent; 0 otherwise
+ */
+typedef int (*mf_staging_flush_cb)(
+    const mf_metric* metrics,
+    size_t count,
+    void* user_data
+);
+
+/**
+ * @brief Creates the staging area and starts its flusher thread.
+ *
+ * @param ring_size bytes of the ring of each thread, rounded up to a power
+ *        of two
+ * @param batch_size maximum number of metrics per batch
+ * @param max_age_ms maximum time a metric is staged before it is sent
+ *
+ * @return the staging area; NULL if out of resources
+ */
+mf_staging* mf_staging_new(
+    size_t ring_size,
+    size_t batch_size,
+    long max_age_ms,
+    mf_staging_flush_cb callback,
+    void* user_data
+);
+
+/**
+ * @brief Enables or disables adaptive batch sizes and flush intervals.
+ *
+ * Batches carry about the metrics staged during two round trips of the
+ * callback, and the flusher pauses about one round trip between passes, so
+ * that batches grow while the server is slow and shrink while it is fast.
+ * When nothing is staged, the flusher sleeps until the next metric arrives,
+ * which it sends right away.
+ */
+void mf_staging_set_adaptive(mf_staging* staging, int adaptive);
+
+/**
+ * @brief Returns the batch size and the pause between passes of the flusher
+ *        currently chosen by the adaptive control.
+ */
+void mf_staging_get_tuning(mf_staging* staging, size_t* batch_size, long* linger_ms);
+
+/**
+ * @brief Sets what mf_staging_append() does when the ring is full.
+ *
+ * @param policy one of MF_BACKPRESSURE_*; MF_BACKPRESSURE_BLOCK by default
+ * @param limit for MF_BACKPRESSURE_BLOCK, the longest wait in milliseconds,
+ *        negative to wait indefinitely (the default); for
+ *        MF_BACKPRESSURE_DOWNSAMPLE, the factor n; ignored otherwise
+ */
+void mf_staging_set_backpressure(mf_staging* staging, int policy, long limit);
+
+/**
+ * @brief Copies the metric into the ring of the calling thread.
+ *
+ * If the ring is full, it waits or drops a metric as the backpressure policy
+ * says. A dropped metric counts as handled.
+ *
+ * @return 1 if the metric was staged or dropped; 0 if it is larger than half
+ *         a ring or out of memory
+ */
+int mf_staging_append(mf_staging* staging, const mf_metric* metric);
+
+/**
+ * @brief Returns the number of metrics dropped by the backpressure policy.
+ */
+unsigned long mf_staging_get_dropped(mf_staging* staging);
+
+/**
+ * @brief Sends all metrics staged before the call.
+ *
+ * Metrics appended by other threads are included if the appends happened
+ * before the call, e.g. because the threads were joined.
+ */
+void mf_staging_flush(mf_staging* staging);
+
+/**
+ * @brief Stops the flusher, sends the remaining metrics and frees all rings.
+ *
+ * No thread may append concurrently or afterwards.
+ */
+void mf_staging_free(mf_staging* staging);
+
+#endif
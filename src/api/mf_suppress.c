@@ -0,0 +1,350 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mf_suppress.h"
+#include "contrib/mf_debug.h"
+
+#include <math.h>     /* fabs, isnan */
+#include <pthread.h>  /* pthread_mutex_lock */
+#include <stdint.h>   /* uint32_t */
+#include <stdlib.h>   /* calloc, realloc, strtod */
+#include <string.h>   /* memcpy, strcmp, strdup */
+#include <time.h>     /* clock_gettime */
+
+/*******************************************************************************
+ * Variable Declarations
+ ******************************************************************************/
+
+#define N_BUCKETS 256
+
+typedef struct rule_t rule;
+
+struct rule_t {
+    char* type;
+    char* name;
+    uint32_t hash;
+
+    /* protects the fields below */
+    pthread_mutex_t lock;
+    int mode;
+    double deadband;
+    long heartbeat_ms;
+
+    /* the sample sent last, in a buffer grown to the longest value */
+    int has_last;
+    char* last;
+    size_t last_capacity;
+    double last_value;
+    int last_is_number;
+    long long last_sent_ms;
+
+    rule* next;
+};
+
+struct mf_suppressor_t {
+    /* chains are only prepended to, under lock, and read without it */
+    rule* buckets[N_BUCKETS];
+    int n_rules;
+    pthread_mutex_t lock;
+
+    unsigned long suppressed;
+};
+
+/*******************************************************************************
+ * now_ms
+ ******************************************************************************/
+
+static long long
+now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*******************************************************************************
+ * hash_metric
+ ******************************************************************************/
+
+/*
+ * FNV-1a of type and name, separated by a '\0'.
+ */
+static uint32_t
+hash_metric(const char* type, const char* name)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *type != '\0'; ++type) {
+        hash = (hash ^ (unsigned char) *type) * 16777619u;
+    }
+    hash *= 16777619u;
+    for (; *name != '\0'; ++name) {
+        hash = (hash ^ (unsigned char) *name) * 16777619u;
+    }
+    return hash;
+}
+
+/*******************************************************************************
+ * find_rule
+ ******************************************************************************/
+
+static rule*
+find_rule(mf_suppressor* suppressor, const char* type, const char* name,
+          uint32_t hash)
+{
+    rule* r = __atomic_load_n(&suppressor->buckets[hash % N_BUCKETS],
+        __ATOMIC_ACQUIRE);
+
+    for (; r != NULL; r = r->next) {
+        if (r->hash == hash && strcmp(r->name, name) == 0 &&
+            strcmp(r->type, type) == 0) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+ * parse_number
+ ******************************************************************************/
+
+static int
+parse_number(const char* value, double* number)
+{
+    char* end;
+
+    *number = strtod(value, &end);
+    return end != value && *end == '\0' && !isnan(*number);
+}
+
+/*******************************************************************************
+ * mf_suppressor_new
+ ******************************************************************************/
+
+mf_suppressor*
+mf_suppressor_new()
+{
+    mf_suppressor* suppressor = (mf_suppressor*) calloc(1, sizeof(mf_suppressor));
+    if (suppressor == NULL) {
+        log_error("cannot allocate suppressor (%zu bytes)", sizeof(mf_suppressor));
+        return NULL;
+    }
+    pthread_mutex_init(&suppressor->lock, NULL);
+
+    return suppressor;
+}
+
+/*******************************************************************************
+ * mf_suppressor_set
+ ******************************************************************************/
+
+int
+mf_suppressor_set(
+    mf_suppressor* suppressor,
+    const char* type,
+    const char* name,
+    int mode,
+    double deadband,
+    long heartbeat_ms)
+{
+    if (type == NULL || name == NULL) {
+        log_error("parameter 'type' or 'name' is not set (%s)", "suppress");
+        return 0;
+    }
+    if (mode < MF_SUPPRESS_NONE || mode > MF_SUPPRESS_RELATIVE) {
+        log_error("unknown suppression mode %d", mode);
+        return 0;
+    }
+    if (!(deadband >= 0) || heartbeat_ms < 0) {
+        log_error("invalid deadband %g or heartbeat %ld", deadband, heartbeat_ms);
+        return 0;
+    }
+
+    uint32_t hash = hash_metric(type, name);
+
+    pthread_mutex_lock(&suppressor->lock);
+    rule* r = find_rule(suppressor, type, name, hash);
+    if (r == NULL) {
+        r = (rule*) calloc(1, sizeof(rule));
+        if (r == NULL || (r->type = strdup(type)) == NULL ||
+            (r->name = strdup(name)) == NULL) {
+            log_error("cannot allocate rule for %s", name);
+            if (r != NULL) {
+                free(r->type);
+                free(r);
+            }
+            pthread_mutex_unlock(&suppressor->lock);
+            return 0;
+        }
+        r->hash = hash;
+        pthread_mutex_init(&r->lock, NULL);
+        r->next = suppressor->buckets[hash % N_BUCKETS];
+        __atomic_store_n(&suppressor->buckets[hash % N_BUCKETS], r,
+            __ATOMIC_RELEASE);
+        __atomic_store_n(&suppressor->n_rules, suppressor->n_rules + 1,
+            __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_lock(&r->lock);
+    r->mode = mode;
+    r->deadband = deadband;
+    r->heartbeat_ms = heartbeat_ms;
+    r->has_last = 0;
+    pthread_mutex_unlock(&r->lock);
+    pthread_mutex_unlock(&suppressor->lock);
+
+    return 1;
+}
+
+/*******************************************************************************
+ * is_redundant
+ ******************************************************************************/
+
+/*
+ * Must be called with the lock of the rule held.
+ */
+static int
+is_redundant(rule* r, const char* value, double number, int is_number,
+             long long now)
+{
+    if (!r->has_last) {
+        return 0;
+    }
+    if (r->heartbeat_ms > 0 && now - r->last_sent_ms >= r->heartbeat_ms) {
+        return 0;
+    }
+    if (!is_number || !r->last_is_number) {
+        return strcmp(value, r->last) == 0;
+    }
+
+    double change = fabs(number - r->last_value);
+    switch (r->mode) {
+    case MF_SUPPRESS_ABSOLUTE:
+        return change <= r->deadband;
+    case MF_SUPPRESS_RELATIVE:
+        return change <= r->deadband * fabs(r->last_value);
+    default:
+        return change == 0;
+    }
+}
+
+/*******************************************************************************
+ * mf_suppressor_pass
+ ******************************************************************************/
+
+int
+mf_suppressor_pass(mf_suppressor* suppressor, const mf_metric* metric)
+{
+    if (suppressor == NULL ||
+        __atomic_load_n(&suppressor->n_rules, __ATOMIC_ACQUIRE) == 0) {
+        return 1;
+    }
+
+    const char* type = (metric->type != NULL) ? metric->type : "";
+    const char* name = (metric->name != NULL) ? metric->name : "";
+    const char* value = (metric->value != NULL) ? metric->value : "";
+
+    rule* r = find_rule(suppressor, type, name, hash_metric(type, name));
+    if (r == NULL) {
+        return 1;
+    }
+
+    double number;
+    int is_number = parse_number(value, &number);
+    long long now = now_ms();
+
+    pthread_mutex_lock(&r->lock);
+    if (r->mode == MF_SUPPRESS_NONE) {
+        pthread_mutex_unlock(&r->lock);
+        return 1;
+    }
+    if (is_redundant(r, value, number, is_number, now)) {
+        pthread_mutex_unlock(&r->lock);
+        __atomic_add_fetch(&suppressor->suppressed, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    size_t size = strlen(value) + 1;
+    if (size > r->last_capacity) {
+        char* last = realloc(r->last, size);
+        if (last != NULL) {
+            r->last = last;
+            r->last_capacity = size;
+        }
+    }
+    if (size <= r->last_capacity) {
+        memcpy(r->last, value, size);
+        r->last_value = number;
+        r->last_is_number = is_number;
+        r->last_sent_ms = now;
+        r->has_last = 1;
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    return 1;
+}
+
+/*******************************************************************************
+ * mf_suppressor_active
+ ******************************************************************************/
+
+int
+mf_suppressor_active(mf_suppressor* suppressor)
+{
+    return suppressor != NULL &&
+        __atomic_load_n(&suppressor->n_rules, __ATOMIC_ACQUIRE) > 0;
+}
+
+/*******************************************************************************
+ * mf_suppressor_get_suppressed
+ ******************************************************************************/
+
+unsigned long
+mf_suppressor_get_suppressed(mf_suppressor* suppressor)
+{
+    if (suppressor == NULL) {
+        return 0;
+    }
+    return __atomic_load_n(&suppressor->suppressed, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * mf_suppressor_free
+ ******************************************************************************/
+
+void
+mf_suppressor_free(mf_suppressor* suppressor)
+{
+    size_t i;
+
+    if (suppressor == NULL) {
+        return;
+    }
+
+    for (i = 0; i < N_BUCKETS; ++i) {
+        rule* r = suppressor->buckets[i];
+        while (r != NULL) {
+            rule* next = r->next;
+            pthread_mutex_destroy(&r->lock);
+            free(r->type);
+            free(r->name);
+            free(r->last);
+            free(r);
+            r = next;
+        }
+    }
+    pthread_mutex_destroy(&suppressor->lock);
+    free(suppressor);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Suppression of samples that carry no new information.
+ *
+ * A rule for a metric, identified by its type and name, compares every new
+ * sample with the value sent last and lets it pass only if it changed, or
+ * moved by more than an absolute or relative deadband. A heartbeat interval
+ * bounds how long a metric may stay silent. The check runs before a sample
+ * is staged or encoded, so a suppressed sample costs a hash lookup and a
+ * comparison.
+ *
+ * Values that do not parse as numbers are compared as strings.
+ *
+ * Rules are never removed, only set to MF_SUPPRESS_NONE, so looking them up
+ * takes no lock; only samples of the same metric reported by several threads
+ * contend for the state of their rule.
+ */
+
+#ifndef MF_SUPPRESS_H_
+#define MF_SUPPRESS_H_
+
+#include <stddef.h>
+
+#include "mf_api.h"
+
+typedef struct mf_suppressor_t mf_suppressor;
+
+/**
+ * @brief Creates an empty set of rules, which lets all samples pass.
+ *
+ * @return the suppressor; NULL if out of memory
+ */
+mf_suppressor* mf_suppressor_new();
+
+/**
+ * @brief Sets the rule for the metric of the given type and name.
+ *
+ * Setting a rule again replaces it and forgets the value sent last, so the
+ * next sample passes.
+ *
+ * @param mode one of MF_SUPPRESS_*
+ * @param deadband minimum absolute or relative change of a sample that
+ *        passes; ignored unless mode is MF_SUPPRESS_ABSOLUTE or
+ *        MF_SUPPRESS_RELATIVE
+ * @param heartbeat_ms maximum time between two samples that pass; 0 for no
+ *        heartbeat
+ *
+ * @return 1 if successful; 0 otherwise
+ */
+int mf_suppressor_set(
+    mf_suppressor* suppressor,
+    const char* type,
+    const char* name,
+    int mode,
+    double deadband,
+    long heartbeat_ms
+);
+
+/**
+ * @brief Decides whether the sample is sent, and if so, remembers it as
+ *        the value sent last.
+ *
+ * @return 1 if the sample has to be sent; 0 if it is suppressed
+ */
+int mf_suppressor_pass(mf_suppressor* suppressor, const mf_metric* metric);
+
+/**
+ * @brief Returns 1 if any rule was set; mf_suppressor_pass() lets all
+ *        samples pass otherwise.
+ */
+int mf_suppressor_active(mf_suppressor* suppressor);
+
+/**
+ * @brief Returns the number of samples suppressed so far.
+ */
+unsigned long mf_suppressor_get_suppressed(mf_suppressor* suppressor);
+
+/**
+ * @brief Frees all rules.
+ *
+ * No thread may call mf_suppressor_pass() concurrently or afterwards.
+ */
+void mf_suppressor_free(mf_suppressor* suppressor);
+
+#endif
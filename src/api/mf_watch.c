@@ -0,0 +1,286 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mf_watch.h"
+#include "mf_sampler.h"
+#include "contrib/mf_debug.h"
+#include "contrib/mf_number.h"
+
+#include <stdlib.h>   /* malloc */
+#include <string.h>   /* strdup */
+
+/*******************************************************************************
+ * Variable Declarations
+ ******************************************************************************/
+
+#define VALUE_SIZE MF_NUMBER_SIZE
+
+typedef struct watch_t {
+    char* name;
+    char* type;
+    const volatile void* addr;
+    int kind;
+    char value[VALUE_SIZE];
+} watch;
+
+struct mf_watcher_t {
+    mf_watcher_cb callback;
+    void* user_data;
+
+    /* its lock protects the watches; held while a sample is taken and sent */
+    mf_sampler sampler;
+
+    watch* watches;
+    mf_metric* metrics;
+    size_t count;
+    size_t capacity;
+};
+
+/*******************************************************************************
+ * Forward Declarations
+ ******************************************************************************/
+
+static void sample(void* arg);
+
+/*******************************************************************************
+ * mf_watcher_new
+ ******************************************************************************/
+
+mf_watcher*
+mf_watcher_new(long interval_ms, mf_watcher_cb callback, void* user_data)
+{
+    mf_watcher* watcher = (mf_watcher*) calloc(1, sizeof(mf_watcher));
+    if (watcher == NULL) {
+        log_error("cannot allocate watcher (%zu bytes)", sizeof(mf_watcher));
+        return NULL;
+    }
+
+    watcher->callback = callback;
+    watcher->user_data = user_data;
+
+    if (!mf_sampler_start(&watcher->sampler, "watch",
+            (interval_ms > 0) ? interval_ms : MF_WATCH_INTERVAL_MS,
+            sample, watcher)) {
+        free(watcher);
+        return NULL;
+    }
+
+    return watcher;
+}
+
+/*******************************************************************************
+ * find_watch
+ ******************************************************************************/
+
+static watch*
+find_watch(mf_watcher* watcher, const volatile void* addr)
+{
+    size_t i;
+
+    for (i = 0; i < watcher->count; ++i) {
+        if (watcher->watches[i].addr == addr) {
+            return &watcher->watches[i];
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+ * mf_watcher_add
+ ******************************************************************************/
+
+int
+mf_watcher_add(
+    mf_watcher* watcher,
+    const char* name,
+    const char* type,
+    const volatile void* addr,
+    int kind)
+{
+    if (name == NULL || addr == NULL) {
+        log_error("parameter 'name' or 'addr' is not set (%s)", name);
+        return 0;
+    }
+    if (kind < MF_WATCH_INT || kind > MF_WATCH_DOUBLE) {
+        log_error("unknown kind %d of watched variable %s", kind, name);
+        return 0;
+    }
+
+    char* name_copy = strdup(name);
+    char* type_copy = (type != NULL) ? strdup(type) : NULL;
+    if (name_copy == NULL || (type != NULL && type_copy == NULL)) {
+        free(name_copy);
+        free(type_copy);
+        return 0;
+    }
+
+    pthread_mutex_lock(&watcher->sampler.lock);
+
+    watch* w = find_watch(watcher, addr);
+    if (w == NULL) {
+        if (watcher->count == watcher->capacity) {
+            size_t capacity = (watcher->capacity > 0) ? watcher->capacity * 2 : 16;
+            watch* watches = realloc(watcher->watches, sizeof(watch) * capacity);
+            mf_metric* metrics = (watches != NULL) ?
+                realloc(watcher->metrics, sizeof(mf_metric) * capacity) : NULL;
+            if (watches != NULL) {
+                watcher->watches = watches;
+            }
+            if (metrics == NULL) {
+                pthread_mutex_unlock(&watcher->sampler.lock);
+                log_error("cannot watch more than %zu variables", watcher->count);
+                free(name_copy);
+                free(type_copy);
+                return 0;
+            }
+            watcher->metrics = metrics;
+            watcher->capacity = capacity;
+        }
+        w = &watcher->watches[watcher->count++];
+    } else {
+        free(w->name);
+        free(w->type);
+    }
+
+    w->name = name_copy;
+    w->type = type_copy;
+    w->addr = addr;
+    w->kind = kind;
+
+    pthread_mutex_unlock(&watcher->sampler.lock);
+
+    return 1;
+}
+
+/*******************************************************************************
+ * mf_watcher_remove
+ ******************************************************************************/
+
+int
+mf_watcher_remove(mf_watcher* watcher, const volatile void* addr)
+{
+    pthread_mutex_lock(&watcher->sampler.lock);
+
+    watch* w = find_watch(watcher, addr);
+    if (w != NULL) {
+        free(w->name);
+        free(w->type);
+        *w = watcher->watches[--watcher->count];
+    }
+
+    pthread_mutex_unlock(&watcher->sampler.lock);
+
+    return w != NULL;
+}
+
+/*******************************************************************************
+ * mf_watcher_set_interval
+ ******************************************************************************/
+
+void
+mf_watcher_set_interval(mf_watcher* watcher, long interval_ms)
+{
+    mf_sampler_set_interval(&watcher->sampler,
+        (interval_ms > 0) ? interval_ms : MF_WATCH_INTERVAL_MS);
+}
+
+/*******************************************************************************
+ * read_value
+ ******************************************************************************/
+
+static void
+read_value(watch* w)
+{
+    switch (w->kind) {
+    case MF_WATCH_INT:
+        mf_number_int(w->value, *(const volatile int*) w->addr);
+        break;
+    case MF_WATCH_LONG:
+        mf_number_int(w->value, *(const volatile long*) w->addr);
+        break;
+    case MF_WATCH_ULONG:
+        mf_number_uint(w->value, *(const volatile unsigned long*) w->addr);
+        break;
+    case MF_WATCH_FLOAT:
+        mf_number_float(w->value, *(const volatile float*) w->addr);
+        break;
+    case MF_WATCH_DOUBLE:
+        mf_number_double(w->value, *(const volatile double*) w->addr);
+        break;
+    }
+}
+
+/*******************************************************************************
+ * sample
+ ******************************************************************************/
+
+/*
+ * Must be called with the lock held.
+ */
+static void
+sample(void* arg)
+{
+    mf_watcher* watcher = (mf_watcher*) arg;
+    size_t i;
+
+    for (i = 0; i < watcher->count; ++i) {
+        watch* w = &watcher->watches[i];
+        read_value(w);
+        watcher->metrics[i].timestamp = NULL;
+        watcher->metrics[i].type = w->type;
+        watcher->metrics[i].name = w->name;
+        watcher->metrics[i].value = w->value;
+    }
+
+    if (!watcher->callback(watcher->metrics, watcher->count, watcher->user_data)) {
+        debug("watch: failed to send sample of %zu variables", watcher->count);
+    }
+}
+
+/*******************************************************************************
+ * mf_watcher_sample
+ ******************************************************************************/
+
+void
+mf_watcher_sample(mf_watcher* watcher)
+{
+    pthread_mutex_lock(&watcher->sampler.lock);
+    sample(watcher);
+    pthread_mutex_unlock(&watcher->sampler.lock);
+}
+
+/*******************************************************************************
+ * mf_watcher_free
+ ******************************************************************************/
+
+void
+mf_watcher_free(mf_watcher* watcher)
+{
+    size_t i;
+
+    if (watcher == NULL) {
+        return;
+    }
+
+    mf_sampler_stop(&watcher->sampler);
+
+    for (i = 0; i < watcher->count; ++i) {
+        free(watcher->watches[i].name);
+        free(watcher->watches[i].type);
+    }
+    free(watcher->watches);
+    free(watcher->metrics);
+    free(watcher);
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Sampling of variables registered by the application.
+ *
+ * Instead of reporting a progress counter or residual from inside its hot
+ * loop, the application registers the address of the variable once. A
+ * sampler thread reads all registered variables at a fixed interval and
+ * hands them to the callback as one batch, so the loop itself pays nothing
+ * for being monitored.
+ *
+ * The variables are read without synchronization; a naturally aligned
+ * variable of at most the machine word size is never read torn.
+ */
+
+#ifndef MF_WATCH_H_
+#define MF_WATCH_H_
+
+#include <stddef.h>
+
+#include "mf_api.h"
+
+#define MF_WATCH_INTERVAL_MS 1000
+
+typedef struct mf_watcher_t mf_watcher;
+
+/**
+ * @brief Receives the values of all watched variables of one sample.
+ *
+ * Called at every interval, with count 0 if no variable is watched. The
+ * timestamp of the metrics is NULL and may be set by the callback. The
+ * strings are only valid during the call.
+ *
+ * @return 1 if the sample was sent; 0 otherwise
+ */
+typedef int (*mf_watcher_cb)(mf_metric* metrics, size_t count, void* user_data);
+
+/**
+ * @brief Creates a watcher and starts its sampler thread.
+ *
+ * @return the watcher; NULL if out of resources
+ */
+mf_watcher* mf_watcher_new(
+    long interval_ms,
+    mf_watcher_cb callback,
+    void* user_data
+);
+
+/**
+ * @brief Registers the variable at addr, holding a value of the given kind
+ *        (one of MF_WATCH_*), as metric name of the given type.
+ *
+ * Registering an address again replaces its name, type and kind.
+ *
+ * @return 1 if successful; 0 otherwise
+ */
+int mf_watcher_add(
+    mf_watcher* watcher,
+    const char* name,
+    const char* type,
+    const volatile void* addr,
+    int kind
+);
+
+/**
+ * @brief Stops sampling the variable at addr.
+ *
+ * @return 1 if the variable was watched; 0 otherwise
+ */
+int mf_watcher_remove(mf_watcher* watcher, const volatile void* addr);
+
+/**
+ * @brief Changes the sampling interval, effective after the next sample.
+ */
+void mf_watcher_set_interval(mf_watcher* watcher, long interval_ms);
+
+/**
+ * @brief Samples all watched variables immediately.
+ */
+void mf_watcher_sample(mf_watcher* watcher);
+
+/**
+ * @brief Stops the sampler thread and frees the watcher.
+ */
+void mf_watcher_free(mf_watcher* watcher);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "mf_debug.h"
+#include "mf_buffer.h"
+
+#define MF_BUFFER_MIN_CAPACITY 256
+
+void
+mf_buffer_init(mf_buffer *buffer)
+{
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+void
+mf_buffer_free(mf_buffer *buffer)
+{
+    free(buffer->data);
+    mf_buffer_init(buffer);
+}
+
+int
+mf_buffer_grow(mf_buffer *buffer, size_t extra)
+{
+    size_t needed = buffer->size + extra + 1;
+    size_t capacity = buffer->capacity;
+
+    if (needed <= capacity) {
+        return 1;
+    }
+    if (capacity < MF_BUFFER_MIN_CAPACITY) {
+        capacity = MF_BUFFER_MIN_CAPACITY;
+    }
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+
+    char *data = (char *) realloc(buffer->data, capacity);
+    if (data == NULL) {
+        log_error("mf_buffer_grow(mf_buffer*, size_t) cannot allocate %zu bytes",
+            capacity);
+        return 0;
+    }
+    if (buffer->data == NULL) {
+        data[0] = '\0';
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+
+    return 1;
+}
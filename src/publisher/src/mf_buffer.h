@@ -0,0 +1,107 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Growable byte buffer used to serialize request bodies.
+ *
+ * The buffer keeps its memory when reset, so that a buffer reused across
+ * requests stops allocating once it has reached the size of the largest
+ * document. The content is always terminated by a '\0' byte, which is not
+ * counted in size.
+ */
+
+#ifndef MF_BUFFER_H_
+#define MF_BUFFER_H_
+
+#include <stddef.h>
+#include <string.h>
+
+typedef struct mf_buffer_t mf_buffer;
+
+struct mf_buffer_t {
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+/**
+ * @brief Initializes an empty buffer without allocating memory.
+ */
+void mf_buffer_init(mf_buffer *buffer);
+
+/**
+ * @brief Releases the memory held by the buffer.
+ */
+void mf_buffer_free(mf_buffer *buffer);
+
+/**
+ * @brief Ensures that at least extra more bytes can be appended.
+ *
+ * @return 1 if successful; 0 if out of memory
+ */
+int mf_buffer_grow(mf_buffer *buffer, size_t extra);
+
+/**
+ * @brief Empties the buffer but keeps its memory.
+ */
+static inline void
+mf_buffer_reset(mf_buffer *buffer)
+{
+    buffer->size = 0;
+    if (buffer->data != NULL) {
+        buffer->data[0] = '\0';
+    }
+}
+
+static inline int
+mf_buffer_reserve(mf_buffer *buffer, size_t extra)
+{
+    if (buffer->size + extra < buffer->capacity) {
+        return 1;
+    }
+    return mf_buffer_grow(buffer, extra);
+}
+
+/**
+ * @brief Appends size bytes of data.
+ *
+ * @return 1 if successful; 0 if out of memory
+ */
+static inline int
+mf_buffer_append(mf_buffer *buffer, const void *data, size_t size)
+{
+    if (!mf_buffer_reserve(buffer, size)) {
+        return 0;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    buffer->data[buffer->size] = '\0';
+    return 1;
+}
+
+static inline int
+mf_buffer_append_str(mf_buffer *buffer, const char *str)
+{
+    return mf_buffer_append(buffer, str, strlen(str));
+}
+
+static inline int
+mf_buffer_append_char(mf_buffer *buffer, char c)
+{
+    return mf_buffer_append(buffer, &c, 1);
+}
+
+#endif
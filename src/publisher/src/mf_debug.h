@@ -37,19 +37,26 @@
 #include <errno.h>
 #include <string.h>
 
+#include "mf_log.h"
+
+/*
+ * The messages are recorded in binary and formatted by a background thread
+ * (see mf_log.h); messages above the runtime level cost a single load.
+ */
+
 #ifdef NDEBUG
 #define debug(M, ...)
 #else
-#define debug(M, ...) fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__)
+#define debug(...) mf_log(MF_LOG_DEBUG, __VA_ARGS__)
 #endif
 
 #define clean_errno() (errno == 0 ? "None" : strerror(errno))
 
-#define log_error(M, ...) fprintf(stderr, "[ERROR] (%s:%d) " M " -- %s\n", __FILE__, __LINE__, clean_errno(), ##__VA_ARGS__)
+#define log_error(...) mf_log(MF_LOG_ERROR, __VA_ARGS__)
 
-#define log_warn(M, ...) fprintf(stderr, "[WARN] (%s:%d: errno: %s) " M "\n", __FILE__, __LINE__, clean_errno(), ##__VA_ARGS__)
+#define log_warn(...) mf_log(MF_LOG_WARN, __VA_ARGS__)
 
-#define log_info(M, ...) fprintf(stderr, "[INFO] (%s:%d) " M "\n", __FILE__, __LINE__, ##__VA_ARGS__)
+#define log_info(...) mf_log(MF_LOG_INFO, __VA_ARGS__)
 
 #define check(A, M, ...) if(!(A)) { log_err(M, ##__VA_ARGS__); errno=0; goto error; }
 
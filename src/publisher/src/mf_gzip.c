@@ -0,0 +1,95 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mf_debug.h"
+#include "mf_gzip.h"
+
+/* 15 bits of window, plus 16 selects the gzip wrapper instead of zlib */
+#define GZIP_WINDOW_BITS (15 + 16)
+#define GZIP_MEM_LEVEL 8
+
+void
+mf_gzip_init(mf_gzip *gz)
+{
+    memset(gz, 0, sizeof(mf_gzip));
+}
+
+void
+mf_gzip_free(mf_gzip *gz)
+{
+    if (gz->level > 0) {
+        deflateEnd(&gz->stream);
+    }
+    gz->level = 0;
+}
+
+static int
+prepare_stream(mf_gzip *gz, int level)
+{
+    if (gz->level == level) {
+        return deflateReset(&gz->stream) == Z_OK;
+    }
+
+    mf_gzip_free(gz);
+    memset(&gz->stream, 0, sizeof(z_stream));
+    if (deflateInit2(&gz->stream, level, Z_DEFLATED, GZIP_WINDOW_BITS,
+            GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        log_error("mf_gzip_compress() %s", "cannot initialize deflate");
+        return 0;
+    }
+    gz->level = level;
+    return 1;
+}
+
+int
+mf_gzip_compress(
+    mf_gzip *gz,
+    int level,
+    mf_buffer *out,
+    const void *data,
+    size_t size)
+{
+    if (level < Z_BEST_SPEED || level > Z_BEST_COMPRESSION) {
+        level = 6; /* what zlib uses for Z_DEFAULT_COMPRESSION */
+    }
+    if (!prepare_stream(gz, level)) {
+        return 0;
+    }
+
+    /* the bound holds for a single deflate() call with Z_FINISH */
+    size_t bound = deflateBound(&gz->stream, (uLong) size);
+    mf_buffer_reset(out);
+    if (!mf_buffer_reserve(out, bound)) {
+        return 0;
+    }
+
+    gz->stream.next_in = (Bytef*) data;
+    gz->stream.avail_in = (uInt) size;
+    gz->stream.next_out = (Bytef*) out->data;
+    gz->stream.avail_out = (uInt) bound;
+
+    if (deflate(&gz->stream, Z_FINISH) != Z_STREAM_END) {
+        log_error("mf_gzip_compress() %s", "deflate failed");
+        return 0;
+    }
+    out->size = gz->stream.total_out;
+    out->data[out->size] = '\0';
+
+    return 1;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @brief gzip compression of request bodies into an mf_buffer.
+ *
+ * The deflate state (about 256 KB at the default memory level) is allocated
+ * on the first call and reused by every later one, so that compressing a
+ * body costs no allocation once the output buffer has grown.
+ */
+
+#ifndef MF_GZIP_H_
+#define MF_GZIP_H_
+
+#include <zlib.h>
+
+#include "mf_buffer.h"
+
+#define MF_GZIP_ENCODING "gzip"
+
+typedef struct mf_gzip_t mf_gzip;
+
+struct mf_gzip_t {
+    z_stream stream;
+    int level; /* level the stream was initialized with; 0 if not yet */
+};
+
+/**
+ * @brief Initializes the state without allocating memory.
+ */
+void mf_gzip_init(mf_gzip *gz);
+
+/**
+ * @brief Releases the deflate state.
+ */
+void mf_gzip_free(mf_gzip *gz);
+
+/**
+ * @brief Replaces the content of out with the gzip member of data.
+ *
+ * level ranges from 1 (fastest) to 9 (smallest).
+ *
+ * @return 1 if successful; 0 if out of memory or on a zlib error
+ */
+int mf_gzip_compress(
+    mf_gzip *gz,
+    int level,
+    mf_buffer *out,
+    const void *data,
+    size_t size
+);
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mf_json.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+int
+mf_json_string(mf_buffer* buffer, const char* str)
+{
+    if (str == NULL) {
+        return mf_buffer_append(buffer, "null", 4);
+    }
+
+    if (!mf_buffer_append_char(buffer, '"')) {
+        return 0;
+    }
+
+    /* copy runs of characters that need no escaping in one go */
+    while (*str != '\0') {
+        size_t run = 0;
+        while (str[run] != '\0' && str[run] != '"' && str[run] != '\\' &&
+               (unsigned char) str[run] >= 0x20) {
+            run++;
+        }
+        if (run > 0 && !mf_buffer_append(buffer, str, run)) {
+            return 0;
+        }
+        str += run;
+        if (*str == '\0') {
+            break;
+        }
+
+        char escaped[6] = { '\\', *str, 0, 0, 0, 0 };
+        size_t length = 2;
+        switch (*str) {
+        case '"':
+        case '\\':
+            break;
+        case '\n':
+            escaped[1] = 'n';
+            break;
+        case '\r':
+            escaped[1] = 'r';
+            break;
+        case '\t':
+            escaped[1] = 't';
+            break;
+        default:
+            escaped[1] = 'u';
+            escaped[2] = '0';
+            escaped[3] = '0';
+            escaped[4] = hex_digits[(*str >> 4) & 0x0f];
+            escaped[5] = hex_digits[*str & 0x0f];
+            length = 6;
+        }
+        if (!mf_buffer_append(buffer, escaped, length)) {
+            return 0;
+        }
+        str++;
+    }
+
+    return mf_buffer_append_char(buffer, '"');
+}
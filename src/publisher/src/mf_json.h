@@ -0,0 +1,34 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Helpers to write JSON into an mf_buffer.
+ */
+
+#ifndef MF_JSON_H_
+#define MF_JSON_H_
+
+#include "mf_buffer.h"
+
+/**
+ * @brief Appends str as a quoted and escaped JSON string, or null if str is
+ *        NULL.
+ *
+ * @return 1 if successful; 0 if out of memory
+ */
+int mf_json_string(mf_buffer *buffer, const char *str);
+
+#endif
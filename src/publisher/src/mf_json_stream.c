@@ -0,0 +1,662 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mf_debug.h"
+#include "mf_buffer.h"
+#include "mf_json_stream.h"
+
+#define MAX_DEPTH 64
+
+enum state {
+    ST_VALUE,           /* expecting a value */
+    ST_VALUE_OR_CLOSE,  /* after '[' */
+    ST_KEY,             /* after ',' in an object */
+    ST_KEY_OR_CLOSE,    /* after '{' */
+    ST_COLON,
+    ST_AFTER,           /* after a value: ',' or a closing bracket */
+    ST_STRING,
+    ST_ESCAPE,
+    ST_UNICODE,
+    ST_LITERAL,
+    ST_RAW,             /* copying an array nested in a record verbatim */
+    ST_DONE,
+    ST_ERROR,
+    ST_STOPPED
+};
+
+struct mf_json_stream_t {
+    mf_json_record_cb callback;
+    void* user_data;
+
+    enum state state;
+    int depth;
+    char stack[MAX_DEPTH];
+    int string_is_key;
+
+    /* \uXXXX escapes */
+    unsigned int unicode;
+    int unicode_digits;
+    unsigned int high_surrogate;
+
+    /* nested arrays copied verbatim */
+    int raw_depth;
+    int raw_in_string;
+    int raw_escape;
+
+    /* current record: key and value strings stored back to back */
+    int in_record;
+    mf_buffer fields;
+    size_t* offsets;
+    size_t n_offsets;
+    size_t max_offsets;
+    const char** keys;
+    const char** values;
+    size_t max_fields;
+
+    mf_buffer token;    /* string or literal being parsed */
+    mf_buffer key;      /* dotted key of the current field */
+    mf_buffer prefix;   /* dotted path of nested objects */
+    size_t prefix_size[MAX_DEPTH];
+
+    unsigned long records;
+};
+
+/*******************************************************************************
+ * mf_json_stream_new
+ ******************************************************************************/
+
+mf_json_stream*
+mf_json_stream_new(mf_json_record_cb callback, void* user_data)
+{
+    mf_json_stream* stream = (mf_json_stream*) calloc(1, sizeof(mf_json_stream));
+    if (stream == NULL) {
+        log_error("mf_json_stream_new(...) %s", "out of memory");
+        return NULL;
+    }
+
+    stream->callback = callback;
+    stream->user_data = user_data;
+    stream->state = ST_VALUE;
+    mf_buffer_init(&stream->fields);
+    mf_buffer_init(&stream->token);
+    mf_buffer_init(&stream->key);
+    mf_buffer_init(&stream->prefix);
+
+    return stream;
+}
+
+/*******************************************************************************
+ * mf_json_stream_free
+ ******************************************************************************/
+
+void
+mf_json_stream_free(mf_json_stream* stream)
+{
+    if (stream == NULL) {
+        return;
+    }
+
+    mf_buffer_free(&stream->fields);
+    mf_buffer_free(&stream->token);
+    mf_buffer_free(&stream->key);
+    mf_buffer_free(&stream->prefix);
+    free(stream->offsets);
+    free(stream->keys);
+    free(stream->values);
+    free(stream);
+}
+
+/*******************************************************************************
+ * Records
+ ******************************************************************************/
+
+static int
+add_field(mf_json_stream* stream)
+{
+    if (stream->fields.size + stream->key.size + stream->token.size >
+        MF_JSON_MAX_RECORD) {
+        log_error("mf_json_stream_feed(...) record exceeds %d bytes",
+            MF_JSON_MAX_RECORD);
+        return 0;
+    }
+
+    if (stream->n_offsets + 2 > stream->max_offsets) {
+        size_t max = (stream->max_offsets == 0) ? 32 : stream->max_offsets * 2;
+        size_t* offsets = (size_t*) realloc(stream->offsets, max * sizeof(size_t));
+        if (offsets == NULL) {
+            return 0;
+        }
+        stream->offsets = offsets;
+        stream->max_offsets = max;
+    }
+
+    /* keep the terminating '\0' of key and value */
+    stream->offsets[stream->n_offsets++] = stream->fields.size;
+    if (!mf_buffer_append(&stream->fields, stream->key.data, stream->key.size + 1)) {
+        return 0;
+    }
+    stream->offsets[stream->n_offsets++] = stream->fields.size;
+    return mf_buffer_append(&stream->fields, stream->token.data, stream->token.size + 1);
+}
+
+static int
+emit_record(mf_json_stream* stream)
+{
+    size_t count = stream->n_offsets / 2;
+    size_t i;
+
+    if (count > stream->max_fields) {
+        const char** keys = (const char**) realloc(stream->keys, count * sizeof(char*));
+        if (keys == NULL) {
+            return 0;
+        }
+        stream->keys = keys;
+        const char** values = (const char**) realloc(stream->values, count * sizeof(char*));
+        if (values == NULL) {
+            return 0;
+        }
+        stream->values = values;
+        stream->max_fields = count;
+    }
+
+    for (i = 0; i < count; ++i) {
+        stream->keys[i] = stream->fields.data + stream->offsets[2 * i];
+        stream->values[i] = stream->fields.data + stream->offsets[2 * i + 1];
+    }
+
+    stream->records++;
+    stream->in_record = 0;
+    if (stream->callback != NULL &&
+        stream->callback(stream->keys, stream->values, count, stream->user_data) != 0) {
+        stream->state = ST_STOPPED;
+    }
+
+    return 1;
+}
+
+/*******************************************************************************
+ * Tokens
+ ******************************************************************************/
+
+/* the token buffer always holds a (possibly empty) '\0'-terminated string */
+static int
+reset_token(mf_buffer* token)
+{
+    mf_buffer_reset(token);
+    return mf_buffer_reserve(token, 0);
+}
+
+static int
+append_utf8(mf_buffer* buffer, unsigned int cp)
+{
+    char out[4];
+    size_t length;
+
+    if (cp < 0x80) {
+        out[0] = (char) cp;
+        length = 1;
+    } else if (cp < 0x800) {
+        out[0] = (char) (0xc0 | (cp >> 6));
+        out[1] = (char) (0x80 | (cp & 0x3f));
+        length = 2;
+    } else if (cp < 0x10000) {
+        out[0] = (char) (0xe0 | (cp >> 12));
+        out[1] = (char) (0x80 | ((cp >> 6) & 0x3f));
+        out[2] = (char) (0x80 | (cp & 0x3f));
+        length = 3;
+    } else {
+        out[0] = (char) (0xf0 | (cp >> 18));
+        out[1] = (char) (0x80 | ((cp >> 12) & 0x3f));
+        out[2] = (char) (0x80 | ((cp >> 6) & 0x3f));
+        out[3] = (char) (0x80 | (cp & 0x3f));
+        length = 4;
+    }
+
+    return mf_buffer_append(buffer, out, length);
+}
+
+static int
+append_code_point(mf_json_stream* stream, unsigned int cp)
+{
+    if (cp >= 0xd800 && cp <= 0xdbff) {
+        if (stream->high_surrogate != 0 && !append_utf8(&stream->token, 0xfffd)) {
+            return 0;
+        }
+        stream->high_surrogate = cp;
+        return 1;
+    }
+    if (cp >= 0xdc00 && cp <= 0xdfff) {
+        if (stream->high_surrogate == 0) {
+            return append_utf8(&stream->token, 0xfffd);
+        }
+        cp = 0x10000 + ((stream->high_surrogate - 0xd800) << 10) + (cp - 0xdc00);
+        stream->high_surrogate = 0;
+        return append_utf8(&stream->token, cp);
+    }
+    if (stream->high_surrogate != 0) {
+        stream->high_surrogate = 0;
+        if (!append_utf8(&stream->token, 0xfffd)) {
+            return 0;
+        }
+    }
+    return append_utf8(&stream->token, cp);
+}
+
+static int
+is_literal_char(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+        c == '-' || c == '+' || c == '.' || c == 'E';
+}
+
+static int
+is_valid_literal(const mf_buffer* token)
+{
+    const char* s = token->data;
+
+    if (strcmp(s, "true") == 0 || strcmp(s, "false") == 0 ||
+        strcmp(s, "null") == 0) {
+        return 1;
+    }
+    if (*s == '-') {
+        s++;
+    }
+    if (*s < '0' || *s > '9') {
+        return 0;
+    }
+
+    char* end;
+    strtod(token->data, &end);
+    return *end == '\0';
+}
+
+/*******************************************************************************
+ * Structure
+ ******************************************************************************/
+
+static int
+value_done(mf_json_stream* stream)
+{
+    if (stream->in_record && !add_field(stream)) {
+        return 0;
+    }
+    stream->state = (stream->depth == 0) ? ST_DONE : ST_AFTER;
+    return 1;
+}
+
+static int
+key_done(mf_json_stream* stream)
+{
+    if (stream->in_record) {
+        mf_buffer_reset(&stream->key);
+        if (!mf_buffer_append(&stream->key, stream->prefix.data, stream->prefix.size) ||
+            !mf_buffer_append(&stream->key, stream->token.data, stream->token.size)) {
+            return 0;
+        }
+    }
+    stream->state = ST_COLON;
+    return 1;
+}
+
+static int
+open_object(mf_json_stream* stream)
+{
+    if (stream->depth == MAX_DEPTH) {
+        log_error("mf_json_stream_feed(...) nesting exceeds %d", MAX_DEPTH);
+        return 0;
+    }
+
+    if (stream->depth == 1) {
+        /* a new record */
+        stream->in_record = 1;
+        stream->n_offsets = 0;
+        mf_buffer_reset(&stream->fields);
+        if (!reset_token(&stream->prefix)) {
+            return 0;
+        }
+    } else if (stream->in_record) {
+        /* nested object: its keys are prefixed with the current key */
+        stream->prefix_size[stream->depth] = stream->prefix.size;
+        stream->prefix.size = 0;
+        if (!mf_buffer_append(&stream->prefix, stream->key.data, stream->key.size) ||
+            !mf_buffer_append_char(&stream->prefix, '.')) {
+            return 0;
+        }
+    }
+
+    stream->stack[stream->depth++] = '{';
+    stream->state = ST_KEY_OR_CLOSE;
+    return 1;
+}
+
+static int
+open_array(mf_json_stream* stream)
+{
+    if (stream->in_record) {
+        stream->raw_depth = 1;
+        stream->raw_in_string = 0;
+        stream->raw_escape = 0;
+        stream->state = ST_RAW;
+        return reset_token(&stream->token) &&
+            mf_buffer_append_char(&stream->token, '[');
+    }
+
+    if (stream->depth == MAX_DEPTH) {
+        log_error("mf_json_stream_feed(...) nesting exceeds %d", MAX_DEPTH);
+        return 0;
+    }
+    stream->stack[stream->depth++] = '[';
+    stream->state = ST_VALUE_OR_CLOSE;
+    return 1;
+}
+
+static int
+close_container(mf_json_stream* stream, char c)
+{
+    char open = (c == '}') ? '{' : '[';
+
+    if (stream->depth == 0 || stream->stack[stream->depth - 1] != open) {
+        return 0;
+    }
+    stream->depth--;
+
+    if (stream->in_record) {
+        if (stream->depth == 1) {
+            if (!emit_record(stream)) {
+                return 0;
+            }
+            if (stream->state == ST_STOPPED) {
+                return 1;
+            }
+        } else {
+            stream->prefix.size = stream->prefix_size[stream->depth];
+            stream->prefix.data[stream->prefix.size] = '\0';
+        }
+    }
+
+    stream->state = (stream->depth == 0) ? ST_DONE : ST_AFTER;
+    return 1;
+}
+
+static int
+start_value(mf_json_stream* stream, char c)
+{
+    switch (c) {
+    case '"':
+        stream->string_is_key = 0;
+        stream->state = ST_STRING;
+        return reset_token(&stream->token);
+    case '{':
+        return open_object(stream);
+    case '[':
+        return open_array(stream);
+    default:
+        if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+            stream->state = ST_LITERAL;
+            return reset_token(&stream->token) &&
+                mf_buffer_append_char(&stream->token, c);
+        }
+        return 0;
+    }
+}
+
+static int
+is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/*
+ * Processes a single byte; returns 0 on malformed input.
+ */
+static int
+process(mf_json_stream* stream, char c)
+{
+    switch (stream->state) {
+    case ST_VALUE_OR_CLOSE:
+        if (c == ']') {
+            return close_container(stream, c);
+        }
+        /* fall through */
+    case ST_VALUE:
+        if (is_space(c)) {
+            return 1;
+        }
+        return start_value(stream, c);
+
+    case ST_KEY_OR_CLOSE:
+        if (c == '}') {
+            return close_container(stream, c);
+        }
+        /* fall through */
+    case ST_KEY:
+        if (is_space(c)) {
+            return 1;
+        }
+        if (c != '"') {
+            return 0;
+        }
+        stream->string_is_key = 1;
+        stream->state = ST_STRING;
+        return reset_token(&stream->token);
+
+    case ST_COLON:
+        if (is_space(c)) {
+            return 1;
+        }
+        if (c != ':') {
+            return 0;
+        }
+        stream->state = ST_VALUE;
+        return 1;
+
+    case ST_AFTER:
+        if (is_space(c)) {
+            return 1;
+        }
+        if (c == ',') {
+            stream->state = (stream->stack[stream->depth - 1] == '{') ?
+                ST_KEY : ST_VALUE;
+            return 1;
+        }
+        if (c == '}' || c == ']') {
+            return close_container(stream, c);
+        }
+        return 0;
+
+    case ST_STRING:
+        if (c == '"') {
+            if (stream->high_surrogate != 0) {
+                stream->high_surrogate = 0;
+                if (!append_utf8(&stream->token, 0xfffd)) {
+                    return 0;
+                }
+            }
+            return stream->string_is_key ? key_done(stream) : value_done(stream);
+        }
+        if (c == '\\') {
+            stream->state = ST_ESCAPE;
+            return 1;
+        }
+        if ((unsigned char) c < 0x20) {
+            return 0;
+        }
+        if (!stream->in_record) {
+            return 1;
+        }
+        if (stream->token.size > MF_JSON_MAX_RECORD) {
+            return 0;
+        }
+        return mf_buffer_append_char(&stream->token, c);
+
+    case ST_ESCAPE:
+        stream->state = ST_STRING;
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            break;
+        case 'b':
+            c = '\b';
+            break;
+        case 'f':
+            c = '\f';
+            break;
+        case 'n':
+            c = '\n';
+            break;
+        case 'r':
+            c = '\r';
+            break;
+        case 't':
+            c = '\t';
+            break;
+        case 'u':
+            stream->unicode = 0;
+            stream->unicode_digits = 0;
+            stream->state = ST_UNICODE;
+            return 1;
+        default:
+            return 0;
+        }
+        return !stream->in_record || mf_buffer_append_char(&stream->token, c);
+
+    case ST_UNICODE: {
+        int digit = hex_value(c);
+        if (digit < 0) {
+            return 0;
+        }
+        stream->unicode = (stream->unicode << 4) | digit;
+        if (++stream->unicode_digits < 4) {
+            return 1;
+        }
+        stream->state = ST_STRING;
+        return !stream->in_record || append_code_point(stream, stream->unicode);
+    }
+
+    case ST_LITERAL:
+        if (is_literal_char(c)) {
+            if (stream->token.size > 64) {
+                return 0;
+            }
+            return mf_buffer_append_char(&stream->token, c);
+        }
+        if (!is_valid_literal(&stream->token) || !value_done(stream)) {
+            return 0;
+        }
+        /* the delimiter belongs to the enclosing structure */
+        return process(stream, c);
+
+    case ST_RAW:
+        if (stream->token.size > MF_JSON_MAX_RECORD ||
+            !mf_buffer_append_char(&stream->token, c)) {
+            return 0;
+        }
+        if (stream->raw_in_string) {
+            if (stream->raw_escape) {
+                stream->raw_escape = 0;
+            } else if (c == '\\') {
+                stream->raw_escape = 1;
+            } else if (c == '"') {
+                stream->raw_in_string = 0;
+            }
+            return 1;
+        }
+        if (c == '"') {
+            stream->raw_in_string = 1;
+        } else if (c == '[' || c == '{') {
+            stream->raw_depth++;
+        } else if (c == ']' || c == '}') {
+            if (--stream->raw_depth == 0) {
+                return value_done(stream);
+            }
+        }
+        return 1;
+
+    case ST_DONE:
+        return is_space(c);
+
+    default:
+        return 0;
+    }
+}
+
+/*******************************************************************************
+ * mf_json_stream_feed
+ ******************************************************************************/
+
+int
+mf_json_stream_feed(mf_json_stream* stream, const char* data, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; ++i) {
+        if (stream->state == ST_STOPPED || stream->state == ST_ERROR) {
+            return 0;
+        }
+        if (!process(stream, data[i])) {
+            log_error("mf_json_stream_feed(...) malformed JSON near '%c'", data[i]);
+            stream->state = ST_ERROR;
+            return 0;
+        }
+    }
+
+    return stream->state != ST_STOPPED && stream->state != ST_ERROR;
+}
+
+/*******************************************************************************
+ * mf_json_stream_finish
+ ******************************************************************************/
+
+int
+mf_json_stream_finish(mf_json_stream* stream)
+{
+    /* a top-level literal is only terminated by the end of the document */
+    if (stream->state == ST_LITERAL && stream->depth == 0) {
+        if (!is_valid_literal(&stream->token)) {
+            return 0;
+        }
+        stream->state = ST_DONE;
+    }
+
+    return stream->state == ST_DONE || stream->state == ST_STOPPED;
+}
+
+/*******************************************************************************
+ * mf_json_stream_records
+ ******************************************************************************/
+
+unsigned long
+mf_json_stream_records(const mf_json_stream* stream)
+{
+    return stream->records;
+}
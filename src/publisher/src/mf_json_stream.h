@@ -0,0 +1,79 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Incremental JSON parser that reports one record at a time.
+ *
+ * The parser accepts a JSON document in arbitrarily split chunks, as they
+ * arrive from the network, and invokes a callback for every record. A record
+ * is an object nested directly in the top-level array or object, e.g. each
+ * metric document in [{...}, {...}] or each value in {"id1": {...}}.
+ *
+ * Fields of a record are passed as '\0'-terminated key and value strings.
+ * Keys of nested objects are flattened into dotted paths ("_source.host"),
+ * nested arrays are passed as raw JSON text, and numbers, true, false and null
+ * as their literal text. The strings are only valid during the callback.
+ *
+ * Memory use is bounded by the size of the largest record, independent of
+ * the size of the document.
+ */
+
+#ifndef MF_JSON_STREAM_H_
+#define MF_JSON_STREAM_H_
+
+#include <stddef.h>
+
+/* records larger than this are rejected as malformed */
+#define MF_JSON_MAX_RECORD (16 * 1024 * 1024)
+
+/**
+ * @brief Called for every record; returning non-zero stops parsing.
+ */
+typedef int (*mf_json_record_cb)(
+    const char** keys,
+    const char** values,
+    size_t count,
+    void* user_data
+);
+
+typedef struct mf_json_stream_t mf_json_stream;
+
+mf_json_stream* mf_json_stream_new(mf_json_record_cb callback, void* user_data);
+
+void mf_json_stream_free(mf_json_stream* stream);
+
+/**
+ * @brief Parses the next chunk of the document.
+ *
+ * @return 1 to continue; 0 if the document is malformed or the callback
+ *         asked to stop
+ */
+int mf_json_stream_feed(mf_json_stream* stream, const char* data, size_t size);
+
+/**
+ * @brief Checks that the document seen so far is complete.
+ *
+ * @return 1 if a complete document was parsed or the callback stopped the
+ *         parser; 0 otherwise
+ */
+int mf_json_stream_finish(mf_json_stream* stream);
+
+/**
+ * @brief Returns the number of records reported so far.
+ */
+unsigned long mf_json_stream_records(const mf_json_stream* stream);
+
+#endif
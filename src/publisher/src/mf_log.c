@@ -0,0 +1,619 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "mf_log.h"
+
+#define RING_MASK (MF_LOG_RING_SIZE - 1)
+#define HEADER_SIZE (5 * sizeof(size_t) + 2 * sizeof(const char *))
+#define DATA_SIZE (MF_LOG_RECORD_SIZE - HEADER_SIZE)
+#define LINE_SIZE 1024
+#define IDLE_NS (20 * 1000000L)
+
+/*
+ * A slot of the ring. Its turn counts the laps of the ring: the producer of
+ * position pos may fill it when turn is 2 * (pos / MF_LOG_RING_SIZE), the
+ * consumer may decode it at the next turn, and hands it back to the next
+ * lap with the turn after. A zeroed ring is thus empty.
+ */
+typedef struct record_t {
+    size_t turn;
+    size_t level;
+    size_t line;
+    size_t error;
+    size_t size;       /* of the arguments in data */
+    const char *file;
+    const char *format;
+    unsigned char data[DATA_SIZE];
+} record;
+
+int mf_log_level = MF_LOG_WARN;
+
+static record ring[MF_LOG_RING_SIZE];
+static size_t head;
+static size_t tail;              /* only advanced with drain_lock held */
+static unsigned long dropped;
+static unsigned long reported_dropped;
+static FILE *output;
+
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The decoder thread runs while its generation is current; mf_log_stop()
+ * advances the generation, so a decoder started again right afterwards is
+ * not confused with the one stopping.
+ */
+static pthread_mutex_t decoder_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t decoder_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t decoder;
+static size_t decoder_generation;
+static int decoder_running;      /* also read without decoder_lock */
+static int handlers_registered;
+
+/*
+ * Argument classes, to which the conversions are normalized on both ends.
+ */
+enum { ARG_NONE, ARG_SIGNED, ARG_UNSIGNED, ARG_DOUBLE, ARG_STRING, ARG_POINTER };
+
+/*
+ * A conversion specification of a format string.
+ */
+typedef struct spec_t {
+    const char *start;  /* the '%' */
+    const char *end;    /* after the conversion character */
+    int stars;          /* '*' for width and precision */
+    int length;         /* 'h', 'l', 'q' (ll), 'L', 'j', 'z' or 't'; 0 if none */
+    int type;           /* ARG_* */
+} spec;
+
+/*
+ * Parses the conversion at p, just after a '%'. Returns 0 for "%%".
+ */
+static int
+parse_spec(const char *p, spec *s)
+{
+    s->start = p - 1;
+    s->stars = 0;
+    s->length = 0;
+
+    if (*p == '%') {
+        s->end = p + 1;
+        return 0;
+    }
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL) {
+        p++;
+    }
+    if (*p == '*') {
+        s->stars++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            s->stars++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    if (*p == 'h' || *p == 'l' || *p == 'L' || *p == 'j' || *p == 'z' ||
+        *p == 't') {
+        s->length = *p++;
+        if ((s->length == 'h' || s->length == 'l') && *p == s->length) {
+            s->length = (s->length == 'l') ? 'q' : 'h';
+            p++;
+        }
+    }
+
+    switch (*p) {
+    case 'd': case 'i':
+        s->type = ARG_SIGNED;
+        break;
+    case 'u': case 'o': case 'x': case 'X': case 'c':
+        s->type = ARG_UNSIGNED;
+        break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        s->type = ARG_DOUBLE;
+        break;
+    case 's':
+        s->type = ARG_STRING;
+        break;
+    case 'p':
+        s->type = ARG_POINTER;
+        break;
+    default:
+        s->type = ARG_NONE;
+        break;
+    }
+    s->end = (*p != '\0') ? p + 1 : p;
+
+    return 1;
+}
+
+static int
+put(record *r, size_t *size, const void *value, size_t length)
+{
+    if (*size + length > DATA_SIZE) {
+        return 0;
+    }
+    memcpy(r->data + *size, value, length);
+    *size += length;
+    return 1;
+}
+
+/*
+ * Copies the arguments of the format into the record, normalized to 64 bit
+ * integers, doubles and copied strings. Stops at the first argument that
+ * does not fit; the decoder prints "?" for the rest.
+ */
+static size_t
+encode_args(record *r, const char *format, va_list args)
+{
+    size_t size = 0;
+    const char *p;
+    spec s;
+    int i;
+
+    for (p = strchr(format, '%'); p != NULL; p = strchr(s.end, '%')) {
+        if (!parse_spec(p + 1, &s)) {
+            continue;
+        }
+        for (i = 0; i < s.stars; ++i) {
+            long long star = va_arg(args, int);
+            if (!put(r, &size, &star, sizeof(star))) {
+                return size;
+            }
+        }
+
+        int fits = 1;
+        if (s.type == ARG_SIGNED) {
+            long long value;
+            switch (s.length) {
+            case 'l': value = va_arg(args, long); break;
+            case 'q': value = va_arg(args, long long); break;
+            case 'j': value = va_arg(args, intmax_t); break;
+            case 'z': value = va_arg(args, ssize_t); break;
+            case 't': value = va_arg(args, ptrdiff_t); break;
+            default:  value = va_arg(args, int); break;
+            }
+            fits = put(r, &size, &value, sizeof(value));
+        } else if (s.type == ARG_UNSIGNED) {
+            unsigned long long value;
+            switch (s.length) {
+            case 'l': value = va_arg(args, unsigned long); break;
+            case 'q': value = va_arg(args, unsigned long long); break;
+            case 'j': value = va_arg(args, uintmax_t); break;
+            case 'z': value = va_arg(args, size_t); break;
+            case 't': value = va_arg(args, ptrdiff_t); break;
+            default:  value = va_arg(args, unsigned int); break;
+            }
+            fits = put(r, &size, &value, sizeof(value));
+        } else if (s.type == ARG_DOUBLE) {
+            double value = (s.length == 'L') ?
+                (double) va_arg(args, long double) : va_arg(args, double);
+            fits = put(r, &size, &value, sizeof(value));
+        } else if (s.type == ARG_POINTER) {
+            void *value = va_arg(args, void *);
+            fits = put(r, &size, &value, sizeof(value));
+        } else if (s.type == ARG_STRING) {
+            const char *value = va_arg(args, const char *);
+            if (value == NULL) {
+                value = "(null)";
+            }
+            size_t length = strlen(value);
+            if (size >= DATA_SIZE) {
+                fits = 0;
+            } else {
+                if (length > DATA_SIZE - size - 1) {
+                    length = DATA_SIZE - size - 1;
+                }
+                memcpy(r->data + size, value, length);
+                r->data[size + length] = '\0';
+                size += length + 1;
+            }
+        } else {
+            /* %n and unknown conversions are not supported */
+            break;
+        }
+        if (!fits) {
+            break;
+        }
+    }
+    return size;
+}
+
+static int
+take(const record *r, size_t *offset, void *value, size_t length)
+{
+    if (*offset + length > r->size) {
+        return 0;
+    }
+    memcpy(value, r->data + *offset, length);
+    *offset += length;
+    return 1;
+}
+
+/*
+ * Appends the conversion s with the next argument of the record to line.
+ * The length modifier is replaced by the one of the normalized argument,
+ * and stars by the widths recorded.
+ */
+static void
+decode_arg(const record *r, size_t *offset, const spec *s, char *line,
+           size_t *used)
+{
+    char format[64];
+    size_t n = 0;
+    const char *p;
+    int ok = 1;
+
+    for (p = s->start; p < s->end - 1 && n < sizeof(format) - 24; ++p) {
+        if (*p == '*') {
+            long long star = 0;
+            ok = ok && take(r, offset, &star, sizeof(star));
+            n += snprintf(format + n, sizeof(format) - n, "%lld", star);
+        } else if (strchr("hlLjzt", *p) == NULL) {
+            format[n++] = *p;
+        }
+    }
+    char conversion = *(s->end - 1);
+    if ((s->type == ARG_SIGNED || s->type == ARG_UNSIGNED) && conversion != 'c') {
+        format[n++] = 'l';
+        format[n++] = 'l';
+    }
+    format[n++] = conversion;
+    format[n] = '\0';
+
+    size_t left = LINE_SIZE - *used;
+    int written = 0;
+    if (conversion == 'c') {
+        unsigned long long value;
+        ok = ok && take(r, offset, &value, sizeof(value));
+        written = ok ? snprintf(line + *used, left, format, (int) value) : 0;
+    } else if (s->type == ARG_SIGNED) {
+        long long value;
+        ok = ok && take(r, offset, &value, sizeof(value));
+        written = ok ? snprintf(line + *used, left, format, value) : 0;
+    } else if (s->type == ARG_UNSIGNED) {
+        unsigned long long value;
+        ok = ok && take(r, offset, &value, sizeof(value));
+        written = ok ? snprintf(line + *used, left, format, value) : 0;
+    } else if (s->type == ARG_DOUBLE) {
+        double value;
+        ok = ok && take(r, offset, &value, sizeof(value));
+        written = ok ? snprintf(line + *used, left, format, value) : 0;
+    } else if (s->type == ARG_POINTER) {
+        void *value;
+        ok = ok && take(r, offset, &value, sizeof(value));
+        written = ok ? snprintf(line + *used, left, format, value) : 0;
+    } else if (s->type == ARG_STRING) {
+        const char *value = (const char *) r->data + *offset;
+        ok = *offset < r->size;
+        if (ok) {
+            *offset += strlen(value) + 1;
+            written = snprintf(line + *used, left, format, value);
+        }
+    }
+    if (!ok) {
+        written = snprintf(line + *used, left, "?");
+    }
+    *used += ((size_t) written < left) ? (size_t) written : left - 1;
+}
+
+static const char *
+error_string(int error)
+{
+    return (error == 0) ? "None" : strerror(error);
+}
+
+/*
+ * Formats the record like the fprintf() macros of mf_debug.h did.
+ */
+static size_t
+decode(const record *r, char *line)
+{
+    size_t used;
+    size_t offset = 0;
+    const char *p;
+    spec s;
+
+    switch (r->level) {
+    case MF_LOG_ERROR:
+        used = snprintf(line, LINE_SIZE, "[ERROR] (%s:%zu: errno: %s) ",
+            r->file, r->line, error_string(r->error));
+        break;
+    case MF_LOG_WARN:
+        used = snprintf(line, LINE_SIZE, "[WARN] (%s:%zu: errno: %s) ",
+            r->file, r->line, error_string(r->error));
+        break;
+    case MF_LOG_INFO:
+        used = snprintf(line, LINE_SIZE, "[INFO] (%s:%zu) ", r->file, r->line);
+        break;
+    default:
+        used = snprintf(line, LINE_SIZE, "DEBUG %s:%zu: ", r->file, r->line);
+        break;
+    }
+
+    for (p = r->format; *p != '\0' && used < LINE_SIZE - 2; ) {
+        const char *percent = strchr(p, '%');
+        size_t literal = (percent != NULL) ? (size_t) (percent - p) : strlen(p);
+        if (literal > LINE_SIZE - 2 - used) {
+            literal = LINE_SIZE - 2 - used;
+        }
+        memcpy(line + used, p, literal);
+        used += literal;
+        if (percent == NULL || used >= LINE_SIZE - 2) {
+            break;
+        }
+
+        if (!parse_spec(percent + 1, &s)) {
+            line[used++] = '%';
+        } else if (s.type != ARG_NONE) {
+            decode_arg(r, &offset, &s, line, &used);
+        }
+        p = s.end;
+    }
+    line[used++] = '\n';
+    line[used] = '\0';
+
+    return used;
+}
+
+/*
+ * Decodes the records ready in order; returns the number decoded.
+ */
+static size_t
+drain()
+{
+    char line[LINE_SIZE + 1];
+    size_t count = 0;
+
+    pthread_mutex_lock(&drain_lock);
+    FILE *out = (output != NULL) ? output : stderr;
+    for (;;) {
+        record *r = &ring[tail & RING_MASK];
+        size_t turn = 2 * (tail / MF_LOG_RING_SIZE);
+        if (__atomic_load_n(&r->turn, __ATOMIC_ACQUIRE) != turn + 1) {
+            break;
+        }
+        fwrite(line, 1, decode(r, line), out);
+        __atomic_store_n(&r->turn, turn + 2, __ATOMIC_RELEASE);
+        tail++;
+        count++;
+    }
+
+    unsigned long lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (lost != reported_dropped) {
+        fprintf(out, "[WARN] (%s:%d: errno: None) %lu log records dropped\n",
+            __FILE__, __LINE__, lost - reported_dropped);
+        reported_dropped = lost;
+    }
+    pthread_mutex_unlock(&drain_lock);
+
+    return count;
+}
+
+static void *
+decoder_main(void *arg)
+{
+    size_t generation = (size_t) arg;
+
+    pthread_mutex_lock(&decoder_lock);
+    while (generation == decoder_generation) {
+        pthread_mutex_unlock(&decoder_lock);
+        size_t count = drain();
+        pthread_mutex_lock(&decoder_lock);
+
+        if (count == 0 && generation == decoder_generation) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += IDLE_NS;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&decoder_wake, &decoder_lock, &until);
+        }
+    }
+    pthread_mutex_unlock(&decoder_lock);
+
+    return NULL;
+}
+
+/*
+ * Fork handlers: the child inherits neither the decoder thread nor a lock
+ * held by another thread, so it starts a decoder of its own when needed.
+ */
+static void
+before_fork()
+{
+    pthread_mutex_lock(&decoder_lock);
+    pthread_mutex_lock(&drain_lock);
+}
+
+static void
+after_fork_in_parent()
+{
+    pthread_mutex_unlock(&drain_lock);
+    pthread_mutex_unlock(&decoder_lock);
+}
+
+static void
+after_fork_in_child()
+{
+    __atomic_store_n(&decoder_running, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&drain_lock);
+    pthread_mutex_unlock(&decoder_lock);
+}
+
+static void
+start_decoder()
+{
+    pthread_mutex_lock(&decoder_lock);
+    if (!decoder_running) {
+        if (!handlers_registered) {
+            /* records left at exit are decoded by mf_log_stop() */
+            atexit(mf_log_stop);
+            pthread_atfork(before_fork, after_fork_in_parent,
+                after_fork_in_child);
+            handlers_registered = 1;
+        }
+        if (pthread_create(&decoder, NULL, decoder_main,
+                (void *) decoder_generation) == 0) {
+            __atomic_store_n(&decoder_running, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&decoder_lock);
+}
+
+void
+mf_log_write(int level, const char *file, int line, const char *format, ...)
+{
+    int error = errno;
+    size_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    record *r;
+    size_t turn;
+    va_list args;
+
+    if (!__atomic_load_n(&decoder_running, __ATOMIC_RELAXED)) {
+        start_decoder();
+    }
+
+    for (;;) {
+        r = &ring[pos & RING_MASK];
+        turn = 2 * (pos / MF_LOG_RING_SIZE);
+        size_t current = __atomic_load_n(&r->turn, __ATOMIC_ACQUIRE);
+        if (current == turn) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, 1,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (current < turn) {
+            /* the decoder is a full ring behind */
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            errno = error;
+            return;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+
+    r->level = level;
+    r->line = line;
+    r->error = error;
+    r->file = file;
+    r->format = format;
+    va_start(args, format);
+    r->size = encode_args(r, format, args);
+    va_end(args);
+    __atomic_store_n(&r->turn, turn + 1, __ATOMIC_RELEASE);
+
+    errno = error;
+}
+
+void
+mf_log_set_level(int level)
+{
+    if (level < MF_LOG_ERROR) {
+        level = MF_LOG_ERROR;
+    } else if (level > MF_LOG_DEBUG) {
+        level = MF_LOG_DEBUG;
+    }
+    __atomic_store_n(&mf_log_level, level, __ATOMIC_RELAXED);
+}
+
+int
+mf_log_get_level()
+{
+    return __atomic_load_n(&mf_log_level, __ATOMIC_RELAXED);
+}
+
+void
+mf_log_set_output(FILE *out)
+{
+    pthread_mutex_lock(&drain_lock);
+    output = out;
+    pthread_mutex_unlock(&drain_lock);
+}
+
+void
+mf_log_flush()
+{
+    drain();
+}
+
+void
+mf_log_stop()
+{
+    pthread_mutex_lock(&decoder_lock);
+    int running = decoder_running;
+    pthread_t thread = decoder;
+    if (running) {
+        decoder_generation++;
+        __atomic_store_n(&decoder_running, 0, __ATOMIC_RELAXED);
+        pthread_cond_signal(&decoder_wake);
+    }
+    pthread_mutex_unlock(&decoder_lock);
+
+    if (running) {
+        pthread_join(thread, NULL);
+    }
+    drain();
+}
+
+unsigned long
+mf_log_get_dropped()
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+/*
+ * Reads MF_LOG_LEVEL when the library is loaded.
+ */
+static void __attribute__((constructor))
+read_level_from_environment()
+{
+    const char *names[] = { "error", "warn", "info", "debug" };
+    const char *value = getenv("MF_LOG_LEVEL");
+    int level;
+
+    if (value == NULL) {
+        return;
+    }
+    for (level = MF_LOG_ERROR; level <= MF_LOG_DEBUG; ++level) {
+        if (strcasecmp(value, names[level]) == 0) {
+            mf_log_set_level(level);
+            return;
+        }
+    }
+    if (value[0] >= '0' && value[0] <= '3' && value[1] == '\0') {
+        mf_log_set_level(value[0] - '0');
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Binary logging behind the macros of mf_debug.h.
+ *
+ * A log call below the runtime level costs a single load. Otherwise it
+ * stores the pointer to its format string, its raw arguments (strings are
+ * copied) and errno into a slot of a lock-free ring, without formatting
+ * anything. A background thread decodes the records to text on stderr or
+ * the file set by mf_log_set_output() until mf_log_stop() ends it, which
+ * also runs at exit; the next record starts it again. If the ring is full,
+ * records are dropped and counted rather than blocking the caller.
+ *
+ * The level is MF_LOG_WARN unless the environment variable MF_LOG_LEVEL
+ * names another one (error, warn, info, debug or 0-3).
+ */
+
+#ifndef MF_LOG_H_
+#define MF_LOG_H_
+
+#include <stdio.h>
+
+#define MF_LOG_ERROR 0
+#define MF_LOG_WARN  1
+#define MF_LOG_INFO  2
+#define MF_LOG_DEBUG 3
+
+#define MF_LOG_RING_SIZE   1024 /* records, a power of two */
+#define MF_LOG_RECORD_SIZE 512  /* bytes per record, including the arguments */
+
+extern int mf_log_level;
+
+/**
+ * @brief Records a message of the given level if the level is enabled.
+ */
+#define mf_log(level, ...)                                              \
+    do {                                                                \
+        if ((level) <= __atomic_load_n(&mf_log_level, __ATOMIC_RELAXED)) { \
+            mf_log_write((level), __FILE__, __LINE__, __VA_ARGS__);     \
+        }                                                               \
+    } while (0)
+
+/**
+ * @brief Records a message unconditionally; use mf_log() instead.
+ *
+ * Supports the conversions of printf() except %n; strings longer than the
+ * space left in the record are truncated.
+ */
+void mf_log_write(int level, const char* file, int line, const char* format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/**
+ * @brief Sets the most verbose level recorded, one of MF_LOG_*.
+ */
+void mf_log_set_level(int level);
+
+/**
+ * @brief Returns the most verbose level recorded.
+ */
+int mf_log_get_level();
+
+/**
+ * @brief Writes the decoded records to out instead of stderr.
+ */
+void mf_log_set_output(FILE* out);
+
+/**
+ * @brief Decodes all pending records in the calling thread.
+ */
+void mf_log_flush();
+
+/**
+ * @brief Stops and joins the decoder thread, then decodes the records left.
+ */
+void mf_log_stop();
+
+/**
+ * @brief Returns the number of records dropped because the ring was full.
+ */
+unsigned long mf_log_get_dropped();
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "mf_msgpack.h"
+
+/*
+ * Writes the tag byte followed by the lowest width bytes of value in
+ * big-endian order.
+ */
+static int
+put_tagged(mf_buffer *buffer, unsigned char tag, uint64_t value, int width)
+{
+    if (!mf_buffer_reserve(buffer, width + 1)) {
+        return 0;
+    }
+
+    unsigned char *out = (unsigned char *) buffer->data + buffer->size;
+    int i;
+
+    out[0] = tag;
+    for (i = 0; i < width; ++i) {
+        out[width - i] = (unsigned char) (value >> (8 * i));
+    }
+    buffer->size += width + 1;
+    buffer->data[buffer->size] = '\0';
+
+    return 1;
+}
+
+int
+mf_msgpack_nil(mf_buffer *buffer)
+{
+    return put_tagged(buffer, 0xc0, 0, 0);
+}
+
+int
+mf_msgpack_bool(mf_buffer *buffer, int value)
+{
+    return put_tagged(buffer, value ? 0xc3 : 0xc2, 0, 0);
+}
+
+int
+mf_msgpack_uint(mf_buffer *buffer, uint64_t value)
+{
+    if (value < 0x80) {
+        return put_tagged(buffer, (unsigned char) value, 0, 0);
+    } else if (value <= UINT8_MAX) {
+        return put_tagged(buffer, 0xcc, value, 1);
+    } else if (value <= UINT16_MAX) {
+        return put_tagged(buffer, 0xcd, value, 2);
+    } else if (value <= UINT32_MAX) {
+        return put_tagged(buffer, 0xce, value, 4);
+    }
+    return put_tagged(buffer, 0xcf, value, 8);
+}
+
+int
+mf_msgpack_int(mf_buffer *buffer, int64_t value)
+{
+    if (value >= 0) {
+        return mf_msgpack_uint(buffer, (uint64_t) value);
+    } else if (value >= -32) {
+        return put_tagged(buffer, (unsigned char) (0xe0 | (value + 32)), 0, 0);
+    } else if (value >= INT8_MIN) {
+        return put_tagged(buffer, 0xd0, (uint64_t) value, 1);
+    } else if (value >= INT16_MIN) {
+        return put_tagged(buffer, 0xd1, (uint64_t) value, 2);
+    } else if (value >= INT32_MIN) {
+        return put_tagged(buffer, 0xd2, (uint64_t) value, 4);
+    }
+    return put_tagged(buffer, 0xd3, (uint64_t) value, 8);
+}
+
+int
+mf_msgpack_double(mf_buffer *buffer, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return put_tagged(buffer, 0xcb, bits, 8);
+}
+
+int
+mf_msgpack_str(mf_buffer *buffer, const char *str, size_t length)
+{
+    int ok;
+
+    if (length < 32) {
+        ok = put_tagged(buffer, (unsigned char) (0xa0 | length), 0, 0);
+    } else if (length <= UINT8_MAX) {
+        ok = put_tagged(buffer, 0xd9, length, 1);
+    } else if (length <= UINT16_MAX) {
+        ok = put_tagged(buffer, 0xda, length, 2);
+    } else {
+        ok = put_tagged(buffer, 0xdb, length, 4);
+    }
+
+    return ok && mf_buffer_append(buffer, str, length);
+}
+
+int
+mf_msgpack_bin(mf_buffer *buffer, const void *data, size_t length)
+{
+    int ok;
+
+    if (length <= UINT8_MAX) {
+        ok = put_tagged(buffer, 0xc4, length, 1);
+    } else if (length <= UINT16_MAX) {
+        ok = put_tagged(buffer, 0xc5, length, 2);
+    } else {
+        ok = put_tagged(buffer, 0xc6, length, 4);
+    }
+
+    return ok && mf_buffer_append(buffer, data, length);
+}
+
+int
+mf_msgpack_array(mf_buffer *buffer, uint32_t count)
+{
+    if (count < 16) {
+        return put_tagged(buffer, (unsigned char) (0x90 | count), 0, 0);
+    } else if (count <= UINT16_MAX) {
+        return put_tagged(buffer, 0xdc, count, 2);
+    }
+    return put_tagged(buffer, 0xdd, count, 4);
+}
+
+int
+mf_msgpack_map(mf_buffer *buffer, uint32_t count)
+{
+    if (count < 16) {
+        return put_tagged(buffer, (unsigned char) (0x80 | count), 0, 0);
+    } else if (count <= UINT16_MAX) {
+        return put_tagged(buffer, 0xde, count, 2);
+    }
+    return put_tagged(buffer, 0xdf, count, 4);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Minimal MessagePack encoder writing into an mf_buffer.
+ *
+ * Only the types needed for metric documents are supported. Every function
+ * picks the shortest encoding for the given value, and returns 1 if
+ * successful or 0 if the buffer could not grow.
+ *
+ * @see https://github.com/msgpack/msgpack/blob/master/spec.md
+ */
+
+#ifndef MF_MSGPACK_H_
+#define MF_MSGPACK_H_
+
+#include <stdint.h>
+
+#include "mf_buffer.h"
+
+#define MF_MSGPACK_CONTENT_TYPE "application/msgpack"
+
+int mf_msgpack_nil(mf_buffer *buffer);
+
+int mf_msgpack_bool(mf_buffer *buffer, int value);
+
+int mf_msgpack_uint(mf_buffer *buffer, uint64_t value);
+
+int mf_msgpack_int(mf_buffer *buffer, int64_t value);
+
+int mf_msgpack_double(mf_buffer *buffer, double value);
+
+int mf_msgpack_str(mf_buffer *buffer, const char *str, size_t length);
+
+int mf_msgpack_bin(mf_buffer *buffer, const void *data, size_t length);
+
+/**
+ * @brief Writes the header of an array; the count elements follow.
+ */
+int mf_msgpack_array(mf_buffer *buffer, uint32_t count);
+
+/**
+ * @brief Writes the header of a map; count keys and values follow alternately.
+ */
+int mf_msgpack_map(mf_buffer *buffer, uint32_t count);
+
+#endif
@@ -0,0 +1,452 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mf_number.h"
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint64_t powers_of_ten[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+static int
+count_digits(uint64_t v)
+{
+    int n = 1;
+
+    for (;;) {
+        if (v < 10) {
+            return n;
+        }
+        if (v < 100) {
+            return n + 1;
+        }
+        if (v < 1000) {
+            return n + 2;
+        }
+        if (v < 10000) {
+            return n + 3;
+        }
+        v /= 10000;
+        n += 4;
+    }
+}
+
+size_t
+mf_number_uint(char *out, unsigned long long value)
+{
+    uint64_t v = value;
+    int length = count_digits(v);
+    char *p = out + length;
+
+    /* written backwards, two digits per division */
+    *p = '\0';
+    while (v >= 100) {
+        unsigned int i = (unsigned int) (v % 100) * 2;
+        v /= 100;
+        *--p = digit_pairs[i + 1];
+        *--p = digit_pairs[i];
+    }
+    if (v >= 10) {
+        *--p = digit_pairs[v * 2 + 1];
+        *--p = digit_pairs[v * 2];
+    } else {
+        *--p = (char) ('0' + v);
+    }
+
+    return length;
+}
+
+size_t
+mf_number_int(char *out, long long value)
+{
+    if (value < 0) {
+        *out = '-';
+        return 1 + mf_number_uint(out + 1, 0ULL - (unsigned long long) value);
+    }
+    return mf_number_uint(out, (unsigned long long) value);
+}
+
+/*
+ * Grisu2 as described by Florian Loitsch, "Printing Floating-Point Numbers
+ * Quickly and Accurately with Integers" (PLDI 2010). A number f * 2^e and
+ * the boundaries halfway to its neighbours are scaled by a cached power of
+ * ten into a range where the digits can be generated with 64-bit integer
+ * arithmetic; digits are generated until they identify the number within
+ * the (slightly narrowed) boundaries.
+ */
+
+typedef struct diy_fp_t {
+    uint64_t f;
+    int e;
+} diy_fp;
+
+/* normalized 10^k for k = -348, -340, ..., 340 */
+static const uint64_t cached_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const int cached_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static diy_fp
+multiply(diy_fp a, diy_fp b)
+{
+    /* upper half of the 128-bit product, rounded */
+    const uint64_t mask = 0xFFFFFFFFULL;
+    uint64_t a_hi = a.f >> 32;
+    uint64_t a_lo = a.f & mask;
+    uint64_t b_hi = b.f >> 32;
+    uint64_t b_lo = b.f & mask;
+    uint64_t hh = a_hi * b_hi;
+    uint64_t hl = a_hi * b_lo;
+    uint64_t lh = a_lo * b_hi;
+    uint64_t ll = a_lo * b_lo;
+    uint64_t mid = (ll >> 32) + (hl & mask) + (lh & mask) + (1ULL << 31);
+    diy_fp product = {
+        hh + (hl >> 32) + (lh >> 32) + (mid >> 32), a.e + b.e + 64
+    };
+
+    return product;
+}
+
+static diy_fp
+normalize(diy_fp v)
+{
+    int shift = __builtin_clzll(v.f);
+
+    v.f <<= shift;
+    v.e -= shift;
+    return v;
+}
+
+/*
+ * Returns the cached power c = 10^-K such that the product of c and a
+ * normalized number with binary exponent e has an exponent from -60 to -32.
+ */
+static diy_fp
+cached_power(int e, int *K)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int) dk;
+    if (dk - k > 0.0) {
+        k++;
+    }
+
+    int index = (k >> 3) + 1;
+    diy_fp c = { cached_f[index], cached_e[index] };
+    *K = -(-348 + index * 8);
+
+    return c;
+}
+
+/*
+ * Moves the last digit closer to w as long as the result stays within the
+ * boundaries.
+ */
+static void
+round_digit(
+    char *digits,
+    int length,
+    uint64_t delta,
+    uint64_t rest,
+    uint64_t ten_kappa,
+    uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w ||
+            wp_w - rest > rest + ten_kappa - wp_w)) {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int
+generate_digits(diy_fp w, diy_fp mp, uint64_t delta, char *digits, int *K)
+{
+    diy_fp one = { 1ULL << -mp.e, mp.e };
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t) (mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = count_digits(p1);
+    int length = 0;
+
+    /* integral part */
+    while (kappa > 0) {
+        uint32_t d = p1 / (uint32_t) powers_of_ten[kappa - 1];
+        p1 %= (uint32_t) powers_of_ten[kappa - 1];
+        if (d != 0 || length != 0) {
+            digits[length++] = (char) ('0' + d);
+        }
+        kappa--;
+
+        uint64_t rest = ((uint64_t) p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *K += kappa;
+            round_digit(digits, length, delta, rest, powers_of_ten[kappa] << -one.e,
+                wp_w);
+            return length;
+        }
+    }
+
+    /* fractional part */
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        int d = (int) (p2 >> -one.e);
+        if (d != 0 || length != 0) {
+            digits[length++] = (char) ('0' + d);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+
+        if (p2 < delta) {
+            *K += kappa;
+            round_digit(digits, length, delta, p2, one.f,
+                wp_w * ((-kappa < 20) ? powers_of_ten[-kappa] : 0));
+            return length;
+        }
+    }
+}
+
+/*
+ * Generates the digits of f * 2^e, a number whose significand has the given
+ * hidden bit, such that the number is digits * 10^K.
+ */
+static int
+grisu2(uint64_t f, int e, uint64_t hidden, char *digits, int *K)
+{
+    diy_fp v = { f, e };
+    diy_fp plus = { (f << 1) + 1, e - 1 };
+    diy_fp minus = { (f << 1) - 1, e - 1 };
+
+    /* the lower neighbour is closer at a power of two */
+    if (f == hidden) {
+        minus.f = (f << 2) - 1;
+        minus.e = e - 2;
+    }
+    plus = normalize(plus);
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    diy_fp c = cached_power(plus.e, K);
+    diy_fp w = multiply(normalize(v), c);
+    diy_fp wp = multiply(plus, c);
+    diy_fp wm = multiply(minus, c);
+    wm.f++;
+    wp.f--;
+
+    return generate_digits(w, wp, wp.f - wm.f, digits, K);
+}
+
+/*
+ * Writes digits * 10^k in fixed notation if the decimal exponent is from -6
+ * to 20, and in scientific notation otherwise.
+ */
+static size_t
+write_digits(char *out, const char *digits, int length, int k)
+{
+    int kk = length + k; /* 10^(kk - 1) <= value < 10^kk */
+    char *p = out;
+
+    if (k >= 0 && kk <= 21) {
+        /* 1234e7 -> 12340000000 */
+        memcpy(p, digits, length);
+        p += length;
+        memset(p, '0', k);
+        p += k;
+    } else if (kk > 0 && kk <= 21) {
+        /* 1234e-2 -> 12.34 */
+        memcpy(p, digits, kk);
+        p += kk;
+        *p++ = '.';
+        memcpy(p, digits + kk, length - kk);
+        p += length - kk;
+    } else if (kk > -6 && kk <= 0) {
+        /* 1234e-6 -> 0.001234 */
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -kk);
+        p += -kk;
+        memcpy(p, digits, length);
+        p += length;
+    } else {
+        /* 1234e30 -> 1.234e+33 */
+        *p++ = digits[0];
+        if (length > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, length - 1);
+            p += length - 1;
+        }
+        *p++ = 'e';
+        *p++ = (kk - 1 < 0) ? '-' : '+';
+        p += mf_number_uint(p, (kk - 1 < 0) ? 1 - kk : kk - 1);
+    }
+    *p = '\0';
+
+    return p - out;
+}
+
+/*
+ * Writes an IEEE 754 number given by its sign, biased exponent and stored
+ * significand bits.
+ */
+static size_t
+write_binary(
+    char *out,
+    int negative,
+    int biased_e,
+    uint64_t significand,
+    int significand_bits,
+    int max_biased_e)
+{
+    uint64_t hidden = 1ULL << significand_bits;
+    int bias = max_biased_e / 2 + significand_bits;
+    char digits[24];
+    char *p = out;
+    int K = 0;
+
+    if (biased_e == max_biased_e) {
+        if (significand != 0) {
+            strcpy(out, "nan");
+            return 3;
+        }
+        if (negative) {
+            *p++ = '-';
+        }
+        strcpy(p, "inf");
+        return p + 3 - out;
+    }
+
+    if (negative) {
+        *p++ = '-';
+    }
+    if (biased_e == 0 && significand == 0) {
+        strcpy(p, "0");
+        return p + 1 - out;
+    }
+
+    int length = (biased_e != 0) ?
+        grisu2(significand | hidden, biased_e - bias, hidden, digits, &K) :
+        grisu2(significand, 1 - bias, hidden, digits, &K);
+
+    return (p - out) + write_digits(p, digits, length, K);
+}
+
+size_t
+mf_number_double(char *out, double value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return write_binary(out, (int) (bits >> 63), (int) (bits >> 52) & 0x7FF,
+        bits & ((1ULL << 52) - 1), 52, 0x7FF);
+}
+
+size_t
+mf_number_float(char *out, float value)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return write_binary(out, (int) (bits >> 31), (int) (bits >> 23) & 0xFF,
+        bits & ((1UL << 23) - 1), 23, 0xFF);
+}
+
+int
+mf_number_append_uint(mf_buffer *buffer, unsigned long long value)
+{
+    if (!mf_buffer_reserve(buffer, MF_NUMBER_SIZE)) {
+        return 0;
+    }
+    buffer->size += mf_number_uint(buffer->data + buffer->size, value);
+    return 1;
+}
+
+int
+mf_number_append_int(mf_buffer *buffer, long long value)
+{
+    if (!mf_buffer_reserve(buffer, MF_NUMBER_SIZE)) {
+        return 0;
+    }
+    buffer->size += mf_number_int(buffer->data + buffer->size, value);
+    return 1;
+}
+
+int
+mf_number_append_double(mf_buffer *buffer, double value)
+{
+    if (!mf_buffer_reserve(buffer, MF_NUMBER_SIZE)) {
+        return 0;
+    }
+    buffer->size += mf_number_double(buffer->data + buffer->size, value);
+    return 1;
+}
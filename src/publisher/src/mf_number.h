@@ -0,0 +1,83 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Locale-independent formatting of numbers as decimal text.
+ *
+ * Integers are written two digits at a time from a lookup table. Floating
+ * point numbers are written with the fewest digits that read back to the
+ * same value with strtod() or strtof(), using the Grisu2 algorithm; for
+ * about 0.1% of the numbers the result is a digit or two longer than the
+ * shortest possible, but never longer than 17 significant digits. Numbers
+ * with a decimal exponent from -6 to 20 are written without exponent, e.g.
+ * 0.001 or 1500, others as in 1.5e+21 or 1e-7. NaN and infinities are
+ * written as nan, inf and -inf, like printf() does.
+ *
+ * The functions write to a caller-provided array of at least MF_NUMBER_SIZE
+ * bytes, terminated by '\0', or straight into a serialization buffer.
+ */
+
+#ifndef MF_NUMBER_H_
+#define MF_NUMBER_H_
+
+#include <stddef.h>
+
+#include "mf_buffer.h"
+
+#define MF_NUMBER_SIZE 32
+
+/**
+ * @brief Writes value in decimal.
+ *
+ * @return the number of characters written, without the '\0'
+ */
+size_t mf_number_uint(char *out, unsigned long long value);
+
+/**
+ * @brief Writes value in decimal, with a leading '-' if negative.
+ */
+size_t mf_number_int(char *out, long long value);
+
+/**
+ * @brief Writes text that reads back as value, the shortest in almost all
+ *        cases.
+ */
+size_t mf_number_double(char *out, double value);
+
+/**
+ * @brief Same as mf_number_double() at single precision, e.g. 0.1 for 0.1f.
+ */
+size_t mf_number_float(char *out, float value);
+
+/**
+ * @brief Appends value in decimal to the buffer.
+ *
+ * @return 1 if successful; 0 if out of memory
+ */
+int mf_number_append_uint(mf_buffer *buffer, unsigned long long value);
+
+/**
+ * @brief Appends value in decimal to the buffer.
+ */
+int mf_number_append_int(mf_buffer *buffer, long long value);
+
+/**
+ * @brief Appends text that reads back as value to the buffer, the shortest
+ *        in almost all cases.
+ */
+int mf_number_append_double(mf_buffer *buffer, double value);
+
+#endif
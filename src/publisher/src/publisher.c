@@ -15,60 +15,565 @@
  */
 
 #include <curl/curl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 
+#include "mf_buffer.h"
 #include "mf_debug.h"
+#include "mf_gzip.h"
+#include "mf_json.h"
+#include "mf_json_stream.h"
 #include "mf_publisher.h"
 
-static CURL *curl;
 char execution_id[ID_SIZE] = { 0 };
 struct curl_slist *headers = NULL;
+static struct curl_slist *gzip_headers = NULL;
+
+/*
+ * The response body never shrinks below the 1024 bytes that used to be
+ * allocated per response.
+ */
+#define RESPONSE_MIN_CAPACITY 1024
+#define CONTENT_TYPE_SIZE 128
+#define COMPRESS_MIN_SIZE 1024
+
+enum breaker_state { BREAKER_CLOSED, BREAKER_OPEN, BREAKER_HALF_OPEN };
+
+/*
+ * A publisher owns a cURL handle (and thereby its connections), the buffers
+ * reused by its requests, and its send policy: every request is bounded by
+ * deadline_ms (including retries and backoff pauses); failed requests are
+ * retried with full-jitter exponential backoff; after breaker_threshold
+ * consecutive failures the circuit opens and requests are spooled or dropped
+ * for breaker_open_ms. Bodies of at least compress_min_size bytes are sent
+ * gzip-compressed if compress_level is set. Publishers share no mutable
+ * state.
+ */
+struct mf_publisher_t {
+    CURL *curl;
+
+    /* body of the last response, reused by all requests */
+    mf_buffer response_body;
+
+    /* serialized Message documents, reused by every call of publish() */
+    mf_buffer message_body;
+
+    /* headers for bodies other than JSON, rebuilt when the type changes */
+    struct curl_slist *data_headers;
+    struct curl_slist *data_gzip_headers;
+    char data_content_type[CONTENT_TYPE_SIZE];
+
+    /* compressed copy of the body being sent; level 0 disables compression */
+    int compress_level;
+    size_t compress_min_size;
+    mf_gzip gzip;
+    mf_buffer compressed_body;
+
+    long connect_timeout_ms;
+    long deadline_ms;
+    int max_retries;
+    long backoff_base_ms;
+    long backoff_max_ms;
+    int breaker_threshold;
+    long breaker_open_ms;
+
+    enum breaker_state breaker;
+    int consecutive_failures;
+    long long breaker_open_until;
+    unsigned int jitter_seed;
+
+    FILE *spool;
+    unsigned long dropped;
+    long last_status;
+
+    /* monotonic time in ms at which all requests are cut off; 0 if none */
+    long long abort_at;
+};
+
+/* used by the functions without publisher argument */
+static mf_publisher default_publisher;
+static int default_ready = 0;
+
+/* cURL global state and the JSON headers shared by all publishers */
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static int global_ready = 0;
 
 static void
-init_curl()
+init_global()
 {
-    if (curl != NULL ) {
+    if (__atomic_load_n(&global_ready, __ATOMIC_ACQUIRE)) {
         return;
     }
 
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
+    pthread_mutex_lock(&global_lock);
+    if (!global_ready) {
+        curl_global_init(CURL_GLOBAL_ALL);
+
+        headers = curl_slist_append(headers, "Accept: application/json");
+        headers = curl_slist_append(headers, "Content-Type: application/json");
+        headers = curl_slist_append(headers, "charsets: utf-8");
+
+        gzip_headers = curl_slist_append(gzip_headers, "Accept: application/json");
+        gzip_headers = curl_slist_append(gzip_headers, "Content-Type: application/json");
+        gzip_headers = curl_slist_append(gzip_headers, "charsets: utf-8");
+        gzip_headers = curl_slist_append(gzip_headers,
+            "Content-Encoding: " MF_GZIP_ENCODING);
+
+        __atomic_store_n(&global_ready, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&global_lock);
+}
+
+static void
+init_publisher(mf_publisher *p)
+{
+    memset(p, 0, sizeof(mf_publisher));
+    mf_buffer_init(&p->response_body);
+    mf_buffer_init(&p->message_body);
+    mf_buffer_init(&p->compressed_body);
+    mf_gzip_init(&p->gzip);
+
+    p->connect_timeout_ms = 2000;
+    p->deadline_ms = 10000;
+    p->max_retries = 3;
+    p->backoff_base_ms = 100;
+    p->backoff_max_ms = 2000;
+    p->breaker_threshold = 5;
+    p->breaker_open_ms = 30000;
+    p->breaker = BREAKER_CLOSED;
+    p->compress_min_size = COMPRESS_MIN_SIZE;
+}
+
+static void
+clear_publisher(mf_publisher *p)
+{
+    if (p->curl != NULL) {
+        curl_easy_cleanup(p->curl);
+    }
+    curl_slist_free_all(p->data_headers);
+    curl_slist_free_all(p->data_gzip_headers);
+    mf_buffer_free(&p->response_body);
+    mf_buffer_free(&p->message_body);
+    mf_buffer_free(&p->compressed_body);
+    mf_gzip_free(&p->gzip);
+    if (p->spool != NULL) {
+        fclose(p->spool);
+    }
+    memset(p, 0, sizeof(mf_publisher));
+}
+
+/*
+ * Maps NULL to the default publisher, which is initialized on first use.
+ */
+static mf_publisher*
+resolve(mf_publisher *p)
+{
+    if (p != NULL) {
+        return p;
+    }
+
+    if (!__atomic_load_n(&default_ready, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&global_lock);
+        if (!default_ready) {
+            init_publisher(&default_publisher);
+            __atomic_store_n(&default_ready, 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&global_lock);
+    }
+    return &default_publisher;
+}
+
+static void
+init_curl(mf_publisher *p)
+{
+    init_global();
+
+    if (p->curl == NULL) {
+        p->curl = curl_easy_init();
+    }
+}
+
+mf_publisher*
+mf_publisher_new()
+{
+    mf_publisher *p = (mf_publisher *) malloc(sizeof(mf_publisher));
+    if (p == NULL) {
+        log_error("mf_publisher_new() %s", "out of memory");
+        return NULL;
+    }
+
+    init_global();
+    init_publisher(p);
+
+    return p;
+}
 
-    if (headers != NULL ) {
+void
+mf_publisher_free(mf_publisher *p)
+{
+    if (p == NULL) {
         return;
     }
 
-    headers = curl_slist_append(headers, "Accept: application/json");
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    headers = curl_slist_append(headers, "charsets: utf-8");
+    clear_publisher(p);
+    free(p);
 }
 
-struct string {
-    char *ptr;
-    size_t len;
-};
+static long long
+now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+sleep_ms(long ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
 
 void
-init_string(struct string *s) {
-    s->len = 0;
-    s->ptr = (char *)malloc(s->len+1);
-    if (s->ptr == NULL) {
-        fprintf(stderr, "malloc() failed\n");
-        exit(EXIT_FAILURE);
+mf_publisher_set_timeouts(mf_publisher *p, long connect_ms, long total_ms)
+{
+    p = resolve(p);
+    p->connect_timeout_ms = connect_ms;
+    p->deadline_ms = total_ms;
+}
+
+void
+mf_publisher_set_retries(mf_publisher *p, int retries, long base_ms, long max_ms)
+{
+    p = resolve(p);
+    p->max_retries = (retries < 0) ? 0 : retries;
+    p->backoff_base_ms = base_ms;
+    p->backoff_max_ms = max_ms;
+}
+
+void
+mf_publisher_set_compression(mf_publisher *p, int level, size_t min_size)
+{
+    p = resolve(p);
+    p->compress_level = (level < 0) ? 0 : (level > 9) ? 9 : level;
+    p->compress_min_size = min_size;
+}
+
+void
+mf_publisher_set_circuit_breaker(
+    mf_publisher *p,
+    int failure_threshold,
+    long open_ms,
+    const char* spool_path)
+{
+    p = resolve(p);
+    p->breaker_threshold = failure_threshold;
+    p->breaker_open_ms = open_ms;
+
+    if (p->spool != NULL) {
+        fclose(p->spool);
+        p->spool = NULL;
     }
-    s->ptr[0] = '\0';
+    if (spool_path != NULL && spool_path[0] != '\0') {
+        p->spool = fopen(spool_path, "a");
+        if (p->spool == NULL) {
+            log_error("mf_publisher_set_circuit_breaker(...) cannot open %s",
+                spool_path);
+        }
+    }
+}
+
+void
+mf_publisher_abort_after(mf_publisher *p, long timeout_ms)
+{
+    p = resolve(p);
+    __atomic_store_n(&p->abort_at,
+        (timeout_ms < 0) ? 0 : now_ms() + timeout_ms, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns the time in ms left until requests are cut off; LONG_MAX if there
+ * is no cut-off.
+ */
+static long
+time_to_abort(mf_publisher *p)
+{
+    long long abort_at = __atomic_load_n(&p->abort_at, __ATOMIC_ACQUIRE);
+    if (abort_at == 0) {
+        return LONG_MAX;
+    }
+
+    long long left = abort_at - now_ms();
+    return (left > 0) ? (long) left : 0;
+}
+
+/*
+ * Progress callback of cURL, which also aborts a transfer that is already
+ * running when the cut-off is set by another thread.
+ */
+static int
+check_abort(
+    void *p,
+    curl_off_t dltotal,
+    curl_off_t dlnow,
+    curl_off_t ultotal,
+    curl_off_t ulnow)
+{
+    return time_to_abort((mf_publisher*) p) == 0;
+}
+
+unsigned long
+mf_publisher_get_dropped(mf_publisher *p)
+{
+    return resolve(p)->dropped;
+}
+
+long
+mf_publisher_get_status(mf_publisher *p)
+{
+    return resolve(p)->last_status;
+}
+
+/*
+ * Returns 1 if a request may be sent. An open circuit turns half-open once
+ * breaker_open_ms has elapsed, letting a single probe request through.
+ */
+static int
+breaker_allows(mf_publisher *p)
+{
+    if (p->breaker == BREAKER_OPEN) {
+        if (now_ms() < p->breaker_open_until) {
+            return 0;
+        }
+        p->breaker = BREAKER_HALF_OPEN;
+    }
+    return 1;
+}
+
+static void
+breaker_record(mf_publisher *p, int success)
+{
+    if (success) {
+        p->consecutive_failures = 0;
+        p->breaker = BREAKER_CLOSED;
+        return;
+    }
+
+    p->consecutive_failures++;
+    if (p->breaker == BREAKER_HALF_OPEN ||
+        (p->breaker_threshold > 0 &&
+         p->consecutive_failures >= p->breaker_threshold)) {
+        if (p->breaker != BREAKER_OPEN) {
+            log_warn("circuit opened after %d failures", p->consecutive_failures);
+        }
+        p->breaker = BREAKER_OPEN;
+        p->breaker_open_until = now_ms() + p->breaker_open_ms;
+    }
+}
+
+/*
+ * Keeps a message that could not be delivered: appended as one line to the
+ * spool file if configured, otherwise counted as dropped.
+ */
+static void
+spool_or_drop(mf_publisher *p, const char *message, int is_text)
+{
+    if (p->spool != NULL && message != NULL && is_text &&
+        fprintf(p->spool, "%s\n", message) > 0 && fflush(p->spool) == 0) {
+        return;
+    }
+    p->dropped++;
+}
+
+static int
+is_transient(CURLcode code)
+{
+    switch (code) {
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Returns 1 if the outcome of an attempt is worth another one: a transient
+ * error, a 429 or a 5xx response.
+ */
+static int
+is_retryable(CURLcode code, long http_code)
+{
+    if (code == CURLE_OK) {
+        return http_code >= 500 || http_code == 429;
+    }
+    return is_transient(code);
+}
+
+static void
+seed_jitter(mf_publisher *p, long long start)
+{
+    if (p->jitter_seed == 0) {
+        p->jitter_seed = (unsigned int) (start ^ getpid() ^ (size_t) p) | 1;
+    }
+}
+
+/*
+ * Limits the next attempt of a request that started at start to the time
+ * left until its deadline or the cut-off.
+ *
+ * Returns 0 if no time is left.
+ */
+static int
+limit_attempt(mf_publisher *p, CURL *curl, long long start)
+{
+    long remaining = (p->deadline_ms > 0) ?
+        (long) (p->deadline_ms - (now_ms() - start)) : LONG_MAX;
+    long left = time_to_abort(p);
+    if (left < remaining) {
+        remaining = left;
+    }
+    if (remaining <= 0) {
+        return 0;
+    }
+    if (remaining == LONG_MAX) {
+        remaining = 0; /* no limit */
+    }
+
+    long connect_ms = p->connect_timeout_ms;
+    if (remaining > 0 && (connect_ms <= 0 || connect_ms > remaining)) {
+        connect_ms = remaining;
+    }
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, connect_ms);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, remaining);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, check_abort);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, p);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+
+    return 1;
+}
+
+/*
+ * Returns the pause before the retry following the given attempt, or -1 if
+ * the pause would reach past the deadline of a request that started at
+ * start, or past the cut-off.
+ */
+static long
+backoff_pause(mf_publisher *p, int attempt, long long start)
+{
+    long cap = p->backoff_base_ms << (attempt < 16 ? attempt : 16);
+    if (cap <= 0 || cap > p->backoff_max_ms) {
+        cap = p->backoff_max_ms;
+    }
+    long pause = (cap > 0) ? rand_r(&p->jitter_seed) % (cap + 1) : 0;
+    if ((p->deadline_ms > 0 && now_ms() - start + pause >= p->deadline_ms) ||
+        pause >= time_to_abort(p)) {
+        return -1;
+    }
+    return pause;
+}
+
+/*
+ * Performs the prepared request, retrying transient errors as well as 429
+ * and 5xx responses. Each attempt is limited to the time left until the
+ * deadline, and no backoff pause reaches past it, so a call never takes
+ * longer than deadline_ms.
+ */
+static CURLcode
+perform_with_retry(mf_publisher *p, const char *caller)
+{
+    long long start = now_ms();
+    CURLcode response = CURLE_OPERATION_TIMEDOUT;
+    int attempt;
+
+    p->last_status = 0;
+    seed_jitter(p, start);
+
+    for (attempt = 0; attempt <= p->max_retries; ++attempt) {
+        if (!limit_attempt(p, p->curl, start)) {
+            response = CURLE_OPERATION_TIMEDOUT;
+            break;
+        }
+
+        mf_buffer_reset(&p->response_body);
+        response = curl_easy_perform(p->curl);
+
+        long http_code = 0;
+        if (response == CURLE_OK) {
+            curl_easy_getinfo(p->curl, CURLINFO_RESPONSE_CODE, &http_code);
+            p->last_status = http_code;
+        }
+        if (!is_retryable(response, http_code)) {
+            return response;
+        }
+
+        if (attempt == p->max_retries) {
+            break;
+        }
+
+        long pause = backoff_pause(p, attempt, start);
+        if (pause < 0) {
+            break;
+        }
+        debug("%s retry %d in %ld ms (curl %d, http %ld)",
+            caller, attempt + 1, pause, response, http_code);
+        sleep_ms(pause);
+    }
+
+    if (response == CURLE_OK) {
+        /* retries exhausted on 429 or 5xx responses */
+        response = CURLE_HTTP_RETURNED_ERROR;
+    }
+    return response;
 }
 
 static size_t
-get_stream_data(void *buffer, size_t size, size_t nmemb, void *stream) {
+get_stream_data(void *buffer, size_t size, size_t nmemb, void *stream)
+{
     size_t total = size * nmemb;
-    memcpy(stream, buffer, total);
 
+    if (!mf_buffer_append((mf_buffer*) stream, buffer, total)) {
+        return 0; /* aborts the transfer */
+    }
     return total;
 }
 
+static int
+reset_response(mf_publisher *p)
+{
+    if (!mf_buffer_reserve(&p->response_body, RESPONSE_MIN_CAPACITY)) {
+        return 0;
+    }
+    mf_buffer_reset(&p->response_body);
+    return 1;
+}
+
+mf_view
+mf_publisher_get_response(mf_publisher *p)
+{
+    mf_view view = { "", 0 };
+
+    p = resolve(p);
+    if (p->response_body.data != NULL) {
+        view.data = p->response_body.data;
+        view.size = p->response_body.size;
+    }
+    return view;
+}
+
 static int
 check_URL(const char *URL)
 {
@@ -92,74 +597,220 @@ check_message(const char *message)
 }
 
 static int
-prepare_publish(const char *URL, const char *message)
+is_json(const char *content_type)
+{
+    return content_type == NULL ||
+        strcmp(content_type, "application/json") == 0;
+}
+
+static struct curl_slist*
+get_headers(mf_publisher *p, const char *content_type, int compressed)
+{
+    if (is_json(content_type)) {
+        return compressed ? gzip_headers : headers;
+    }
+    if (p->data_headers != NULL &&
+        strcmp(p->data_content_type, content_type) == 0) {
+        return compressed ? p->data_gzip_headers : p->data_headers;
+    }
+
+    char content_header[CONTENT_TYPE_SIZE + 16];
+    snprintf(content_header, sizeof(content_header), "Content-Type: %s",
+        content_type);
+    snprintf(p->data_content_type, CONTENT_TYPE_SIZE, "%s", content_type);
+
+    curl_slist_free_all(p->data_headers);
+    p->data_headers = NULL;
+    p->data_headers = curl_slist_append(p->data_headers, "Accept: application/json");
+    p->data_headers = curl_slist_append(p->data_headers, content_header);
+
+    curl_slist_free_all(p->data_gzip_headers);
+    p->data_gzip_headers = NULL;
+    p->data_gzip_headers = curl_slist_append(p->data_gzip_headers, "Accept: application/json");
+    p->data_gzip_headers = curl_slist_append(p->data_gzip_headers, content_header);
+    p->data_gzip_headers = curl_slist_append(p->data_gzip_headers,
+        "Content-Encoding: " MF_GZIP_ENCODING);
+
+    return compressed ? p->data_gzip_headers : p->data_headers;
+}
+
+static int
+prepare_publish(
+    mf_publisher *p,
+    const char *URL,
+    const void *data,
+    size_t size,
+    const char *content_type,
+    int compressed)
 {
-    init_curl();
+    init_curl(p);
 
-    curl_easy_setopt(curl, CURLOPT_URL, URL);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(p->curl, CURLOPT_URL, URL);
+    curl_easy_setopt(p->curl, CURLOPT_HTTPHEADER,
+        get_headers(p, content_type, compressed));
 
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, message);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long ) strlen(message));
-    #ifdef DEBUG
-    curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-    #endif
+    curl_easy_setopt(p->curl, CURLOPT_POSTFIELDS, data);
+    curl_easy_setopt(p->curl, CURLOPT_POSTFIELDSIZE, (long) size);
+    if (mf_log_get_level() >= MF_LOG_DEBUG) {
+        curl_easy_setopt(p->curl, CURLOPT_VERBOSE, 1L);
+    }
 
     return 1;
 }
 
 static int
-prepare_query(const char* URL)
+prepare_query(mf_publisher *p, const char* URL)
 {
-    init_curl();
+    init_curl(p);
 
-    curl_easy_setopt(curl, CURLOPT_URL, URL);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    #ifdef DEBUG
-    curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-    #endif
+    curl_easy_setopt(p->curl, CURLOPT_URL, URL);
+    curl_easy_setopt(p->curl, CURLOPT_HTTPHEADER, headers);
+    if (mf_log_get_level() >= MF_LOG_DEBUG) {
+        curl_easy_setopt(p->curl, CURLOPT_VERBOSE, 1L);
+    }
 
     return 1;
 }
 
-size_t
-curl_write( void *ptr, size_t size, size_t nmemb, void *stream)
+static size_t
+parse_stream_data(void *buffer, size_t size, size_t nmemb, void *stream)
 {
-    return fwrite(ptr, size, nmemb, stdout);
+    size_t total = size * nmemb;
+
+    if (!mf_json_stream_feed((mf_json_stream*) stream, buffer, total)) {
+        return 0; /* aborts the transfer */
+    }
+    return total;
 }
 
 int
-query(const char* query, char* received_data)
+mf_publisher_query(
+    mf_publisher *p,
+    const char* URL,
+    mf_json_record_cb callback,
+    void* user_data)
 {
     int result = SEND_SUCCESS;
-    struct string response_message;
 
-    if (!check_URL(query)) {
+    if (!check_URL(URL)) {
+        return SEND_FAILED;
+    }
+
+    p = resolve(p);
+    mf_json_stream* stream = mf_json_stream_new(callback, user_data);
+    if (stream == NULL || !prepare_query(p, URL)) {
+        mf_json_stream_free(stream);
+        return SEND_FAILED;
+    }
+
+    /*
+     * The response may take long to transfer; instead of a total deadline,
+     * give up when no data arrived for deadline_ms.
+     */
+    curl_easy_setopt(p->curl, CURLOPT_WRITEFUNCTION, parse_stream_data);
+    curl_easy_setopt(p->curl, CURLOPT_WRITEDATA, stream);
+    curl_easy_setopt(p->curl, CURLOPT_CONNECTTIMEOUT_MS, p->connect_timeout_ms);
+    curl_easy_setopt(p->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(p->curl, CURLOPT_LOW_SPEED_TIME,
+        (p->deadline_ms > 0) ? (p->deadline_ms + 999) / 1000 : 0L);
+    curl_easy_setopt(p->curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(p->curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(p->curl, CURLOPT_XFERINFOFUNCTION, check_abort);
+    curl_easy_setopt(p->curl, CURLOPT_XFERINFODATA, p);
+    curl_easy_setopt(p->curl, CURLOPT_NOPROGRESS, 0L);
+
+    CURLcode response = curl_easy_perform(p->curl);
+    if (response != CURLE_OK &&
+        !(response == CURLE_WRITE_ERROR && mf_json_stream_finish(stream))) {
+        result = SEND_FAILED;
+        const char *error_msg = curl_easy_strerror(response);
+        log_error("query(const char*, ...) %s", error_msg);
+    } else if (!mf_json_stream_finish(stream)) {
+        result = SEND_FAILED;
+        log_error("query(const char*, ...) %s", "incomplete response");
+    }
+
+    debug("query(const char*, ...) %lu records from %s",
+        mf_json_stream_records(stream), URL);
+
+    mf_json_stream_free(stream);
+    curl_easy_reset(p->curl);
+
+    return result;
+}
+
+int
+query(const char* URL, mf_json_record_cb callback, void* user_data)
+{
+    return mf_publisher_query(NULL, URL, callback, user_data);
+}
+
+static int
+append_field(mf_buffer *buffer, const char *key, const char *value)
+{
+    return (buffer->size == 1 || mf_buffer_append_char(buffer, ',')) &&
+        mf_json_string(buffer, key) &&
+        mf_buffer_append_char(buffer, ':') &&
+        mf_json_string(buffer, value);
+}
+
+static int
+serialize_message(mf_buffer *buffer, const Message *message)
+{
+    const Data *data;
+
+    mf_buffer_reset(buffer);
+    if (!mf_buffer_append_char(buffer, '{')) {
         return 0;
     }
 
-    if (!prepare_query(query)) {
+    if ((message->sender != NULL &&
+            !append_field(buffer, "host", message->sender)) ||
+        (message->username != NULL &&
+            !append_field(buffer, "user", message->username)) ||
+        (message->timestamp != NULL &&
+            !append_field(buffer, "@timestamp", message->timestamp))) {
         return 0;
     }
 
-    init_string(&response_message);
+    for (data = message->data; data != NULL && data->key != NULL; ++data) {
+        if (!append_field(buffer, data->key, data->value)) {
+            return 0;
+        }
+    }
 
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response_message);
+    return mf_buffer_append_char(buffer, '}');
+}
 
-    CURLcode response = curl_easy_perform(curl);
-    if (response != CURLE_OK) {
-        result = SEND_FAILED;
-        const char *error_msg = curl_easy_strerror(response);
-        log_error("query(const char*, char*) %s", error_msg);
+int
+mf_publisher_publish(mf_publisher *p, const char *URL, Message *messages)
+{
+    if (!check_URL(URL)) {
+        return SEND_FAILED;
+    }
+    if (messages == NULL) {
+        log_error("publish(const char*, Message) %s", "message not set.");
+        return SEND_FAILED;
     }
 
-    received_data = (char*) realloc (received_data, response_message.len);
-    received_data = response_message.ptr;
+    p = resolve(p);
+    if (!serialize_message(&p->message_body, messages)) {
+        return SEND_FAILED;
+    }
 
-    curl_easy_reset(curl);
+    if (mf_publisher_send(p, URL, p->message_body.data, p->message_body.size,
+            NULL) == NULL ||
+        p->last_status < 200 || p->last_status >= 300) {
+        return SEND_FAILED;
+    }
 
-    return result;
+    return SEND_SUCCESS;
+}
+
+int
+publish(const char *URL, Message *messages)
+{
+    return mf_publisher_publish(NULL, URL, messages);
 }
 
 char*
@@ -169,31 +820,83 @@ publish_json(const char *URL, const char *message)
         return 0;
     }
 
-    if (!prepare_publish(URL, message)) {
+    return mf_publisher_send(NULL, URL, message, strlen(message), NULL);
+}
+
+char*
+publish_data(
+    const char *URL,
+    const void *data,
+    size_t size,
+    const char *content_type)
+{
+    return mf_publisher_send(NULL, URL, data, size, content_type);
+}
+
+char*
+mf_publisher_send(
+    mf_publisher *p,
+    const char *URL,
+    const void *data,
+    size_t size,
+    const char *content_type)
+{
+    if (!check_URL(URL)) {
+        return 0;
+    }
+
+    p = resolve(p);
+    if (!reset_response(p)) {
         return 0;
     }
 
-    char* response_message = (char *)malloc(sizeof(char) * 1024);
-    memset(response_message, 0x00, 1024);
+    if (!breaker_allows(p)) {
+        p->last_status = 0;
+        spool_or_drop(p, data, is_json(content_type));
+        return NULL;
+    }
 
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, get_stream_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response_message);
+    /* the original body is spooled, so that it can be replayed as is */
+    int compressed = p->compress_level > 0 && size >= p->compress_min_size &&
+        mf_gzip_compress(&p->gzip, p->compress_level, &p->compressed_body,
+            data, size);
+    const void *body = compressed ? p->compressed_body.data : data;
+    size_t body_size = compressed ? p->compressed_body.size : size;
 
-    CURLcode response = curl_easy_perform(curl);
+    if (!prepare_publish(p, URL, body, body_size, content_type, compressed)) {
+        return 0;
+    }
+
+    curl_easy_setopt(p->curl, CURLOPT_WRITEFUNCTION, get_stream_data);
+    curl_easy_setopt(p->curl, CURLOPT_WRITEDATA, &p->response_body);
+
+    CURLcode response = perform_with_retry(p, "publish_data");
+    if (compressed && response == CURLE_OK && p->last_status == 415) {
+        /* the server does not accept the encoding; send plain from now on */
+        debug("URL %s rejects %s bodies, compression disabled",
+            URL, MF_GZIP_ENCODING);
+        p->compress_level = 0;
+        curl_easy_reset(p->curl);
+        return mf_publisher_send(p, URL, data, size, content_type);
+    }
+    breaker_record(p, response == CURLE_OK);
     if (response != CURLE_OK) {
         const char *error_msg = curl_easy_strerror(response);
         log_error("publish(const char*, Message) %s", error_msg);
+        spool_or_drop(p, data, is_json(content_type));
     }
 
-    debug("URL %s + RESPONSE: %s", URL, response_message);
-    curl_easy_reset(curl);
+    debug("URL %s + RESPONSE: %s", URL, p->response_body.data);
+    curl_easy_reset(p->curl);
 
-    return response_message;
+    return p->response_body.data;
 }
 
 char*
 get_execution_id(const char *URL, char *message)
 {
+    mf_publisher *p = resolve(NULL);
+
     if (strlen(execution_id) > 0) {
         return execution_id;
     }
@@ -202,22 +905,29 @@ get_execution_id(const char *URL, char *message)
         return '\0';
     }
 
-    if (!prepare_publish(URL, message)) {
+    if (!reset_response(p) ||
+        !prepare_publish(p, URL, message, strlen(message), NULL, 0)) {
         return '\0';
     }
 
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, get_stream_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &execution_id);
+    curl_easy_setopt(p->curl, CURLOPT_WRITEFUNCTION, get_stream_data);
+    curl_easy_setopt(p->curl, CURLOPT_WRITEDATA, &p->response_body);
 
-    CURLcode response = curl_easy_perform(curl);
+    CURLcode response = CURLE_COULDNT_CONNECT;
+    if (breaker_allows(p)) {
+        response = perform_with_retry(p, "get_execution_id");
+        breaker_record(p, response == CURLE_OK);
+    }
     if (response != CURLE_OK) {
         const char *error_msg = curl_easy_strerror(response);
         log_error("publish(const char*, Message) %s", error_msg);
+    } else if (p->response_body.data != NULL) {
+        snprintf(execution_id, ID_SIZE, "%s", p->response_body.data);
     }
 
     debug("get_execution_id(const char*, char*) Execution_ID = <%s>", execution_id);
 
-    curl_easy_reset(curl);
+    curl_easy_reset(p->curl);
 
     return execution_id;
 }
@@ -225,26 +935,37 @@ get_execution_id(const char *URL, char *message)
 void
 shutdown_curl()
 {
-    if (curl == NULL ) {
-        return;
+    pthread_mutex_lock(&global_lock);
+    if (default_ready) {
+        clear_publisher(&default_publisher);
+        __atomic_store_n(&default_ready, 0, __ATOMIC_RELEASE);
     }
-
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
+    if (global_ready) {
+        curl_slist_free_all(headers);
+        headers = NULL;
+        curl_slist_free_all(gzip_headers);
+        gzip_headers = NULL;
+        curl_global_cleanup();
+        __atomic_store_n(&global_ready, 0, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&global_lock);
 }
 
 int
 mf_head(const char* URL)
 {
-    init_curl();
+    mf_publisher *p = resolve(NULL);
+    init_curl(p);
 
-    curl_easy_setopt(curl, CURLOPT_URL, URL);
-    curl_easy_setopt(curl, CURLOPT_HEADER, 1);
-    curl_easy_setopt(curl, CURLOPT_NOBODY, 1);
-    curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 1L);
+    curl_easy_setopt(p->curl, CURLOPT_URL, URL);
+    curl_easy_setopt(p->curl, CURLOPT_HEADER, 1);
+    curl_easy_setopt(p->curl, CURLOPT_NOBODY, 1);
+    curl_easy_setopt(p->curl, CURLOPT_CONNECT_ONLY, 1L);
+    curl_easy_setopt(p->curl, CURLOPT_CONNECTTIMEOUT_MS, p->connect_timeout_ms);
+    curl_easy_setopt(p->curl, CURLOPT_NOSIGNAL, 1L);
 
-    CURLcode response = curl_easy_perform(curl);
-    curl_easy_reset(curl);
+    CURLcode response = curl_easy_perform(p->curl);
+    curl_easy_reset(p->curl);
 
     if (response != CURLE_OK) {
         const char *error_msg = curl_easy_strerror(response);
@@ -261,32 +982,38 @@ mf_register_workflow(
     const char* workflow,
     const char* json_string)
 {
-    init_curl();
-    char* response_message = (char *)malloc(sizeof(char) * 1024);
-    memset(response_message, 0x00, 1024);
+    mf_publisher *p = resolve(NULL);
+    init_curl(p);
+    if (!reset_response(p)) {
+        return 0;
+    }
 
     const char* index = "v1/mf/users";
     char* newURL = (char *)malloc(sizeof(char) * (strlen(URL) + strlen(index) + strlen(workflow) + 4));
     sprintf(newURL, "%s/%s/%s", URL, index, workflow);
 
-    curl_easy_setopt(curl, CURLOPT_URL, newURL);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, get_stream_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response_message);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_string);
-
-    CURLcode response = curl_easy_perform(curl);
+    curl_easy_setopt(p->curl, CURLOPT_URL, newURL);
+    curl_easy_setopt(p->curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(p->curl, CURLOPT_CUSTOMREQUEST, "PUT");
+    curl_easy_setopt(p->curl, CURLOPT_WRITEFUNCTION, get_stream_data);
+    curl_easy_setopt(p->curl, CURLOPT_WRITEDATA, &p->response_body);
+    curl_easy_setopt(p->curl, CURLOPT_POSTFIELDS, json_string);
+
+    CURLcode response = CURLE_COULDNT_CONNECT;
+    if (breaker_allows(p)) {
+        response = perform_with_retry(p, "mf_register_workflow");
+        breaker_record(p, response == CURLE_OK);
+    }
     if (response != CURLE_OK) {
         const char *error_msg = curl_easy_strerror(response);
         log_error("mf_register_workflow(const char*) %s", error_msg);
     } else {
-        debug("RESPONSE: %s", response_message);
+        debug("RESPONSE: %s", p->response_body.data);
     }
-    curl_easy_reset(curl);
+    curl_easy_reset(p->curl);
     free(newURL);
 
-    return response_message;
+    return p->response_body.data;
 }
 
 char* mf_create_user(
@@ -295,12 +1022,21 @@ char* mf_create_user(
   const char* experiment_id,
   const char* message)
 {
-    init_curl();
+    return mf_publisher_create_user(NULL, server, username, experiment_id, message);
+}
 
+char*
+mf_publisher_create_user(
+    mf_publisher *p,
+    const char* server,
+    const char* username,
+    const char* experiment_id,
+    const char* message)
+{
     const char* resource = "v1/mf/users";
     char* URL;
 
-    if (experiment_id == NULL || experiment_id == '\0') {
+    if (experiment_id == NULL || experiment_id[0] == '\0') {
         URL = (char *)malloc(
             sizeof(char) *
             (strlen(server) +
@@ -321,16 +1057,19 @@ char* mf_create_user(
         sprintf(URL, "%s/%s/%s/%s/create", server, resource, username, experiment_id);
     }
 
-    char* json = (char *)malloc(sizeof(char) * 128 + strlen(username));
-
     /* include message as body */
+    char* json = NULL;
     if (message == NULL || message[0] == '\0') {
+        json = (char *)malloc(sizeof(char) * 128 + strlen(username));
         sprintf(json, "{ \"user\": \"%s\" }", username);
-    } else {
-        json = strdup(message);
+        message = json;
     }
 
-    return publish_json(URL, json);
+    char* response = mf_publisher_send(p, URL, message, strlen(message), NULL);
+    free(json);
+    free(URL);
+
+    return response;
 }
 
 char*
@@ -339,15 +1078,331 @@ mf_create_experiment(
     const char* workflow,
     const char* json_string)
 {
-    char* resource = (char *)malloc(sizeof(char) * 128);
     const char* index = "v1/dreamcloud/mf/experiments";
 
-    sprintf(resource, "%s/%s", index, workflow);
     char* URL = (char *)malloc(sizeof(char) *
             (strlen(server) + strlen(index) + strlen(workflow) + 4));
-    sprintf(URL, "%s/%s", server, resource);
+    sprintf(URL, "%s/%s/%s", server, index, workflow);
 
     debug("CREATE(URL): %s", URL);
 
-    return publish_json(URL, json_string);
+    char* response = publish_json(URL, json_string);
+    free(URL);
+
+    return response;
+}
+
+/*
+ * A transfer slot of a batch registration. The easy handle and the response
+ * buffer of a slot are reused for the next item once its item is done,
+ * while the multi handle pools the connections of all slots.
+ */
+typedef struct batch_slot_t {
+    CURL *curl;
+    mf_buffer response;
+    char *URL;
+    mf_registration *item;
+    int attempt;
+    long long started;
+    long long retry_at; /* 0 unless pausing before a retry */
+} batch_slot;
+
+typedef struct batch_t {
+    mf_publisher *p;
+    CURLM *multi;
+    int active; /* transfers added to the multi handle */
+    const char *server;
+    const char *resource;
+    const char *method; /* NULL for POST */
+    const char *caller;
+} batch;
+
+static void
+finish_item(batch *b, batch_slot *s, long status, const char *error)
+{
+    mf_registration *item = s->item;
+
+    item->status = status;
+    item->error = error;
+    if (status != 0) {
+        item->response = strdup(
+            (s->response.data != NULL) ? s->response.data : "");
+    }
+    if (error != NULL) {
+        log_error("%s(...) %s: %s", b->caller,
+            (item->workflow != NULL) ? item->workflow : "(null)", error);
+    } else {
+        debug("%s(...) %s: %s", b->caller, item->workflow, item->response);
+    }
+
+    free(s->URL);
+    s->URL = NULL;
+    s->item = NULL;
+}
+
+/*
+ * Adds the next attempt of the item of the slot to the multi handle.
+ *
+ * Returns NULL if successful; otherwise the reason of the failure.
+ */
+static const char*
+start_attempt(batch *b, batch_slot *s)
+{
+    curl_easy_reset(s->curl);
+    if (!limit_attempt(b->p, s->curl, s->started)) {
+        return curl_easy_strerror(CURLE_OPERATION_TIMEDOUT);
+    }
+
+    mf_buffer_reset(&s->response);
+    curl_easy_setopt(s->curl, CURLOPT_URL, s->URL);
+    curl_easy_setopt(s->curl, CURLOPT_HTTPHEADER, headers);
+    if (b->method != NULL) {
+        curl_easy_setopt(s->curl, CURLOPT_CUSTOMREQUEST, b->method);
+    }
+    curl_easy_setopt(s->curl, CURLOPT_POSTFIELDS, s->item->json_string);
+    curl_easy_setopt(s->curl, CURLOPT_WRITEFUNCTION, get_stream_data);
+    curl_easy_setopt(s->curl, CURLOPT_WRITEDATA, &s->response);
+    curl_easy_setopt(s->curl, CURLOPT_PRIVATE, s);
+    if (mf_log_get_level() >= MF_LOG_DEBUG) {
+        curl_easy_setopt(s->curl, CURLOPT_VERBOSE, 1L);
+    }
+
+    if (curl_multi_add_handle(b->multi, s->curl) != CURLM_OK) {
+        return "cannot start transfer";
+    }
+    b->active++;
+
+    return NULL;
+}
+
+static const char*
+start_item(batch *b, batch_slot *s, mf_registration *item)
+{
+    s->item = item;
+    s->attempt = 0;
+    s->retry_at = 0;
+    s->started = now_ms();
+
+    if (item->workflow == NULL || item->workflow[0] == '\0') {
+        return "workflow not set";
+    }
+    if (item->json_string == NULL) {
+        return "message not set";
+    }
+    if (!breaker_allows(b->p)) {
+        return "circuit open";
+    }
+
+    s->URL = (char *) malloc(strlen(b->server) + strlen(b->resource) +
+        strlen(item->workflow) + 3);
+    if (s->URL == NULL) {
+        return "out of memory";
+    }
+    sprintf(s->URL, "%s/%s/%s", b->server, b->resource, item->workflow);
+
+    return start_attempt(b, s);
+}
+
+/*
+ * Evaluates a completed transfer, and schedules a retry if the outcome is
+ * worth one and time is left.
+ *
+ * Returns 1 if the item is registered, 0 if it failed, and -1 if it is
+ * retried.
+ */
+static int
+complete_transfer(batch *b, batch_slot *s, CURLcode code)
+{
+    mf_publisher *p = b->p;
+    long http_code = 0;
+
+    curl_multi_remove_handle(b->multi, s->curl);
+    b->active--;
+
+    if (code == CURLE_OK) {
+        curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &http_code);
+    }
+    if (is_retryable(code, http_code) && s->attempt < p->max_retries) {
+        long pause = backoff_pause(p, s->attempt, s->started);
+        if (pause >= 0) {
+            debug("%s retry %d in %ld ms (curl %d, http %ld)",
+                b->caller, s->attempt + 1, pause, code, http_code);
+            s->attempt++;
+            s->retry_at = now_ms() + pause;
+            return -1;
+        }
+    }
+
+    breaker_record(p, code == CURLE_OK && !is_retryable(code, http_code));
+    if (code != CURLE_OK) {
+        finish_item(b, s, 0, curl_easy_strerror(code));
+        return 0;
+    }
+    if (http_code < 200 || http_code >= 300) {
+        finish_item(b, s, http_code, "request rejected by the server");
+        return 0;
+    }
+    finish_item(b, s, http_code, NULL);
+    return 1;
+}
+
+/*
+ * Sends one request per item over up to max_concurrent transfers at a time,
+ * all driven by a single multi handle in the calling thread.
+ */
+static size_t
+register_batch(
+    batch *b,
+    mf_registration *items,
+    size_t count,
+    int max_concurrent)
+{
+    size_t n_slots = (max_concurrent > 0) ?
+        (size_t) max_concurrent : MF_REGISTER_CONCURRENCY;
+    size_t next = 0;
+    size_t done = 0;
+    size_t registered = 0;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        items[i].response = NULL;
+        items[i].status = 0;
+        items[i].error = NULL;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    if (!check_URL(b->server)) {
+        for (i = 0; i < count; ++i) {
+            items[i].error = "URL not set";
+        }
+        return 0;
+    }
+    if (n_slots > count) {
+        n_slots = count;
+    }
+
+    b->p = resolve(b->p);
+    init_global();
+    seed_jitter(b->p, now_ms());
+
+    b->multi = curl_multi_init();
+    batch_slot *slots = (batch_slot *) calloc(n_slots, sizeof(batch_slot));
+    for (i = 0; slots != NULL && i < n_slots; ++i) {
+        mf_buffer_init(&slots[i].response);
+        slots[i].curl = curl_easy_init();
+        if (slots[i].curl == NULL) {
+            break;
+        }
+    }
+    if (b->multi == NULL || slots == NULL || i == 0) {
+        for (i = 0; i < count; ++i) {
+            items[i].error = "out of memory";
+        }
+        log_error("%s(...) %s", b->caller, "out of memory");
+        curl_multi_cleanup(b->multi);
+        free(slots);
+        return 0;
+    }
+    n_slots = i;
+    curl_multi_setopt(b->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) n_slots);
+
+    while (done < count) {
+        long long now = now_ms();
+
+        for (i = 0; i < n_slots; ++i) {
+            batch_slot *s = &slots[i];
+            const char *error;
+
+            if (s->item != NULL && s->retry_at != 0 && s->retry_at <= now) {
+                s->retry_at = 0;
+                if ((error = start_attempt(b, s)) != NULL) {
+                    finish_item(b, s, 0, error);
+                    done++;
+                }
+            }
+            while (s->item == NULL && next < count) {
+                if ((error = start_item(b, s, &items[next++])) != NULL) {
+                    finish_item(b, s, 0, error);
+                    done++;
+                }
+            }
+        }
+
+        int running;
+        CURLMsg *msg;
+        curl_multi_perform(b->multi, &running);
+        while ((msg = curl_multi_info_read(b->multi, &running)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+
+            batch_slot *s = NULL;
+            CURLcode code = msg->data.result;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &s);
+            int result = complete_transfer(b, s, code);
+            if (result >= 0) {
+                done++;
+                registered += result;
+            }
+        }
+        if (done == count) {
+            break;
+        }
+
+        /* wake up for the next retry at the latest */
+        long timeout = 100;
+        now = now_ms();
+        for (i = 0; i < n_slots; ++i) {
+            if (slots[i].retry_at != 0 && slots[i].retry_at - now < timeout) {
+                timeout = (slots[i].retry_at > now) ?
+                    (long) (slots[i].retry_at - now) : 0;
+            }
+        }
+        if (b->active > 0) {
+            curl_multi_wait(b->multi, NULL, 0, (int) timeout, NULL);
+        } else if (timeout > 0) {
+            sleep_ms(timeout);
+        }
+    }
+
+    for (i = 0; i < n_slots; ++i) {
+        curl_easy_cleanup(slots[i].curl);
+        mf_buffer_free(&slots[i].response);
+    }
+    free(slots);
+    curl_multi_cleanup(b->multi);
+
+    debug("%s(...) %lu of %lu registered", b->caller,
+        (unsigned long) registered, (unsigned long) count);
+
+    return registered;
+}
+
+size_t
+mf_register_workflows(
+    mf_publisher *p,
+    const char* URL,
+    mf_registration *items,
+    size_t count,
+    int max_concurrent)
+{
+    batch b = { p, NULL, 0, URL, "v1/mf/users", "PUT",
+        "mf_register_workflows" };
+
+    return register_batch(&b, items, count, max_concurrent);
+}
+
+size_t
+mf_create_experiments(
+    mf_publisher *p,
+    const char* server,
+    mf_registration *items,
+    size_t count,
+    int max_concurrent)
+{
+    batch b = { p, NULL, 0, server, "v1/dreamcloud/mf/experiments", NULL,
+        "mf_create_experiments" };
+
+    return register_batch(&b, items, count, max_concurrent);
 }
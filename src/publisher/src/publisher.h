@@ -28,20 +28,34 @@
 #ifndef PUBLISHER_H_
 #define PUBLISHER_H_
 
+#include <stddef.h>
+
+#include "mf_json_stream.h"
+
 #define SEND_SUCCESS 1
 #define SEND_FAILED  0
 #define ID_SIZE 64
+#define MF_REGISTER_CONCURRENCY 16
 
 extern char execution_id[ID_SIZE];
 
+typedef struct mf_publisher_t mf_publisher;
+typedef struct mf_view_t mf_view;
 typedef struct Message_t Message;
 typedef struct Data_t Data;
+typedef struct mf_registration_t mf_registration;
 
 struct Data_t {
   char *key;
   char *value;
 };
 
+/* read-only window into a buffer owned by the publisher */
+struct mf_view_t {
+  const char *data;
+  size_t size;
+};
+
 struct Message_t {
   char *sender;
   char *username;
@@ -49,6 +63,24 @@ struct Message_t {
   Data *data;
 };
 
+/**
+ * @brief Creates a publisher with its own cURL handle, buffers and send
+ *        policy.
+ *
+ * Publishers share no mutable state, so each may be used by a different
+ * thread without locking. A single publisher must not be used by several
+ * threads at once. All functions taking a publisher accept NULL for the
+ * default publisher, which the functions without publisher argument use.
+ *
+ * @return the new publisher; NULL if out of memory
+ */
+mf_publisher* mf_publisher_new();
+
+/**
+ * @brief Closes the connections of the publisher and frees it.
+ */
+void mf_publisher_free(mf_publisher *publisher);
+
 /**
  * @brief Returns the execution id used for communication with Elasticsearch.
  *
@@ -69,28 +101,95 @@ struct Message_t {
 char* get_execution_id(const char *URL, char *message);
 
 /**
- * @brief Queries a server by the given query, and writes the response into
- *        received data.
+ * @brief Sends a GET request to the given URL and streams the JSON response
+ *        record by record to the callback.
  *
+ * The response is parsed incrementally while it arrives (see
+ * mf_json_stream.h), so memory use does not depend on the size of the
+ * response. The callback may return non-zero to stop the transfer early.
+ *
+ * @return 1 if successful; 0 otherwise
+ */
+int query(const char* URL, mf_json_record_cb callback, void* user_data);
+
+/**
+ * @brief Same as query(), using the given publisher.
  */
-int query(const char* query, char* received_data);
+int mf_publisher_query(
+    mf_publisher *publisher,
+    const char* URL,
+    mf_json_record_cb callback,
+    void* user_data
+);
 
 /**
- * @brief Publishes previously defined Message objects.
+ * @brief Publishes a Message as a single JSON document.
  *
- * It should be noted that this function is not yet implemented.
+ * The document holds the fields "host" (sender), "user" (username) and
+ * "@timestamp", each omitted if NULL, followed by one field per element of
+ * the data array. The data array is terminated by an element whose key is
+ * NULL. The document is serialized in one pass into a buffer that is reused
+ * across calls, and sent in one request.
  *
- * @return 1
+ * @return 1 if the server accepted the document; 0 otherwise
  */
 int publish(const char *URL, Message *messages);
 
+/**
+ * @brief Same as publish(), using the given publisher.
+ */
+int mf_publisher_publish(
+    mf_publisher *publisher,
+    const char *URL,
+    Message *messages
+);
+
 /**
  * @brief Sends the data defined in message to the given URL via cURL.
  *
- * @return 1 if successful; 0 otherwise
+ * The response is stored in a buffer that is reused by every request, and
+ * that grows to the size of the largest response. The returned string is
+ * owned by the publisher and valid until the next request.
+ *
+ * @return the response of the server; NULL if the URL or message is not set
  */
 char* publish_json(const char *URL, const char *message);
 
+/**
+ * @brief Returns the body of the last response as pointer and length.
+ *
+ * The view remains valid until the next request. Unlike the string returned
+ * by publish_json(), it also covers responses containing '\0' bytes.
+ */
+mf_view mf_publisher_get_response(mf_publisher *publisher);
+
+/**
+ * @brief Sends size bytes of data with the given content type via cURL.
+ *
+ * Unlike publish_json(), the body does not need to be '\0'-terminated and may
+ * hold binary data. A NULL content_type denotes application/json.
+ *
+ * @return the response of the server, or NULL if the request was not sent,
+ *         e.g. while the circuit breaker is open
+ */
+char* publish_data(
+    const char *URL,
+    const void *data,
+    size_t size,
+    const char *content_type
+);
+
+/**
+ * @brief Same as publish_data(), using the given publisher.
+ */
+char* mf_publisher_send(
+    mf_publisher *publisher,
+    const char *URL,
+    const void *data,
+    size_t size,
+    const char *content_type
+);
+
 /**
  * @brief Creates a new index in Elasticsearch if it not yet exists.
  */
@@ -117,6 +216,17 @@ char* mf_create_user(
   const char* message
 );
 
+/**
+ * @brief Same as mf_create_user(), using the given publisher.
+ */
+char* mf_publisher_create_user(
+    mf_publisher *publisher,
+    const char* server,
+    const char* username,
+    const char* experiment_id,
+    const char* message
+);
+
 /**
  * @brief Creates a new experiment on the database for the given workflow.
  *
@@ -129,7 +239,133 @@ char* mf_create_experiment(
 );
 
 /**
- * @brief Frees the cURL headers and global variables.
+ * @brief A workflow or experiment of a batch registration and its outcome.
+ *
+ * The caller sets workflow and json_string; the other fields are set by the
+ * registration. The response is allocated for the caller, who frees it.
+ */
+struct mf_registration_t {
+  const char *workflow;
+  const char *json_string;
+  char *response;    /* body of the response; NULL if none was received */
+  long status;       /* HTTP status code; 0 if the server was not reached */
+  const char *error; /* NULL if registered; otherwise the reason */
+};
+
+/**
+ * @brief Registers many workflows at once, like mf_register_workflow().
+ *
+ * Up to max_concurrent requests (MF_REGISTER_CONCURRENCY if 0) are in flight
+ * at the same time over a shared pool of connections. Each request follows
+ * the timeouts, retries and circuit breaker of the publisher; a failed
+ * request does not affect the others.
+ *
+ * @return the number of items registered with a 2xx response
+ */
+size_t mf_register_workflows(
+    mf_publisher *publisher,
+    const char* URL,
+    mf_registration *items,
+    size_t count,
+    int max_concurrent
+);
+
+/**
+ * @brief Creates many experiments at once, like mf_create_experiment().
+ *
+ * See mf_register_workflows(); the response of each item holds the ID of the
+ * new experiment.
+ *
+ * @return the number of experiments created
+ */
+size_t mf_create_experiments(
+    mf_publisher *publisher,
+    const char* server,
+    mf_registration *items,
+    size_t count,
+    int max_concurrent
+);
+
+/**
+ * @brief Bounds the time spent in a single request.
+ *
+ * The connect timeout limits establishing the connection, the deadline limits
+ * the whole call including all retries and backoff pauses. A value of 0
+ * disables the respective limit.
+ */
+void mf_publisher_set_timeouts(
+    mf_publisher *publisher,
+    long connect_timeout_ms,
+    long deadline_ms
+);
+
+/**
+ * @brief Configures retries of failed requests.
+ *
+ * Connection errors, timeouts, 429 and 5xx responses are retried up to
+ * max_retries times, pausing a random time between 0 and
+ * min(backoff_max_ms, backoff_base_ms * 2^attempt) before each retry.
+ */
+void mf_publisher_set_retries(
+    mf_publisher *publisher,
+    int max_retries,
+    long backoff_base_ms,
+    long backoff_max_ms
+);
+
+/**
+ * @brief Compresses request bodies with gzip.
+ *
+ * Bodies of at least min_size bytes are sent with "Content-Encoding: gzip",
+ * smaller ones as they are, since compressing them saves too little to pay
+ * for the CPU time. level ranges from 1 (fastest) to 9 (smallest); 0, the
+ * default, disables compression. A server that answers 415 Unsupported Media
+ * Type gets the body again uncompressed, and compression is turned off.
+ */
+void mf_publisher_set_compression(
+    mf_publisher *publisher,
+    int level,
+    size_t min_size
+);
+
+/**
+ * @brief Configures the circuit breaker.
+ *
+ * After failure_threshold consecutive failed requests, no request is sent for
+ * open_ms milliseconds; afterwards a single probe decides whether the circuit
+ * closes again. Messages that cannot be delivered are appended as single
+ * lines to the file at spool_path, or counted as dropped if no path is set.
+ */
+void mf_publisher_set_circuit_breaker(
+    mf_publisher *publisher,
+    int failure_threshold,
+    long open_ms,
+    const char* spool_path
+);
+
+/**
+ * @brief Cuts off all requests of the publisher after timeout_ms.
+ *
+ * Requests still running at that time, including those of other threads,
+ * are aborted, and later requests fail immediately; their messages are
+ * spooled or dropped. Used to bound the time spent sending at shutdown. A
+ * negative timeout removes the cut-off.
+ */
+void mf_publisher_abort_after(mf_publisher *publisher, long timeout_ms);
+
+/**
+ * @brief Returns the number of messages dropped since startup.
+ */
+unsigned long mf_publisher_get_dropped(mf_publisher *publisher);
+
+/**
+ * @brief Returns the HTTP status code of the last request, or 0 if the
+ *        request did not reach the server.
+ */
+long mf_publisher_get_status(mf_publisher *publisher);
+
+/**
+ * @brief Frees the default publisher, the cURL headers and global variables.
  *
  * Note: This method needs to be private in order to hide cURL.
  */
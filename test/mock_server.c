@@ -0,0 +1,311 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define _GNU_SOURCE
+#include "mock_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+typedef struct connection_t {
+    mock_server* server;
+    int fd;
+} connection;
+
+static int
+count_documents(const char* body, size_t size)
+{
+    const char* key = "@timestamp";
+    const char* end = body + size;
+    int count = 0;
+
+    while ((body = memmem(body, end - body, key, strlen(key))) != NULL) {
+        body += strlen(key);
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Returns the start of the header line beginning with name, searching only
+ * the headers up to header_end; NULL if there is none.
+ */
+static const char*
+find_header(const char* data, const char* header_end, const char* name)
+{
+    size_t length = strlen(name);
+    const char* line = data;
+
+    while (line < header_end &&
+           (line = memmem(line, header_end - line, "\r\n", 2)) != NULL) {
+        line += 2;
+        if ((size_t) (header_end - line) >= length &&
+            strncasecmp(line, name, length) == 0) {
+            return line;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Sends the answer with a single write, since a separate write for the body
+ * would wait for the acknowledgement of the headers.
+ */
+static void
+respond(int fd, int status, const char* body)
+{
+    size_t capacity = strlen(body) + 128;
+    char* response = malloc(capacity);
+    int length = snprintf(response, capacity,
+        "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\n"
+        "Content-Length: %zu\r\n\r\n%s", status,
+        (status == 200) ? "OK" : "Error", strlen(body), body);
+    if (write(fd, response, length) != length) {
+        fprintf(stderr, "mock server: short write\n");
+    }
+    free(response);
+}
+
+/*
+ * Sends the document with chunked transfer encoding, a few bytes per chunk
+ * and write, so that the client receives it in many pieces. Stops when the
+ * client hangs up.
+ */
+static void
+respond_in_chunks(int fd, const char* document)
+{
+    const char* header = "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n";
+    size_t left = strlen(document);
+    char chunk[64];
+
+    if (send(fd, header, strlen(header), MSG_NOSIGNAL) < 0) {
+        return;
+    }
+    while (left > 0) {
+        size_t size = (left < 16) ? left : 16;
+        int length = snprintf(chunk, sizeof(chunk), "%zx\r\n%.*s\r\n",
+            size, (int) size, document);
+        if (send(fd, chunk, length, MSG_NOSIGNAL) < 0) {
+            return;
+        }
+        document += size;
+        left -= size;
+        usleep(1000);
+    }
+    send(fd, "0\r\n\r\n", 5, MSG_NOSIGNAL);
+}
+
+/*
+ * Serves the requests of one keep-alive connection. The received data is
+ * kept '\0'-terminated, with a spare byte, for the string searches in the
+ * headers.
+ */
+static void*
+serve_connection(void* arg)
+{
+    connection* conn = (connection*) arg;
+    size_t capacity = 1 << 16;
+    size_t size = 0;
+    char* data = malloc(capacity);
+
+    data[0] = '\0';
+    for (;;) {
+        char* header_end = memmem(data, size, "\r\n\r\n", 4);
+        if (header_end == NULL) {
+            if (size + 1 == capacity) {
+                capacity *= 2;
+                data = realloc(data, capacity);
+            }
+            ssize_t n = read(conn->fd, data + size, capacity - size - 1);
+            if (n <= 0) {
+                break;
+            }
+            size += n;
+            data[size] = '\0';
+            continue;
+        }
+
+        size_t header_size = header_end + 4 - data;
+        size_t body_size = 0;
+        const char* line = find_header(data, header_end, "Content-Length:");
+        if (line != NULL) {
+            body_size = strtoul(line + 15, NULL, 10);
+        }
+        line = find_header(data, header_end, "Expect: 100-continue");
+        if (line != NULL && size == header_size) {
+            const char* proceed = "HTTP/1.1 100 Continue\r\n\r\n";
+            if (write(conn->fd, proceed, strlen(proceed)) < 0) {
+                break;
+            }
+        }
+
+        while (size < header_size + body_size) {
+            if (header_size + body_size >= capacity) {
+                capacity = header_size + body_size + 1;
+                data = realloc(data, capacity);
+            }
+            ssize_t n = read(conn->fd, data + size, capacity - size - 1);
+            if (n <= 0) {
+                goto done;
+            }
+            size += n;
+            data[size] = '\0';
+        }
+
+        __atomic_add_fetch(&conn->server->requests, 1, __ATOMIC_RELEASE);
+        if (conn->server->delay_ms > 0) {
+            usleep(conn->server->delay_ms * 1000);
+        }
+
+        char* request_line_end = memmem(data, header_size, "\r\n", 2);
+        int is_create = memmem(data, request_line_end - data, "/create", 7) != NULL;
+        int status = __atomic_load_n(&conn->server->status, __ATOMIC_ACQUIRE);
+        if (is_create) {
+            respond(conn->fd, 200, "shutdown-test");
+        } else if (strncmp(data, "GET ", 4) == 0) {
+            if (conn->server->silent) {
+                /* leaves the client waiting */
+            } else if (status > 0 && status != 200) {
+                respond(conn->fd, status, "{\"error\":\"status\"}");
+            } else {
+                respond_in_chunks(conn->fd, (conn->server->document != NULL) ?
+                    conn->server->document : "[]");
+            }
+        } else {
+            pthread_mutex_lock(&conn->server->lock);
+            free(conn->server->body);
+            conn->server->body = strndup(data + header_size, body_size);
+            pthread_mutex_unlock(&conn->server->lock);
+
+            __atomic_add_fetch(&conn->server->received,
+                count_documents(data + header_size, body_size), __ATOMIC_RELEASE);
+            if (!conn->server->silent) {
+                respond(conn->fd, (status > 0) ? status : 200,
+                    (conn->server->answer != NULL) ?
+                    conn->server->answer : "{\"href\":\"ok\"}");
+            }
+        }
+
+        size -= header_size + body_size;
+        memmove(data, data + header_size + body_size, size);
+        data[size] = '\0';
+    }
+
+done:
+    close(conn->fd);
+    free(data);
+    free(conn);
+    return NULL;
+}
+
+static void*
+serve(void* arg)
+{
+    mock_server* server = (mock_server*) arg;
+
+    for (;;) {
+        int fd = accept(server->fd, NULL, NULL);
+        if (fd < 0) {
+            return NULL;
+        }
+
+        pthread_t thread;
+        connection* conn = malloc(sizeof(connection));
+        conn->server = server;
+        conn->fd = fd;
+        pthread_create(&thread, NULL, serve_connection, conn);
+        pthread_detach(thread);
+    }
+}
+
+int
+mock_listen(mock_server* server, int silent)
+{
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+
+    memset(server, 0, sizeof(mock_server));
+    pthread_mutex_init(&server->lock, NULL);
+    server->silent = silent;
+    server->fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(server->fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+        listen(server->fd, 16) != 0 ||
+        getsockname(server->fd, (struct sockaddr*) &addr, &length) != 0) {
+        close(server->fd);
+        return 0;
+    }
+    server->port = ntohs(addr.sin_port);
+
+    return 1;
+}
+
+void
+mock_start(mock_server* server)
+{
+    pthread_create(&server->thread, NULL, serve, server);
+}
+
+void
+mock_stop(mock_server* server)
+{
+    shutdown(server->fd, SHUT_RDWR);
+    close(server->fd);
+    pthread_join(server->thread, NULL);
+
+    pthread_mutex_lock(&server->lock);
+    free(server->body);
+    server->body = NULL;
+    pthread_mutex_unlock(&server->lock);
+}
+
+int
+mock_received(mock_server* server)
+{
+    return __atomic_load_n(&server->received, __ATOMIC_ACQUIRE);
+}
+
+int
+mock_requests(mock_server* server)
+{
+    return __atomic_load_n(&server->requests, __ATOMIC_ACQUIRE);
+}
+
+void
+mock_set_status(mock_server* server, int status)
+{
+    __atomic_store_n(&server->status, status, __ATOMIC_RELEASE);
+}
+
+void
+mock_last_body(mock_server* server, char* out, size_t size)
+{
+    pthread_mutex_lock(&server->lock);
+    snprintf(out, size, "%s", (server->body != NULL) ? server->body : "");
+    pthread_mutex_unlock(&server->lock);
+}
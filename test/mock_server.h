@@ -0,0 +1,81 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A minimal HTTP server for tests, which answers registrations with an
+ * experiment ID and counts the metric documents it receives.
+ */
+
+#ifndef MOCK_SERVER_H_
+#define MOCK_SERVER_H_
+
+#include <pthread.h>
+
+typedef struct mock_server_t {
+    int fd;
+    int port;
+    int silent;   /* never answers requests for metrics */
+    int received; /* metric documents received */
+    int requests; /* requests received */
+    int delay_ms; /* time taken to answer a request */
+    int status;   /* HTTP status answered to metrics; 200 if 0 */
+    const char* document; /* answered to GET requests in small chunks */
+    const char* answer; /* to requests for metrics; {"href":"ok"} if NULL */
+    char* body;   /* of the last request for metrics, under lock */
+    pthread_mutex_t lock;
+    pthread_t thread;
+} mock_server;
+
+/*
+ * Opens a listening socket on a free port of the loopback interface. A
+ * silent server never answers requests for metrics or documents.
+ *
+ * Returns 1 if successful; 0 otherwise.
+ */
+int mock_listen(mock_server* server, int silent);
+
+/*
+ * Starts serving connections in a thread of its own.
+ */
+void mock_start(mock_server* server);
+
+/*
+ * Closes the listening socket and stops serving new connections.
+ */
+void mock_stop(mock_server* server);
+
+/*
+ * Returns the number of metric documents received so far.
+ */
+int mock_received(mock_server* server);
+
+/*
+ * Returns the number of requests received so far.
+ */
+int mock_requests(mock_server* server);
+
+/*
+ * Copies the body of the last request for metrics, '\0'-terminated and
+ * truncated to size bytes; an empty string if there was none.
+ */
+void mock_last_body(mock_server* server, char* out, size_t size);
+
+/*
+ * Sets the HTTP status of the answers to requests for metrics.
+ */
+void mock_set_status(mock_server* server, int status);
+
+#endif
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include <stdlib.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -122,6 +123,60 @@ Test_register_and_update_multiple_times(CuTest *tc)
     CuAssertTrue(tc, strstr(response, "error") == NULL);
 }
 
+static void*
+update_in_context(void* arg)
+{
+    mf_ctx* ctx = (mf_ctx*) arg;
+    char* response = NULL;
+    int value;
+
+    mf_metric metric;
+    metric.type = "foobar";
+    metric.name = "progress (%)";
+    for (value = 0; value != 20; ++value) {
+        char tmp[8];
+        sprintf(tmp, "%d", value * 5);
+        metric.value = tmp;
+        metric.timestamp = mf_api_get_time();
+
+        response = mf_ctx_update(ctx, &metric);
+        if (response == NULL || strstr(response, "error") != NULL) {
+            return NULL;
+        }
+    }
+
+    return ctx;
+}
+
+void
+Test_contexts_in_parallel(CuTest *tc)
+{
+    const char* server = "http://localhost:3030";
+    mf_ctx* ctx[4];
+    pthread_t threads[4];
+    void* result;
+    int i;
+
+    for (i = 0; i != 4; ++i) {
+        char job_id[32];
+        sprintf(job_id, "parallel job %d", i);
+        ctx[i] = mf_ctx_new(server, "test_user", "myApp", NULL, job_id);
+        CuAssertPtrNotNull(tc, ctx[i]);
+    }
+    CuAssertPtrNotNull(tc, mf_ctx_get_id(ctx[0]));
+    CuAssertPtrNotNull(tc, mf_ctx_get_id(ctx[1]));
+    CuAssertTrue(tc, strcmp(mf_ctx_get_id(ctx[0]), mf_ctx_get_id(ctx[1])) != 0);
+
+    for (i = 0; i != 4; ++i) {
+        pthread_create(&threads[i], NULL, update_in_context, ctx[i]);
+    }
+    for (i = 0; i != 4; ++i) {
+        pthread_join(threads[i], &result);
+        CuAssertPtrEquals(tc, ctx[i], result);
+        mf_ctx_free(ctx[i]);
+    }
+}
+
 CuSuite* CuGetSuite(void)
 {
     CuSuite* suite = CuSuiteNew();
@@ -135,5 +190,8 @@ CuSuite* CuGetSuite(void)
     SUITE_ADD_TEST(suite, Test_register_and_update);
     SUITE_ADD_TEST(suite, Test_register_and_update_multiple_times);
 
+    // mf_ctx_new
+    SUITE_ADD_TEST(suite, Test_contexts_in_parallel);
+
     return suite;
 }
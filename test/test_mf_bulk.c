@@ -0,0 +1,105 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mf_encode.h"
+#include "mock_server.h"
+
+/*
+ * A second mock server stands in for the Elasticsearch _bulk endpoint; it
+ * counts the documents of NDJSON bodies just like those of JSON arrays.
+ */
+
+void
+Test_bulk_body_is_ndjson(CuTest *tc)
+{
+    mf_buffer buffer;
+    mf_metric metrics[2] = {
+        { "2016-04-20T10:00:00.000", "energy", "power", "42.5" },
+        { "2016-04-20T10:00:01.000", "progress", "step \"1\"", "7" }
+    };
+    const char* expected =
+        "{\"index\":{\"_index\":\"user\"}}\n"
+        "{\"@timestamp\":\"2016-04-20T10:00:00.000\",\"host\":\"node01\","
+        "\"task\":\"app\",\"type\":\"energy\",\"power\":\"42.5\","
+        "\"@experiment_id\":\"AVx1\"}\n"
+        "{\"index\":{\"_index\":\"user\"}}\n"
+        "{\"@timestamp\":\"2016-04-20T10:00:01.000\",\"host\":\"node01\","
+        "\"task\":\"app\",\"type\":\"progress\",\"step \\\"1\\\"\":\"7\","
+        "\"@experiment_id\":\"AVx1\"}\n";
+
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, mf_encode_bulk(&buffer, "user", "AVx1", "node01", "app",
+        metrics, 2));
+    CuAssertIntEquals(tc, (int) strlen(expected), (int) buffer.size);
+    CuAssertTrue(tc, memcmp(expected, buffer.data, buffer.size) == 0);
+    mf_buffer_free(&buffer);
+}
+
+void
+Test_metrics_go_to_bulk_endpoint(CuTest *tc)
+{
+    mock_server server;
+    mock_server bulk;
+    mf_metric metrics[10];
+    char URL[64];
+    int i;
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    CuAssertTrue(tc, mock_listen(&bulk, 0));
+    mock_start(&server);
+    mock_start(&bulk);
+
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d", server.port);
+    CuAssertPtrNotNull(tc, mf_api_new(URL, "bulk", "ingest", NULL, NULL));
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d/_bulk", bulk.port);
+    CuAssertTrue(tc, mf_api_set_bulk_endpoint(URL, "metrics"));
+
+    for (i = 0; i < 10; ++i) {
+        metrics[i].timestamp = NULL;
+        metrics[i].type = "progress";
+        metrics[i].name = "iteration";
+        metrics[i].value = "1";
+    }
+    CuAssertPtrNotNull(tc, mf_api_update(&metrics[0]));
+    CuAssertPtrNotNull(tc, mf_api_update_batch(metrics, 10));
+
+    CuAssertIntEquals(tc, 11, mock_received(&bulk));
+    CuAssertIntEquals(tc, 0, mock_received(&server));
+
+    /* switches back to the monitoring server */
+    CuAssertTrue(tc, mf_api_set_bulk_endpoint(NULL, NULL));
+    CuAssertPtrNotNull(tc, mf_api_update(&metrics[0]));
+    CuAssertIntEquals(tc, 1, mock_received(&server));
+
+    mf_api_clear();
+    mock_stop(&bulk);
+    mock_stop(&server);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_bulk_body_is_ndjson);
+    SUITE_ADD_TEST(suite, Test_metrics_go_to_bulk_endpoint);
+
+    return suite;
+}
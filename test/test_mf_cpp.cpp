@@ -0,0 +1,131 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+extern "C" {
+#include "CuTest.h"
+#include "mock_server.h"
+}
+#include "mf_api.hpp"
+
+constexpr mf::key iteration("progress", "iteration");
+
+static void
+start(mock_server* server, char* URL, std::size_t size)
+{
+    mock_listen(server, 0);
+    mock_start(server);
+    std::snprintf(URL, size, "http://127.0.0.1:%d", server->port);
+}
+
+void
+Test_values_are_formatted(CuTest *tc)
+{
+    std::string long_string(100, 'x');
+    std::string_view unterminated("12345", 3);
+
+    CuAssertStrEquals(tc, "-42", mf::value(-42).c_str());
+    CuAssertStrEquals(tc, "18446744073709551615",
+        mf::value(18446744073709551615ULL).c_str());
+    CuAssertStrEquals(tc, "0.1", mf::value(0.1).c_str());
+    CuAssertStrEquals(tc, "0.1", mf::value(0.1f).c_str());
+    CuAssertStrEquals(tc, "1e+300", mf::value(1e300).c_str());
+    CuAssertStrEquals(tc, "-2.5", mf::value(-2.5L).c_str());
+    CuAssertStrEquals(tc, "1", mf::value(true).c_str());
+    CuAssertStrEquals(tc, "123", mf::value(unterminated).c_str());
+    CuAssertStrEquals(tc, long_string.c_str(), mf::value(long_string).c_str());
+
+    const char* literal = "as is";
+    CuAssertPtrEquals(tc, (void*) literal, (void*) mf::value(literal).c_str());
+}
+
+void
+Test_session_sends_typed_values(CuTest *tc)
+{
+    mock_server server;
+    char URL[64];
+
+    start(&server, URL, sizeof(URL));
+    {
+        mf::session session(URL, "cpp", "wrapper");
+        CuAssertTrue(tc, (bool) session);
+        CuAssertPtrNotNull(tc, (void*) session.id());
+
+        /* the registration is global, so a second session must fail */
+        mf::session second(URL, "cpp", "second");
+        CuAssertTrue(tc, !second);
+        CuAssertPtrEquals(tc, NULL, (void*) second.id());
+        CuAssertStrEquals(tc, mf_api_get_id(), session.id());
+
+        CuAssertTrue(tc, mf::update(iteration, 1));
+        CuAssertTrue(tc, mf::update(iteration, 2.5));
+        CuAssertTrue(tc, mf::update(iteration, std::string_view("three")));
+        CuAssertTrue(tc, mf::update(iteration, std::string("four")));
+        CuAssertTrue(tc, mf::update(iteration, "five"));
+
+        /* the moved-from session must not end the registration */
+        mf::session moved(std::move(session));
+        CuAssertTrue(tc, !session);
+        CuAssertTrue(tc, (bool) moved);
+    }
+    CuAssertIntEquals(tc, 5, mock_received(&server));
+    CuAssertPtrEquals(tc, NULL, (void*) mf_api_get_id());
+
+    mock_stop(&server);
+}
+
+void
+Test_region_sends_elapsed_time_once(CuTest *tc)
+{
+    constexpr mf::key sleep_time("timing", "sleep");
+    mock_server server;
+    char URL[64];
+
+    start(&server, URL, sizeof(URL));
+    mf::session session(URL, "cpp", "wrapper");
+    {
+        mf::region region(sleep_time);
+        usleep(10000);
+        CuAssertTrue(tc, region.elapsed() >= 0.01);
+
+        mf::region moved(std::move(region));
+        CuAssertTrue(tc, !region.stop());
+    }
+    CuAssertIntEquals(tc, 1, mock_received(&server));
+
+    mf::region region(sleep_time);
+    CuAssertTrue(tc, region.stop());
+    CuAssertTrue(tc, !region.stop());
+    CuAssertIntEquals(tc, 2, mock_received(&server));
+
+    session.close();
+    mock_stop(&server);
+}
+
+extern "C" CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_values_are_formatted);
+    SUITE_ADD_TEST(suite, Test_session_sends_typed_values);
+    SUITE_ADD_TEST(suite, Test_region_sends_elapsed_time_once);
+
+    return suite;
+}
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mf_energy.h"
+
+/*
+ * The tests sample a fake powercap tree in a temporary directory, laid out
+ * like /sys/class/powercap of a single package:
+ *
+ *   intel-rapl/                  control type, no counter
+ *   intel-rapl:0/name            package-0
+ *   intel-rapl:0/energy_uj
+ *   intel-rapl:0/max_energy_range_uj
+ *   intel-rapl:0:0/...           core
+ */
+
+#define MAX_METRICS 8
+#define RANGE_UJ    1000000
+
+typedef struct sampled_t {
+    int samples;
+    size_t count;
+    char names[MAX_METRICS][32];
+    char values[MAX_METRICS][32];
+} sampled;
+
+static int
+collect(mf_metric* metrics, size_t count, void* user_data)
+{
+    sampled* s = (sampled*) user_data;
+    size_t i;
+
+    s->count = count;
+    for (i = 0; i < count && i < MAX_METRICS; ++i) {
+        snprintf(s->names[i], 32, "%s", metrics[i].name);
+        snprintf(s->values[i], 32, "%s", metrics[i].value);
+    }
+    __atomic_add_fetch(&s->samples, 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+static const char*
+value_of(sampled* s, const char* name)
+{
+    size_t i;
+
+    for (i = 0; i < s->count && i < MAX_METRICS; ++i) {
+        if (strcmp(s->names[i], name) == 0) {
+            return s->values[i];
+        }
+    }
+    return "";
+}
+
+static void
+write_file(const char* root, const char* zone, const char* file, const char* value)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s/%s", root, zone, file);
+
+    FILE* f = fopen(path, "w");
+    if (f != NULL) {
+        fprintf(f, "%s\n", value);
+        fclose(f);
+    }
+}
+
+static void
+set_counter(const char* root, const char* zone, unsigned long uj)
+{
+    char value[32];
+    snprintf(value, sizeof(value), "%lu", uj);
+    write_file(root, zone, "energy_uj", value);
+}
+
+static void
+add_zone(const char* root, const char* zone, const char* name, unsigned long uj)
+{
+    char path[256];
+    char range[32];
+
+    snprintf(path, sizeof(path), "%s/%s", root, zone);
+    mkdir(path, 0755);
+    write_file(root, zone, "name", name);
+    snprintf(range, sizeof(range), "%d", RANGE_UJ);
+    write_file(root, zone, "max_energy_range_uj", range);
+    set_counter(root, zone, uj);
+}
+
+static void
+remove_tree(const char* root)
+{
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf '%s'", root);
+    if (system(command) != 0) {
+        fprintf(stderr, "cannot remove %s\n", root);
+    }
+}
+
+static char*
+make_tree(char* root)
+{
+    char path[256];
+
+    strcpy(root, "/tmp/mf_energy_XXXXXX");
+    if (mkdtemp(root) == NULL) {
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/intel-rapl", root);
+    mkdir(path, 0755);
+    add_zone(root, "intel-rapl:0", "package-0", 100000);
+    add_zone(root, "intel-rapl:0:0", "core", 990000);
+
+    return root;
+}
+
+void
+Test_zones_are_discovered(CuTest *tc)
+{
+    char root[64];
+    sampled s;
+
+    memset(&s, 0, sizeof(s));
+    CuAssertPtrNotNull(tc, make_tree(root));
+
+    mf_energy* energy = mf_energy_new(root, 60000, collect, &s);
+    CuAssertPtrNotNull(tc, energy);
+    CuAssertIntEquals(tc, 2, (int) mf_energy_zones(energy));
+
+    mf_energy_sample(energy);
+    CuAssertIntEquals(tc, 4, (int) s.count);
+    CuAssertStrEquals(tc, "0.000000", value_of(&s, "package-0_energy"));
+    CuAssertStrEquals(tc, "0.000", value_of(&s, "package-0_power"));
+    CuAssertStrEquals(tc, "0.000000", value_of(&s, "package-0_core_energy"));
+
+    mf_energy_free(energy);
+    remove_tree(root);
+}
+
+void
+Test_energy_accounts_for_wraparound(CuTest *tc)
+{
+    char root[64];
+    sampled s;
+
+    memset(&s, 0, sizeof(s));
+    CuAssertPtrNotNull(tc, make_tree(root));
+    mf_energy* energy = mf_energy_new(root, 60000, collect, &s);
+    CuAssertPtrNotNull(tc, energy);
+
+    /* 0.5 J on the package; the core counter wraps after 10 mJ, then 20 mJ */
+    set_counter(root, "intel-rapl:0", 600000);
+    set_counter(root, "intel-rapl:0:0", 20000);
+    usleep(100 * 1000);
+    mf_energy_sample(energy);
+
+    CuAssertStrEquals(tc, "0.500000", value_of(&s, "package-0_energy"));
+    CuAssertStrEquals(tc, "0.030000", value_of(&s, "package-0_core_energy"));
+
+    /* at most 0.5 J in at least 100 ms */
+    double power = atof(value_of(&s, "package-0_power"));
+    CuAssertTrue(tc, power > 0 && power <= 5.0);
+
+    set_counter(root, "intel-rapl:0", 700000);
+    mf_energy_sample(energy);
+    CuAssertStrEquals(tc, "0.600000", value_of(&s, "package-0_energy"));
+    CuAssertStrEquals(tc, "0.030000", value_of(&s, "package-0_core_energy"));
+
+    mf_energy_free(energy);
+    remove_tree(root);
+}
+
+void
+Test_root_without_zones_is_rejected(CuTest *tc)
+{
+    char root[64];
+    sampled s;
+
+    strcpy(root, "/tmp/mf_energy_XXXXXX");
+    CuAssertPtrNotNull(tc, mkdtemp(root));
+
+    CuAssertPtrEquals(tc, NULL, mf_energy_new(root, 60000, collect, &s));
+    CuAssertPtrEquals(tc, NULL, mf_energy_new("/nonexistent", 60000, collect, &s));
+
+    remove_tree(root);
+}
+
+void
+Test_sampler_runs_at_interval(CuTest *tc)
+{
+    char root[64];
+    sampled s;
+
+    memset(&s, 0, sizeof(s));
+    CuAssertPtrNotNull(tc, make_tree(root));
+
+    mf_energy* energy = mf_energy_new(root, 20, collect, &s);
+    CuAssertPtrNotNull(tc, energy);
+    usleep(300 * 1000);
+    mf_energy_free(energy);
+
+    int samples = __atomic_load_n(&s.samples, __ATOMIC_ACQUIRE);
+    CuAssertTrue(tc, samples >= 5);
+    CuAssertTrue(tc, samples <= 20);
+
+    remove_tree(root);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_zones_are_discovered);
+    SUITE_ADD_TEST(suite, Test_energy_accounts_for_wraparound);
+    SUITE_ADD_TEST(suite, Test_root_without_zones_is_rejected);
+    SUITE_ADD_TEST(suite, Test_sampler_runs_at_interval);
+
+    return suite;
+}
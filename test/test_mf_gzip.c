@@ -0,0 +1,124 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <zlib.h>
+
+#include "CuTest.h"
+#include "contrib/mf_gzip.h"
+
+/* inflates a gzip member into out; returns the inflated size, or -1 */
+static long
+gunzip(const mf_buffer* in, char* out, size_t capacity)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+        return -1;
+    }
+    stream.next_in = (Bytef*) in->data;
+    stream.avail_in = (uInt) in->size;
+    stream.next_out = (Bytef*) out;
+    stream.avail_out = (uInt) capacity;
+
+    int result = inflate(&stream, Z_FINISH);
+    long size = (result == Z_STREAM_END) ? (long) stream.total_out : -1;
+    inflateEnd(&stream);
+
+    return size;
+}
+
+static void
+make_batch(char* body, size_t size)
+{
+    size_t length = 0;
+    int i = 0;
+
+    while (length + 80 < size) {
+        length += sprintf(body + length,
+            "{\"type\":\"PAPI-C\",\"name\":\"PAPI_TOT_INS\",\"value\":%d}\n", i++);
+    }
+}
+
+void
+Test_roundtrip_at_every_level(CuTest *tc)
+{
+    char body[8192];
+    char inflated[8192];
+    mf_buffer out;
+    mf_gzip gz;
+    int level;
+
+    make_batch(body, sizeof(body));
+    mf_buffer_init(&out);
+    mf_gzip_init(&gz);
+
+    for (level = 1; level <= 9; ++level) {
+        CuAssertTrue(tc, mf_gzip_compress(&gz, level, &out, body, strlen(body)));
+        CuAssertTrue(tc, out.size < strlen(body) / 4);
+        CuAssertIntEquals(tc, 0x1f, (unsigned char) out.data[0]);
+        CuAssertIntEquals(tc, 0x8b, (unsigned char) out.data[1]);
+
+        long size = gunzip(&out, inflated, sizeof(inflated));
+        CuAssertIntEquals(tc, (int) strlen(body), (int) size);
+        CuAssertTrue(tc, memcmp(body, inflated, size) == 0);
+    }
+
+    mf_gzip_free(&gz);
+    mf_buffer_free(&out);
+}
+
+void
+Test_reused_state_compresses_each_body_alone(CuTest *tc)
+{
+    const char* first = "{\"type\":\"energy\",\"power\":\"125.0\"}";
+    const char* second = "";
+    char inflated[256];
+    mf_buffer out;
+    mf_gzip gz;
+
+    mf_buffer_init(&out);
+    mf_gzip_init(&gz);
+
+    CuAssertTrue(tc, mf_gzip_compress(&gz, 6, &out, first, strlen(first)));
+    CuAssertTrue(tc, mf_gzip_compress(&gz, 6, &out, second, 0));
+    CuAssertIntEquals(tc, 0, (int) gunzip(&out, inflated, sizeof(inflated)));
+
+    CuAssertTrue(tc, mf_gzip_compress(&gz, 1, &out, first, strlen(first)));
+    long size = gunzip(&out, inflated, sizeof(inflated));
+    CuAssertIntEquals(tc, (int) strlen(first), (int) size);
+    CuAssertTrue(tc, memcmp(first, inflated, size) == 0);
+
+    /* out of range falls back to the default level */
+    CuAssertTrue(tc, mf_gzip_compress(&gz, 42, &out, first, strlen(first)));
+    CuAssertIntEquals(tc, (int) strlen(first),
+        (int) gunzip(&out, inflated, sizeof(inflated)));
+
+    mf_gzip_free(&gz);
+    mf_buffer_free(&out);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_roundtrip_at_every_level);
+    SUITE_ADD_TEST(suite, Test_reused_state_compresses_each_body_alone);
+
+    return suite;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mf_histogram.h"
+
+#define N_THREADS 4
+#define N_PER_THREAD 100000
+
+void
+Test_buckets_are_contiguous(CuTest *tc)
+{
+    size_t i;
+
+    CuAssertIntEquals(tc, 0, (int) mf_histogram_bucket_lower(0));
+    for (i = 1; i < MF_HIST_N_BUCKETS; ++i) {
+        CuAssertTrue(tc, mf_histogram_bucket_lower(i) ==
+            mf_histogram_bucket_upper(i - 1) + 1);
+    }
+    CuAssertTrue(tc, mf_histogram_bucket_upper(MF_HIST_N_BUCKETS - 1) == UINT64_MAX);
+}
+
+void
+Test_values_fall_into_their_bucket(CuTest *tc)
+{
+    uint64_t values[] = {
+        0, 1, 31, 32, 33, 63, 64, 65, 1000, 1023, 1024, 123456789,
+        1ULL << 40, (1ULL << 40) + 12345, UINT64_MAX - 1, UINT64_MAX
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        size_t bucket = mf_histogram_bucket(values[i]);
+        uint64_t lower = mf_histogram_bucket_lower(bucket);
+        uint64_t upper = mf_histogram_bucket_upper(bucket);
+
+        CuAssertTrue(tc, bucket < MF_HIST_N_BUCKETS);
+        CuAssertTrue(tc, lower <= values[i] && values[i] <= upper);
+        /* relative width of at most 1/32 */
+        CuAssertTrue(tc, (upper - lower) <= lower / 32);
+    }
+}
+
+void
+Test_percentiles_of_uniform_values(CuTest *tc)
+{
+    uint64_t value;
+
+    mf_histogram* histogram = mf_histogram_new("latency", "request_us",
+        MF_HIST_PERCENTILES);
+    for (value = 1; value <= 10000; ++value) {
+        mf_histogram_record(histogram, value);
+    }
+
+    CuAssertTrue(tc, mf_histogram_collect(histogram) == 10000);
+    uint64_t p50 = mf_histogram_percentile(histogram, 50.0);
+    uint64_t p99 = mf_histogram_percentile(histogram, 99.0);
+    CuAssertTrue(tc, p50 >= 5000 && p50 <= 5000 + 5000 / 32);
+    CuAssertTrue(tc, p99 >= 9900 && p99 <= 9900 + 9900 / 32);
+    CuAssertTrue(tc, mf_histogram_percentile(histogram, 100.0) >= 10000);
+
+    mf_histogram_free(histogram);
+}
+
+void
+Test_collect_returns_values_since_last_collect(CuTest *tc)
+{
+    mf_histogram* histogram = mf_histogram_new("latency", "request_us", 0);
+
+    mf_histogram_record(histogram, 10);
+    mf_histogram_record(histogram, 20);
+    CuAssertTrue(tc, mf_histogram_collect(histogram) == 2);
+    CuAssertTrue(tc, mf_histogram_collect(histogram) == 0);
+    CuAssertTrue(tc, mf_histogram_percentile(histogram, 50.0) == 0);
+
+    mf_histogram_record(histogram, 1000);
+    CuAssertTrue(tc, mf_histogram_collect(histogram) == 1);
+    CuAssertTrue(tc, mf_histogram_percentile(histogram, 50.0) >= 1000);
+
+    mf_histogram_free(histogram);
+}
+
+static void*
+record_values(void* arg)
+{
+    mf_histogram* histogram = (mf_histogram*) arg;
+    int i;
+
+    for (i = 0; i < N_PER_THREAD; ++i) {
+        mf_histogram_record(histogram, i % 1000);
+    }
+    return NULL;
+}
+
+void
+Test_threads_are_merged(CuTest *tc)
+{
+    pthread_t threads[N_THREADS];
+    int i;
+
+    mf_histogram* histogram = mf_histogram_new("latency", "request_us", 0);
+
+    /* the recording thread exits before the collection */
+    for (i = 0; i < N_THREADS; ++i) {
+        pthread_create(&threads[i], NULL, record_values, histogram);
+    }
+    for (i = 0; i < N_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    mf_histogram_record(histogram, 5);
+
+    CuAssertTrue(tc, mf_histogram_collect(histogram) == N_THREADS * N_PER_THREAD + 1);
+
+    /* counts of exited threads are not reported twice */
+    mf_histogram_record(histogram, 5);
+    CuAssertTrue(tc, mf_histogram_collect(histogram) == 1);
+
+    mf_histogram_free(histogram);
+}
+
+void
+Test_encode_json(CuTest *tc)
+{
+    mf_buffer buffer;
+
+    mf_histogram* histogram = mf_histogram_new("latency", "request_us",
+        MF_HIST_PERCENTILES | MF_HIST_BUCKETS);
+    mf_histogram_record(histogram, 7);
+    mf_histogram_record(histogram, 7);
+    mf_histogram_record(histogram, 100);
+    mf_histogram_collect(histogram);
+
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, mf_histogram_encode(&buffer, MF_FORMAT_JSON, "h", "t",
+        "2016-04-20T12:00:00.000", histogram));
+    CuAssertStrEquals(tc,
+        "{\"@timestamp\":\"2016-04-20T12:00:00.000\",\"host\":\"h\",\"task\":\"t\","
+        "\"type\":\"latency\",\"name\":\"request_us\",\"encoding\":\"hdr\","
+        "\"count\":3,\"sum\":114,\"min\":7,\"max\":101,"
+        "\"p50\":7,\"p90\":101,\"p99\":101,\"p99.9\":101,"
+        "\"buckets\":[7,2,100,1]}",
+        buffer.data);
+
+    mf_buffer_free(&buffer);
+    mf_histogram_free(histogram);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_buckets_are_contiguous);
+    SUITE_ADD_TEST(suite, Test_values_fall_into_their_bucket);
+    SUITE_ADD_TEST(suite, Test_percentiles_of_uniform_values);
+    SUITE_ADD_TEST(suite, Test_collect_returns_values_since_last_collect);
+    SUITE_ADD_TEST(suite, Test_threads_are_merged);
+    SUITE_ADD_TEST(suite, Test_encode_json);
+
+    return suite;
+}
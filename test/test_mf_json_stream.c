@@ -0,0 +1,163 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "CuTest.h"
+#include "contrib/mf_json_stream.h"
+
+static const char* document =
+    "[ {\"@timestamp\": \"2016-04-20T12:00:00.000\", \"type\": \"energy\","
+    "   \"power\": 12.5e1, \"ok\": true, \"note\": null},\n"
+    "  {\"_source\": {\"host\": \"node\\u00e901\", \"cpu\": {\"id\": 3}},"
+    "   \"tags\": [1, \"a]\", {\"b\": 2}], \"s\": \"tab\\tquote\\\"\"},\n"
+    "  {} ]";
+
+/* concatenates all records as "key=value;" and records as "|" */
+static int
+collect(const char** keys, const char** values, size_t count, void* user_data)
+{
+    CuString* out = (CuString*) user_data;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        CuStringAppendFormat(out, "%s=%s;", keys[i], values[i]);
+    }
+    CuStringAppend(out, "|");
+
+    return 0;
+}
+
+static int
+stop_after_first(const char** keys, const char** values, size_t count, void* user_data)
+{
+    (*(int*) user_data)++;
+    return 1;
+}
+
+static const char* expected =
+    "@timestamp=2016-04-20T12:00:00.000;type=energy;power=12.5e1;ok=true;note=null;|"
+    "_source.host=node\xc3\xa9" "01;_source.cpu.id=3;tags=[1, \"a]\", {\"b\": 2}];"
+    "s=tab\tquote\";|"
+    "|";
+
+void
+Test_parse_whole_document(CuTest *tc)
+{
+    CuString* out = CuStringNew();
+    mf_json_stream* stream = mf_json_stream_new(collect, out);
+
+    CuAssertTrue(tc, mf_json_stream_feed(stream, document, strlen(document)));
+    CuAssertTrue(tc, mf_json_stream_finish(stream));
+    CuAssertStrEquals(tc, expected, out->buffer);
+    CuAssertTrue(tc, mf_json_stream_records(stream) == 3);
+
+    mf_json_stream_free(stream);
+    CuStringDelete(out);
+}
+
+void
+Test_parse_byte_by_byte(CuTest *tc)
+{
+    CuString* out = CuStringNew();
+    mf_json_stream* stream = mf_json_stream_new(collect, out);
+    size_t i;
+
+    for (i = 0; i < strlen(document); ++i) {
+        CuAssertTrue(tc, mf_json_stream_feed(stream, document + i, 1));
+    }
+    CuAssertTrue(tc, mf_json_stream_finish(stream));
+    CuAssertStrEquals(tc, expected, out->buffer);
+
+    mf_json_stream_free(stream);
+    CuStringDelete(out);
+}
+
+void
+Test_parse_object_of_records(CuTest *tc)
+{
+    const char* json = "{\"id1\": {\"a\": \"1\"}, \"id2\": {\"a\": \"2\"}, \"n\": 5}";
+    CuString* out = CuStringNew();
+    mf_json_stream* stream = mf_json_stream_new(collect, out);
+
+    CuAssertTrue(tc, mf_json_stream_feed(stream, json, strlen(json)));
+    CuAssertTrue(tc, mf_json_stream_finish(stream));
+    CuAssertStrEquals(tc, "a=1;|a=2;|", out->buffer);
+
+    mf_json_stream_free(stream);
+    CuStringDelete(out);
+}
+
+void
+Test_callback_stops_parsing(CuTest *tc)
+{
+    int calls = 0;
+    mf_json_stream* stream = mf_json_stream_new(stop_after_first, &calls);
+
+    CuAssertTrue(tc, !mf_json_stream_feed(stream, document, strlen(document)));
+    CuAssertTrue(tc, mf_json_stream_finish(stream));
+    CuAssertIntEquals(tc, 1, calls);
+
+    mf_json_stream_free(stream);
+}
+
+void
+Test_reject_malformed(CuTest *tc)
+{
+    const char* malformed[] = {
+        "[{\"a\": 1,}]", "[{\"a\" 1}]", "[{\"a\": 1]", "[{\"a\": tru}]",
+        "[{\"a\": \"\\x\"}]", "[1] 2", "[{\"a\": 01x}]"
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+        mf_json_stream* stream = mf_json_stream_new(NULL, NULL);
+        int ok = mf_json_stream_feed(stream, malformed[i], strlen(malformed[i]));
+        CuAssertTrue(tc, !ok || !mf_json_stream_finish(stream));
+        mf_json_stream_free(stream);
+    }
+}
+
+void
+Test_incomplete_document(CuTest *tc)
+{
+    const char* json = "[{\"a\": 1}, {\"b\":";
+    mf_json_stream* stream = mf_json_stream_new(NULL, NULL);
+
+    CuAssertTrue(tc, mf_json_stream_feed(stream, json, strlen(json)));
+    CuAssertTrue(tc, !mf_json_stream_finish(stream));
+    CuAssertTrue(tc, mf_json_stream_records(stream) == 1);
+
+    mf_json_stream_free(stream);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    // mf_json_stream_feed
+    SUITE_ADD_TEST(suite, Test_parse_whole_document);
+    SUITE_ADD_TEST(suite, Test_parse_byte_by_byte);
+    SUITE_ADD_TEST(suite, Test_parse_object_of_records);
+    SUITE_ADD_TEST(suite, Test_callback_stops_parsing);
+
+    // mf_json_stream_finish
+    SUITE_ADD_TEST(suite, Test_reject_malformed);
+    SUITE_ADD_TEST(suite, Test_incomplete_document);
+
+    return suite;
+}
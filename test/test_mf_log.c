@@ -0,0 +1,185 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "CuTest.h"
+#include "contrib/mf_log.h"
+
+/*
+ * The records are decoded into a temporary file, which the tests read back
+ * after mf_log_flush().
+ */
+
+static FILE* out = NULL;
+
+static void
+capture(int level)
+{
+    if (out != NULL) {
+        fclose(out);
+    }
+    out = tmpfile();
+    mf_log_set_output(out);
+    mf_log_set_level(level);
+}
+
+/*
+ * Decodes the pending records and returns everything written so far.
+ */
+static char*
+captured()
+{
+    static char text[1 << 20];
+
+    mf_log_flush();
+    fflush(out);
+    rewind(out);
+    size_t n = fread(text, 1, sizeof(text) - 1, out);
+    text[n] = '\0';
+
+    return text;
+}
+
+void
+Test_record_is_formatted_like_printf(CuTest *tc)
+{
+    char expected[512];
+    int line;
+
+    capture(MF_LOG_DEBUG);
+    line = __LINE__ + 1;
+    mf_log(MF_LOG_INFO, "%d %s %zu %.3f %c %lu [%5.2s|%-4d|%x] 100%% %p",
+        -42, "text", (size_t) 7, 2.5, 'x', 123456789012UL, "abc", 9, 255,
+        (void*) &line);
+
+    snprintf(expected, sizeof(expected), "[INFO] (%s:%d) "
+        "%d %s %zu %.3f %c %lu [%5.2s|%-4d|%x] 100%% %p\n", __FILE__, line,
+        -42, "text", (size_t) 7, 2.5, 'x', 123456789012UL, "abc", 9, 255,
+        (void*) &line);
+    CuAssertStrEquals(tc, expected, captured());
+}
+
+void
+Test_error_keeps_errno(CuTest *tc)
+{
+    char expected[256];
+    int line;
+
+    capture(MF_LOG_WARN);
+    errno = ENOENT;
+    line = __LINE__ + 1;
+    mf_log(MF_LOG_ERROR, "cannot open %s", "file");
+    CuAssertIntEquals(tc, ENOENT, errno);
+
+    snprintf(expected, sizeof(expected),
+        "[ERROR] (%s:%d: errno: %s) cannot open file\n",
+        __FILE__, line, strerror(ENOENT));
+    CuAssertStrEquals(tc, expected, captured());
+}
+
+void
+Test_level_filters_records(CuTest *tc)
+{
+    capture(MF_LOG_WARN);
+    mf_log(MF_LOG_DEBUG, "not %s", "recorded");
+    mf_log(MF_LOG_INFO, "not %s", "recorded");
+    CuAssertStrEquals(tc, "", captured());
+
+    mf_log_set_level(MF_LOG_DEBUG);
+    mf_log(MF_LOG_DEBUG, "%s", "recorded");
+    CuAssertTrue(tc, strstr(captured(), "recorded\n") != NULL);
+}
+
+void
+Test_long_string_is_truncated(CuTest *tc)
+{
+    char* long_string = malloc(4096);
+
+    memset(long_string, 'a', 4095);
+    long_string[4095] = '\0';
+
+    capture(MF_LOG_DEBUG);
+    mf_log(MF_LOG_WARN, "%s %d", long_string, 5);
+    char* text = captured();
+
+    CuAssertTrue(tc, strstr(text, "aaaa") != NULL);
+    CuAssertTrue(tc, strlen(text) < MF_LOG_RECORD_SIZE + 128);
+    CuAssertTrue(tc, strstr(text, " ?\n") != NULL);
+
+    free(long_string);
+}
+
+void
+Test_full_ring_drops_records(CuTest *tc)
+{
+    const int total = 4 * MF_LOG_RING_SIZE;
+    unsigned long dropped = mf_log_get_dropped();
+    int i;
+
+    capture(MF_LOG_DEBUG);
+    for (i = 0; i < total; ++i) {
+        mf_log(MF_LOG_INFO, "record %d", i);
+    }
+    char* text = captured();
+    dropped = mf_log_get_dropped() - dropped;
+
+    int lines = 0;
+    for (; (text = strstr(text, "record ")) != NULL; text++) {
+        lines++;
+    }
+    CuAssertIntEquals(tc, total, lines + (int) dropped);
+}
+
+void
+Test_stop_decodes_pending_records(CuTest *tc)
+{
+    static char text[4096];
+    size_t n;
+
+    capture(MF_LOG_DEBUG);
+    mf_log(MF_LOG_INFO, "before %s", "stop");
+    mf_log_stop();
+
+    /* no flush: the stopped decoder must have left nothing behind */
+    fflush(out);
+    rewind(out);
+    n = fread(text, 1, sizeof(text) - 1, out);
+    text[n] = '\0';
+    CuAssertPtrNotNull(tc, strstr(text, "before stop\n"));
+
+    /* the next record starts the decoder again */
+    mf_log(MF_LOG_INFO, "after %s", "stop");
+    mf_log_stop();
+    mf_log_stop();
+    CuAssertPtrNotNull(tc, strstr(captured(), "after stop\n"));
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_record_is_formatted_like_printf);
+    SUITE_ADD_TEST(suite, Test_error_keeps_errno);
+    SUITE_ADD_TEST(suite, Test_level_filters_records);
+    SUITE_ADD_TEST(suite, Test_long_string_is_truncated);
+    SUITE_ADD_TEST(suite, Test_full_ring_drops_records);
+    SUITE_ADD_TEST(suite, Test_stop_decodes_pending_records);
+
+    return suite;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mock_server.h"
+
+/*
+ * Steady-state updates must not allocate, so the resident memory of the
+ * process stays flat however many metrics it reports.
+ */
+
+#define MAX_GROWTH (1024 * 1024)
+
+static long
+resident_bytes()
+{
+    long pages = 0;
+    long resident = 0;
+
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return 0;
+    }
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Reports metrics through every update path: staged and synchronous
+ * updates, batches and snapshots, all without timestamp.
+ */
+static void
+report(int staged, int updates, int batches)
+{
+    const char* names[] = { "cpu", "memory", "io" };
+    const char* values[] = { "1", "2", "3" };
+    mf_metric metrics[100];
+    char value[16];
+    int i;
+    int j;
+
+    mf_api_set_staging(512, 100);
+    for (i = 0; i < staged; ++i) {
+        snprintf(value, sizeof(value), "%d", i);
+        mf_metric metric = { NULL, "memory", "staged", value };
+        mf_api_update(&metric);
+        mf_api_get_time();
+    }
+    mf_api_flush();
+    mf_api_set_staging(0, 0);
+
+    for (i = 0; i < updates; ++i) {
+        snprintf(value, sizeof(value), "%d", i);
+        mf_metric metric = { NULL, "memory", "update", value };
+        mf_api_update(&metric);
+    }
+
+    for (i = 0; i < batches; ++i) {
+        for (j = 0; j < 100; ++j) {
+            metrics[j].timestamp = NULL;
+            metrics[j].type = "memory";
+            metrics[j].name = "batch";
+            metrics[j].value = "42";
+        }
+        mf_api_update_batch(metrics, 100);
+        mf_api_update_snapshot("memory", names, values, 3);
+    }
+}
+
+void
+Test_resident_memory_stays_flat(CuTest *tc)
+{
+    mock_server server;
+    char URL[64];
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    mock_start(&server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d", server.port);
+    CuAssertPtrNotNull(tc, mf_api_new(URL, "memory", "flat", NULL, NULL));
+
+    /* grows the buffers to their steady-state size */
+    report(100000, 1000, 100);
+    long before = resident_bytes();
+
+    report(2000000, 10000, 2000);
+    long after = resident_bytes();
+
+    CuAssertTrue(tc, before > 0);
+    CuAssertTrue(tc, after - before < MAX_GROWTH);
+    CuAssertIntEquals(tc, 2100000 + 11000 + 2100 * 101, mock_received(&server));
+
+    mf_api_clear();
+    mock_stop(&server);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_resident_memory_stays_flat);
+
+    return suite;
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mf_encode.h"
+#include "contrib/mf_msgpack.h"
+
+/*
+ * Compares the buffer with the expected bytes; on a mismatch, fails with
+ * both in hex.
+ */
+static void
+assert_bytes(CuTest *tc, const char* expected, size_t size, mf_buffer* buffer)
+{
+    char message[512];
+    size_t n = 0;
+    size_t i;
+
+    if (buffer->size == size && memcmp(buffer->data, expected, size) == 0) {
+        return;
+    }
+    n += snprintf(message + n, sizeof(message) - n, "expected");
+    for (i = 0; i < size && n < sizeof(message) / 2; ++i) {
+        n += snprintf(message + n, sizeof(message) - n, " %02x",
+            (unsigned char) expected[i]);
+    }
+    n += snprintf(message + n, sizeof(message) - n, ", was");
+    for (i = 0; i < buffer->size && n < sizeof(message) - 4; ++i) {
+        n += snprintf(message + n, sizeof(message) - n, " %02x",
+            (unsigned char) buffer->data[i]);
+    }
+    CuFail(tc, message);
+}
+
+#define ASSERT_BYTES(tc, expected, buffer) \
+    assert_bytes((tc), (expected), sizeof(expected) - 1, (buffer))
+
+/*
+ * Checks the header written before length bytes of a str or bin value.
+ */
+static void
+assert_header(CuTest *tc, const char* expected, size_t header_size,
+              int (*put)(mf_buffer*, const char*, size_t), size_t length)
+{
+    char* data = malloc(length + 1);
+    mf_buffer buffer;
+
+    memset(data, 'x', length);
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, put(&buffer, data, length));
+    CuAssertIntEquals(tc, (int) (header_size + length), (int) buffer.size);
+    CuAssertTrue(tc, memcmp(buffer.data, expected, header_size) == 0);
+    CuAssertTrue(tc, memcmp(buffer.data + header_size, data, length) == 0);
+    mf_buffer_free(&buffer);
+    free(data);
+}
+
+static int
+put_bin(mf_buffer* buffer, const char* data, size_t length)
+{
+    return mf_msgpack_bin(buffer, data, length);
+}
+
+void
+Test_scalars(CuTest *tc)
+{
+    mf_buffer buffer;
+
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, mf_msgpack_nil(&buffer) &&
+        mf_msgpack_bool(&buffer, 1) &&
+        mf_msgpack_bool(&buffer, 0) &&
+        mf_msgpack_double(&buffer, 1.5));
+    ASSERT_BYTES(tc, "\xc0\xc3\xc2\xcb\x3f\xf8\0\0\0\0\0\0", &buffer);
+    mf_buffer_free(&buffer);
+}
+
+void
+Test_uint_widths(CuTest *tc)
+{
+    mf_buffer buffer;
+
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, mf_msgpack_uint(&buffer, 0) &&
+        mf_msgpack_uint(&buffer, 127) &&
+        mf_msgpack_uint(&buffer, 128) &&
+        mf_msgpack_uint(&buffer, UINT8_MAX) &&
+        mf_msgpack_uint(&buffer, UINT8_MAX + 1) &&
+        mf_msgpack_uint(&buffer, UINT16_MAX) &&
+        mf_msgpack_uint(&buffer, UINT16_MAX + 1) &&
+        mf_msgpack_uint(&buffer, UINT32_MAX) &&
+        mf_msgpack_uint(&buffer, UINT32_MAX + 1ULL));
+    ASSERT_BYTES(tc,
+        "\x00" "\x7f" "\xcc\x80" "\xcc\xff" "\xcd\x01\x00" "\xcd\xff\xff"
+        "\xce\x00\x01\x00\x00" "\xce\xff\xff\xff\xff"
+        "\xcf\x00\x00\x00\x01\x00\x00\x00\x00", &buffer);
+    mf_buffer_free(&buffer);
+}
+
+void
+Test_int_widths(CuTest *tc)
+{
+    mf_buffer buffer;
+
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, mf_msgpack_int(&buffer, 5) &&
+        mf_msgpack_int(&buffer, -1) &&
+        mf_msgpack_int(&buffer, -32) &&
+        mf_msgpack_int(&buffer, -33) &&
+        mf_msgpack_int(&buffer, INT8_MIN) &&
+        mf_msgpack_int(&buffer, INT8_MIN - 1) &&
+        mf_msgpack_int(&buffer, INT16_MIN) &&
+        mf_msgpack_int(&buffer, INT16_MIN - 1) &&
+        mf_msgpack_int(&buffer, INT32_MIN) &&
+        mf_msgpack_int(&buffer, INT32_MIN - 1LL));
+    ASSERT_BYTES(tc,
+        "\x05" "\xff" "\xe0" "\xd0\xdf" "\xd0\x80" "\xd1\xff\x7f" "\xd1\x80\x00"
+        "\xd2\xff\xff\x7f\xff" "\xd2\x80\x00\x00\x00"
+        "\xd3\xff\xff\xff\xff\x7f\xff\xff\xff", &buffer);
+    mf_buffer_free(&buffer);
+}
+
+void
+Test_str_and_bin_boundaries(CuTest *tc)
+{
+    assert_header(tc, "\xa0", 1, mf_msgpack_str, 0);
+    assert_header(tc, "\xbf", 1, mf_msgpack_str, 31);
+    assert_header(tc, "\xd9\x20", 2, mf_msgpack_str, 32);
+    assert_header(tc, "\xd9\xff", 2, mf_msgpack_str, UINT8_MAX);
+    assert_header(tc, "\xda\x01\x00", 3, mf_msgpack_str, UINT8_MAX + 1);
+    assert_header(tc, "\xda\xff\xff", 3, mf_msgpack_str, UINT16_MAX);
+    assert_header(tc, "\xdb\x00\x01\x00\x00", 5, mf_msgpack_str, UINT16_MAX + 1);
+
+    assert_header(tc, "\xc4\x00", 2, put_bin, 0);
+    assert_header(tc, "\xc4\xff", 2, put_bin, UINT8_MAX);
+    assert_header(tc, "\xc5\x01\x00", 3, put_bin, UINT8_MAX + 1);
+    assert_header(tc, "\xc5\xff\xff", 3, put_bin, UINT16_MAX);
+    assert_header(tc, "\xc6\x00\x01\x00\x00", 5, put_bin, UINT16_MAX + 1);
+}
+
+void
+Test_array_and_map_headers(CuTest *tc)
+{
+    mf_buffer buffer;
+
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, mf_msgpack_array(&buffer, 0) &&
+        mf_msgpack_array(&buffer, 15) &&
+        mf_msgpack_array(&buffer, 16) &&
+        mf_msgpack_array(&buffer, UINT16_MAX) &&
+        mf_msgpack_array(&buffer, UINT16_MAX + 1));
+    ASSERT_BYTES(tc, "\x90" "\x9f" "\xdc\x00\x10" "\xdc\xff\xff"
+        "\xdd\x00\x01\x00\x00", &buffer);
+
+    mf_buffer_reset(&buffer);
+    CuAssertTrue(tc, mf_msgpack_map(&buffer, 0) &&
+        mf_msgpack_map(&buffer, 15) &&
+        mf_msgpack_map(&buffer, 16) &&
+        mf_msgpack_map(&buffer, UINT16_MAX) &&
+        mf_msgpack_map(&buffer, UINT16_MAX + 1));
+    ASSERT_BYTES(tc, "\x80" "\x8f" "\xde\x00\x10" "\xde\xff\xff"
+        "\xdf\x00\x01\x00\x00", &buffer);
+    mf_buffer_free(&buffer);
+}
+
+/* the document of mf_encode_metric(), with the given timestamp and value */
+#define DOCUMENT(timestamp, value)                                  \
+    "\x85"                                                          \
+    "\xaa" "@timestamp" timestamp                                   \
+    "\xa4" "host" "\xa6" "node01"                                   \
+    "\xa4" "task" "\xa5" "myapp"                                    \
+    "\xa4" "type" "\xa6" "PAPI-C"                                   \
+    "\xac" "PAPI_TOT_INS" value
+
+void
+Test_metric_is_encoded(CuTest *tc)
+{
+    mf_metric metric = {
+        "2016-04-20T12:34:56.789", "PAPI-C", "PAPI_TOT_INS", "1234"
+    };
+    mf_buffer buffer;
+
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, mf_encode_metric(&buffer, MF_FORMAT_MSGPACK,
+        "node01", "myapp", &metric));
+    ASSERT_BYTES(tc,
+        DOCUMENT("\xb7" "2016-04-20T12:34:56.789", "\xa4" "1234"), &buffer);
+
+    /* missing fields are written as nil */
+    metric.timestamp = NULL;
+    metric.value = NULL;
+    mf_buffer_reset(&buffer);
+    CuAssertTrue(tc, mf_encode_metric(&buffer, MF_FORMAT_MSGPACK,
+        "node01", "myapp", &metric));
+    ASSERT_BYTES(tc, DOCUMENT("\xc0", "\xc0"), &buffer);
+    mf_buffer_free(&buffer);
+}
+
+void
+Test_batch_is_encoded(CuTest *tc)
+{
+    mf_metric metrics[2] = {
+        { "2016-04-20T12:34:56.789", "PAPI-C", "PAPI_TOT_INS", "1" },
+        { NULL, "PAPI-C", "PAPI_TOT_INS", "2" }
+    };
+    mf_buffer buffer;
+
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, mf_encode_batch(&buffer, MF_FORMAT_MSGPACK,
+        "node01", "myapp", metrics, 2));
+    ASSERT_BYTES(tc, "\x92"
+        DOCUMENT("\xb7" "2016-04-20T12:34:56.789", "\xa1" "1")
+        DOCUMENT("\xc0", "\xa1" "2"), &buffer);
+
+    mf_buffer_reset(&buffer);
+    CuAssertTrue(tc, mf_encode_batch(&buffer, MF_FORMAT_MSGPACK,
+        "node01", "myapp", metrics, 0));
+    ASSERT_BYTES(tc, "\x90", &buffer);
+    mf_buffer_free(&buffer);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    // mf_msgpack_*
+    SUITE_ADD_TEST(suite, Test_scalars);
+    SUITE_ADD_TEST(suite, Test_uint_widths);
+    SUITE_ADD_TEST(suite, Test_int_widths);
+    SUITE_ADD_TEST(suite, Test_str_and_bin_boundaries);
+    SUITE_ADD_TEST(suite, Test_array_and_map_headers);
+
+    // mf_encode_metric, mf_encode_batch
+    SUITE_ADD_TEST(suite, Test_metric_is_encoded);
+    SUITE_ADD_TEST(suite, Test_batch_is_encoded);
+
+    return suite;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "CuTest.h"
+#include "contrib/mf_number.h"
+
+#define SAMPLES 1000000
+
+static uint64_t state = 88172645463325252ULL;
+
+static uint64_t
+next_random()
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/*
+ * Returns the length of the shortest %.*g output that reads back as value.
+ */
+static size_t
+shortest_length(double value)
+{
+    char text[64];
+    int precision;
+
+    for (precision = 1; precision < 17; ++precision) {
+        snprintf(text, sizeof(text), "%.*g", precision, value);
+        if (strtod(text, NULL) == value) {
+            break;
+        }
+    }
+    snprintf(text, sizeof(text), "%.*g", precision, value);
+
+    /* count the significant digits only, the notation differs */
+    size_t digits = 0;
+    char *p;
+    for (p = text; *p != '\0' && *p != 'e'; ++p) {
+        digits += (*p >= '0' && *p <= '9');
+    }
+    return digits;
+}
+
+static size_t
+significant_digits(const char *text)
+{
+    const char *p = text;
+    size_t digits = 0;
+    size_t zeros = 0;
+
+    while (*p == '-' || *p == '0' || *p == '.') {
+        p++;
+    }
+    for (; *p != '\0' && *p != 'e'; ++p) {
+        if (*p == '0') {
+            zeros++;
+        } else if (*p != '.') {
+            digits += zeros + 1;
+            zeros = 0;
+        }
+    }
+    return digits;
+}
+
+void
+Test_integers_match_printf(CuTest *tc)
+{
+    char text[MF_NUMBER_SIZE];
+    char expected[MF_NUMBER_SIZE];
+    int i;
+
+    CuAssertIntEquals(tc, 1, (int) mf_number_uint(text, 0));
+    CuAssertStrEquals(tc, "0", text);
+    mf_number_uint(text, ULLONG_MAX);
+    CuAssertStrEquals(tc, "18446744073709551615", text);
+    mf_number_int(text, LLONG_MIN);
+    CuAssertStrEquals(tc, "-9223372036854775808", text);
+    CuAssertIntEquals(tc, 2, (int) mf_number_int(text, -7));
+    CuAssertStrEquals(tc, "-7", text);
+
+    for (i = 0; i < SAMPLES; ++i) {
+        /* spread over all numbers of digits */
+        long long value = (long long) (next_random() >> (next_random() % 64));
+        if (i % 2 == 1) {
+            value = -value;
+        }
+        snprintf(expected, sizeof(expected), "%lld", value);
+        CuAssertIntEquals(tc, (int) strlen(expected),
+            (int) mf_number_int(text, value));
+        CuAssertStrEquals(tc, expected, text);
+    }
+}
+
+void
+Test_doubles_are_written_like_javascript(CuTest *tc)
+{
+    char text[MF_NUMBER_SIZE];
+
+    struct {
+        double value;
+        const char *text;
+    } cases[] = {
+        { 0.0, "0" },
+        { -0.0, "-0" },
+        { 0.1, "0.1" },
+        { -1.5, "-1.5" },
+        { 100.0, "100" },
+        { 123.456, "123.456" },
+        { 1.0 / 3.0, "0.3333333333333333" },
+        { 0.000001, "0.000001" },
+        { 1e-7, "1e-7" },
+        { 1.25e-7, "1.25e-7" },
+        { 1e20, "100000000000000000000" },
+        { 1e21, "1e+21" },
+        { 5e-324, "5e-324" },
+        { DBL_MAX, "1.7976931348623157e+308" },
+        { DBL_MIN, "2.2250738585072014e-308" },
+        { 9007199254740993.0, "9007199254740992" },
+        { INFINITY, "inf" },
+        { -INFINITY, "-inf" },
+        { NAN, "nan" }
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        CuAssertIntEquals(tc, (int) strlen(cases[i].text),
+            (int) mf_number_double(text, cases[i].value));
+        CuAssertStrEquals(tc, cases[i].text, text);
+    }
+
+    mf_number_float(text, 0.1f);
+    CuAssertStrEquals(tc, "0.1", text);
+    mf_number_float(text, FLT_MAX);
+    CuAssertStrEquals(tc, "3.4028235e+38", text);
+    mf_number_float(text, 1e-45f);
+    CuAssertStrEquals(tc, "1e-45", text);
+}
+
+void
+Test_doubles_round_trip(CuTest *tc)
+{
+    char text[MF_NUMBER_SIZE];
+    long longer = 0;
+    long tested = 0;
+    int i;
+
+    for (i = 0; i < SAMPLES; ++i) {
+        uint64_t bits = next_random();
+        double value;
+
+        memcpy(&value, &bits, sizeof(value));
+        if (isnan(value) || isinf(value)) {
+            continue;
+        }
+
+        size_t length = mf_number_double(text, value);
+        CuAssertIntEquals(tc, (int) strlen(text), (int) length);
+        CuAssertTrue(tc, length < MF_NUMBER_SIZE);
+
+        double parsed = strtod(text, NULL);
+        if (memcmp(&parsed, &value, sizeof(value)) != 0) {
+            char message[128];
+            snprintf(message, sizeof(message), "%a written as %s", value, text);
+            CuFail(tc, message);
+        }
+
+        /* Grisu2 is not always shortest, in about 0.1% of the cases */
+        size_t digits = significant_digits(text);
+        CuAssertTrue(tc, digits <= 17);
+        longer += digits > shortest_length(value);
+        tested++;
+    }
+    CuAssertTrue(tc, longer * 100 < tested);
+}
+
+void
+Test_floats_round_trip(CuTest *tc)
+{
+    char text[MF_NUMBER_SIZE];
+    int i;
+
+    for (i = 0; i < SAMPLES; ++i) {
+        uint32_t bits = (uint32_t) next_random();
+        float value;
+
+        memcpy(&value, &bits, sizeof(value));
+        if (isnan(value) || isinf(value)) {
+            continue;
+        }
+
+        mf_number_float(text, value);
+        float parsed = strtof(text, NULL);
+        CuAssertTrue(tc, memcmp(&parsed, &value, sizeof(value)) == 0);
+    }
+}
+
+void
+Test_numbers_are_appended_in_place(CuTest *tc)
+{
+    mf_buffer buffer;
+
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, mf_buffer_append_str(&buffer, "[") &&
+        mf_number_append_int(&buffer, -12) &&
+        mf_buffer_append_char(&buffer, ',') &&
+        mf_number_append_uint(&buffer, 3400000000ULL) &&
+        mf_buffer_append_char(&buffer, ',') &&
+        mf_number_append_double(&buffer, 2.5e-3) &&
+        mf_buffer_append_char(&buffer, ']'));
+    CuAssertStrEquals(tc, "[-12,3400000000,0.0025]", buffer.data);
+    CuAssertIntEquals(tc, (int) strlen(buffer.data), (int) buffer.size);
+    mf_buffer_free(&buffer);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_integers_match_printf);
+    SUITE_ADD_TEST(suite, Test_doubles_are_written_like_javascript);
+    SUITE_ADD_TEST(suite, Test_doubles_round_trip);
+    SUITE_ADD_TEST(suite, Test_floats_round_trip);
+    SUITE_ADD_TEST(suite, Test_numbers_are_appended_in_place);
+
+    return suite;
+}
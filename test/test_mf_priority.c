@@ -0,0 +1,163 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mock_server.h"
+
+/*
+ * Metrics of a high-priority type must arrive while the bulk traffic is
+ * still staged; the staging holds metrics for a minute in these tests.
+ */
+
+#define MAX_WAIT_MS 1000
+
+static void
+start(CuTest *tc, mock_server* server)
+{
+    char URL[64];
+
+    CuAssertTrue(tc, mock_listen(server, 0));
+    mock_start(server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d", server->port);
+    CuAssertPtrNotNull(tc, mf_api_new(URL, "priority", "lane", NULL, NULL));
+}
+
+/*
+ * Waits until the server received the given number of metrics; returns the
+ * number received.
+ */
+static int
+wait_for(mock_server* server, int expected)
+{
+    int waited;
+
+    for (waited = 0; waited < MAX_WAIT_MS; waited += 10) {
+        if (mock_received(server) >= expected) {
+            break;
+        }
+        usleep(10 * 1000);
+    }
+    return mock_received(server);
+}
+
+/*
+ * Enables staging, and waits for the first pass of the flusher, which sends
+ * whatever is staged when it starts.
+ */
+static void
+stage(CuTest *tc)
+{
+    CuAssertTrue(tc, mf_api_set_staging(1000, 60000));
+    usleep(100 * 1000);
+}
+
+static void
+update(const char* type, const char* name)
+{
+    mf_metric metric = { NULL, type, name, "1" };
+    mf_api_update(&metric);
+}
+
+void
+Test_urgent_metric_bypasses_staging(CuTest *tc)
+{
+    mock_server server;
+    int i;
+
+    start(tc, &server);
+    stage(tc);
+    CuAssertTrue(tc, mf_api_set_priority("alert", MF_PRIORITY_HIGH));
+
+    for (i = 0; i < 10; ++i) {
+        update("progress", "iteration");
+    }
+    update("alert", "node_down");
+
+    CuAssertIntEquals(tc, 1, wait_for(&server, 1));
+
+    mf_api_flush();
+    CuAssertIntEquals(tc, 11, mock_received(&server));
+
+    mf_api_clear();
+    mock_stop(&server);
+}
+
+void
+Test_batch_sends_urgent_metrics_separately(CuTest *tc)
+{
+    mock_server server;
+    mf_metric metrics[4] = {
+        { NULL, "progress", "iteration", "1" },
+        { NULL, "alert", "node_down", "1" },
+        { NULL, "progress", "residual", "0.1" },
+        { NULL, "alert", "disk_full", "1" }
+    };
+
+    start(tc, &server);
+    CuAssertTrue(tc, mf_api_set_priority("alert", MF_PRIORITY_HIGH));
+
+    CuAssertPtrNotNull(tc, mf_api_update_batch(metrics, 4));
+    CuAssertIntEquals(tc, 4, wait_for(&server, 4));
+
+    mf_api_clear();
+    mock_stop(&server);
+}
+
+void
+Test_normal_priority_is_staged_again(CuTest *tc)
+{
+    mock_server server;
+
+    start(tc, &server);
+    stage(tc);
+    CuAssertTrue(tc, mf_api_set_priority("alert", MF_PRIORITY_HIGH));
+    CuAssertTrue(tc, mf_api_set_priority("alert", MF_PRIORITY_NORMAL));
+
+    update("alert", "node_down");
+    usleep(200 * 1000);
+    CuAssertIntEquals(tc, 0, mock_received(&server));
+
+    mf_api_flush();
+    CuAssertIntEquals(tc, 1, mock_received(&server));
+
+    mf_api_clear();
+    mock_stop(&server);
+}
+
+void
+Test_invalid_priority_is_rejected(CuTest *tc)
+{
+    CuAssertIntEquals(tc, 0, mf_api_set_priority(NULL, MF_PRIORITY_HIGH));
+    CuAssertIntEquals(tc, 0, mf_api_set_priority("alert", 7));
+    mf_api_clear();
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_urgent_metric_bypasses_staging);
+    SUITE_ADD_TEST(suite, Test_batch_sends_urgent_metrics_separately);
+    SUITE_ADD_TEST(suite, Test_normal_priority_is_staged_again);
+    SUITE_ADD_TEST(suite, Test_invalid_priority_is_rejected);
+
+    return suite;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "contrib/mf_publisher.h"
+#include "mock_server.h"
+
+static const char* body = "{\"@timestamp\":\"2016-01-01T00:00:00\"}";
+
+static long long
+now_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static char*
+send_body(mf_publisher* publisher, mock_server* server)
+{
+    char URL[64];
+
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d/v1/mf/metrics",
+        server->port);
+    return mf_publisher_send(publisher, URL, body, strlen(body), NULL);
+}
+
+void
+Test_retries_until_deadline(CuTest *tc)
+{
+    mock_server server;
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    mock_set_status(&server, 503);
+    mock_start(&server);
+
+    mf_publisher* publisher = mf_publisher_new();
+    mf_publisher_set_timeouts(publisher, 1000, 500);
+    mf_publisher_set_retries(publisher, 1000, 10, 50);
+    mf_publisher_set_circuit_breaker(publisher, 0, 0, NULL);
+
+    long long start = now_ms();
+    char* response = send_body(publisher, &server);
+    long long elapsed = now_ms() - start;
+
+    /* the server answered each attempt, but never successfully */
+    CuAssertPtrNotNull(tc, response);
+    CuAssertIntEquals(tc, 503, (int) mf_publisher_get_status(publisher));
+    CuAssertTrue(tc, mock_requests(&server) > 2);
+    CuAssertTrue(tc, mock_requests(&server) < 1000);
+    CuAssertTrue(tc, elapsed < 500 + 200);
+
+    mf_publisher_free(publisher);
+    mock_stop(&server);
+}
+
+void
+Test_breaker_opens_and_closes(CuTest *tc)
+{
+    mock_server server;
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    mock_set_status(&server, 503);
+    mock_start(&server);
+
+    mf_publisher* publisher = mf_publisher_new();
+    mf_publisher_set_retries(publisher, 0, 0, 0);
+    mf_publisher_set_circuit_breaker(publisher, 2, 200, NULL);
+
+    /* two failures open the circuit, so the third request is not sent */
+    CuAssertPtrNotNull(tc, send_body(publisher, &server));
+    CuAssertPtrNotNull(tc, send_body(publisher, &server));
+    CuAssertIntEquals(tc, 2, mock_requests(&server));
+    unsigned long dropped = mf_publisher_get_dropped(publisher);
+    CuAssertPtrEquals(tc, NULL, send_body(publisher, &server));
+    CuAssertIntEquals(tc, 2, mock_requests(&server));
+    CuAssertTrue(tc, mf_publisher_get_dropped(publisher) == dropped + 1);
+
+    /* a failing probe opens the circuit again right away */
+    usleep(250 * 1000);
+    CuAssertPtrNotNull(tc, send_body(publisher, &server));
+    CuAssertIntEquals(tc, 3, mock_requests(&server));
+    CuAssertPtrEquals(tc, NULL, send_body(publisher, &server));
+    CuAssertIntEquals(tc, 3, mock_requests(&server));
+
+    /* a successful probe closes it */
+    mock_set_status(&server, 200);
+    usleep(250 * 1000);
+    char* response = send_body(publisher, &server);
+    CuAssertPtrNotNull(tc, response);
+    CuAssertStrEquals(tc, "{\"href\":\"ok\"}", response);
+    CuAssertPtrNotNull(tc, send_body(publisher, &server));
+    CuAssertIntEquals(tc, 5, mock_requests(&server));
+
+    mf_publisher_free(publisher);
+    mock_stop(&server);
+}
+
+void
+Test_breaker_gates_execution_id(CuTest *tc)
+{
+    mock_server server;
+    char URL[64];
+    char message[] = "{\"Name\":\"node01\"}";
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    mock_set_status(&server, 503);
+    mock_start(&server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d/v1/mf/experiments",
+        server.port);
+
+    /* the default publisher registers the execution */
+    mf_publisher_set_retries(NULL, 0, 0, 0);
+    mf_publisher_set_circuit_breaker(NULL, 1, 200, NULL);
+
+    CuAssertStrEquals(tc, "", get_execution_id(URL, message));
+    CuAssertIntEquals(tc, 1, mock_requests(&server));
+    CuAssertStrEquals(tc, "", get_execution_id(URL, message));
+    CuAssertIntEquals(tc, 1, mock_requests(&server));
+
+    /* a successful probe closes the circuit and sets the ID */
+    mock_set_status(&server, 200);
+    usleep(250 * 1000);
+    CuAssertStrEquals(tc, "{\"href\":\"ok\"}", get_execution_id(URL, message));
+    CuAssertIntEquals(tc, 2, mock_requests(&server));
+
+    mf_publisher_set_circuit_breaker(NULL, 0, 0, NULL);
+    mock_stop(&server);
+}
+
+/*
+ * Returns an answer of size bytes, a JSON string of digits.
+ */
+static char*
+large_answer(size_t size)
+{
+    char* answer = malloc(size + 1);
+    size_t i;
+
+    answer[0] = '"';
+    for (i = 1; i < size - 1; ++i) {
+        answer[i] = '0' + i % 10;
+    }
+    answer[size - 1] = '"';
+    answer[size] = '\0';
+    return answer;
+}
+
+void
+Test_large_response_is_kept(CuTest *tc)
+{
+    mock_server server;
+    char* answer = large_answer(5000);
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    server.answer = answer;
+    mock_start(&server);
+
+    /* larger than the 1024 bytes reserved for a response */
+    mf_publisher* publisher = mf_publisher_new();
+    CuAssertPtrNotNull(tc, send_body(publisher, &server));
+    mf_view view = mf_publisher_get_response(publisher);
+    CuAssertIntEquals(tc, 5000, (int) view.size);
+    CuAssertStrEquals(tc, answer, view.data);
+
+    /* the next requests reuse the grown buffer */
+    const char* data = view.data;
+    answer[10] = 'x';
+    CuAssertPtrNotNull(tc, send_body(publisher, &server));
+    view = mf_publisher_get_response(publisher);
+    CuAssertPtrEquals(tc, (void*) data, (void*) view.data);
+    CuAssertStrEquals(tc, answer, view.data);
+
+    answer[100] = '\0';
+    CuAssertPtrNotNull(tc, send_body(publisher, &server));
+    view = mf_publisher_get_response(publisher);
+    CuAssertPtrEquals(tc, (void*) data, (void*) view.data);
+    CuAssertIntEquals(tc, 100, (int) view.size);
+    CuAssertStrEquals(tc, answer, view.data);
+
+    mf_publisher_free(publisher);
+    mock_stop(&server);
+    free(answer);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_retries_until_deadline);
+    SUITE_ADD_TEST(suite, Test_breaker_opens_and_closes);
+    SUITE_ADD_TEST(suite, Test_breaker_gates_execution_id);
+    SUITE_ADD_TEST(suite, Test_large_response_is_kept);
+
+    return suite;
+}
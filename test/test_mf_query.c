@@ -0,0 +1,209 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "contrib/mf_publisher.h"
+#include "mock_server.h"
+
+/*
+ * The mock server answers queries with the document below, sent in chunks
+ * of a few bytes, so that records and tokens span several writes.
+ */
+
+static const char* document =
+    "[ {\"@timestamp\": \"2016-04-20T12:00:00.000\", \"type\": \"energy\","
+    "   \"power\": 12.5, \"ok\": true},\n"
+    "  {\"_source\": {\"host\": \"node01\", \"cpu\": {\"id\": 3}},"
+    "   \"s\": \"tab\\tquote\\\"\"},\n"
+    "  {\"name\": \"last\"} ]";
+
+static const char* expected =
+    "@timestamp=2016-04-20T12:00:00.000;type=energy;power=12.5;ok=true;|"
+    "_source.host=node01;_source.cpu.id=3;s=tab\tquote\";|"
+    "name=last;|";
+
+typedef struct collected_t {
+    CuString* text;
+    int records;
+    int stop_after;   /* stops after this many records; 0 for never */
+    int report;       /* reports a metric from within the callback */
+    int reported;
+} collected;
+
+static int
+collect(const char** keys, const char** values, size_t count, void* user_data)
+{
+    collected* c = (collected*) user_data;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        CuStringAppendFormat(c->text, "%s=%s;", keys[i], values[i]);
+    }
+    CuStringAppend(c->text, "|");
+    c->records++;
+
+    if (c->report) {
+        mf_metric metric = { NULL, "query", "records", "1" };
+        c->reported += mf_api_update(&metric) != NULL;
+    }
+
+    return c->stop_after > 0 && c->records >= c->stop_after;
+}
+
+static void
+start(CuTest *tc, mock_server* server, int silent)
+{
+    char URL[64];
+
+    CuAssertTrue(tc, mock_listen(server, silent));
+    server->document = document;
+    mock_start(server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d", server->port);
+    CuAssertPtrNotNull(tc, mf_api_new(URL, "query", "stream", NULL, NULL));
+}
+
+static void
+stop(mock_server* server)
+{
+    mf_api_clear();
+    mock_stop(server);
+}
+
+void
+Test_records_arrive_in_chunks(CuTest *tc)
+{
+    mock_server server;
+    collected c = { CuStringNew(), 0, 0, 0, 0 };
+
+    start(tc, &server, 0);
+    CuAssertIntEquals(tc, 1, mf_api_query("v1/mf/profiles/query", collect, &c));
+    CuAssertStrEquals(tc, expected, c.text->buffer);
+    CuAssertIntEquals(tc, 3, c.records);
+
+    /* the profile of the experiment is read the same way */
+    c.records = 0;
+    CuAssertIntEquals(tc, 1, mf_api_query_metrics(collect, &c));
+    CuAssertIntEquals(tc, 3, c.records);
+
+    stop(&server);
+    CuStringDelete(c.text);
+}
+
+void
+Test_callback_may_report_metrics(CuTest *tc)
+{
+    mock_server server;
+    collected c = { CuStringNew(), 0, 0, 1, 0 };
+
+    start(tc, &server, 0);
+    CuAssertIntEquals(tc, 1, mf_api_query("v1/mf/profiles/query", collect, &c));
+    CuAssertIntEquals(tc, 3, c.reported);
+    CuAssertIntEquals(tc, 3, mock_received(&server));
+
+    stop(&server);
+    CuStringDelete(c.text);
+}
+
+void
+Test_callback_stops_early(CuTest *tc)
+{
+    mock_server server;
+    collected c = { CuStringNew(), 0, 2, 0, 0 };
+
+    start(tc, &server, 0);
+    CuAssertIntEquals(tc, 1, mf_api_query("v1/mf/profiles/query", collect, &c));
+    CuAssertIntEquals(tc, 2, c.records);
+
+    stop(&server);
+    CuStringDelete(c.text);
+}
+
+void
+Test_failing_status_fails_query(CuTest *tc)
+{
+    mock_server server;
+    collected c = { CuStringNew(), 0, 0, 0, 0 };
+
+    start(tc, &server, 0);
+    mock_set_status(&server, 404);
+    CuAssertIntEquals(tc, 0, mf_api_query("v1/mf/profiles/query", collect, &c));
+    CuAssertIntEquals(tc, 0, c.records);
+
+    mock_set_status(&server, 0);
+    stop(&server);
+    CuStringDelete(c.text);
+}
+
+void
+Test_stalled_response_times_out(CuTest *tc)
+{
+    mock_server server;
+    collected c = { CuStringNew(), 0, 0, 0, 0 };
+    char URL[64];
+    struct timeval before, after;
+
+    CuAssertTrue(tc, mock_listen(&server, 1));
+    mock_start(&server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d/v1/mf/profiles/query",
+        server.port);
+
+    /* no data for the deadline of 1 s ends the transfer */
+    mf_publisher* publisher = mf_publisher_new();
+    mf_publisher_set_timeouts(publisher, 1000, 1000);
+    gettimeofday(&before, NULL);
+    CuAssertIntEquals(tc, 0, mf_publisher_query(publisher, URL, collect, &c));
+    gettimeofday(&after, NULL);
+    long elapsed_ms = (after.tv_sec - before.tv_sec) * 1000 +
+        (after.tv_usec - before.tv_usec) / 1000;
+    CuAssertTrue(tc, elapsed_ms >= 900);
+    CuAssertTrue(tc, elapsed_ms < 3000);
+    CuAssertIntEquals(tc, 0, c.records);
+
+    mf_publisher_free(publisher);
+    mock_stop(&server);
+    CuStringDelete(c.text);
+}
+
+void
+Test_query_without_server_fails(CuTest *tc)
+{
+    collected c = { CuStringNew(), 0, 0, 0, 0 };
+
+    CuAssertIntEquals(tc, 0, mf_ctx_query(NULL, "v1/mf/profiles", collect, &c));
+    CuAssertIntEquals(tc, 0, mf_api_query_metrics(collect, &c));
+
+    CuStringDelete(c.text);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_records_arrive_in_chunks);
+    SUITE_ADD_TEST(suite, Test_callback_may_report_metrics);
+    SUITE_ADD_TEST(suite, Test_callback_stops_early);
+    SUITE_ADD_TEST(suite, Test_failing_status_fails_query);
+    SUITE_ADD_TEST(suite, Test_stalled_response_times_out);
+    SUITE_ADD_TEST(suite, Test_query_without_server_fails);
+
+    return suite;
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "contrib/mf_publisher.h"
+#include "mock_server.h"
+
+#define ITEMS 64
+
+static char names[ITEMS][32];
+
+static void
+init_items(mf_registration* items, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        snprintf(names[i], sizeof(names[i]), "workflow_%lu", (unsigned long) i);
+        items[i].workflow = names[i];
+        items[i].json_string = "{\"tasks\":[\"t1\",\"t2\"]}";
+    }
+}
+
+static void
+free_items(mf_registration* items, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        free(items[i].response);
+    }
+}
+
+static double
+now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+void
+Test_all_workflows_are_registered(CuTest *tc)
+{
+    mock_server server;
+    mf_registration items[ITEMS];
+    char URL[64];
+    int i;
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    mock_start(&server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d", server.port);
+
+    init_items(items, ITEMS);
+    CuAssertIntEquals(tc, ITEMS,
+        (int) mf_register_workflows(NULL, URL, items, ITEMS, 8));
+    CuAssertIntEquals(tc, ITEMS, mock_requests(&server));
+    for (i = 0; i < ITEMS; ++i) {
+        CuAssertPtrEquals(tc, NULL, (void*) items[i].error);
+        CuAssertIntEquals(tc, 200, (int) items[i].status);
+        CuAssertStrEquals(tc, "{\"href\":\"ok\"}", items[i].response);
+    }
+    free_items(items, ITEMS);
+
+    mock_stop(&server);
+}
+
+void
+Test_requests_overlap(CuTest *tc)
+{
+    mock_server server;
+    mf_registration items[ITEMS];
+    char URL[64];
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    server.delay_ms = 50;
+    mock_start(&server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d", server.port);
+
+    /* one after another, this takes 64 * 50 ms */
+    init_items(items, ITEMS);
+    double start = now();
+    CuAssertIntEquals(tc, ITEMS,
+        (int) mf_create_experiments(NULL, URL, items, ITEMS, 16));
+    CuAssertTrue(tc, now() - start < 1.0);
+    free_items(items, ITEMS);
+
+    mock_stop(&server);
+}
+
+void
+Test_errors_are_reported_per_item(CuTest *tc)
+{
+    mock_server server;
+    mf_registration items[4];
+    char URL[64];
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    mock_start(&server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d", server.port);
+
+    init_items(items, 4);
+    items[1].workflow = NULL;
+    items[2].json_string = NULL;
+    CuAssertIntEquals(tc, 2, (int) mf_register_workflows(NULL, URL, items, 4, 0));
+
+    CuAssertPtrEquals(tc, NULL, (void*) items[0].error);
+    CuAssertPtrNotNull(tc, (void*) items[1].error);
+    CuAssertPtrEquals(tc, NULL, items[1].response);
+    CuAssertIntEquals(tc, 0, (int) items[1].status);
+    CuAssertPtrNotNull(tc, (void*) items[2].error);
+    CuAssertPtrEquals(tc, NULL, (void*) items[3].error);
+    CuAssertIntEquals(tc, 2, mock_requests(&server));
+    free_items(items, 4);
+
+    mock_stop(&server);
+}
+
+void
+Test_unreachable_server_fails_all_items(CuTest *tc)
+{
+    mock_server server;
+    mf_registration items[8];
+    char URL[64];
+    int i;
+
+    /* a port nobody listens on */
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    close(server.fd);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d", server.port);
+
+    mf_publisher* publisher = mf_publisher_new();
+    mf_publisher_set_retries(publisher, 1, 10, 10);
+    mf_publisher_set_circuit_breaker(publisher, 0, 0, NULL);
+
+    init_items(items, 8);
+    CuAssertIntEquals(tc, 0,
+        (int) mf_register_workflows(publisher, URL, items, 8, 4));
+    for (i = 0; i < 8; ++i) {
+        CuAssertPtrNotNull(tc, (void*) items[i].error);
+        CuAssertIntEquals(tc, 0, (int) items[i].status);
+        CuAssertPtrEquals(tc, NULL, items[i].response);
+    }
+    free_items(items, 8);
+
+    mf_publisher_free(publisher);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_all_workflows_are_registered);
+    SUITE_ADD_TEST(suite, Test_requests_overlap);
+    SUITE_ADD_TEST(suite, Test_errors_are_reported_per_item);
+    SUITE_ADD_TEST(suite, Test_unreachable_server_fails_all_items);
+
+    return suite;
+}
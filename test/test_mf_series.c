@@ -0,0 +1,238 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mf_encode.h"
+#include "mf_series.h"
+
+#define N_SAMPLES 1000
+
+static void
+assert_round_trip(CuTest *tc, const long long* timestamps, const double* values, size_t count)
+{
+    mf_buffer buffer;
+    long long* decoded_timestamps = malloc(sizeof(long long) * count);
+    double* decoded_values = malloc(sizeof(double) * count);
+    size_t i;
+
+    mf_buffer_init(&buffer);
+    CuAssertTrue(tc, mf_series_compress(&buffer, timestamps, values, count));
+    CuAssertTrue(tc, mf_series_decompress(
+        buffer.data, buffer.size, count, decoded_timestamps, decoded_values));
+
+    for (i = 0; i < count; ++i) {
+        CuAssertTrue(tc, timestamps[i] == decoded_timestamps[i]);
+        CuAssertTrue(tc, memcmp(&values[i], &decoded_values[i], sizeof(double)) == 0);
+    }
+
+    mf_buffer_free(&buffer);
+    free(decoded_timestamps);
+    free(decoded_values);
+}
+
+void
+Test_round_trip_fixed_rate_counter(CuTest *tc)
+{
+    long long timestamps[N_SAMPLES];
+    double values[N_SAMPLES];
+    int i;
+
+    for (i = 0; i < N_SAMPLES; ++i) {
+        timestamps[i] = 1461150000000LL + i * 100;
+        values[i] = 1000.0 + (i / 10) * 3;
+    }
+
+    assert_round_trip(tc, timestamps, values, N_SAMPLES);
+}
+
+void
+Test_round_trip_irregular_samples(CuTest *tc)
+{
+    long long timestamps[N_SAMPLES];
+    double values[N_SAMPLES];
+    int i;
+
+    srand(42);
+    timestamps[0] = 1461150000000LL;
+    values[0] = -0.0;
+    for (i = 1; i < N_SAMPLES; ++i) {
+        /* jitter covers every delta-of-delta bucket, including 64 bit */
+        long long step = (i % 100 == 0) ? 5000000000LL : rand() % 5000;
+        timestamps[i] = timestamps[i - 1] + step;
+        values[i] = (rand() - RAND_MAX / 2) * 1e-3;
+    }
+    values[10] = NAN;
+    values[11] = INFINITY;
+    values[12] = 1e-308;
+
+    assert_round_trip(tc, timestamps, values, N_SAMPLES);
+}
+
+void
+Test_round_trip_single_sample(CuTest *tc)
+{
+    long long timestamp = 1461150000000LL;
+    double value = 42.5;
+
+    assert_round_trip(tc, &timestamp, &value, 1);
+}
+
+void
+Test_truncated_stream_is_rejected(CuTest *tc)
+{
+    long long timestamps[2] = { 1, 2 };
+    double values[2] = { 1.0, 2.0 };
+    long long decoded_timestamps[2];
+    double decoded_values[2];
+    mf_buffer buffer;
+
+    mf_buffer_init(&buffer);
+    mf_series_compress(&buffer, timestamps, values, 2);
+    CuAssertTrue(tc, !mf_series_decompress(
+        buffer.data, 12, 2, decoded_timestamps, decoded_values));
+    mf_buffer_free(&buffer);
+}
+
+void
+Test_series_is_order_of_magnitude_smaller(CuTest *tc)
+{
+    long long timestamps[N_SAMPLES];
+    double values[N_SAMPLES];
+    char strings[N_SAMPLES][32];
+    mf_metric metrics[N_SAMPLES];
+    mf_buffer series, batch;
+    int i;
+
+    for (i = 0; i < N_SAMPLES; ++i) {
+        timestamps[i] = 1461150000000LL + i * 10;
+        values[i] = 4096.0 + (i / 50);
+        snprintf(strings[i], sizeof(strings[i]), "%.1f", values[i]);
+        metrics[i].timestamp = "2016-04-20T12:34:56.789";
+        metrics[i].type = "PAPI-C";
+        metrics[i].name = "PAPI_TOT_INS";
+        metrics[i].value = strings[i];
+    }
+
+    mf_buffer_init(&series);
+    mf_buffer_init(&batch);
+    mf_series_encode(&series, MF_FORMAT_JSON, "node01", "myapp",
+        "PAPI-C", "PAPI_TOT_INS", timestamps, values, N_SAMPLES);
+    mf_encode_batch(&batch, MF_FORMAT_JSON, "node01", "myapp",
+        metrics, N_SAMPLES);
+
+    CuAssertTrue(tc, series.size * 10 < batch.size);
+
+    mf_buffer_free(&series);
+    mf_buffer_free(&batch);
+}
+
+/* decodes the base64 text up to the closing quote; returns the length */
+static size_t
+decode_base64(const char* text, unsigned char* out)
+{
+    const char* digits =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned int group = 0;
+    size_t size = 0;
+    int bits = 0;
+
+    for (; *text != '"' && *text != '=' && *text != '\0'; ++text) {
+        group = (group << 6) | (unsigned int) (strchr(digits, *text) - digits);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[size++] = (unsigned char) (group >> bits);
+        }
+    }
+    return size;
+}
+
+void
+Test_encoded_data_matches_stream(CuTest *tc)
+{
+    static const size_t counts[] = { 1, 2, 3, 4, 5, 100, N_SAMPLES };
+    long long timestamps[N_SAMPLES];
+    double values[N_SAMPLES];
+    unsigned char decoded[N_SAMPLES * 20];
+    mf_buffer stream, json, msgpack;
+    size_t c;
+    int i;
+
+    srand(7);
+    for (i = 0; i < N_SAMPLES; ++i) {
+        timestamps[i] = 1461150000000LL + i * 100 + rand() % 7;
+        values[i] = rand() * 1e-3;
+    }
+
+    for (c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        size_t count = counts[c];
+
+        mf_buffer_init(&stream);
+        mf_buffer_init(&json);
+        mf_buffer_init(&msgpack);
+        CuAssertTrue(tc, mf_series_compress(&stream, timestamps, values, count));
+        CuAssertTrue(tc, mf_series_encode(&json, MF_FORMAT_JSON, "node01",
+            "myapp", "PAPI-C", "PAPI_TOT_INS", timestamps, values, count));
+        CuAssertTrue(tc, mf_series_encode(&msgpack, MF_FORMAT_MSGPACK, "node01",
+            "myapp", "PAPI-C", "PAPI_TOT_INS", timestamps, values, count));
+
+        /* JSON carries the stream base64-encoded */
+        const char* data = strstr(json.data, "\"data\":\"");
+        CuAssertPtrNotNull(tc, data);
+        CuAssertIntEquals(tc, (int) stream.size,
+            (int) decode_base64(data + 8, decoded));
+        CuAssertTrue(tc, memcmp(stream.data, decoded, stream.size) == 0);
+        CuAssertStrEquals(tc, "\"}", json.data + json.size - 2);
+
+        /* MessagePack carries it as the trailing binary value */
+        const unsigned char* bin = (const unsigned char*) msgpack.data +
+            msgpack.size - stream.size;
+        if (stream.size <= 0xff) {
+            CuAssertIntEquals(tc, 0xc4, bin[-2]);
+            CuAssertIntEquals(tc, (int) stream.size, bin[-1]);
+        } else {
+            CuAssertIntEquals(tc, 0xc5, bin[-3]);
+            CuAssertIntEquals(tc, (int) stream.size, (bin[-2] << 8) | bin[-1]);
+        }
+        CuAssertTrue(tc, memcmp(stream.data, bin, stream.size) == 0);
+
+        mf_buffer_free(&stream);
+        mf_buffer_free(&json);
+        mf_buffer_free(&msgpack);
+    }
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    // mf_series_compress, mf_series_decompress
+    SUITE_ADD_TEST(suite, Test_round_trip_fixed_rate_counter);
+    SUITE_ADD_TEST(suite, Test_round_trip_irregular_samples);
+    SUITE_ADD_TEST(suite, Test_round_trip_single_sample);
+    SUITE_ADD_TEST(suite, Test_truncated_stream_is_rejected);
+
+    // mf_series_encode
+    SUITE_ADD_TEST(suite, Test_series_is_order_of_magnitude_smaller);
+    SUITE_ADD_TEST(suite, Test_encoded_data_matches_stream);
+
+    return suite;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mock_server.h"
+
+/*
+ * The tests run the application in a child process, which exits right after
+ * reporting, and count what arrives at a minimal HTTP server in the parent.
+ */
+
+static long long
+now_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/*
+ * Body of the child process: reports a burst of metrics and exits without
+ * calling mf_api_clear(). Signals the parent through ready_fd just before
+ * exiting.
+ */
+static void
+report_and_exit(int port, int metrics, long shutdown_timeout_ms, int ready_fd)
+{
+    char server[64];
+    char value[16];
+    mf_metric metric;
+    int i;
+
+    snprintf(server, sizeof(server), "http://127.0.0.1:%d", port);
+    if (mf_api_new(server, "shutdown", "burst", NULL, NULL) == NULL) {
+        exit(1);
+    }
+    mf_api_set_shutdown_timeout(shutdown_timeout_ms);
+    mf_api_set_staging(1000, 60000);
+
+    metric.timestamp = NULL;
+    metric.type = "progress";
+    metric.name = "iteration";
+    metric.value = value;
+    for (i = 0; i < metrics; ++i) {
+        snprintf(value, sizeof(value), "%d", i);
+        if (mf_api_update(&metric) == NULL) {
+            exit(1);
+        }
+    }
+
+    if (write(ready_fd, "x", 1) != 1) {
+        exit(1);
+    }
+    exit(0);
+}
+
+/*
+ * Runs report_and_exit() in a child; returns its exit status and the time
+ * from the end of the burst to the end of the process.
+ */
+static int
+run_child(mock_server* server, int metrics, long shutdown_timeout_ms,
+          long long* exit_ms)
+{
+    int ready[2];
+    int status;
+    char c;
+
+    if (pipe(ready) != 0) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(server->fd);
+        close(ready[0]);
+        report_and_exit(server->port, metrics, shutdown_timeout_ms, ready[1]);
+    }
+    close(ready[1]);
+
+    mock_start(server);
+
+    long long start = 0;
+    if (read(ready[0], &c, 1) == 1) {
+        start = now_ms();
+    }
+    waitpid(pid, &status, 0);
+    *exit_ms = now_ms() - start;
+    close(ready[0]);
+
+    mock_stop(server);
+
+    return (start > 0 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+}
+
+void
+Test_burst_before_exit_arrives(CuTest *tc)
+{
+    mock_server server;
+    long long exit_ms;
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    CuAssertIntEquals(tc, 0, run_child(&server, 5000, 5000, &exit_ms));
+
+    CuAssertIntEquals(tc, 5000, mock_received(&server));
+}
+
+void
+Test_exit_is_bounded_by_shutdown_timeout(CuTest *tc)
+{
+    mock_server server;
+    long long exit_ms;
+
+    /* the default deadline of 10 s per request would apply otherwise */
+    CuAssertTrue(tc, mock_listen(&server, 1));
+    CuAssertIntEquals(tc, 0, run_child(&server, 100, 500, &exit_ms));
+
+    CuAssertTrue(tc, mock_received(&server) > 0);
+    CuAssertTrue(tc, exit_ms >= 400);
+    CuAssertTrue(tc, exit_ms < 2000);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_burst_before_exit_arrives);
+    SUITE_ADD_TEST(suite, Test_exit_is_bounded_by_shutdown_timeout);
+
+    return suite;
+}
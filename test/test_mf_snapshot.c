@@ -0,0 +1,170 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "contrib/mf_publisher.h"
+#include "mock_server.h"
+
+/*
+ * Snapshots are sent as Message documents of the publisher; the tests check
+ * the documents as received by the mock server, and the responses as
+ * returned by the API.
+ */
+
+static void
+assert_ends_with(CuTest *tc, const char* expected, const char* text)
+{
+    size_t n = strlen(expected);
+    size_t size = strlen(text);
+
+    CuAssertStrEquals(tc, expected, (size >= n) ? text + size - n : text);
+}
+
+void
+Test_message_is_serialized(CuTest *tc)
+{
+    mock_server server;
+    char URL[64];
+    char body[1024];
+    char key[] = "a\\b", value[] = "x\ny", k[] = "k", v[] = "v";
+    char sender[] = "node\"01", host[] = "node01", user[] = "user";
+    char timestamp[] = "2016-04-20T12:34:56.789";
+    Data data[] = { { key, value }, { k, v }, { NULL, NULL } };
+    Message message = { sender, NULL, NULL, data };
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    mock_start(&server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d/v1/mf/metrics",
+        server.port);
+    mf_publisher* publisher = mf_publisher_new();
+
+    /* fields that are not set are left out */
+    CuAssertIntEquals(tc, SEND_SUCCESS,
+        mf_publisher_publish(publisher, URL, &message));
+    mock_last_body(&server, body, sizeof(body));
+    CuAssertStrEquals(tc,
+        "{\"host\":\"node\\\"01\",\"a\\\\b\":\"x\\ny\",\"k\":\"v\"}", body);
+
+    message.sender = NULL;
+    CuAssertIntEquals(tc, SEND_SUCCESS,
+        mf_publisher_publish(publisher, URL, &message));
+    mock_last_body(&server, body, sizeof(body));
+    CuAssertStrEquals(tc, "{\"a\\\\b\":\"x\\ny\",\"k\":\"v\"}", body);
+
+    message.sender = host;
+    message.username = user;
+    message.timestamp = timestamp;
+    message.data = NULL;
+    CuAssertIntEquals(tc, SEND_SUCCESS,
+        mf_publisher_publish(publisher, URL, &message));
+    mock_last_body(&server, body, sizeof(body));
+    CuAssertStrEquals(tc, "{\"host\":\"node01\",\"user\":\"user\","
+        "\"@timestamp\":\"2016-04-20T12:34:56.789\"}", body);
+
+    mf_publisher_free(publisher);
+    mock_stop(&server);
+}
+
+void
+Test_snapshot_drops_suppressed_fields(CuTest *tc)
+{
+    mock_server server;
+    char URL[64];
+    char body[1024];
+    const char* names[] = { "a", "b\"" };
+    const char* values[] = { "1", "2" };
+
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    mock_start(&server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d", server.port);
+    CuAssertPtrNotNull(tc, mf_api_new(URL, "snapshot", "app", NULL, NULL));
+    CuAssertTrue(tc, mf_api_suppress("cpu", "a", MF_SUPPRESS_CHANGE, 0, 0));
+
+    CuAssertPtrNotNull(tc, mf_api_update_snapshot("cpu", names, values, 2));
+    mock_last_body(&server, body, sizeof(body));
+    CuAssertTrue(tc, strncmp(body, "{\"host\":\"", 9) == 0);
+    CuAssertPtrNotNull(tc, strstr(body, ",\"@timestamp\":\""));
+    CuAssertTrue(tc, strstr(body, "\"user\"") == NULL);
+    assert_ends_with(tc,
+        ",\"task\":\"app\",\"type\":\"cpu\",\"a\":\"1\",\"b\\\"\":\"2\"}", body);
+
+    /* a is unchanged, so only b is sent */
+    values[1] = "3";
+    CuAssertPtrNotNull(tc, mf_api_update_snapshot("cpu", names, values, 2));
+    mock_last_body(&server, body, sizeof(body));
+    assert_ends_with(tc, ",\"type\":\"cpu\",\"b\\\"\":\"3\"}", body);
+
+    /* nothing is sent if every field is suppressed */
+    int requests = mock_requests(&server);
+    CuAssertStrEquals(tc, "", mf_api_update_snapshot("cpu", names, values, 1));
+    CuAssertIntEquals(tc, requests, mock_requests(&server));
+
+    mf_api_clear();
+    mock_stop(&server);
+}
+
+void
+Test_large_response_is_returned(CuTest *tc)
+{
+    mock_server server;
+    char URL[64];
+    char answer[3000];
+    size_t size = 0;
+    mf_metric metric = { NULL, "cpu", "load", "1" };
+
+    memset(answer, 'a', sizeof(answer) - 1);
+    answer[sizeof(answer) - 1] = '\0';
+    CuAssertTrue(tc, mock_listen(&server, 0));
+    mock_start(&server);
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%d", server.port);
+    CuAssertPtrNotNull(tc, mf_api_new(URL, "snapshot", "app", NULL, NULL));
+
+    server.answer = answer;
+    CuAssertPtrNotNull(tc, mf_api_update(&metric));
+    const char* response = mf_api_get_response(&size);
+    CuAssertIntEquals(tc, (int) sizeof(answer) - 1, (int) size);
+    CuAssertStrEquals(tc, answer, response);
+
+    /* a shorter response reuses the same memory */
+    answer[5] = '\0';
+    CuAssertPtrNotNull(tc, mf_api_update(&metric));
+    CuAssertPtrEquals(tc, (void*) response, (void*) mf_api_get_response(&size));
+    CuAssertIntEquals(tc, 5, (int) size);
+    CuAssertStrEquals(tc, "aaaaa", response);
+
+    mf_api_clear();
+    mock_stop(&server);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    // mf_publisher_publish
+    SUITE_ADD_TEST(suite, Test_message_is_serialized);
+
+    // mf_api_update_snapshot
+    SUITE_ADD_TEST(suite, Test_snapshot_drops_suppressed_fields);
+
+    // mf_api_get_response
+    SUITE_ADD_TEST(suite, Test_large_response_is_returned);
+
+    return suite;
+}
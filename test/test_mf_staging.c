@@ -0,0 +1,479 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mf_staging.h"
+
+#define N_THREADS 8
+#define N_PER_THREAD 20000
+
+typedef struct received_t {
+    size_t count;
+    size_t batches;
+    size_t largest_batch;
+    int in_order;
+    int next[N_THREADS];
+} received;
+
+static void
+init_received(received* r)
+{
+    memset(r, 0, sizeof(received));
+    r->in_order = 1;
+}
+
+/* values are "<thread> <sequence number>" */
+static int
+collect(const mf_metric* metrics, size_t count, void* user_data)
+{
+    received* r = (received*) user_data;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        int thread, sequence;
+        if (sscanf(metrics[i].value, "%d %d", &thread, &sequence) != 2 ||
+            thread < 0 || thread >= N_THREADS ||
+            r->next[thread] != sequence) {
+            r->in_order = 0;
+            continue;
+        }
+        r->next[thread]++;
+    }
+
+    r->batches++;
+    if (count > r->largest_batch) {
+        r->largest_batch = count;
+    }
+    __atomic_add_fetch(&r->count, count, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+static void
+append_sequence(mf_staging* staging, int thread, int count)
+{
+    char value[32];
+    mf_metric metric;
+    int i;
+
+    metric.timestamp = "2016-04-20T12:00:00.000";
+    metric.type = "foobar";
+    metric.name = "progress (%)";
+    metric.value = value;
+    for (i = 0; i < count; ++i) {
+        sprintf(value, "%d %d", thread, i);
+        mf_staging_append(staging, &metric);
+    }
+}
+
+void
+Test_single_thread_batches_in_order(CuTest *tc)
+{
+    received r;
+    init_received(&r);
+
+    mf_staging* staging = mf_staging_new(MF_STAGING_RING_SIZE, 100, 60000,
+        collect, &r);
+    CuAssertPtrNotNull(tc, staging);
+
+    append_sequence(staging, 0, 1000);
+    mf_staging_flush(staging);
+
+    CuAssertIntEquals(tc, 1000, (int) r.count);
+    CuAssertTrue(tc, r.in_order);
+    CuAssertTrue(tc, r.largest_batch <= 100);
+    CuAssertTrue(tc, r.batches >= 10);
+
+    mf_staging_free(staging);
+}
+
+typedef struct producer_t {
+    mf_staging* staging;
+    int thread;
+} producer;
+
+static void*
+produce(void* arg)
+{
+    producer* p = (producer*) arg;
+    append_sequence(p->staging, p->thread, N_PER_THREAD);
+    return NULL;
+}
+
+void
+Test_threads_deliver_all(CuTest *tc)
+{
+    pthread_t threads[N_THREADS];
+    producer producers[N_THREADS];
+    received r;
+    int i;
+
+    init_received(&r);
+
+    /* small rings wrap around and fill up often */
+    mf_staging* staging = mf_staging_new(4096, 256, 5, collect, &r);
+    CuAssertPtrNotNull(tc, staging);
+
+    for (i = 0; i < N_THREADS; ++i) {
+        producers[i].staging = staging;
+        producers[i].thread = i;
+        pthread_create(&threads[i], NULL, produce, &producers[i]);
+    }
+    for (i = 0; i < N_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    mf_staging_flush(staging);
+
+    CuAssertIntEquals(tc, N_THREADS * N_PER_THREAD, (int) r.count);
+    CuAssertTrue(tc, r.in_order);
+    CuAssertTrue(tc, r.largest_batch <= 256);
+
+    mf_staging_free(staging);
+}
+
+void
+Test_aged_metrics_are_sent(CuTest *tc)
+{
+    received r;
+    int waited;
+
+    init_received(&r);
+
+    mf_staging* staging = mf_staging_new(MF_STAGING_RING_SIZE, 100, 20,
+        collect, &r);
+    append_sequence(staging, 0, 3);
+
+    for (waited = 0; waited < 1000; waited += 10) {
+        if (__atomic_load_n(&r.count, __ATOMIC_ACQUIRE) == 3) {
+            break;
+        }
+        usleep(10000);
+    }
+    CuAssertIntEquals(tc, 3, (int) __atomic_load_n(&r.count, __ATOMIC_ACQUIRE));
+
+    mf_staging_free(staging);
+}
+
+static int
+check_null_fields(const mf_metric* metrics, size_t count, void* user_data)
+{
+    int* ok = (int*) user_data;
+    *ok = count == 1 &&
+        metrics[0].timestamp == NULL &&
+        strcmp(metrics[0].type, "") == 0 &&
+        metrics[0].name == NULL &&
+        strcmp(metrics[0].value, "42") == 0;
+    return 1;
+}
+
+void
+Test_null_fields_are_kept(CuTest *tc)
+{
+    int ok = 0;
+    mf_metric metric = { NULL, "", NULL, "42" };
+
+    mf_staging* staging = mf_staging_new(MF_STAGING_RING_SIZE, 100, 60000,
+        check_null_fields, &ok);
+    CuAssertTrue(tc, mf_staging_append(staging, &metric));
+    mf_staging_flush(staging);
+    CuAssertTrue(tc, ok);
+
+    mf_staging_free(staging);
+}
+
+void
+Test_oversized_metric_is_rejected(CuTest *tc)
+{
+    received r;
+    char value[4096];
+    mf_metric metric = { NULL, "foobar", "progress (%)", value };
+
+    init_received(&r);
+    memset(value, 'x', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+
+    mf_staging* staging = mf_staging_new(4096, 100, 60000, collect, &r);
+    CuAssertTrue(tc, !mf_staging_append(staging, &metric));
+    mf_staging_free(staging);
+
+    CuAssertIntEquals(tc, 0, (int) r.count);
+}
+
+/*
+ * A server that accepts nothing until the gate opens; metrics are received
+ * in order if their sequence numbers increase, with gaps where they were
+ * dropped.
+ */
+typedef struct gated_t {
+    pthread_mutex_t lock;
+    pthread_cond_t opened;
+    int open;
+    size_t count;
+    int last;
+    int increasing;
+} gated;
+
+static void
+init_gated(gated* g)
+{
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->opened, NULL);
+    g->open = 0;
+    g->count = 0;
+    g->last = -1;
+    g->increasing = 1;
+}
+
+static void
+open_gate(gated* g)
+{
+    pthread_mutex_lock(&g->lock);
+    g->open = 1;
+    pthread_cond_broadcast(&g->opened);
+    pthread_mutex_unlock(&g->lock);
+}
+
+static int
+collect_gated(const mf_metric* metrics, size_t count, void* user_data)
+{
+    gated* g = (gated*) user_data;
+    size_t i;
+
+    pthread_mutex_lock(&g->lock);
+    while (!g->open) {
+        pthread_cond_wait(&g->opened, &g->lock);
+    }
+    for (i = 0; i < count; ++i) {
+        int thread, sequence;
+        if (sscanf(metrics[i].value, "%d %d", &thread, &sequence) != 2 ||
+            sequence <= g->last) {
+            g->increasing = 0;
+        }
+        g->last = sequence;
+    }
+    g->count += count;
+    pthread_mutex_unlock(&g->lock);
+
+    return 1;
+}
+
+static long long
+now_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void
+Test_drop_newest_does_not_block(CuTest *tc)
+{
+    gated g;
+    init_gated(&g);
+
+    mf_staging* staging = mf_staging_new(4096, 16, 5, collect_gated, &g);
+    mf_staging_set_backpressure(staging, MF_BACKPRESSURE_DROP_NEWEST, 0);
+
+    /* would block forever with the default policy */
+    append_sequence(staging, 0, 10000);
+    unsigned long dropped = mf_staging_get_dropped(staging);
+    CuAssertTrue(tc, dropped > 9000);
+
+    open_gate(&g);
+    mf_staging_flush(staging);
+
+    CuAssertIntEquals(tc, 10000, (int) (g.count + dropped));
+    CuAssertTrue(tc, g.increasing);
+    CuAssertTrue(tc, g.last < 9999);
+
+    mf_staging_free(staging);
+}
+
+void
+Test_drop_oldest_keeps_latest(CuTest *tc)
+{
+    gated g;
+    init_gated(&g);
+
+    mf_staging* staging = mf_staging_new(4096, 16, 5, collect_gated, &g);
+    mf_staging_set_backpressure(staging, MF_BACKPRESSURE_DROP_OLDEST, 0);
+
+    append_sequence(staging, 0, 10000);
+    unsigned long dropped = mf_staging_get_dropped(staging);
+    CuAssertTrue(tc, dropped > 9000);
+
+    open_gate(&g);
+    mf_staging_flush(staging);
+
+    CuAssertIntEquals(tc, 10000, (int) (g.count + dropped));
+    CuAssertTrue(tc, g.increasing);
+    CuAssertIntEquals(tc, 9999, g.last);
+
+    mf_staging_free(staging);
+}
+
+void
+Test_block_gives_up_after_timeout(CuTest *tc)
+{
+    char value[32];
+    mf_metric metric = { "2016-04-20T12:00:00.000", "foobar", "progress (%)", value };
+    gated g;
+    int i;
+
+    init_gated(&g);
+
+    mf_staging* staging = mf_staging_new(4096, 16, 5, collect_gated, &g);
+    mf_staging_set_backpressure(staging, MF_BACKPRESSURE_BLOCK, 50);
+
+    long long waited = 0;
+    for (i = 0; mf_staging_get_dropped(staging) == 0 && i < 10000; ++i) {
+        sprintf(value, "0 %d", i);
+        long long start = now_ms();
+        CuAssertTrue(tc, mf_staging_append(staging, &metric));
+        waited = now_ms() - start;
+    }
+    CuAssertIntEquals(tc, 1, (int) mf_staging_get_dropped(staging));
+    CuAssertTrue(tc, waited >= 50);
+
+    open_gate(&g);
+    mf_staging_flush(staging);
+    CuAssertIntEquals(tc, i - 1, (int) g.count);
+    CuAssertTrue(tc, g.increasing);
+
+    mf_staging_free(staging);
+}
+
+void
+Test_downsample_under_pressure(CuTest *tc)
+{
+    gated g;
+    init_gated(&g);
+
+    mf_staging* staging = mf_staging_new(4096, 16, 5, collect_gated, &g);
+    mf_staging_set_backpressure(staging, MF_BACKPRESSURE_DOWNSAMPLE, 4);
+
+    /* a fourth of the samples is staged until the ring is full */
+    append_sequence(staging, 0, 200);
+    unsigned long dropped = mf_staging_get_dropped(staging);
+    CuAssertTrue(tc, dropped >= 100);
+
+    open_gate(&g);
+    mf_staging_flush(staging);
+
+    CuAssertIntEquals(tc, 200, (int) (g.count + dropped));
+    CuAssertTrue(tc, g.increasing);
+
+    mf_staging_free(staging);
+}
+
+static int
+collect_slowly(const mf_metric* metrics, size_t count, void* user_data)
+{
+    usleep(20000);
+    return collect(metrics, count, user_data);
+}
+
+void
+Test_adaptive_batches_grow_for_slow_server(CuTest *tc)
+{
+    size_t batch_size;
+    long linger_ms;
+    received r;
+
+    init_received(&r);
+
+    mf_staging* staging = mf_staging_new(MF_STAGING_RING_SIZE, 4096, 1000,
+        collect_slowly, &r);
+    mf_staging_set_adaptive(staging, 1);
+
+    append_sequence(staging, 0, 20000);
+    mf_staging_get_tuning(staging, &batch_size, &linger_ms);
+    mf_staging_flush(staging);
+
+    CuAssertIntEquals(tc, 20000, (int) r.count);
+    CuAssertTrue(tc, r.in_order);
+    CuAssertTrue(tc, r.largest_batch > 256);
+    CuAssertTrue(tc, batch_size > 256);
+    CuAssertTrue(tc, linger_ms >= 10 && linger_ms <= 1000);
+
+    mf_staging_free(staging);
+}
+
+void
+Test_adaptive_idle_sends_right_away(CuTest *tc)
+{
+    size_t batch_size;
+    long linger_ms;
+    received r;
+    int i;
+
+    init_received(&r);
+
+    /* without adaptive control, each metric would wait up to 2 s */
+    mf_staging* staging = mf_staging_new(MF_STAGING_RING_SIZE, 4096, 2000,
+        collect, &r);
+    mf_staging_set_adaptive(staging, 1);
+    usleep(20000);
+
+    for (i = 0; i < 5; ++i) {
+        long long start = now_ms();
+        char value[32];
+        mf_metric metric = { NULL, "foobar", "progress (%)", value };
+        sprintf(value, "0 %d", i);
+        mf_staging_append(staging, &metric);
+
+        while (__atomic_load_n(&r.count, __ATOMIC_ACQUIRE) < (size_t) i + 1 &&
+               now_ms() - start < 2000) {
+            usleep(1000);
+        }
+        CuAssertIntEquals(tc, i + 1, (int) __atomic_load_n(&r.count, __ATOMIC_ACQUIRE));
+        CuAssertTrue(tc, now_ms() - start < 200);
+        usleep(50000);
+    }
+    CuAssertTrue(tc, r.in_order);
+
+    mf_staging_get_tuning(staging, &batch_size, &linger_ms);
+    CuAssertTrue(tc, batch_size <= 64);
+    CuAssertTrue(tc, linger_ms <= 5);
+
+    mf_staging_free(staging);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_single_thread_batches_in_order);
+    SUITE_ADD_TEST(suite, Test_threads_deliver_all);
+    SUITE_ADD_TEST(suite, Test_aged_metrics_are_sent);
+    SUITE_ADD_TEST(suite, Test_null_fields_are_kept);
+    SUITE_ADD_TEST(suite, Test_oversized_metric_is_rejected);
+    SUITE_ADD_TEST(suite, Test_drop_newest_does_not_block);
+    SUITE_ADD_TEST(suite, Test_drop_oldest_keeps_latest);
+    SUITE_ADD_TEST(suite, Test_block_gives_up_after_timeout);
+    SUITE_ADD_TEST(suite, Test_downsample_under_pressure);
+    SUITE_ADD_TEST(suite, Test_adaptive_batches_grow_for_slow_server);
+    SUITE_ADD_TEST(suite, Test_adaptive_idle_sends_right_away);
+
+    return suite;
+}
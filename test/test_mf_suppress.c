@@ -0,0 +1,175 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mf_suppress.h"
+
+static int
+pass(mf_suppressor* suppressor, const char* name, const char* value)
+{
+    mf_metric metric;
+
+    metric.timestamp = NULL;
+    metric.type = "node";
+    metric.name = name;
+    metric.value = value;
+
+    return mf_suppressor_pass(suppressor, &metric);
+}
+
+void
+Test_metrics_without_rule_pass(CuTest *tc)
+{
+    mf_suppressor* suppressor = mf_suppressor_new();
+
+    CuAssertTrue(tc, !mf_suppressor_active(suppressor));
+    CuAssertTrue(tc, pass(suppressor, "temperature", "42"));
+    CuAssertTrue(tc, pass(suppressor, "temperature", "42"));
+
+    mf_suppressor_set(suppressor, "node", "memory", MF_SUPPRESS_CHANGE, 0, 0);
+    CuAssertTrue(tc, mf_suppressor_active(suppressor));
+    CuAssertTrue(tc, pass(suppressor, "temperature", "42"));
+    CuAssertTrue(tc, pass(suppressor, "temperature", "42"));
+    CuAssertIntEquals(tc, 0, (int) mf_suppressor_get_suppressed(suppressor));
+
+    mf_suppressor_free(suppressor);
+}
+
+void
+Test_change_only(CuTest *tc)
+{
+    mf_suppressor* suppressor = mf_suppressor_new();
+
+    CuAssertTrue(tc, mf_suppressor_set(suppressor, "node", "memory",
+        MF_SUPPRESS_CHANGE, 0, 0));
+
+    CuAssertTrue(tc, pass(suppressor, "memory", "1024"));
+    CuAssertTrue(tc, !pass(suppressor, "memory", "1024"));
+    CuAssertTrue(tc, !pass(suppressor, "memory", "1024.0"));
+    CuAssertTrue(tc, pass(suppressor, "memory", "2048"));
+    CuAssertTrue(tc, !pass(suppressor, "memory", "2048"));
+    CuAssertTrue(tc, pass(suppressor, "memory", "1024"));
+
+    /* the same name of another type has no rule */
+    mf_metric other = { NULL, "job", "memory", "1024" };
+    CuAssertTrue(tc, mf_suppressor_pass(suppressor, &other));
+    CuAssertTrue(tc, mf_suppressor_pass(suppressor, &other));
+
+    CuAssertIntEquals(tc, 3, (int) mf_suppressor_get_suppressed(suppressor));
+
+    mf_suppressor_free(suppressor);
+}
+
+void
+Test_absolute_deadband_tracks_value_sent(CuTest *tc)
+{
+    mf_suppressor* suppressor = mf_suppressor_new();
+
+    mf_suppressor_set(suppressor, "node", "temperature",
+        MF_SUPPRESS_ABSOLUTE, 0.5, 0);
+
+    CuAssertTrue(tc, pass(suppressor, "temperature", "40"));
+    CuAssertTrue(tc, !pass(suppressor, "temperature", "40.3"));
+    CuAssertTrue(tc, !pass(suppressor, "temperature", "39.5"));
+    /* a slow drift is sent once it adds up beyond the deadband */
+    CuAssertTrue(tc, pass(suppressor, "temperature", "40.6"));
+    CuAssertTrue(tc, !pass(suppressor, "temperature", "40.9"));
+    CuAssertTrue(tc, pass(suppressor, "temperature", "41.2"));
+
+    mf_suppressor_free(suppressor);
+}
+
+void
+Test_relative_deadband(CuTest *tc)
+{
+    mf_suppressor* suppressor = mf_suppressor_new();
+
+    mf_suppressor_set(suppressor, "node", "power", MF_SUPPRESS_RELATIVE, 0.1, 0);
+
+    CuAssertTrue(tc, pass(suppressor, "power", "200"));
+    CuAssertTrue(tc, !pass(suppressor, "power", "215"));
+    CuAssertTrue(tc, !pass(suppressor, "power", "181"));
+    CuAssertTrue(tc, pass(suppressor, "power", "221"));
+    CuAssertTrue(tc, !pass(suppressor, "power", "240"));
+    CuAssertTrue(tc, pass(suppressor, "power", "0"));
+    CuAssertTrue(tc, !pass(suppressor, "power", "0"));
+    CuAssertTrue(tc, pass(suppressor, "power", "0.001"));
+
+    mf_suppressor_free(suppressor);
+}
+
+void
+Test_heartbeat(CuTest *tc)
+{
+    mf_suppressor* suppressor = mf_suppressor_new();
+
+    mf_suppressor_set(suppressor, "node", "progress", MF_SUPPRESS_CHANGE, 0, 50);
+
+    CuAssertTrue(tc, pass(suppressor, "progress", "7"));
+    CuAssertTrue(tc, !pass(suppressor, "progress", "7"));
+    usleep(60000);
+    CuAssertTrue(tc, pass(suppressor, "progress", "7"));
+    CuAssertTrue(tc, !pass(suppressor, "progress", "7"));
+
+    mf_suppressor_free(suppressor);
+}
+
+void
+Test_strings_and_reset(CuTest *tc)
+{
+    mf_suppressor* suppressor = mf_suppressor_new();
+
+    mf_suppressor_set(suppressor, "node", "state", MF_SUPPRESS_ABSOLUTE, 10, 0);
+
+    CuAssertTrue(tc, pass(suppressor, "state", "idle"));
+    CuAssertTrue(tc, !pass(suppressor, "state", "idle"));
+    CuAssertTrue(tc, pass(suppressor, "state", "busy"));
+    CuAssertTrue(tc, pass(suppressor, "state", "3"));
+    CuAssertTrue(tc, !pass(suppressor, "state", "5"));
+
+    /* setting the rule again forgets the value sent last */
+    mf_suppressor_set(suppressor, "node", "state", MF_SUPPRESS_ABSOLUTE, 10, 0);
+    CuAssertTrue(tc, pass(suppressor, "state", "5"));
+
+    mf_suppressor_set(suppressor, "node", "state", MF_SUPPRESS_NONE, 0, 0);
+    CuAssertTrue(tc, pass(suppressor, "state", "5"));
+    CuAssertTrue(tc, pass(suppressor, "state", "5"));
+
+    CuAssertTrue(tc, !mf_suppressor_set(suppressor, "node", "state", 42, 0, 0));
+    CuAssertTrue(tc, !mf_suppressor_set(suppressor, "node", "state",
+        MF_SUPPRESS_ABSOLUTE, -1, 0));
+
+    mf_suppressor_free(suppressor);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_metrics_without_rule_pass);
+    SUITE_ADD_TEST(suite, Test_change_only);
+    SUITE_ADD_TEST(suite, Test_absolute_deadband_tracks_value_sent);
+    SUITE_ADD_TEST(suite, Test_relative_deadband);
+    SUITE_ADD_TEST(suite, Test_heartbeat);
+    SUITE_ADD_TEST(suite, Test_strings_and_reset);
+
+    return suite;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "mf_api.h"
+#include "mf_watch.h"
+
+typedef struct sampled_t {
+    int samples;
+    size_t count;
+    char names[4][32];
+    char values[4][32];
+} sampled;
+
+static int
+collect(mf_metric* metrics, size_t count, void* user_data)
+{
+    sampled* s = (sampled*) user_data;
+    size_t i;
+
+    s->count = count;
+    for (i = 0; i < count && i < 4; ++i) {
+        snprintf(s->names[i], 32, "%s", metrics[i].name);
+        snprintf(s->values[i], 32, "%s", metrics[i].value);
+    }
+    __atomic_add_fetch(&s->samples, 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+static const char*
+value_of(sampled* s, const char* name)
+{
+    size_t i;
+
+    for (i = 0; i < s->count && i < 4; ++i) {
+        if (strcmp(s->names[i], name) == 0) {
+            return s->values[i];
+        }
+    }
+    return "";
+}
+
+void
+Test_sample_reads_current_values(CuTest *tc)
+{
+    volatile int iteration = 7;
+    volatile double residual = 0.125;
+    volatile unsigned long bytes = 4294967296UL;
+    sampled s;
+
+    memset(&s, 0, sizeof(s));
+    mf_watcher* watcher = mf_watcher_new(60000, collect, &s);
+    CuAssertPtrNotNull(tc, watcher);
+
+    CuAssertTrue(tc, mf_watcher_add(watcher, "iteration", "progress", &iteration, MF_WATCH_INT));
+    CuAssertTrue(tc, mf_watcher_add(watcher, "residual", "solver", &residual, MF_WATCH_DOUBLE));
+    CuAssertTrue(tc, mf_watcher_add(watcher, "bytes", "io", &bytes, MF_WATCH_ULONG));
+
+    mf_watcher_sample(watcher);
+    CuAssertIntEquals(tc, 3, (int) s.count);
+    CuAssertStrEquals(tc, "7", value_of(&s, "iteration"));
+    CuAssertStrEquals(tc, "0.125", value_of(&s, "residual"));
+    CuAssertStrEquals(tc, "4294967296", value_of(&s, "bytes"));
+
+    iteration = 8;
+    residual = -1.5e-9;
+    mf_watcher_sample(watcher);
+    CuAssertStrEquals(tc, "8", value_of(&s, "iteration"));
+    CuAssertTrue(tc, atof(value_of(&s, "residual")) == -1.5e-9);
+
+    mf_watcher_free(watcher);
+}
+
+void
+Test_remove_and_replace(CuTest *tc)
+{
+    volatile long a = 1;
+    volatile long b = 2;
+    sampled s;
+
+    memset(&s, 0, sizeof(s));
+    mf_watcher* watcher = mf_watcher_new(60000, collect, &s);
+
+    mf_watcher_add(watcher, "a", "test", &a, MF_WATCH_LONG);
+    mf_watcher_add(watcher, "b", "test", &b, MF_WATCH_LONG);
+    mf_watcher_add(watcher, "a2", "test", &a, MF_WATCH_LONG);
+    CuAssertTrue(tc, mf_watcher_remove(watcher, &b));
+    CuAssertTrue(tc, !mf_watcher_remove(watcher, &b));
+
+    mf_watcher_sample(watcher);
+    CuAssertIntEquals(tc, 1, (int) s.count);
+    CuAssertStrEquals(tc, "1", value_of(&s, "a2"));
+
+    CuAssertTrue(tc, !mf_watcher_add(watcher, "c", "test", &b, 42));
+
+    mf_watcher_free(watcher);
+}
+
+void
+Test_sampler_thread_samples_periodically(CuTest *tc)
+{
+    volatile int counter = 0;
+    sampled s;
+    int i;
+
+    memset(&s, 0, sizeof(s));
+    mf_watcher* watcher = mf_watcher_new(10, collect, &s);
+    mf_watcher_add(watcher, "counter", "progress", &counter, MF_WATCH_INT);
+
+    /* the hot loop only writes its variable */
+    for (i = 0; i < 100 && __atomic_load_n(&s.samples, __ATOMIC_ACQUIRE) < 3; ++i) {
+        counter++;
+        usleep(10000);
+    }
+    CuAssertTrue(tc, __atomic_load_n(&s.samples, __ATOMIC_ACQUIRE) >= 3);
+
+    mf_watcher_free(watcher);
+}
+
+CuSuite* CuGetSuite(void)
+{
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_sample_reads_current_values);
+    SUITE_ADD_TEST(suite, Test_remove_and_replace);
+    SUITE_ADD_TEST(suite, Test_sampler_thread_samples_periodically);
+
+    return suite;
+}
@@ -0,0 +1,323 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Generates metrics at a target rate from several threads, to find out how
+ * many metrics per second the library can report before it hurts the
+ * application.
+ *
+ * Each thread reports its share of the rate through the API selected by -m:
+ *
+ *   update  mf_api_update(), one request per metric
+ *   staged  mf_api_update() with per-thread staging (see mf_api_set_staging())
+ *   batch   mf_api_update_batch() of -b metrics per call
+ *   hist    mf_api_hist_record() into a histogram uploaded every second
+ *   adaptive  like staged, with batch size and delay tuned to the server
+ *             (see mf_api_set_adaptive_staging()), up to -b metrics
+ *
+ * With -e, metrics are written to the given Elasticsearch _bulk endpoint
+ * instead of the metrics resource of the server (see
+ * mf_api_set_bulk_endpoint()), to compare both paths.
+ *
+ * At the end, it reports the achieved rate, the percentiles of the time a
+ * call took, the metrics failed or dropped, and the CPU time spent by the
+ * library, split into the reporting threads and its background threads
+ * (staging flusher and sampler). A rate of 0 reports as fast as possible.
+ *
+ * Usage: mf_loadgen [-m mode] [-t threads] [-r metrics per second]
+ *                   [-d seconds] [-b batch size] [-f json|msgpack]
+ *                   [-e bulk endpoint] SERVER
+ *
+ * SERVER is the URL of the monitoring server, e.g. http://localhost:3030
+ */
+#define _GNU_SOURCE /* RUSAGE_THREAD */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mf_api.h"
+#include "mf_histogram.h"
+#include "mf_staging.h"
+
+#define THREADS    4
+#define RATE       10000
+#define SECONDS    10
+#define BATCH_SIZE 100
+
+enum { MODE_UPDATE, MODE_STAGED, MODE_BATCH, MODE_HIST, MODE_ADAPTIVE };
+
+static const char* mode_names[] = {
+    "update", "staged", "batch", "hist", "adaptive"
+};
+
+typedef struct generator_t {
+    int mode;
+    double rate;           /* metrics per second of this thread; 0 for max */
+    double seconds;
+    size_t batch_size;
+    mf_histogram* values;  /* target of MODE_HIST */
+    mf_histogram* latency; /* duration of the calls in ns */
+
+    /* results */
+    unsigned long sent;
+    unsigned long failed;
+    double cpu_seconds;
+} generator;
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double
+cpu_seconds(int who)
+{
+    struct rusage usage;
+    getrusage(who, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+static void
+sleep_until(double deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t) deadline;
+    ts.tv_nsec = (long) ((deadline - ts.tv_sec) * 1e9);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/*
+ * Body of a reporting thread. Calls are scheduled at fixed times; a thread
+ * that falls behind calls again immediately instead of skipping, so the
+ * achieved rate shows what the library sustains within the duration.
+ */
+static void*
+generate(void* arg)
+{
+    generator* g = (generator*) arg;
+    size_t per_call = (g->mode == MODE_BATCH) ? g->batch_size : 1;
+    mf_metric* metrics = (mf_metric*) calloc(per_call, sizeof(mf_metric));
+    char (*values)[24] = calloc(per_call, sizeof(*values));
+    unsigned long calls = 0;
+    size_t i;
+
+    double start = now();
+    double end = start + g->seconds;
+    double interval = (g->rate > 0) ? per_call / g->rate : 0;
+
+    double cpu_start = cpu_seconds(RUSAGE_THREAD);
+    for (;;) {
+        double t = start + calls * interval;
+        if (t >= end || now() >= end) {
+            break;
+        }
+        if (interval > 0) {
+            sleep_until(t);
+        }
+
+        for (i = 0; i < per_call; ++i) {
+            snprintf(values[i], sizeof(values[i]), "%lu", g->sent + i);
+            metrics[i].timestamp = NULL;
+            metrics[i].type = "loadgen";
+            metrics[i].name = "counter";
+            metrics[i].value = values[i];
+        }
+
+        double before = now();
+        int ok = 1;
+        switch (g->mode) {
+        case MODE_UPDATE:
+        case MODE_STAGED:
+        case MODE_ADAPTIVE:
+            ok = mf_api_update(&metrics[0]) != NULL;
+            break;
+        case MODE_BATCH:
+            ok = mf_api_update_batch(metrics, per_call) != NULL;
+            break;
+        case MODE_HIST:
+            mf_api_hist_record(g->values, g->sent);
+            break;
+        }
+        mf_histogram_record(g->latency, (uint64_t) ((now() - before) * 1e9));
+
+        if (ok) {
+            g->sent += per_call;
+        } else {
+            g->failed += per_call;
+        }
+        calls++;
+    }
+    g->cpu_seconds = cpu_seconds(RUSAGE_THREAD) - cpu_start;
+
+    free(metrics);
+    free(values);
+
+    return NULL;
+}
+
+static void
+usage(const char* program)
+{
+    fprintf(stderr,
+        "usage: %s [-m update|staged|batch|hist|adaptive] [-t threads]\n"
+        "          [-r metrics per second] [-d seconds] [-b batch size]\n"
+        "          [-f json|msgpack] [-e bulk endpoint] SERVER\n", program);
+}
+
+int
+main(int argc, char** argv)
+{
+    int mode = MODE_UPDATE;
+    int threads = THREADS;
+    double rate = RATE;
+    double seconds = SECONDS;
+    size_t batch_size = BATCH_SIZE;
+    int format = MF_FORMAT_JSON;
+    const char* bulk_url = NULL;
+    int option;
+    int i;
+
+    while ((option = getopt(argc, argv, "m:t:r:d:b:f:e:")) != -1) {
+        switch (option) {
+        case 'm':
+            for (mode = MODE_ADAPTIVE; mode >= 0; --mode) {
+                if (strcmp(optarg, mode_names[mode]) == 0) {
+                    break;
+                }
+            }
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 'b':
+            batch_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            format = (strcmp(optarg, "msgpack") == 0) ?
+                MF_FORMAT_MSGPACK : MF_FORMAT_JSON;
+            break;
+        case 'e':
+            bulk_url = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind + 1 != argc || mode < 0 || threads <= 0 || batch_size == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (mf_api_new(argv[optind], "loadgen", "loadgen", NULL, NULL) == NULL) {
+        fprintf(stderr, "cannot register at %s\n", argv[optind]);
+        return 1;
+    }
+    mf_api_set_format(format);
+    if (bulk_url != NULL && !mf_api_set_bulk_endpoint(bulk_url, NULL)) {
+        return 1;
+    }
+    if (mode == MODE_STAGED) {
+        mf_api_set_staging(MF_STAGING_BATCH_SIZE, MF_STAGING_MAX_AGE_MS);
+    } else if (mode == MODE_ADAPTIVE) {
+        mf_api_set_adaptive_staging(batch_size, MF_STAGING_MAX_AGE_MS);
+    }
+
+    mf_histogram* values = NULL;
+    if (mode == MODE_HIST) {
+        values = mf_api_hist_new("loadgen", "counter", MF_HIST_PERCENTILES);
+        if (values == NULL) {
+            return 1;
+        }
+    }
+    mf_histogram* latency = mf_histogram_new("loadgen", "latency", 0);
+
+    generator* generators = (generator*) calloc(threads, sizeof(generator));
+    pthread_t* ids = (pthread_t*) malloc(sizeof(pthread_t) * threads);
+    unsigned long dropped = mf_api_get_dropped();
+    double cpu_start = cpu_seconds(RUSAGE_SELF);
+    double start = now();
+
+    for (i = 0; i < threads; ++i) {
+        generators[i].mode = mode;
+        generators[i].rate = rate / threads;
+        generators[i].seconds = seconds;
+        generators[i].batch_size = batch_size;
+        generators[i].values = values;
+        generators[i].latency = latency;
+        pthread_create(&ids[i], NULL, generate, &generators[i]);
+    }
+
+    unsigned long sent = 0;
+    unsigned long failed = 0;
+    double caller_cpu = 0;
+    for (i = 0; i < threads; ++i) {
+        pthread_join(ids[i], NULL);
+        sent += generators[i].sent;
+        failed += generators[i].failed;
+        caller_cpu += generators[i].cpu_seconds;
+    }
+    double elapsed = now() - start;
+
+    /* staged metrics and histograms are sent in the background */
+    mf_api_flush();
+    mf_api_hist_flush();
+    double drained = now() - start;
+    double total_cpu = cpu_seconds(RUSAGE_SELF) - cpu_start;
+    dropped = mf_api_get_dropped() - dropped;
+
+    mf_histogram_collect(latency);
+
+    printf("mode %s, %d threads, target %.0f metrics/s for %.1f s%s\n",
+        mode_names[mode], threads, rate, seconds,
+        (bulk_url != NULL) ? ", _bulk" : "");
+    printf("achieved   %.0f metrics/s (%lu sent, %lu failed, %lu dropped)\n",
+        sent / elapsed, sent, failed, dropped);
+    printf("call time  p50 %.2f us, p90 %.2f us, p99 %.2f us, p99.9 %.2f us, "
+        "max %.2f us\n",
+        mf_histogram_percentile(latency, 50) / 1e3,
+        mf_histogram_percentile(latency, 90) / 1e3,
+        mf_histogram_percentile(latency, 99) / 1e3,
+        mf_histogram_percentile(latency, 99.9) / 1e3,
+        mf_histogram_percentile(latency, 100) / 1e3);
+    printf("cpu        %.3f s in reporting threads, %.3f s in background, "
+        "%.2f us per metric, %.1f%% of a core\n",
+        caller_cpu, total_cpu - caller_cpu,
+        (sent > 0) ? total_cpu / sent * 1e6 : 0.0,
+        100 * total_cpu / drained);
+    printf("drain      %.3f s after the last call\n", drained - elapsed);
+
+    mf_histogram_free(latency);
+    free(generators);
+    free(ids);
+    mf_api_clear();
+
+    return (failed > 0 || dropped > 0) ? 1 : 0;
+}
@@ -0,0 +1,509 @@
+/*
+ * Copyright 2016 High Performance Computing Center, Stuttgart
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Uploads files of metric documents, e.g. a spool file written while the
+ * server was unreachable (see mf_api_set_circuit_breaker()), to the metrics
+ * resource of an experiment.
+ *
+ * Every line of a file holds a JSON document or an array of documents.
+ * Consecutive lines are merged into batches, which several connections send
+ * concurrently. With -p, the position up to which every batch was accepted
+ * is saved after each batch, and a later run with the same progress file
+ * continues from there. The first failed batch stops reading; batches after
+ * it that were already sent are sent again when resuming.
+ *
+ * Usage: mf_replay [-c connections] [-b lines per batch] [-s bytes per batch]
+ *                  [-p progress file] [-t deadline in ms] URL FILE...
+ *
+ * URL is the metrics resource of the experiment, for instance
+ * http://localhost:3030/v1/mf/metrics/user/experiment?task=application
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "contrib/mf_buffer.h"
+#include "contrib/mf_publisher.h"
+
+#define CONNECTIONS    4
+#define BATCH_LINES    1000
+#define BATCH_BYTES    (4 * 1024 * 1024)
+#define DEADLINE_MS    30000
+
+enum { SLOT_FREE, SLOT_QUEUED, SLOT_SENDING, SLOT_SENT, SLOT_FAILED };
+
+/*
+ * A batch of consecutive lines of one file, covering the bytes from start to
+ * end of the file.
+ */
+typedef struct batch_t {
+    int state;
+    size_t file;
+    long start;
+    long end;
+    size_t lines;
+    mf_buffer body;
+} batch;
+
+typedef struct replay_t {
+    const char* URL;
+    char** files;
+    size_t n_files;
+    long* offsets;          /* position up to which a file was accepted */
+    const char* progress_path;
+    long deadline_ms;
+
+    /*
+     * Batches in file order: retired from head once sent, handed to the
+     * connections from next, filled by the reader at tail.
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    batch* slots;
+    size_t capacity;
+    size_t head;
+    size_t next;
+    size_t tail;
+    int reading;
+    int failed;
+
+    size_t lines_sent;
+    size_t bytes_sent;
+    size_t batches_sent;
+} replay;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+on_signal(int sig)
+{
+    interrupted = 1;
+}
+
+/*******************************************************************************
+ * progress
+ ******************************************************************************/
+
+/*
+ * The progress file holds one line "offset path" per input file.
+ */
+static void
+load_progress(replay* r)
+{
+    char line[4096];
+    size_t i;
+
+    FILE* file = fopen(r->progress_path, "r");
+    if (file == NULL) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char* path;
+        long offset = strtol(line, &path, 10);
+        if (path == line || *path != ' ') {
+            continue;
+        }
+        path++;
+        path[strcspn(path, "\n")] = '\0';
+        for (i = 0; i < r->n_files; ++i) {
+            if (strcmp(r->files[i], path) == 0) {
+                r->offsets[i] = offset;
+            }
+        }
+    }
+    fclose(file);
+}
+
+/*
+ * Replaces the progress file atomically, so an interrupted run never leaves
+ * a truncated one behind. Must be called with the lock held.
+ */
+static void
+save_progress(replay* r)
+{
+    char tmp_path[4096];
+    size_t i;
+
+    if (r->progress_path == NULL) {
+        return;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", r->progress_path);
+    FILE* file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "cannot write %s: %s\n", tmp_path, strerror(errno));
+        return;
+    }
+    for (i = 0; i < r->n_files; ++i) {
+        fprintf(file, "%ld %s\n", r->offsets[i], r->files[i]);
+    }
+    if (fclose(file) != 0 || rename(tmp_path, r->progress_path) != 0) {
+        fprintf(stderr, "cannot write %s: %s\n", r->progress_path, strerror(errno));
+    }
+}
+
+/*
+ * Frees the slots of all batches at the head that were sent, and advances
+ * the progress of their files. Progress stops at the first failed batch.
+ * Must be called with the lock held.
+ */
+static void
+retire_batches(replay* r)
+{
+    int advanced = 0;
+
+    while (r->head != r->next) {
+        batch* b = &r->slots[r->head % r->capacity];
+        if (b->state != SLOT_SENT && b->state != SLOT_FAILED) {
+            break;
+        }
+        if (b->state == SLOT_FAILED) {
+            r->failed = 1;
+        }
+        if (!r->failed) {
+            r->offsets[b->file] = b->end;
+            r->lines_sent += b->lines;
+            r->bytes_sent += b->body.size;
+            r->batches_sent++;
+            advanced = 1;
+        }
+        b->state = SLOT_FREE;
+        r->head++;
+    }
+
+    if (advanced) {
+        save_progress(r);
+    }
+    pthread_cond_broadcast(&r->changed);
+}
+
+/*******************************************************************************
+ * send_batches
+ ******************************************************************************/
+
+/*
+ * Body of a connection: sends batches until the reader is done and no batch
+ * is left.
+ */
+static void*
+send_batches(void* arg)
+{
+    replay* r = (replay*) arg;
+
+    mf_publisher* publisher = mf_publisher_new();
+    if (publisher == NULL) {
+        return NULL;
+    }
+    mf_publisher_set_timeouts(publisher, 2000, r->deadline_ms);
+
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (r->next == r->tail && r->reading) {
+            pthread_cond_wait(&r->changed, &r->lock);
+        }
+        if (r->next == r->tail) {
+            break;
+        }
+
+        batch* b = &r->slots[r->next % r->capacity];
+        b->state = SLOT_SENDING;
+        r->next++;
+        pthread_mutex_unlock(&r->lock);
+
+        mf_publisher_send(publisher, r->URL, b->body.data, b->body.size,
+            "application/json");
+        long status = mf_publisher_get_status(publisher);
+
+        pthread_mutex_lock(&r->lock);
+        if (status >= 200 && status < 300) {
+            b->state = SLOT_SENT;
+        } else {
+            fprintf(stderr, "%s: batch at byte %ld failed (HTTP %ld)\n",
+                r->files[b->file], b->start, status);
+            b->state = SLOT_FAILED;
+        }
+        retire_batches(r);
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    mf_publisher_free(publisher);
+
+    return NULL;
+}
+
+/*******************************************************************************
+ * read_batches
+ ******************************************************************************/
+
+/*
+ * Returns a free slot at the tail, waiting while all slots are in use; NULL
+ * if reading has to stop.
+ */
+static batch*
+acquire_slot(replay* r)
+{
+    batch* b = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    while (r->tail - r->head == r->capacity && !r->failed && !interrupted) {
+        pthread_cond_wait(&r->changed, &r->lock);
+    }
+    if (!r->failed && !interrupted) {
+        b = &r->slots[r->tail % r->capacity];
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    return b;
+}
+
+static void
+submit_slot(replay* r, batch* b)
+{
+    pthread_mutex_lock(&r->lock);
+    b->state = SLOT_QUEUED;
+    r->tail++;
+    pthread_cond_broadcast(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * Appends a line to the JSON array of the batch; the documents of a line
+ * holding an array are appended one by one.
+ */
+static void
+append_line(batch* b, char* line, size_t length)
+{
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r' ||
+           line[length - 1] == ' ' || line[length - 1] == '\t')) {
+        length--;
+    }
+    while (length > 0 && (*line == ' ' || *line == '\t')) {
+        line++;
+        length--;
+    }
+    if (length >= 2 && line[0] == '[' && line[length - 1] == ']') {
+        line++;
+        length -= 2;
+    }
+    if (length == 0) {
+        return;
+    }
+
+    mf_buffer_append_char(&b->body, (b->body.size > 1) ? ',' : '[');
+    mf_buffer_append(&b->body, line, length);
+    b->lines++;
+}
+
+/*
+ * Reads the files from their saved positions and queues their lines in
+ * batches of up to batch_lines lines and batch_bytes bytes.
+ *
+ * @return 1 if all files were read; 0 otherwise
+ */
+static int
+read_batches(replay* r, size_t batch_lines, size_t batch_bytes)
+{
+    char* line = NULL;
+    size_t line_capacity = 0;
+    size_t i;
+
+    for (i = 0; i < r->n_files; ++i) {
+        FILE* file = fopen(r->files[i], "r");
+        if (file == NULL) {
+            fprintf(stderr, "cannot open %s: %s\n", r->files[i], strerror(errno));
+            free(line);
+            return 0;
+        }
+        if (r->offsets[i] > 0 && fseek(file, r->offsets[i], SEEK_SET) != 0) {
+            fprintf(stderr, "cannot seek in %s: %s\n", r->files[i], strerror(errno));
+            fclose(file);
+            free(line);
+            return 0;
+        }
+
+        long position = r->offsets[i];
+        batch* b = NULL;
+        ssize_t length;
+        while ((length = getline(&line, &line_capacity, file)) > 0) {
+            if (b == NULL) {
+                if ((b = acquire_slot(r)) == NULL) {
+                    break;
+                }
+                mf_buffer_reset(&b->body);
+                b->file = i;
+                b->start = position;
+                b->lines = 0;
+            }
+            append_line(b, line, length);
+            position += length;
+
+            if (b->lines >= batch_lines || b->body.size >= batch_bytes) {
+                mf_buffer_append_char(&b->body, ']');
+                b->end = position;
+                submit_slot(r, b);
+                b = NULL;
+            }
+        }
+        fclose(file);
+
+        if (b != NULL && b->lines > 0) {
+            mf_buffer_append_char(&b->body, ']');
+            b->end = position;
+            submit_slot(r, b);
+        }
+
+        pthread_mutex_lock(&r->lock);
+        int stop = r->failed || interrupted;
+        pthread_mutex_unlock(&r->lock);
+        if (stop) {
+            free(line);
+            return 0;
+        }
+    }
+    free(line);
+
+    return 1;
+}
+
+/*******************************************************************************
+ * main
+ ******************************************************************************/
+
+static void
+usage(const char* program)
+{
+    fprintf(stderr,
+        "usage: %s [-c connections] [-b lines per batch] [-s bytes per batch]\n"
+        "          [-p progress file] [-t deadline in ms] URL FILE...\n",
+        program);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t connections = CONNECTIONS;
+    size_t batch_lines = BATCH_LINES;
+    size_t batch_bytes = BATCH_BYTES;
+    replay r;
+    size_t i;
+    int option;
+
+    memset(&r, 0, sizeof(r));
+    r.deadline_ms = DEADLINE_MS;
+
+    while ((option = getopt(argc, argv, "c:b:s:p:t:")) != -1) {
+        switch (option) {
+        case 'c':
+            connections = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            batch_lines = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            batch_bytes = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            r.progress_path = optarg;
+            break;
+        case 't':
+            r.deadline_ms = strtol(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind < 2 || connections == 0 || batch_lines == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    r.URL = argv[optind];
+    r.files = argv + optind + 1;
+    r.n_files = argc - optind - 1;
+    r.offsets = (long*) calloc(r.n_files, sizeof(long));
+    if (r.progress_path != NULL) {
+        load_progress(&r);
+    }
+
+    /* two batches per connection: one being sent, one read ahead */
+    r.capacity = 2 * connections;
+    r.slots = (batch*) calloc(r.capacity, sizeof(batch));
+    for (i = 0; i < r.capacity; ++i) {
+        mf_buffer_init(&r.slots[i].body);
+    }
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.changed, NULL);
+    r.reading = 1;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * connections);
+    double start = now();
+    for (i = 0; i < connections; ++i) {
+        pthread_create(&threads[i], NULL, send_batches, &r);
+    }
+
+    int complete = read_batches(&r, batch_lines, batch_bytes);
+
+    pthread_mutex_lock(&r.lock);
+    r.reading = 0;
+    pthread_cond_broadcast(&r.changed);
+    pthread_mutex_unlock(&r.lock);
+    for (i = 0; i < connections; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = now() - start;
+
+    pthread_mutex_lock(&r.lock);
+    save_progress(&r);
+    pthread_mutex_unlock(&r.lock);
+
+    printf("%zu lines in %zu batches, %.1f MB in %.2f s: %.0f lines/s, %.1f MB/s\n",
+        r.lines_sent, r.batches_sent, r.bytes_sent / 1e6, seconds,
+        r.lines_sent / seconds, r.bytes_sent / 1e6 / seconds);
+    if (!complete || r.failed) {
+        fprintf(stderr, "incomplete; %s\n", (r.progress_path != NULL) ?
+            "run again with the same progress file to resume" :
+            "use -p to resume later");
+    }
+
+    for (i = 0; i < r.capacity; ++i) {
+        mf_buffer_free(&r.slots[i].body);
+    }
+    free(r.slots);
+    free(r.offsets);
+    free(threads);
+    shutdown_curl();
+
+    return (complete && !r.failed) ? 0 : 1;
+}